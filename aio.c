@@ -17,17 +17,11 @@
 #include "block.h"
 #include "qemu-queue.h"
 #include "qemu_socket.h"
+#include "main-loop.h"
+#include "qemu-tls.h"
 
-typedef struct AioHandler AioHandler;
-
-/* The list of registered AIO handlers */
-static QLIST_HEAD(, AioHandler) aio_handlers;
-
-/* This is a simple lock used to protect the aio_handlers list.  Specifically,
- * it's used to ensure that no callbacks are removed while we're walking and
- * dispatching callbacks.
- */
-static int walking_handlers;
+/* The context that the thread is running in aio_poll */
+static DEFINE_TLS(AioContext *, current_aio_context);
 
 struct AioHandler
 {
@@ -36,15 +30,16 @@ struct AioHandler
     IOHandler *io_write;
     AioFlushHandler *io_flush;
     int deleted;
+    int pollfds_idx;
     void *opaque;
     QLIST_ENTRY(AioHandler) node;
 };
 
-static AioHandler *find_aio_handler(int fd)
+static AioHandler *find_aio_handler(AioContext *ctx, int fd)
 {
     AioHandler *node;
 
-    QLIST_FOREACH(node, &aio_handlers, node) {
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
         if (node->fd == fd)
             if (!node->deleted)
                 return node;
@@ -53,21 +48,22 @@ static AioHandler *find_aio_handler(int fd)
     return NULL;
 }
 
-int qemu_aio_set_fd_handler(int fd,
-                            IOHandler *io_read,
-                            IOHandler *io_write,
-                            AioFlushHandler *io_flush,
-                            void *opaque)
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioFlushHandler *io_flush,
+                        void *opaque)
 {
     AioHandler *node;
 
-    node = find_aio_handler(fd);
+    node = find_aio_handler(ctx, fd);
 
     /* Are we deleting the fd handler? */
     if (!io_read && !io_write) {
         if (node) {
             /* If the lock is held, just mark the node as deleted */
-            if (walking_handlers)
+            if (ctx->walking_handlers)
                 node->deleted = 1;
             else {
                 /* Otherwise, delete it for real.  We can't just mark it as
@@ -83,7 +79,8 @@ int qemu_aio_set_fd_handler(int fd,
             /* Alloc and insert if it's not already there */
             node = g_malloc0(sizeof(AioHandler));
             node->fd = fd;
-            QLIST_INSERT_HEAD(&aio_handlers, node, node);
+            node->pollfds_idx = -1;
+            QLIST_INSERT_HEAD(&ctx->aio_handlers, node, node);
         }
         /* Update handler with latest information */
         node->io_read = io_read;
@@ -92,41 +89,93 @@ int qemu_aio_set_fd_handler(int fd,
         node->opaque = opaque;
     }
 
-    qemu_set_fd_handler2(fd, NULL, io_read, io_write, opaque);
+    if (ctx->main_loop) {
+        qemu_set_fd_handler2(fd, NULL, io_read, io_write, opaque);
+    }
+}
 
+int qemu_aio_set_fd_handler(int fd,
+                            IOHandler *io_read,
+                            IOHandler *io_write,
+                            AioFlushHandler *io_flush,
+                            void *opaque)
+{
+    aio_set_fd_handler(qemu_get_aio_context(), fd, io_read, io_write,
+                       io_flush, opaque);
     return 0;
 }
 
+AioContext *qemu_get_current_aio_context(void)
+{
+    AioContext *ctx = tls_var(current_aio_context);
+
+    return ctx ? ctx : qemu_get_aio_context();
+}
+
+/* Nanoseconds until the first timer of @ctx expires, or -1 */
+static int64_t aio_timers_deadline_ns(AioContext *ctx)
+{
+    int64_t deadline = -1;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(ctx->timer_lists) && ctx->timer_lists[i];
+         i++) {
+        int64_t d = qemu_timer_list_deadline_ns(ctx->timer_lists[i]);
+
+        if (d >= 0 && (deadline < 0 || d < deadline)) {
+            deadline = d;
+        }
+    }
+    return deadline;
+}
+
+static bool aio_timers_run(AioContext *ctx)
+{
+    bool progress = false;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(ctx->timer_lists) && ctx->timer_lists[i];
+         i++) {
+        progress |= qemu_run_timer_list(ctx->timer_lists[i]);
+    }
+    return progress;
+}
+
 void qemu_aio_flush(void)
 {
     while (qemu_aio_wait());
 }
 
 bool qemu_aio_wait(void)
+{
+    return aio_poll(qemu_get_aio_context(), true);
+}
+
+static bool aio_poll_internal(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
-    fd_set rdfds, wrfds;
-    int max_fd = -1;
+    int64_t timeout;
     int ret;
     bool busy;
 
     /*
      * If there are callbacks left that have been queued, we need to call then.
-     * Do not call select in this case, because it is possible that the caller
+     * Do not call poll in this case, because it is possible that the caller
      * does not need a complete flush (as is the case for qemu_aio_wait loops).
      */
-    if (qemu_bh_poll()) {
+    if (aio_bh_poll(ctx) || aio_timers_run(ctx)) {
         return true;
     }
 
-    walking_handlers++;
+    g_array_set_size(ctx->pollfds, 0);
 
-    FD_ZERO(&rdfds);
-    FD_ZERO(&wrfds);
+    ctx->walking_handlers++;
 
-    /* fill fd sets */
+    /* fill pollfds */
     busy = false;
-    QLIST_FOREACH(node, &aio_handlers, node) {
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        node->pollfds_idx = -1;
+
         /* If there aren't pending AIO operations, don't invoke callbacks.
          * Otherwise, if there are no AIO requests, qemu_aio_wait() would
          * wait indefinitely.
@@ -137,17 +186,22 @@ bool qemu_aio_wait(void)
             }
             busy = true;
         }
-        if (!node->deleted && node->io_read) {
-            FD_SET(node->fd, &rdfds);
-            max_fd = MAX(max_fd, node->fd + 1);
-        }
-        if (!node->deleted && node->io_write) {
-            FD_SET(node->fd, &wrfds);
-            max_fd = MAX(max_fd, node->fd + 1);
+        if (!node->deleted && (node->io_read || node->io_write)) {
+            GPollFD pfd = {
+                .fd = node->fd,
+                .events = (node->io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0) |
+                          (node->io_write ? G_IO_OUT | G_IO_ERR : 0),
+            };
+            node->pollfds_idx = ctx->pollfds->len;
+            g_array_append_val(ctx->pollfds, pfd);
         }
     }
 
-    walking_handlers--;
+    ctx->walking_handlers--;
+
+    /* An armed timer is pending work too */
+    timeout = aio_timers_deadline_ns(ctx);
+    busy |= timeout >= 0;
 
     /* No AIO operations?  Get us out of here */
     if (!busy) {
@@ -155,25 +209,33 @@ bool qemu_aio_wait(void)
     }
 
     /* wait until next event */
-    ret = select(max_fd, &rdfds, &wrfds, NULL, NULL);
+    ret = qemu_poll_ns((GPollFD *)ctx->pollfds->data, ctx->pollfds->len,
+                       blocking ? timeout : 0);
 
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
         /* we have to walk very carefully in case
-         * qemu_aio_set_fd_handler is called while we're walking */
-        node = QLIST_FIRST(&aio_handlers);
+         * aio_set_fd_handler is called while we're walking */
+        node = QLIST_FIRST(&ctx->aio_handlers);
         while (node) {
             AioHandler *tmp;
+            int revents = 0;
 
-            walking_handlers++;
+            ctx->walking_handlers++;
+
+            if (node->pollfds_idx != -1) {
+                GPollFD *pfd = &g_array_index(ctx->pollfds, GPollFD,
+                                              node->pollfds_idx);
+                revents = pfd->revents & pfd->events;
+            }
 
             if (!node->deleted &&
-                FD_ISSET(node->fd, &rdfds) &&
+                (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
                 node->io_read) {
                 node->io_read(node->opaque);
             }
             if (!node->deleted &&
-                FD_ISSET(node->fd, &wrfds) &&
+                (revents & (G_IO_OUT | G_IO_ERR)) &&
                 node->io_write) {
                 node->io_write(node->opaque);
             }
@@ -181,14 +243,26 @@ bool qemu_aio_wait(void)
             tmp = node;
             node = QLIST_NEXT(node, node);
 
-            walking_handlers--;
+            ctx->walking_handlers--;
 
-            if (!walking_handlers && tmp->deleted) {
+            if (!ctx->walking_handlers && tmp->deleted) {
                 QLIST_REMOVE(tmp, node);
                 g_free(tmp);
             }
         }
     }
 
+    aio_timers_run(ctx);
     return true;
 }
+
+bool aio_poll(AioContext *ctx, bool blocking)
+{
+    AioContext *prev = tls_var(current_aio_context);
+    bool ret;
+
+    tls_var(current_aio_context) = ctx;
+    ret = aio_poll_internal(ctx, blocking);
+    tls_var(current_aio_context) = prev;
+    return ret;
+}
@@ -24,15 +24,14 @@
 
 #include "qemu-common.h"
 #include "qemu-aio.h"
+#include "qemu-barrier.h"
 #include "main-loop.h"
 
-/* Anchor of the list of Bottom Halves belonging to the context */
-static struct QEMUBH *first_bh;
-
 /***********************************************************/
 /* bottom halves (can be seen as timers which expire ASAP) */
 
 struct QEMUBH {
+    AioContext *ctx;
     QEMUBHFunc *cb;
     void *opaque;
     QEMUBH *next;
@@ -41,30 +40,41 @@ struct QEMUBH {
     bool deleted;
 };
 
-QEMUBH *qemu_bh_new(QEMUBHFunc *cb, void *opaque)
+QEMUBH *aio_bh_new(AioContext *ctx, QEMUBHFunc *cb, void *opaque)
 {
     QEMUBH *bh;
     bh = g_malloc0(sizeof(QEMUBH));
+    bh->ctx = ctx;
     bh->cb = cb;
     bh->opaque = opaque;
-    bh->next = first_bh;
-    first_bh = bh;
+    qemu_mutex_lock(&ctx->bh_lock);
+    bh->next = ctx->first_bh;
+    /* Make sure that the members are ready before putting bh into list */
+    smp_wmb();
+    ctx->first_bh = bh;
+    qemu_mutex_unlock(&ctx->bh_lock);
     return bh;
 }
 
-int qemu_bh_poll(void)
+QEMUBH *qemu_bh_new(QEMUBHFunc *cb, void *opaque)
+{
+    return aio_bh_new(qemu_get_aio_context(), cb, opaque);
+}
+
+int aio_bh_poll(AioContext *ctx)
 {
     QEMUBH *bh, **bhp, *next;
     int ret;
-    static int nesting = 0;
 
-    nesting++;
+    ctx->walking_bh++;
 
     ret = 0;
-    for (bh = first_bh; bh; bh = next) {
+    for (bh = ctx->first_bh; bh; bh = next) {
         next = bh->next;
         if (!bh->deleted && bh->scheduled) {
             bh->scheduled = 0;
+            /* Paired with the write barrier in qemu_bh_schedule */
+            smp_rmb();
             if (!bh->idle)
                 ret = 1;
             bh->idle = 0;
@@ -72,11 +82,12 @@ int qemu_bh_poll(void)
         }
     }
 
-    nesting--;
+    ctx->walking_bh--;
 
     /* remove deleted bhs */
-    if (!nesting) {
-        bhp = &first_bh;
+    if (!ctx->walking_bh) {
+        qemu_mutex_lock(&ctx->bh_lock);
+        bhp = &ctx->first_bh;
         while (*bhp) {
             bh = *bhp;
             if (bh->deleted) {
@@ -86,27 +97,38 @@ int qemu_bh_poll(void)
                 bhp = &bh->next;
             }
         }
+        qemu_mutex_unlock(&ctx->bh_lock);
     }
 
     return ret;
 }
 
+int qemu_bh_poll(void)
+{
+    return aio_bh_poll(qemu_get_aio_context());
+}
+
 void qemu_bh_schedule_idle(QEMUBH *bh)
 {
     if (bh->scheduled)
         return;
-    bh->scheduled = 1;
     bh->idle = 1;
+    /* Make sure that idle is set before the BH is seen as scheduled */
+    smp_wmb();
+    bh->scheduled = 1;
 }
 
 void qemu_bh_schedule(QEMUBH *bh)
 {
     if (bh->scheduled)
         return;
-    bh->scheduled = 1;
     bh->idle = 0;
-    /* stop the currently executing CPU to execute the BH ASAP */
-    qemu_notify_event();
+    /* Make sure that idle and whatever the callback reads are written
+     * before aio_bh_poll can see the BH as scheduled */
+    smp_wmb();
+    bh->scheduled = 1;
+    /* wake up the thread that runs the BH's context */
+    aio_notify(bh->ctx);
 }
 
 void qemu_bh_cancel(QEMUBH *bh)
@@ -120,11 +142,11 @@ void qemu_bh_delete(QEMUBH *bh)
     bh->deleted = 1;
 }
 
-void qemu_bh_update_timeout(uint32_t *timeout)
+void aio_bh_update_timeout(AioContext *ctx, uint32_t *timeout)
 {
     QEMUBH *bh;
 
-    for (bh = first_bh; bh; bh = bh->next) {
+    for (bh = ctx->first_bh; bh; bh = bh->next) {
         if (!bh->deleted && bh->scheduled) {
             if (bh->idle) {
                 /* idle bottom halves will be polled at least
@@ -140,3 +162,198 @@ void qemu_bh_update_timeout(uint32_t *timeout)
     }
 }
 
+void qemu_bh_update_timeout(uint32_t *timeout)
+{
+    aio_bh_update_timeout(qemu_get_aio_context(), timeout);
+}
+
+/***********************************************************/
+/* AIO contexts */
+
+static AioContext *qemu_aio_context;
+
+static AioContext *aio_context_alloc(void)
+{
+    AioContext *ctx;
+
+    ctx = g_malloc0(sizeof(AioContext));
+    qemu_mutex_init(&ctx->bh_lock);
+    QLIST_INIT(&ctx->aio_handlers);
+    QTAILQ_INIT(&ctx->co_queue_wakeup);
+    ctx->pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    ctx->notify_fds[0] = ctx->notify_fds[1] = -1;
+    qemu_mutex_init(&ctx->owner_lock);
+    qemu_cond_init(&ctx->owner_cond);
+    return ctx;
+}
+
+AioContext *qemu_get_aio_context(void)
+{
+    if (!qemu_aio_context) {
+        qemu_aio_context = aio_context_alloc();
+        qemu_aio_context->main_loop = true;
+    }
+    return qemu_aio_context;
+}
+
+#ifndef _WIN32
+static void aio_notify_read(void *opaque)
+{
+    AioContext *ctx = opaque;
+    ssize_t len;
+    char buffer[512];
+
+    /* Drain the notify pipe.  For eventfd, only 8 bytes will be read.  */
+    do {
+        len = read(ctx->notify_fds[0], buffer, sizeof(buffer));
+    } while ((len == -1 && errno == EINTR) || len == sizeof(buffer));
+}
+
+AioContext *aio_context_new(void)
+{
+    AioContext *ctx;
+    int fds[2];
+
+    if (qemu_eventfd(fds) == -1) {
+        return NULL;
+    }
+    if (fcntl_setfl(fds[0], O_NONBLOCK) < 0 ||
+        fcntl_setfl(fds[1], O_NONBLOCK) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    ctx = aio_context_alloc();
+    ctx->notify_fds[0] = fds[0];
+    ctx->notify_fds[1] = fds[1];
+    aio_set_fd_handler(ctx, fds[0], aio_notify_read, NULL, NULL, ctx);
+    return ctx;
+}
+#else
+AioContext *aio_context_new(void)
+{
+    return NULL;
+}
+#endif
+
+void aio_context_free(AioContext *ctx)
+{
+    QEMUBH *bh, *next;
+    int i;
+
+    assert(!ctx->main_loop && !ctx->walking_bh && !ctx->walking_handlers);
+
+    aio_set_fd_handler(ctx, ctx->notify_fds[0], NULL, NULL, NULL, NULL);
+    assert(QLIST_EMPTY(&ctx->aio_handlers));
+    close(ctx->notify_fds[0]);
+    close(ctx->notify_fds[1]);
+
+    assert(QTAILQ_EMPTY(&ctx->co_queue_wakeup));
+    if (ctx->co_queue_bh) {
+        qemu_bh_delete(ctx->co_queue_bh);
+    }
+    for (bh = ctx->first_bh; bh; bh = next) {
+        next = bh->next;
+        assert(bh->deleted);
+        g_free(bh);
+    }
+    for (i = 0; i < ARRAY_SIZE(ctx->timer_lists); i++) {
+        if (ctx->timer_lists[i]) {
+            qemu_free_timer_list(ctx->timer_lists[i]);
+        }
+    }
+    g_array_free(ctx->pollfds, TRUE);
+    assert(!ctx->owner_depth);
+    qemu_cond_destroy(&ctx->owner_cond);
+    qemu_mutex_destroy(&ctx->owner_lock);
+    qemu_mutex_destroy(&ctx->bh_lock);
+    g_free(ctx);
+}
+
+void aio_context_acquire(AioContext *ctx)
+{
+    unsigned int ticket;
+
+    if (ctx->main_loop) {
+        return;
+    }
+
+    qemu_mutex_lock(&ctx->owner_lock);
+    if (ctx->owner_depth && qemu_thread_is_self(&ctx->owner)) {
+        ctx->owner_depth++;
+        qemu_mutex_unlock(&ctx->owner_lock);
+        return;
+    }
+    ticket = ctx->next_ticket++;
+    if (ticket != ctx->now_serving) {
+        /* The owner may be blocked in aio_poll */
+        aio_notify(ctx);
+        do {
+            qemu_cond_wait(&ctx->owner_cond, &ctx->owner_lock);
+        } while (ticket != ctx->now_serving);
+    }
+    qemu_thread_get_self(&ctx->owner);
+    ctx->owner_depth = 1;
+    qemu_mutex_unlock(&ctx->owner_lock);
+}
+
+void aio_context_release(AioContext *ctx)
+{
+    if (ctx->main_loop) {
+        return;
+    }
+
+    qemu_mutex_lock(&ctx->owner_lock);
+    assert(ctx->owner_depth && qemu_thread_is_self(&ctx->owner));
+    if (--ctx->owner_depth == 0) {
+        ctx->now_serving++;
+        qemu_cond_broadcast(&ctx->owner_cond);
+    }
+    qemu_mutex_unlock(&ctx->owner_lock);
+}
+
+void aio_notify(AioContext *ctx)
+{
+    /* Write 8 bytes to be compatible with eventfd.  */
+    static const uint64_t val = 1;
+    ssize_t ret;
+
+    if (ctx->main_loop) {
+        qemu_notify_event();
+        return;
+    }
+    do {
+        ret = write(ctx->notify_fds[1], &val, sizeof(val));
+    } while (ret < 0 && errno == EINTR);
+
+    /* EAGAIN is fine, a read must be pending.  */
+}
+
+static void aio_timer_list_notify(void *opaque)
+{
+    aio_notify(opaque);
+}
+
+QEMUTimer *aio_timer_new(AioContext *ctx, QEMUClock *clock, int scale,
+                         QEMUTimerCB *cb, void *opaque)
+{
+    int i;
+
+    if (ctx->main_loop) {
+        return qemu_new_timer(clock, scale, cb, opaque);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ctx->timer_lists); i++) {
+        if (!ctx->timer_lists[i]) {
+            ctx->timer_lists[i] = qemu_new_timer_list(clock,
+                                                      aio_timer_list_notify,
+                                                      ctx);
+        }
+        if (qemu_timer_list_clock(ctx->timer_lists[i]) == clock) {
+            return qemu_new_timer_on_list(ctx->timer_lists[i], scale,
+                                          cb, opaque);
+        }
+    }
+    abort();
+}
@@ -153,7 +153,8 @@ static void bdrv_block_timer(void *opaque)
 void bdrv_io_limits_enable(BlockDriverState *bs)
 {
     qemu_co_queue_init(&bs->throttled_reqs);
-    bs->block_timer = qemu_new_timer_ns(vm_clock, bdrv_block_timer, bs);
+    bs->block_timer = aio_timer_new(bs->aio_context, vm_clock, SCALE_NS,
+                                    bdrv_block_timer, bs);
     bs->slice_time  = 5 * BLOCK_IO_SLICE_TIME;
     bs->slice_start = qemu_get_clock_ns(vm_clock);
     bs->slice_end   = bs->slice_start + bs->slice_time;
@@ -307,6 +308,7 @@ BlockDriverState *bdrv_new(const char *device_name)
     BlockDriverState *bs;
 
     bs = g_malloc0(sizeof(BlockDriverState));
+    bs->aio_context = qemu_get_aio_context();
     pstrcpy(bs->device_name, sizeof(bs->device_name), device_name);
     if (device_name[0] != '\0') {
         QTAILQ_INSERT_TAIL(&bdrv_states, bs, list);
@@ -1164,24 +1166,46 @@ void bdrv_close_all(void)
  * coroutine is complete.  Because of this, it is not possible to have a
  * function to drain a single device's I/O queue.
  */
-void bdrv_drain_all(void)
+static void bdrv_drain_context(AioContext *ctx, BlockDriverState *only)
 {
     BlockDriverState *bs;
     bool busy;
 
     do {
-        busy = qemu_aio_wait();
+        busy = aio_poll(ctx, true);
 
         /* FIXME: We do not have timer support here, so this is effectively
          * a busy wait.
          */
         QTAILQ_FOREACH(bs, &bdrv_states, list) {
-            if (!qemu_co_queue_empty(&bs->throttled_reqs)) {
+            if (bs->aio_context == ctx && (!only || bs == only) &&
+                !qemu_co_queue_empty(&bs->throttled_reqs)) {
                 qemu_co_queue_restart_all(&bs->throttled_reqs);
                 busy = true;
             }
         }
     } while (busy);
+}
+
+/*
+ * Every AioContext that has devices attached is acquired and drained in
+ * turn.  The main loop's context comes last, so that completions which
+ * devices defer to a main loop bottom half have run when this returns.
+ */
+void bdrv_drain_all(void)
+{
+    BlockDriverState *bs;
+
+    QTAILQ_FOREACH(bs, &bdrv_states, list) {
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        if (ctx != qemu_get_aio_context()) {
+            aio_context_acquire(ctx);
+            bdrv_drain_context(ctx, NULL);
+            aio_context_release(ctx);
+        }
+    }
+    bdrv_drain_context(qemu_get_aio_context(), NULL);
 
     /* If requests are still pending there is a bug somewhere */
     QTAILQ_FOREACH(bs, &bdrv_states, list) {
@@ -1190,6 +1214,84 @@ void bdrv_drain_all(void)
     }
 }
 
+AioContext *bdrv_get_aio_context(BlockDriverState *bs)
+{
+    return bs->aio_context;
+}
+
+static bool bdrv_supports_aio_context(BlockDriverState *bs)
+{
+    if (!bs) {
+        return true;
+    }
+    if ((bs->drv && !bs->drv->supports_aio_context) || bs->job) {
+        return false;
+    }
+    return bdrv_supports_aio_context(bs->file) &&
+           bdrv_supports_aio_context(bs->backing_hd);
+}
+
+static void bdrv_detach_aio_context(BlockDriverState *bs)
+{
+    if (!bs) {
+        return;
+    }
+    if (bs->block_timer) {
+        qemu_del_timer(bs->block_timer);
+        qemu_free_timer(bs->block_timer);
+        bs->block_timer = NULL;
+    }
+    if (bs->drv && bs->drv->bdrv_detach_aio_context) {
+        bs->drv->bdrv_detach_aio_context(bs);
+    }
+    bdrv_detach_aio_context(bs->file);
+    bdrv_detach_aio_context(bs->backing_hd);
+}
+
+static void bdrv_attach_aio_context(BlockDriverState *bs,
+                                    AioContext *new_context)
+{
+    if (!bs) {
+        return;
+    }
+    bs->aio_context = new_context;
+    if (bs->io_limits_enabled) {
+        bs->block_timer = aio_timer_new(new_context, vm_clock, SCALE_NS,
+                                        bdrv_block_timer, bs);
+    }
+    if (bs->drv && bs->drv->bdrv_attach_aio_context) {
+        bs->drv->bdrv_attach_aio_context(bs, new_context);
+    }
+    bdrv_attach_aio_context(bs->file, new_context);
+    bdrv_attach_aio_context(bs->backing_hd, new_context);
+}
+
+/*
+ * Move @bs, together with its protocol and backing files, to @new_context
+ * so that its requests complete in the thread that runs @new_context.
+ * Requests in flight are completed first.  The caller must have acquired
+ * both the old and the new context.
+ *
+ * Returns -ENOTSUP if a driver in the chain does not support it, or if
+ * a block job is running on @bs.
+ */
+int bdrv_set_aio_context(BlockDriverState *bs, AioContext *new_context)
+{
+    if (bs->aio_context == new_context) {
+        return 0;
+    }
+    if (!bdrv_supports_aio_context(bs)) {
+        return -ENOTSUP;
+    }
+
+    bdrv_drain_context(bs->aio_context, bs);
+    assert(QLIST_EMPTY(&bs->tracked_requests));
+
+    bdrv_detach_aio_context(bs);
+    bdrv_attach_aio_context(bs, new_context);
+    return 0;
+}
+
 /* make a BlockDriverState anonymous by removing from bdrv_state list.
    Also, NULL terminate the device_name to prevent double remove */
 void bdrv_make_anon(BlockDriverState *bs)
@@ -1278,6 +1380,7 @@ void bdrv_swap(BlockDriverState *bs_new, BlockDriverState *bs_old)
     assert(bs_new->in_use == 0);
     assert(bs_new->io_limits_enabled == false);
     assert(bs_new->block_timer == NULL);
+    assert(bs_new->aio_context == bs_old->aio_context);
 
     tmp = *bs_new;
     *bs_new = *bs_old;
@@ -1960,11 +2063,15 @@ static int bdrv_rw_co(BlockDriverState *bs, int64_t sector_num, uint8_t *buf,
         /* Fast-path if already in coroutine context */
         bdrv_rw_co_entry(&rwco);
     } else {
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        aio_context_acquire(ctx);
         co = qemu_coroutine_create(bdrv_rw_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(ctx, true);
         }
+        aio_context_release(ctx);
     }
     return rwco.ret;
 }
@@ -2731,6 +2838,7 @@ static void coroutine_fn bdrv_is_allocated_co_entry(void *opaque)
 int bdrv_is_allocated(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
                       int *pnum)
 {
+    AioContext *ctx = bdrv_get_aio_context(bs);
     Coroutine *co;
     BdrvCoIsAllocatedData data = {
         .bs = bs,
@@ -2740,11 +2848,13 @@ int bdrv_is_allocated(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
         .done = false,
     };
 
+    aio_context_acquire(ctx);
     co = qemu_coroutine_create(bdrv_is_allocated_co_entry);
     qemu_coroutine_enter(co, &data);
     while (!data.done) {
-        qemu_aio_wait();
+        aio_poll(ctx, true);
     }
+    aio_context_release(ctx);
     return data.ret;
 }
 
@@ -3666,7 +3776,7 @@ static BlockDriverAIOCB *bdrv_aio_rw_vector(BlockDriverState *bs,
     acb->is_write = is_write;
     acb->qiov = qiov;
     acb->bounce = qemu_blockalign(bs, qiov->size);
-    acb->bh = qemu_bh_new(bdrv_aio_bh_cb, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(bs), bdrv_aio_bh_cb, acb);
 
     if (is_write) {
         qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
@@ -3704,7 +3814,13 @@ typedef struct BlockDriverAIOCBCoroutine {
 
 static void bdrv_aio_co_cancel_em(BlockDriverAIOCB *blockacb)
 {
-    qemu_aio_flush();
+    AioContext *ctx = bdrv_get_aio_context(blockacb->bs);
+
+    aio_context_acquire(ctx);
+    while (aio_poll(ctx, true)) {
+        /* Wait for all requests in the context of blockacb->bs */
+    }
+    aio_context_release(ctx);
 }
 
 static AIOPool bdrv_em_co_aio_pool = {
@@ -3735,7 +3851,8 @@ static void coroutine_fn bdrv_co_do_rw(void *opaque)
             acb->req.nb_sectors, acb->req.qiov, 0);
     }
 
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(acb->common.bs),
+                         bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3768,7 +3885,8 @@ static void coroutine_fn bdrv_aio_flush_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_flush(bs);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(acb->common.bs),
+                         bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3793,7 +3911,8 @@ static void coroutine_fn bdrv_aio_discard_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_discard(bs, acb->req.sector, acb->req.nb_sectors);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(acb->common.bs),
+                         bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3831,7 +3950,8 @@ void *qemu_aio_get(AIOPool *pool, BlockDriverState *bs,
 {
     BlockDriverAIOCB *acb;
 
-    if (pool->free_aiocb) {
+    /* The free list is only used from the main loop's context */
+    if (pool->free_aiocb && (!bs || bs->aio_context == qemu_get_aio_context())) {
         acb = pool->free_aiocb;
         pool->free_aiocb = acb->next;
     } else {
@@ -3848,6 +3968,11 @@ void qemu_aio_release(void *p)
 {
     BlockDriverAIOCB *acb = (BlockDriverAIOCB *)p;
     AIOPool *pool = acb->pool;
+
+    if (acb->bs && acb->bs->aio_context != qemu_get_aio_context()) {
+        g_free(acb);
+        return;
+    }
     acb->next = pool->free_aiocb;
     pool->free_aiocb = acb;
 }
@@ -4013,11 +4138,15 @@ int bdrv_flush(BlockDriverState *bs)
         /* Fast-path if already in coroutine context */
         bdrv_flush_co_entry(&rwco);
     } else {
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        aio_context_acquire(ctx);
         co = qemu_coroutine_create(bdrv_flush_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(ctx, true);
         }
+        aio_context_release(ctx);
     }
 
     return rwco.ret;
@@ -4074,11 +4203,15 @@ int bdrv_discard(BlockDriverState *bs, int64_t sector_num, int nb_sectors)
         /* Fast-path if already in coroutine context */
         bdrv_discard_co_entry(&rwco);
     } else {
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        aio_context_acquire(ctx);
         co = qemu_coroutine_create(bdrv_discard_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(ctx, true);
         }
+        aio_context_release(ctx);
     }
 
     return rwco.ret;
@@ -271,6 +271,9 @@ void bdrv_flush_all(void);
 void bdrv_close_all(void);
 void bdrv_drain_all(void);
 
+AioContext *bdrv_get_aio_context(BlockDriverState *bs);
+int bdrv_set_aio_context(BlockDriverState *bs, AioContext *new_context);
+
 int bdrv_discard(BlockDriverState *bs, int64_t sector_num, int nb_sectors);
 int bdrv_co_discard(BlockDriverState *bs, int64_t sector_num, int nb_sectors);
 int bdrv_has_zero_init(BlockDriverState *bs);
@@ -1720,6 +1720,8 @@ static BlockDriver bdrv_qcow2 = {
 
     .create_options = qcow2_create_options,
     .bdrv_check = qcow2_check,
+
+    .supports_aio_context = true,
 };
 
 static void bdrv_qcow2_init(void)
@@ -196,6 +196,17 @@ struct BlockDriver {
      */
     int (*bdrv_has_zero_init)(BlockDriverState *bs);
 
+    /*
+     * Set if the driver can run in an AioContext other than the main
+     * loop's: it only uses bottom halves, timers and fd handlers of
+     * bdrv_get_aio_context(bs), and moves those that outlive a request
+     * in the two callbacks below.
+     */
+    bool supports_aio_context;
+    void (*bdrv_detach_aio_context)(BlockDriverState *bs);
+    void (*bdrv_attach_aio_context)(BlockDriverState *bs,
+                                    AioContext *new_context);
+
     QLIST_ENTRY(BlockDriver) list;
 };
 
@@ -277,6 +288,9 @@ struct BlockDriverState {
     /* long-running background operation */
     BlockJob *job;
 
+    /* the context that runs the completions of this device's requests */
+    AioContext *aio_context;
+
 };
 
 int get_tmp_filename(char *filename, int size);
@@ -33,11 +33,6 @@
 #include "qemu-common.h"
 #include "qemu-coroutine-int.h"
 
-enum {
-    /* Maximum free pool size prevents holding too many freed coroutines */
-    POOL_MAX_SIZE = 64,
-};
-
 /** Free list to speed up creation */
 static QSLIST_HEAD(, Coroutine) pool = QSLIST_HEAD_INITIALIZER(pool);
 static unsigned int pool_size;
@@ -276,6 +271,18 @@ Coroutine *qemu_coroutine_new(void)
 {
     Coroutine *co;
 
+    /* The pool may have been shrunk since these were parked */
+    while (pool_size > coroutine_pool_max_size) {
+        CoroutineUContext *old;
+
+        co = QSLIST_FIRST(&pool);
+        QSLIST_REMOVE_HEAD(&pool, pool_next);
+        pool_size--;
+        old = DO_UPCAST(CoroutineUContext, base, co);
+        g_free(old->stack);
+        g_free(old);
+    }
+
     co = QSLIST_FIRST(&pool);
     if (co) {
         QSLIST_REMOVE_HEAD(&pool, pool_next);
@@ -290,7 +297,7 @@ void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineUContext *co = DO_UPCAST(CoroutineUContext, base, co_);
 
-    if (pool_size < POOL_MAX_SIZE) {
+    if (pool_size < coroutine_pool_max_size) {
         QSLIST_INSERT_HEAD(&pool, &co->base, pool_next);
         co->base.caller = NULL;
         pool_size++;
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <ucontext.h>
+#include <sys/mman.h>
 #include "qemu-common.h"
 #include "qemu-coroutine-int.h"
 
@@ -35,18 +36,33 @@
 #endif
 
 enum {
-    /* Maximum free pool size prevents holding too many freed coroutines */
-    POOL_MAX_SIZE = 64,
+    /* Pools parked in the release pool */
+    RELEASE_POOL_BATCHES = 4,
+
+    STACK_SIZE = 1 << 20,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) pool = QSLIST_HEAD_INITIALIZER(pool);
-static unsigned int pool_size;
+typedef struct CoroutinePool CoroutinePool;
+QSLIST_HEAD(CoroutinePool, Coroutine);
+
+/*
+ * Free coroutines given up by threads whose own pool is full.  Threads
+ * move whole pools in and out of it, one at a time, so that a thread that
+ * only creates coroutines can reuse those terminated by another thread
+ * without taking the lock for each of them.
+ */
+static pthread_mutex_t release_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    CoroutinePool pool;
+    unsigned int size;
+} release_pool[RELEASE_POOL_BATCHES];
+static unsigned int release_pool_batches;
 
 typedef struct {
     Coroutine base;
     void *stack;
-    jmp_buf env;
+    bool stack_guard;
+    sigjmp_buf env;
 
 #ifdef CONFIG_VALGRIND_H
     unsigned int valgrind_stack_id;
@@ -63,6 +79,10 @@ typedef struct {
 
     /** The default coroutine */
     CoroutineUContext leader;
+
+    /** Free list to speed up creation */
+    CoroutinePool pool;
+    unsigned int pool_size;
 } CoroutineThreadState;
 
 static pthread_key_t thread_state_key;
@@ -89,21 +109,37 @@ static CoroutineThreadState *coroutine_get_thread_state(void)
     return s;
 }
 
+static void coroutine_free(CoroutineUContext *co);
+
+static void coroutine_pool_free(CoroutinePool *pool)
+{
+    Coroutine *co;
+    Coroutine *tmp;
+
+    QSLIST_FOREACH_SAFE(co, pool, pool_next, tmp) {
+        coroutine_free(DO_UPCAST(CoroutineUContext, base, co));
+    }
+    QSLIST_INIT(pool);
+}
+
 static void qemu_coroutine_thread_cleanup(void *opaque)
 {
     CoroutineThreadState *s = opaque;
 
+    coroutine_pool_free(&s->pool);
     g_free(s);
 }
 
 static void __attribute__((destructor)) coroutine_cleanup(void)
 {
-    Coroutine *co;
-    Coroutine *tmp;
+    CoroutineThreadState *s = pthread_getspecific(thread_state_key);
 
-    QSLIST_FOREACH_SAFE(co, &pool, pool_next, tmp) {
-        g_free(DO_UPCAST(CoroutineUContext, base, co)->stack);
-        g_free(co);
+    if (s) {
+        coroutine_pool_free(&s->pool);
+        s->pool_size = 0;
+    }
+    while (release_pool_batches) {
+        coroutine_pool_free(&release_pool[--release_pool_batches].pool);
     }
 }
 
@@ -130,8 +166,8 @@ static void coroutine_trampoline(int i0, int i1)
     co = &self->base;
 
     /* Initialize longjmp environment and switch back the caller */
-    if (!setjmp(self->env)) {
-        longjmp(*(jmp_buf *)co->entry_arg, 1);
+    if (!sigsetjmp(self->env, 0)) {
+        siglongjmp(*(sigjmp_buf *)co->entry_arg, 1);
     }
 
     while (true) {
@@ -140,19 +176,55 @@ static void coroutine_trampoline(int i0, int i1)
     }
 }
 
+static void coroutine_stack_alloc(CoroutineUContext *co)
+{
+    size_t pagesize;
+    uint8_t *p;
+
+    co->stack_guard = coroutine_stack_guard;
+    if (!co->stack_guard) {
+        co->stack = g_malloc(STACK_SIZE);
+        return;
+    }
+
+    /* The stack grows down, so an overflow hits the page below it */
+    pagesize = getpagesize();
+    p = mmap(NULL, STACK_SIZE + pagesize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        abort();
+    }
+    if (mprotect(p, pagesize, PROT_NONE) != 0) {
+        abort();
+    }
+    co->stack = p + pagesize;
+}
+
+static void coroutine_stack_free(CoroutineUContext *co)
+{
+    size_t pagesize;
+
+    if (!co->stack_guard) {
+        g_free(co->stack);
+        return;
+    }
+    pagesize = getpagesize();
+    munmap((uint8_t *)co->stack - pagesize, STACK_SIZE + pagesize);
+}
+
 static Coroutine *coroutine_new(void)
 {
-    const size_t stack_size = 1 << 20;
     CoroutineUContext *co;
     ucontext_t old_uc, uc;
-    jmp_buf old_env;
+    sigjmp_buf old_env;
     union cc_arg arg = {0};
 
     /* The ucontext functions preserve signal masks which incurs a system call
-     * overhead.  setjmp()/longjmp() does not preserve signal masks but only
-     * works on the current stack.  Since we need a way to create and switch to
-     * a new stack, use the ucontext functions for that but setjmp()/longjmp()
-     * for everything else.
+     * overhead.  sigsetjmp(buf, 0)/siglongjmp() does not preserve signal masks
+     * but only works on the current stack.  Since we need a way to create and
+     * switch to a new stack, use the ucontext functions for that but
+     * sigsetjmp()/siglongjmp() for everything else.  Plain setjmp() would save
+     * the signal mask on BSD hosts.
      */
 
     if (getcontext(&uc) == -1) {
@@ -160,17 +232,17 @@ static Coroutine *coroutine_new(void)
     }
 
     co = g_malloc0(sizeof(*co));
-    co->stack = g_malloc(stack_size);
+    coroutine_stack_alloc(co);
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
     uc.uc_link = &old_uc;
     uc.uc_stack.ss_sp = co->stack;
-    uc.uc_stack.ss_size = stack_size;
+    uc.uc_stack.ss_size = STACK_SIZE;
     uc.uc_stack.ss_flags = 0;
 
 #ifdef CONFIG_VALGRIND_H
     co->valgrind_stack_id =
-        VALGRIND_STACK_REGISTER(co->stack, co->stack + stack_size);
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + STACK_SIZE);
 #endif
 
     arg.p = co;
@@ -178,8 +250,8 @@ static Coroutine *coroutine_new(void)
     makecontext(&uc, (void (*)(void))coroutine_trampoline,
                 2, arg.i[0], arg.i[1]);
 
-    /* swapcontext() in, longjmp() back out */
-    if (!setjmp(old_env)) {
+    /* swapcontext() in, siglongjmp() back out */
+    if (!sigsetjmp(old_env, 0)) {
         swapcontext(&old_uc, &uc);
     }
     return &co->base;
@@ -187,12 +259,34 @@ static Coroutine *coroutine_new(void)
 
 Coroutine *qemu_coroutine_new(void)
 {
+    CoroutineThreadState *s = coroutine_get_thread_state();
     Coroutine *co;
 
-    co = QSLIST_FIRST(&pool);
+    /* Take over one pool released by another thread, if any.  The
+     * unlocked check may miss it, that only costs an allocation.
+     */
+    if (QSLIST_EMPTY(&s->pool) && release_pool_batches) {
+        pthread_mutex_lock(&release_pool_lock);
+        if (release_pool_batches) {
+            release_pool_batches--;
+            s->pool = release_pool[release_pool_batches].pool;
+            s->pool_size = release_pool[release_pool_batches].size;
+        }
+        pthread_mutex_unlock(&release_pool_lock);
+    }
+
+    /* The pool may have been shrunk since these were parked */
+    while (s->pool_size > coroutine_pool_max_size) {
+        co = QSLIST_FIRST(&s->pool);
+        QSLIST_REMOVE_HEAD(&s->pool, pool_next);
+        s->pool_size--;
+        coroutine_free(DO_UPCAST(CoroutineUContext, base, co));
+    }
+
+    co = QSLIST_FIRST(&s->pool);
     if (co) {
-        QSLIST_REMOVE_HEAD(&pool, pool_next);
-        pool_size--;
+        QSLIST_REMOVE_HEAD(&s->pool, pool_next);
+        s->pool_size--;
     } else {
         co = coroutine_new();
     }
@@ -213,23 +307,50 @@ static inline void valgrind_stack_deregister(CoroutineUContext *co)
 #endif
 #endif
 
+static void coroutine_free(CoroutineUContext *co)
+{
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    coroutine_stack_free(co);
+    g_free(co);
+}
+
+/* Move the whole pool of S to the release pool, unless that one is full */
+static void coroutine_release_pool(CoroutineThreadState *s)
+{
+    pthread_mutex_lock(&release_pool_lock);
+    if (release_pool_batches < RELEASE_POOL_BATCHES) {
+        release_pool[release_pool_batches].pool = s->pool;
+        release_pool[release_pool_batches].size = s->pool_size;
+        release_pool_batches++;
+        QSLIST_INIT(&s->pool);
+        s->pool_size = 0;
+    }
+    pthread_mutex_unlock(&release_pool_lock);
+}
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineUContext *co = DO_UPCAST(CoroutineUContext, base, co_);
+    CoroutineThreadState *s = coroutine_get_thread_state();
 
-    if (pool_size < POOL_MAX_SIZE) {
-        QSLIST_INSERT_HEAD(&pool, &co->base, pool_next);
+    /* When the release pool is full, which the unlocked check sees without
+     * taking the lock, the coroutine is simply freed.
+     */
+    if (s->pool_size && s->pool_size >= coroutine_pool_max_size &&
+        release_pool_batches < RELEASE_POOL_BATCHES) {
+        coroutine_release_pool(s);
+    }
+    if (s->pool_size < coroutine_pool_max_size) {
+        QSLIST_INSERT_HEAD(&s->pool, &co->base, pool_next);
         co->base.caller = NULL;
-        pool_size++;
+        s->pool_size++;
         return;
     }
 
-#ifdef CONFIG_VALGRIND_H
-    valgrind_stack_deregister(co);
-#endif
-
-    g_free(co->stack);
-    g_free(co);
+    coroutine_free(co);
 }
 
 CoroutineAction qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
@@ -242,9 +363,9 @@ CoroutineAction qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
 
     s->current = to_;
 
-    ret = setjmp(from->env);
+    ret = sigsetjmp(from->env, 0);
     if (ret == 0) {
-        longjmp(to->env, action);
+        siglongjmp(to->env, action);
     }
     return ret;
 }
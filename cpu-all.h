@@ -471,6 +471,20 @@ void run_on_cpu(CPUArchState *env, void (*func)(void *data), void *data);
 
 #if !defined(CONFIG_USER_ONLY)
 
+/* Multi-threaded TCG (cpus.c).  The caller must hold the iothread lock.
+   async_run_on_cpu() queues @func for @env's thread without waiting.
+   Between tcg_exclusive_start() and tcg_exclusive_end() no other vCPU is
+   inside cpu_exec().  tcg_request_tb_flush() asks the vCPU threads to
+   flush the translation cache as soon as they can, and like
+   tcg_release_exec_locks() (which drops whatever a vCPU held when it
+   longjmps out of cpu_exec()) may be called without the lock.  */
+void async_run_on_cpu(CPUArchState *env, void (*func)(void *data), void *data);
+void tcg_exclusive_start(void);
+void tcg_exclusive_end(void);
+bool tcg_exclusive_held(void);
+void tcg_request_tb_flush(void);
+void tcg_release_exec_locks(void);
+
 /* Return the physical page corresponding to a virtual one. Use it
    only for debugging because no protection checks are done. Return -1
    if no page found. */
@@ -506,6 +520,7 @@ extern RAMList ram_list;
 
 extern const char *mem_path;
 extern int mem_prealloc;
+extern int mem_share;
 
 /* Flags stored in the low bits of the TLB virtual address.  These are
    defined so that fast path ram access is all zeros.  */
@@ -518,6 +533,8 @@ extern int mem_prealloc;
 #define TLB_MMIO        (1 << 5)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf);
+void ram_block_info(FILE *f, fprintf_function cpu_fprintf);
+void dump_tb_profile(FILE *f, fprintf_function cpu_fprintf, int count);
 #endif /* !CONFIG_USER_ONLY */
 
 int cpu_memory_rw_debug(CPUArchState *env, target_ulong addr,
@@ -79,6 +79,24 @@ typedef uint64_t target_ulong __attribute__((aligned(TARGET_LONG_ALIGNMENT)));
 #if !defined(CONFIG_USER_ONLY)
 #define CPU_TLB_BITS 8
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+/* The x86 TCG backend and TCI take the TLB index mask from
+   env->tlb_mask, so there the TLB starts with CPU_TLB_SIZE entries and
+   is resized on full flushes according to how much of it was used.
+   The other backends build CPU_TLB_BITS into the generated code.  */
+#if defined(CONFIG_TCG_INTERPRETER) || defined(__i386__) || \
+    defined(__x86_64__)
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_MAX_BITS 12
+#else
+#define CPU_TLB_DYN_MIN_BITS CPU_TLB_BITS
+#define CPU_TLB_DYN_MAX_BITS CPU_TLB_BITS
+#endif
+#define CPU_TLB_DYN_MAX_SIZE (1 << CPU_TLB_DYN_MAX_BITS)
+/* Number of full flushes with low TLB use before the TLB is shrunk.  */
+#define CPU_TLB_DYN_WINDOW 16
+/* Number of entries in the fully associative victim TLB that holds
+   entries evicted from the direct mapped one.  */
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -110,10 +128,19 @@ extern int CPUTLBEntry_wrong_size[sizeof(CPUTLBEntry) == (1 << CPU_TLB_ENTRY_BIT
 
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_DYN_MAX_SIZE];          \
+    target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_DYN_MAX_SIZE];       \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    target_phys_addr_t iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];            \
+    unsigned int vtlb_index;                                            \
     target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;
+    target_ulong tlb_flush_mask;                                        \
+    /* (number of TLB entries - 1) << CPU_TLB_ENTRY_BITS */             \
+    target_ulong tlb_mask;                                              \
+    /* entries filled since the last full flush */                      \
+    unsigned int tlb_used[NB_MMU_MODES];                                \
+    unsigned int tlb_window_max;                                        \
+    unsigned int tlb_window_flushes;
 
 #else
 
@@ -22,6 +22,7 @@
 #include "tcg.h"
 #include "qemu-barrier.h"
 #include "qtest.h"
+#include "main-loop.h"
 
 int tb_invalidated_flag;
 
@@ -95,7 +96,7 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
     /* find translated block using physical mappings */
     phys_pc = get_page_addr_code(env, pc);
     phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
+    h = tb_phys_hash_func(phys_pc, pc, flags, cs_base);
     ptb1 = &tb_phys_hash[h];
     for(;;) {
         tb = *ptb1;
@@ -154,6 +155,31 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Called by translated code ending in an indirect branch.  Returns the
+   host code of the next TB when it is in the jump cache, otherwise the
+   epilogue, which goes back to cpu_exec to translate it or to service
+   interrupts.  */
+void *tcg_helper_lookup_tb_ptr(void *opaque)
+{
+    CPUArchState *env = opaque;
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    env->current_tb = tb;
+    barrier();
+    if (unlikely(env->exit_request || env->interrupt_request)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    return tb->tc_ptr;
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -266,6 +292,12 @@ int cpu_exec(CPUArchState *env)
             for(;;) {
                 interrupt_request = env->interrupt_request;
                 if (unlikely(interrupt_request)) {
+#if !defined(CONFIG_USER_ONLY)
+                    /* interrupt delivery reads device state */
+                    if (mttcg_enabled) {
+                        qemu_mutex_lock_iothread();
+                    }
+#endif
                     if (unlikely(env->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -540,6 +572,11 @@ int cpu_exec(CPUArchState *env)
                            the program flow was changed */
                         next_tb = 0;
                     }
+#if !defined(CONFIG_USER_ONLY)
+                    if (mttcg_enabled) {
+                        qemu_mutex_unlock_iothread();
+                    }
+#endif
                 }
                 if (unlikely(env->exit_request)) {
                     env->exit_request = 0;
@@ -566,6 +603,7 @@ int cpu_exec(CPUArchState *env)
                 }
 #endif /* DEBUG_DISAS || CONFIG_DEBUG_EXEC */
                 spin_lock(&tb_lock);
+                tb_lock_acquire();
                 tb = tb_find_fast(env);
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
@@ -587,6 +625,7 @@ int cpu_exec(CPUArchState *env)
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
                     tb_add_jump((TranslationBlock *)(next_tb & ~3), next_tb & 3, tb);
                 }
+                tb_lock_release();
                 spin_unlock(&tb_lock);
 
                 /* cpu_interrupt might be called while translating the
@@ -599,7 +638,22 @@ int cpu_exec(CPUArchState *env)
                     tc_ptr = tb->tc_ptr;
                     /* execute the generated code */
                     next_tb = tcg_qemu_tb_exec(env, tc_ptr);
-                    if ((next_tb & 3) == 2) {
+                    if (unlikely(tcg_tb_profile) &&
+                        (next_tb & 3) != 3 && (next_tb & ~3)) {
+                        ((TranslationBlock *)(next_tb & ~3))->exit_count++;
+                    }
+                    if ((next_tb & 3) == 3) {
+                        /* exit_request seen on TB entry (multi-threaded
+                           TCG) or the TB just became hot; it has not
+                           executed */
+                        tb = (TranslationBlock *)(next_tb & ~3);
+                        cpu_pc_from_tb(env, tb);
+                        if (tcg_trace_threshold &&
+                            tb->exec_count >= tcg_trace_threshold) {
+                            tb_gen_trace(env, tb);
+                        }
+                        next_tb = 0;
+                    } else if ((next_tb & 3) == 2) {
                         /* Instruction counter expired.  */
                         int insns_left;
                         tb = (TranslationBlock *)(next_tb & ~3);
@@ -635,6 +689,9 @@ int cpu_exec(CPUArchState *env)
             /* Reload env after longjmp - the compiler may have smashed all
              * local variables as longjmp is marked 'noreturn'. */
             env = cpu_single_env;
+#if !defined(CONFIG_USER_ONLY)
+            tcg_release_exec_locks();
+#endif
         }
     } /* for(;;) */
 
@@ -624,6 +624,20 @@ static QemuCond qemu_cpu_cond;
 static QemuCond qemu_pause_cond;
 static QemuCond qemu_work_cond;
 
+static DEFINE_TLS(bool, iothread_locked);
+
+/* Multi-threaded TCG.  A vCPU is running while it executes cpu_exec()
+   without the iothread lock.  An exclusive section waits until no other
+   vCPU is running and keeps them out of cpu_exec() until it ends.  All
+   of this state is protected by the iothread lock.  */
+static int tcg_pending_cpus;
+static int tcg_exclusive_in_exec;
+static QemuCond tcg_exclusive_cond;
+static QemuCond tcg_exclusive_resume;
+static DEFINE_TLS(int, tcg_exclusive_depth);
+static DEFINE_TLS(bool, tcg_exclusive_from_exec);
+static volatile int tcg_tb_flush_pending;
+
 void qemu_init_cpu_loop(void)
 {
     qemu_init_sigbus();
@@ -631,6 +645,8 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&tcg_exclusive_cond);
+    qemu_cond_init(&tcg_exclusive_resume);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
@@ -647,6 +663,7 @@ void run_on_cpu(CPUArchState *env, void (*func)(void *data), void *data)
 
     wi.func = func;
     wi.data = data;
+    wi.free = false;
     if (!env->queued_work_first) {
         env->queued_work_first = &wi;
     } else {
@@ -665,6 +682,31 @@ void run_on_cpu(CPUArchState *env, void (*func)(void *data), void *data)
     }
 }
 
+void async_run_on_cpu(CPUArchState *env, void (*func)(void *data), void *data)
+{
+    struct qemu_work_item *wi;
+
+    if (qemu_cpu_is_self(env)) {
+        func(data);
+        return;
+    }
+
+    wi = g_malloc0(sizeof(struct qemu_work_item));
+    wi->func = func;
+    wi->data = data;
+    wi->free = true;
+    if (!env->queued_work_first) {
+        env->queued_work_first = wi;
+    } else {
+        env->queued_work_last->next = wi;
+    }
+    env->queued_work_last = wi;
+    wi->next = NULL;
+    wi->done = false;
+
+    qemu_cpu_kick(env);
+}
+
 static void flush_queued_work(CPUArchState *env)
 {
     struct qemu_work_item *wi;
@@ -676,7 +718,11 @@ static void flush_queued_work(CPUArchState *env)
     while ((wi = env->queued_work_first)) {
         env->queued_work_first = wi->next;
         wi->func(wi->data);
-        wi->done = true;
+        if (wi->free) {
+            g_free(wi);
+        } else {
+            wi->done = true;
+        }
     }
     env->queued_work_last = NULL;
     qemu_cond_broadcast(&qemu_work_cond);
@@ -732,6 +778,7 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
     int r;
 
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     qemu_thread_get_self(cpu->thread);
     env->thread_id = qemu_get_thread_id();
     cpu_single_env = env;
@@ -804,6 +851,116 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 #endif
 }
 
+static void tcg_exec_start(CPUArchState *env)
+{
+    while (tcg_pending_cpus) {
+        qemu_cond_wait(&tcg_exclusive_resume, &qemu_global_mutex);
+    }
+    env->running = 1;
+}
+
+static void tcg_exec_end(CPUArchState *env)
+{
+    env->running = 0;
+    if (tcg_pending_cpus > 1 && --tcg_pending_cpus == 1) {
+        qemu_cond_signal(&tcg_exclusive_cond);
+    }
+}
+
+void tcg_exclusive_start(void)
+{
+    CPUArchState *self = cpu_single_env;
+    CPUArchState *env;
+
+    if (tls_var(tcg_exclusive_depth)++) {
+        return;
+    }
+
+    /* Called from guest code, e.g. for a locked instruction.  Leave the
+       running set, or a concurrent exclusive section would wait for us
+       while we wait for it.  */
+    tls_var(tcg_exclusive_from_exec) = self && self->running;
+    if (tls_var(tcg_exclusive_from_exec)) {
+        tcg_exec_end(self);
+        tcg_exclusive_in_exec++;
+    }
+
+    while (tcg_pending_cpus) {
+        qemu_cond_wait(&tcg_exclusive_resume, &qemu_global_mutex);
+    }
+    tcg_pending_cpus = 1;
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        if (env->running) {
+            tcg_pending_cpus++;
+            cpu_exit(env);
+        }
+    }
+    while (tcg_pending_cpus > 1) {
+        qemu_cond_wait(&tcg_exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+void tcg_exclusive_end(void)
+{
+    if (--tls_var(tcg_exclusive_depth)) {
+        return;
+    }
+    if (tls_var(tcg_exclusive_from_exec)) {
+        tcg_exclusive_in_exec--;
+        cpu_single_env->running = 1;
+    }
+    tcg_pending_cpus = 0;
+    qemu_cond_broadcast(&tcg_exclusive_resume);
+}
+
+bool tcg_exclusive_held(void)
+{
+    return tls_var(tcg_exclusive_depth) > 0;
+}
+
+void tcg_request_tb_flush(void)
+{
+    CPUArchState *env;
+
+    tcg_tb_flush_pending = 1;
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        env->exit_request = 1;
+    }
+}
+
+static void tcg_flush_pending_tbs(CPUArchState *env)
+{
+    if (!tcg_tb_flush_pending) {
+        return;
+    }
+    tcg_exclusive_start();
+    /* a vCPU that entered an exclusive section from guest code returns
+       into translated code; it will come back here when it leaves */
+    if (tcg_tb_flush_pending && !tcg_exclusive_in_exec) {
+        tcg_tb_flush_pending = 0;
+        tb_flush(env);
+    }
+    tcg_exclusive_end();
+}
+
+void tcg_release_exec_locks(void)
+{
+    if (!mttcg_enabled) {
+        return;
+    }
+    tb_lock_reset();
+    if (tls_var(tcg_exclusive_depth)) {
+        if (!qemu_mutex_iothread_locked()) {
+            qemu_mutex_lock_iothread();
+        }
+        tls_var(tcg_exclusive_depth) = 1;
+        tcg_exclusive_end();
+    }
+    if (qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void tcg_exec_all(void);
 
 static void *qemu_tcg_cpu_thread_fn(void *arg)
@@ -816,6 +973,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
 
     /* signal CPU creation */
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         env->thread_id = qemu_get_thread_id();
         env->created = 1;
@@ -843,6 +1001,46 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+static void qemu_mttcg_wait_io_event(CPUArchState *env)
+{
+    while (cpu_thread_is_idle(env)) {
+        qemu_cond_wait(env->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(env);
+}
+
+static int tcg_cpu_exec(CPUArchState *env);
+
+static void *qemu_mttcg_cpu_thread_fn(void *arg)
+{
+    CPUArchState *env = arg;
+    CPUState *cpu = ENV_GET_CPU(env);
+    int r;
+
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+    env->thread_id = qemu_get_thread_id();
+
+    /* signal CPU creation */
+    env->created = 1;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    while (1) {
+        tcg_flush_pending_tbs(env);
+        if (cpu_can_run(env)) {
+            r = tcg_cpu_exec(env);
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(env);
+            }
+            tcg_flush_pending_tbs(env);
+        }
+        qemu_mttcg_wait_io_event(env);
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
@@ -869,7 +1067,10 @@ void qemu_cpu_kick(void *_env)
     CPUState *cpu = ENV_GET_CPU(env);
 
     qemu_cond_broadcast(env->halt_cond);
-    if (!tcg_enabled() && !cpu->thread_kicked) {
+    if (mttcg_enabled) {
+        /* translated code polls exit_request, no signal needed */
+        cpu_exit(env);
+    } else if (!tcg_enabled() && !cpu->thread_kicked) {
         qemu_cpu_kick_thread(env);
         cpu->thread_kicked = true;
     }
@@ -900,7 +1101,7 @@ int qemu_cpu_is_self(void *_env)
 
 void qemu_mutex_lock_iothread(void)
 {
-    if (!tcg_enabled()) {
+    if (!tcg_enabled() || mttcg_enabled) {
         qemu_mutex_lock(&qemu_global_mutex);
     } else {
         iothread_requesting_mutex = true;
@@ -911,13 +1112,20 @@ void qemu_mutex_lock_iothread(void)
         iothread_requesting_mutex = false;
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    tls_var(iothread_locked) = true;
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    tls_var(iothread_locked) = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return tls_var(iothread_locked);
+}
+
 static int all_vcpus_paused(void)
 {
     CPUArchState *penv = first_cpu;
@@ -945,7 +1153,7 @@ void pause_all_vcpus(void)
 
     if (!qemu_thread_is_self(&io_thread)) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !mttcg_enabled) {
             while (penv) {
                 penv->stop = 0;
                 penv->stopped = 1;
@@ -983,6 +1191,18 @@ static void qemu_tcg_init_vcpu(void *_env)
     CPUArchState *env = _env;
     CPUState *cpu = ENV_GET_CPU(env);
 
+    if (mttcg_enabled) {
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        env->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(env->halt_cond);
+        qemu_thread_create(cpu->thread, qemu_mttcg_cpu_thread_fn, env,
+                           QEMU_THREAD_JOINABLE);
+        while (env->created == 0) {
+            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+        }
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -1106,7 +1326,15 @@ static int tcg_cpu_exec(CPUArchState *env)
         env->icount_decr.u16.low = decr;
         env->icount_extra = count;
     }
-    ret = cpu_exec(env);
+    if (mttcg_enabled) {
+        tcg_exec_start(env);
+        qemu_mutex_unlock_iothread();
+        ret = cpu_exec(env);
+        qemu_mutex_lock_iothread();
+        tcg_exec_end(env);
+    } else {
+        ret = cpu_exec(env);
+    }
 #ifdef CONFIG_PROFILER
     qemu_time += profile_getclock() - ti;
 #endif
@@ -32,6 +32,10 @@
 
 /* statistics */
 int tlb_flush_count;
+int tlb_flush_page_count;
+int tlb_miss_count;
+int tlb_victim_hit_count;
+int tlb_resize_count;
 
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
@@ -52,24 +56,89 @@ static const CPUTLBEntry s_cputlb_empty_entry = {
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
+/* With multi-threaded TCG another vCPU's TLB may only be changed by its
+   own thread while that vCPU is executing.  */
+static bool tlb_flush_is_remote(CPUArchState *env)
+{
+    return mttcg_enabled && env->running && !qemu_cpu_is_self(env) &&
+           !tcg_exclusive_held();
+}
+
+static void tlb_flush_remote(void *data)
+{
+    tlb_flush(data, 1);
+}
+
+static void tlb_set_size(CPUArchState *env, unsigned int size)
+{
+    env->tlb_mask = (target_ulong)(size - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_window_max = 0;
+    env->tlb_window_flushes = 0;
+}
+
+/* Called on a full flush, once the old entries are gone.  Double the
+   TLB when more than 70% of it was filled since the previous flush;
+   halve it when use stayed below 30% for CPU_TLB_DYN_WINDOW flushes.
+   Shrinking only over a window avoids thrashing when a guest
+   alternates between small and large working sets.  */
+static void tlb_resize(CPUArchState *env)
+{
+    unsigned int size = tlb_size(env);
+    unsigned int used = 0;
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        used = MAX(used, env->tlb_used[mmu_idx]);
+        env->tlb_used[mmu_idx] = 0;
+    }
+    env->tlb_window_max = MAX(env->tlb_window_max, used);
+
+    if (used * 10 > size * 7 && size < CPU_TLB_DYN_MAX_SIZE) {
+        tlb_set_size(env, size * 2);
+        tlb_resize_count++;
+    } else if (++env->tlb_window_flushes == CPU_TLB_DYN_WINDOW) {
+        if (env->tlb_window_max * 10 < size * 3 &&
+            size > (1 << CPU_TLB_DYN_MIN_BITS)) {
+            tlb_set_size(env, size / 2);
+            tlb_resize_count++;
+        } else {
+            tlb_set_size(env, size);
+        }
+    }
+}
+
 void tlb_flush(CPUArchState *env, int flush_global)
 {
-    int i;
+    unsigned int i;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
 #endif
+    if (tlb_flush_is_remote(env)) {
+        async_run_on_cpu(env, tlb_flush_remote, env);
+        return;
+    }
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     env->current_tb = NULL;
 
-    for (i = 0; i < CPU_TLB_SIZE; i++) {
+    /* Entries past the end of the TLB are always empty, so clearing
+       the current size is enough even if the TLB then grows.  */
+    for (i = 0; i < tlb_size(env); i++) {
         int mmu_idx;
 
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
     }
+    tlb_resize(env);
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        int mmu_idx;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
+    }
 
     memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
 
@@ -78,14 +147,44 @@ void tlb_flush(CPUArchState *env, int flush_global)
     tlb_flush_count++;
 }
 
+void tlb_init(CPUArchState *env)
+{
+    int mmu_idx, i;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_TLB_DYN_MAX_SIZE; i++) {
+            env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
+        env->tlb_used[mmu_idx] = 0;
+    }
+    tlb_set_size(env, CPU_TLB_SIZE);
+    env->tlb_flush_addr = -1;
+    env->tlb_flush_mask = 0;
+}
+
+static inline bool tlb_entry_is_page(CPUTLBEntry *tlb_entry,
+                                     target_ulong addr)
+{
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_write &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_code &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
+static inline bool tlb_entry_is_empty(CPUTLBEntry *tlb_entry)
+{
+    return tlb_entry->addr_read == -1 && tlb_entry->addr_write == -1 &&
+           tlb_entry->addr_code == -1;
+}
+
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+    if (tlb_entry_is_page(tlb_entry, addr)) {
         *tlb_entry = s_cputlb_empty_entry;
     }
 }
@@ -98,6 +197,11 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
 #if defined(DEBUG_TLB)
     printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
 #endif
+    if (tlb_flush_is_remote(env)) {
+        /* not worth queueing the address */
+        async_run_on_cpu(env, tlb_flush_remote, env);
+        return;
+    }
     /* Check if we need to flush due to large pages.  */
     if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
 #if defined(DEBUG_TLB)
@@ -113,12 +217,20 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
     env->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    i = tlb_index(env, addr);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
     }
 
+    /* check whether there are entries that need to be flushed in the vtlb */
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
+        }
+    }
+
     tb_flush_jmp_cache(env, addr);
+    tlb_flush_page_count++;
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -181,10 +293,14 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             unsigned int i;
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < tlb_size(env); i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -204,10 +320,48 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    i = tlb_index(env, vaddr);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
     }
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+        }
+    }
+}
+
+/* Called on a miss in the direct mapped TLB, before the guest page tables
+   are walked.  If the victim TLB holds the page, swap the entry back into
+   slot 'index' of the main TLB and return true.  'elt_ofs' selects the
+   addr_read, addr_write or addr_code field to compare against.  */
+bool tlb_victim_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page)
+{
+    int vidx;
+
+    tlb_miss_count++;
+    for (vidx = CPU_VTLB_SIZE - 1; vidx >= 0; --vidx) {
+        CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
+
+        if (cmp == (page | (cmp & ~TARGET_PAGE_MASK & ~TLB_INVALID_MASK))) {
+            CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
+            target_phys_addr_t tmpio, *io = &env->iotlb[mmu_idx][index];
+
+            tmptlb = *tlb;
+            *tlb = *vtlb;
+            *vtlb = tmptlb;
+            tmpio = *io;
+            *io = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpio;
+            tlb_victim_hit_count++;
+            return true;
+        }
+    }
+    return false;
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -242,6 +396,7 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
 {
     MemoryRegionSection *section;
     unsigned int index;
+    int i;
     target_ulong address;
     target_ulong code_address;
     uintptr_t addend;
@@ -277,9 +432,25 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(env, section, vaddr, paddr, prot,
                                             &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    index = tlb_index(env, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Drop any stale copy of this page from the victim TLB, then move the
+       entry we are replacing there, unless it maps the same page.  */
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][i],
+                        vaddr & TARGET_PAGE_MASK);
+    }
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_used[mmu_idx]++;
+    } else if (!tlb_entry_is_page(te, vaddr & TARGET_PAGE_MASK)) {
+        unsigned int vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -321,7 +492,7 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     void *p;
     MemoryRegion *mr;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    page_index = tlb_index(env1, addr);
     mmu_idx = cpu_mmu_index(env1);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
@@ -24,6 +24,18 @@
 #include "error.h"
 #include "qmp-commands.h"
 #include "gdbstub.h"
+#include "qemu-thread.h"
+#include "migration.h"
+#include "exec-memory.h"
+#include <zlib.h>
+
+/* Largest write issued for guest memory */
+#define DUMP_CHUNK_SIZE  (1 << 20)
+#define DUMP_THREADS_MAX 8
+
+/* A live dump stops the guest once this few pages are left dirty */
+#define DUMP_LIVE_MAX_PASSES 8
+#define DUMP_LIVE_MIN_DIRTY  1024
 
 static uint16_t cpu_convert_to_target16(uint16_t val, int endian)
 {
@@ -58,6 +70,16 @@ static uint64_t cpu_convert_to_target64(uint64_t val, int endian)
     return val;
 }
 
+/* Part of a RAMBlock that goes to the vmcore */
+typedef struct DumpRange {
+    uint8_t *host;
+    MemoryRegion *mr;
+    ram_addr_t mr_offset;
+    ram_addr_t addr;
+    int64_t size;
+    int64_t pos;        /* offset from the start of the memory in the vmcore */
+} DumpRange;
+
 typedef struct DumpState {
     ArchDumpInfo dump_info;
     MemoryMappingList list;
@@ -68,20 +90,70 @@ typedef struct DumpState {
     size_t note_size;
     target_phys_addr_t memory_offset;
     int fd;
-
-    RAMBlock *block;
-    ram_addr_t start;
+    /* the vmcore is a file we created: pages can be written in place by
+       several threads, and zero pages left as holes */
+    bool seekable;
+    bool detach;
+    const char *error;
+
+    /* kdump-compressed instead of ELF; kdump_flat if the output cannot
+       seek, see create_kdump() */
+    bool kdump;
+    bool kdump_flat;
+    uint8_t *note_buf;
+    size_t note_buf_offset;
+
+    /* A live dump writes memory while the guest runs, rewrites the pages
+       in dirty[] until few are left, and only then stops the guest; see
+       dump_live().  Its dirty log is read by main loop bottom halves. */
+    bool live;
+    bool dirty_log;
+    int64_t *dirty;         /* offsets from the start of the memory */
+    int64_t nb_dirty;
+    int64_t dirty_size;
+    QEMUBH *main_bh;
+    void (*main_fn)(struct DumpState *s);
+    bool main_done;
+    QemuMutex main_lock;
+    QemuCond main_cond;
+
+    DumpRange *ranges;
+    int nb_ranges;
     bool has_filter;
     int64_t begin;
     int64_t length;
     Error **errp;
+
+    QemuThread thread;
+    QEMUBH *bh;
 } DumpState;
 
+/* Progress of the current or last dump, for query-dump */
+static DumpStatus dump_status = DUMP_STATUS_NONE;
+static int64_t dump_total_size;
+static int64_t dump_written_size;
+
+static void dump_add_progress(int64_t size)
+{
+    __sync_fetch_and_add(&dump_written_size, size);
+}
+
 static int dump_cleanup(DumpState *s)
 {
     int ret = 0;
 
     memory_mapping_list_free(&s->list);
+    g_free(s->ranges);
+    g_free(s->note_buf);
+    if (s->dirty_log) {
+        memory_global_dirty_log_stop();
+    }
+    if (s->live) {
+        g_free(s->dirty);
+        qemu_bh_delete(s->main_bh);
+        qemu_cond_destroy(&s->main_cond);
+        qemu_mutex_destroy(&s->main_lock);
+    }
     if (s->fd != -1) {
         close(s->fd);
     }
@@ -92,9 +164,10 @@ static int dump_cleanup(DumpState *s)
     return ret;
 }
 
+/* Errors are only recorded; whoever runs create_vmcore() cleans up */
 static void dump_error(DumpState *s, const char *reason)
 {
-    dump_cleanup(s);
+    s->error = reason;
 }
 
 static int fd_write_vmcore(void *buf, size_t size, void *opaque)
@@ -268,7 +341,7 @@ static int write_elf64_note(DumpState *s)
     return 0;
 }
 
-static int write_elf64_notes(DumpState *s)
+static int write_elf64_notes(write_core_dump_function f, DumpState *s)
 {
     CPUArchState *env;
     int ret;
@@ -276,7 +349,7 @@ static int write_elf64_notes(DumpState *s)
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         id = cpu_index(env);
-        ret = cpu_write_elf64_note(fd_write_vmcore, env, id, s);
+        ret = cpu_write_elf64_note(f, env, id, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write elf notes.\n");
             return -1;
@@ -284,7 +357,7 @@ static int write_elf64_notes(DumpState *s)
     }
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
-        ret = cpu_write_elf64_qemunote(fd_write_vmcore, env, s);
+        ret = cpu_write_elf64_qemunote(f, env, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write CPU status.\n");
             return -1;
@@ -318,7 +391,7 @@ static int write_elf32_note(DumpState *s)
     return 0;
 }
 
-static int write_elf32_notes(DumpState *s)
+static int write_elf32_notes(write_core_dump_function f, DumpState *s)
 {
     CPUArchState *env;
     int ret;
@@ -326,7 +399,7 @@ static int write_elf32_notes(DumpState *s)
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         id = cpu_index(env);
-        ret = cpu_write_elf32_note(fd_write_vmcore, env, id, s);
+        ret = cpu_write_elf32_note(f, env, id, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write elf notes.\n");
             return -1;
@@ -334,7 +407,7 @@ static int write_elf32_notes(DumpState *s)
     }
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
-        ret = cpu_write_elf32_qemunote(fd_write_vmcore, env, s);
+        ret = cpu_write_elf32_qemunote(f, env, s);
         if (ret < 0) {
             dump_error(s, "dump: failed to write CPU status.\n");
             return -1;
@@ -387,32 +460,717 @@ static int write_data(DumpState *s, void *buf, int length)
     return 0;
 }
 
-/* write the memroy to vmcore. 1 page per I/O. */
-static int write_memory(DumpState *s, RAMBlock *block, ram_addr_t start,
-                        int64_t size)
+/* write the memory to vmcore, in chunks of up to DUMP_CHUNK_SIZE */
+static int write_memory(DumpState *s, uint8_t *buf, int64_t size)
+{
+    int64_t done, len;
+
+    for (done = 0; done < size; done += len) {
+        len = MIN(size - done, DUMP_CHUNK_SIZE);
+        if (write_data(s, buf + done, len) < 0) {
+            return -1;
+        }
+        dump_add_progress(len);
+    }
+
+    return 0;
+}
+
+#ifndef _WIN32
+static bool is_zero_page(uint8_t *buf, int64_t size)
 {
-    int64_t i;
+    return size == TARGET_PAGE_SIZE && !((uintptr_t)buf % sizeof(long)) &&
+           buffer_is_zero(buf, size);
+}
+
+static int pwrite_full(int fd, uint8_t *buf, int64_t size, off_t offset)
+{
+    ssize_t ret;
+
+    while (size) {
+        ret = pwrite(fd, buf, size, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        buf += ret;
+        offset += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/* write the memory at OFFSET in the vmcore, leaving holes for zero pages */
+static int write_memory_sparse(DumpState *s, uint8_t *buf, int64_t size,
+                               off_t offset)
+{
+    int64_t done = 0, len, page;
+
+    while (done < size) {
+        page = MIN(TARGET_PAGE_SIZE, size - done);
+        if (is_zero_page(buf + done, page)) {
+            dump_add_progress(page);
+            done += page;
+            continue;
+        }
+
+        /* gather a run of non-zero pages */
+        for (len = page; done + len < size && len < DUMP_CHUNK_SIZE;
+             len += page) {
+            page = MIN(TARGET_PAGE_SIZE, size - done - len);
+            if (is_zero_page(buf + done + len, page)) {
+                break;
+            }
+        }
+        if (pwrite_full(s->fd, buf + done, len, offset + done) < 0) {
+            return -1;
+        }
+        dump_add_progress(len);
+        done += len;
+    }
+
+    return 0;
+}
+
+typedef struct DumpWorker {
+    QemuThread thread;
+    DumpState *s;
+    int64_t begin, end;     /* slice of the memory part of the vmcore */
     int ret;
+} DumpWorker;
 
-    for (i = 0; i < size / TARGET_PAGE_SIZE; i++) {
-        ret = write_data(s, block->host + start + i * TARGET_PAGE_SIZE,
-                         TARGET_PAGE_SIZE);
-        if (ret < 0) {
-            return ret;
+static void *dump_worker_thread(void *opaque)
+{
+    DumpWorker *w = opaque;
+    DumpState *s = w->s;
+    int i;
+
+    for (i = 0; i < s->nb_ranges && !w->ret; i++) {
+        DumpRange *r = &s->ranges[i];
+        int64_t lo = MAX(w->begin, r->pos);
+        int64_t hi = MIN(w->end, r->pos + r->size);
+
+        if (lo < hi) {
+            w->ret = write_memory_sparse(s, r->host + (lo - r->pos), hi - lo,
+                                         s->memory_offset + lo);
         }
     }
+    return NULL;
+}
 
-    if ((size % TARGET_PAGE_SIZE) != 0) {
-        ret = write_data(s, block->host + start + i * TARGET_PAGE_SIZE,
-                         size % TARGET_PAGE_SIZE);
-        if (ret < 0) {
-            return ret;
+static int dump_nb_threads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    return MAX(1, MIN(sysconf(_SC_NPROCESSORS_ONLN), DUMP_THREADS_MAX));
+#else
+    return 1;
+#endif
+}
+
+/* write all memory with one thread per slice of the vmcore */
+static int write_memory_parallel(DumpState *s)
+{
+    DumpWorker workers[DUMP_THREADS_MAX];
+    int64_t slice;
+    int i, nb_threads = dump_nb_threads(), ret = 0;
+
+    slice = DIV_ROUND_UP(dump_total_size, nb_threads);
+    slice = (slice + TARGET_PAGE_SIZE - 1) & TARGET_PAGE_MASK;
+
+    for (i = 0; i < nb_threads; i++) {
+        workers[i].s = s;
+        workers[i].begin = i * slice;
+        workers[i].end = MIN((i + 1) * slice, dump_total_size);
+        workers[i].ret = 0;
+        qemu_thread_create(&workers[i].thread, dump_worker_thread,
+                           &workers[i], QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_join(&workers[i].thread);
+        ret |= workers[i].ret;
+    }
+
+    /* trailing zero pages were not written */
+    if (!ret && ftruncate(s->fd, s->memory_offset + dump_total_size) < 0) {
+        ret = -1;
+    }
+    if (ret < 0) {
+        dump_error(s, "dump: failed to save memory.\n");
+    }
+    return ret;
+}
+
+/*
+ * kdump-compressed format, as written by makedumpfile and read by crash:
+ *
+ *   block 0           disk dump header
+ *   block 1           kdump sub header, followed by the ELF notes
+ *   bitmap blocks     two bitmaps of the dumped page frames
+ *   descriptors       one per dumped page, in page frame order
+ *   page data         the pages, zlib-compressed unless that does not
+ *                     save space; all zero pages share one copy
+ *
+ * Blocks are TARGET_PAGE_SIZE bytes.  Outputs that cannot seek get
+ * makedumpfile's flattened format, which "makedumpfile -R" turns back
+ * into the above.
+ */
+#define KDUMP_SIGNATURE             "KDUMP   "
+#define KDUMP_HEADER_VERSION        6
+#define KDUMP_DUMP_LEVEL            1   /* zero pages are not stored */
+#define DUMP_DH_COMPRESSED_ZLIB     0x1
+
+#define MAKEDUMPFILE_SIGNATURE      "makedumpfile"
+#define MAKEDUMPFILE_HEADER_SIZE    4096
+#define MAKEDUMPFILE_TYPE_FLAT      1
+#define MAKEDUMPFILE_VERSION_FLAT   1
+
+/* Pages compressed by a thread at a time */
+#define KDUMP_BATCH_PAGES           256
+
+typedef struct QEMU_PACKED NewUtsname {
+    char sysname[65];
+    char nodename[65];
+    char release[65];
+    char version[65];
+    char machine[65];
+    char domainname[65];
+} NewUtsname;
+
+typedef struct QEMU_PACKED DiskDumpHeader32 {
+    char signature[8];
+    uint32_t header_version;
+    NewUtsname utsname;
+    char timestamp[10];         /* struct timeval, aligned */
+    uint32_t status;
+    uint32_t block_size;
+    uint32_t sub_hdr_size;      /* in blocks */
+    uint32_t bitmap_blocks;
+    uint32_t max_mapnr;
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    uint32_t nr_cpus;
+} DiskDumpHeader32;
+
+typedef struct QEMU_PACKED DiskDumpHeader64 {
+    char signature[8];
+    uint32_t header_version;
+    NewUtsname utsname;
+    char timestamp[22];         /* struct timeval, aligned */
+    uint32_t status;
+    uint32_t block_size;
+    uint32_t sub_hdr_size;
+    uint32_t bitmap_blocks;
+    uint32_t max_mapnr;
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    uint32_t nr_cpus;
+} DiskDumpHeader64;
+
+typedef struct QEMU_PACKED KdumpSubHeader32 {
+    uint32_t phys_base;
+    uint32_t dump_level;
+    uint32_t split;
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+    uint64_t offset_vmcoreinfo;
+    uint32_t size_vmcoreinfo;
+    uint64_t offset_note;
+    uint32_t note_size;
+    uint64_t offset_eraseinfo;
+    uint32_t size_eraseinfo;
+    uint64_t start_pfn_64;
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+} KdumpSubHeader32;
+
+typedef struct QEMU_PACKED KdumpSubHeader64 {
+    uint64_t phys_base;
+    uint32_t dump_level;
+    uint32_t split;
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t offset_vmcoreinfo;
+    uint64_t size_vmcoreinfo;
+    uint64_t offset_note;
+    uint64_t note_size;
+    uint64_t offset_eraseinfo;
+    uint64_t size_eraseinfo;
+    uint64_t start_pfn_64;
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+} KdumpSubHeader64;
+
+typedef struct QEMU_PACKED PageDescriptor {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t flags;
+    uint64_t page_flags;
+} PageDescriptor;
+
+typedef struct QEMU_PACKED MakedumpfileHeader {
+    char signature[16];
+    int64_t type;
+    int64_t version;
+} MakedumpfileHeader;
+
+typedef struct QEMU_PACKED MakedumpfileDataHeader {
+    int64_t offset;
+    int64_t buf_size;
+} MakedumpfileDataHeader;
+
+/* A batch of pages, compressed back to back into data */
+typedef struct KdumpBatch {
+    int64_t index;              /* -1 while the slot is free */
+    bool ready;
+    int nb_pages;
+    size_t used;
+    uint8_t *data;
+    uint32_t size[KDUMP_BATCH_PAGES];   /* 0 for a zero page */
+    uint32_t flags[KDUMP_BATCH_PAGES];
+} KdumpBatch;
+
+typedef struct KdumpState {
+    DumpState *s;
+    int64_t nb_pages;
+    uint64_t max_mapnr;
+    uint32_t sub_hdr_blocks;
+    uint32_t bitmap_blocks;     /* both bitmaps */
+    int nr_cpus;
+
+    /* compression threads take batches in order and fill slots
+       index % nb_slots, which create_kdump() writes out in order */
+    QemuMutex lock;
+    QemuCond cond;
+    int64_t nb_batches;
+    int64_t next_batch;
+    bool abort;
+    KdumpBatch *slots;
+    int nb_slots;
+} KdumpState;
+
+/* write BUF at OFFSET in the (unflattened) vmcore */
+static int kdump_write(DumpState *s, const void *buf, size_t size,
+                       off_t offset)
+{
+    MakedumpfileDataHeader dh;
+
+    if (!s->kdump_flat) {
+        return pwrite_full(s->fd, (uint8_t *)buf, size, offset);
+    }
+
+    dh.offset = cpu_to_be64(offset);
+    dh.buf_size = cpu_to_be64(size);
+    if (qemu_write_full(s->fd, &dh, sizeof(dh)) != sizeof(dh) ||
+        qemu_write_full(s->fd, buf, size) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int kdump_write_flat_header(DumpState *s)
+{
+    uint8_t *buf = g_malloc0(MAKEDUMPFILE_HEADER_SIZE);
+    MakedumpfileHeader *mh = (MakedumpfileHeader *)buf;
+    int ret = 0;
+
+    memcpy(mh->signature, MAKEDUMPFILE_SIGNATURE,
+           strlen(MAKEDUMPFILE_SIGNATURE));
+    mh->type = cpu_to_be64(MAKEDUMPFILE_TYPE_FLAT);
+    mh->version = cpu_to_be64(MAKEDUMPFILE_VERSION_FLAT);
+    if (qemu_write_full(s->fd, buf, MAKEDUMPFILE_HEADER_SIZE) !=
+        MAKEDUMPFILE_HEADER_SIZE) {
+        ret = -1;
+    }
+    g_free(buf);
+    return ret;
+}
+
+static int kdump_write_flat_end(DumpState *s)
+{
+    MakedumpfileDataHeader dh;
+
+    dh.offset = cpu_to_be64(-1);
+    dh.buf_size = cpu_to_be64(-1);
+    if (qemu_write_full(s->fd, &dh, sizeof(dh)) != sizeof(dh)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int kdump_note_write(void *buf, size_t size, void *opaque)
+{
+    DumpState *s = opaque;
+
+    if (s->note_buf_offset + size > s->note_size) {
+        return -1;
+    }
+    memcpy(s->note_buf + s->note_buf_offset, buf, size);
+    s->note_buf_offset += size;
+    return 0;
+}
+
+static const char *kdump_machine(DumpState *s)
+{
+    switch (s->dump_info.d_machine) {
+    case EM_X86_64:
+        return "x86_64";
+    case EM_386:
+        return "i686";
+    default:
+        return "unknown";
+    }
+}
+
+static int kdump_write_headers(KdumpState *k)
+{
+    DumpState *s = k->s;
+    int endian = s->dump_info.d_endian;
+    uint32_t block_size = TARGET_PAGE_SIZE;
+    uint64_t offset_note;
+    int ret;
+
+    if (s->dump_info.d_class == ELFCLASS64) {
+        DiskDumpHeader64 dh;
+        KdumpSubHeader64 sh;
+
+        memset(&dh, 0, sizeof(dh));
+        memcpy(dh.signature, KDUMP_SIGNATURE, sizeof(dh.signature));
+        dh.header_version = cpu_convert_to_target32(KDUMP_HEADER_VERSION,
+                                                    endian);
+        pstrcpy(dh.utsname.machine, sizeof(dh.utsname.machine),
+                kdump_machine(s));
+        dh.status = cpu_convert_to_target32(DUMP_DH_COMPRESSED_ZLIB, endian);
+        dh.block_size = cpu_convert_to_target32(block_size, endian);
+        dh.sub_hdr_size = cpu_convert_to_target32(k->sub_hdr_blocks, endian);
+        dh.bitmap_blocks = cpu_convert_to_target32(k->bitmap_blocks, endian);
+        dh.max_mapnr = cpu_convert_to_target32(MIN(k->max_mapnr, UINT_MAX),
+                                               endian);
+        dh.nr_cpus = cpu_convert_to_target32(k->nr_cpus, endian);
+
+        offset_note = block_size + sizeof(sh);
+        memset(&sh, 0, sizeof(sh));
+        sh.dump_level = cpu_convert_to_target32(KDUMP_DUMP_LEVEL, endian);
+        sh.offset_note = cpu_convert_to_target64(offset_note, endian);
+        sh.note_size = cpu_convert_to_target64(s->note_size, endian);
+        sh.max_mapnr_64 = cpu_convert_to_target64(k->max_mapnr, endian);
+
+        ret = kdump_write(s, &dh, sizeof(dh), 0);
+        if (ret == 0) {
+            ret = kdump_write(s, &sh, sizeof(sh), block_size);
+        }
+    } else {
+        DiskDumpHeader32 dh;
+        KdumpSubHeader32 sh;
+
+        memset(&dh, 0, sizeof(dh));
+        memcpy(dh.signature, KDUMP_SIGNATURE, sizeof(dh.signature));
+        dh.header_version = cpu_convert_to_target32(KDUMP_HEADER_VERSION,
+                                                    endian);
+        pstrcpy(dh.utsname.machine, sizeof(dh.utsname.machine),
+                kdump_machine(s));
+        dh.status = cpu_convert_to_target32(DUMP_DH_COMPRESSED_ZLIB, endian);
+        dh.block_size = cpu_convert_to_target32(block_size, endian);
+        dh.sub_hdr_size = cpu_convert_to_target32(k->sub_hdr_blocks, endian);
+        dh.bitmap_blocks = cpu_convert_to_target32(k->bitmap_blocks, endian);
+        dh.max_mapnr = cpu_convert_to_target32(MIN(k->max_mapnr, UINT_MAX),
+                                               endian);
+        dh.nr_cpus = cpu_convert_to_target32(k->nr_cpus, endian);
+
+        offset_note = block_size + sizeof(sh);
+        memset(&sh, 0, sizeof(sh));
+        sh.dump_level = cpu_convert_to_target32(KDUMP_DUMP_LEVEL, endian);
+        sh.offset_note = cpu_convert_to_target64(offset_note, endian);
+        sh.note_size = cpu_convert_to_target32(s->note_size, endian);
+        sh.max_mapnr_64 = cpu_convert_to_target64(k->max_mapnr, endian);
+
+        ret = kdump_write(s, &dh, sizeof(dh), 0);
+        if (ret == 0) {
+            ret = kdump_write(s, &sh, sizeof(sh), block_size);
+        }
+    }
+    if (ret < 0) {
+        dump_error(s, "dump: failed to write kdump header.\n");
+        return -1;
+    }
+
+    s->note_buf = g_malloc0(s->note_size);
+    s->note_buf_offset = 0;
+    if (s->dump_info.d_class == ELFCLASS64) {
+        ret = write_elf64_notes(kdump_note_write, s);
+    } else {
+        ret = write_elf32_notes(kdump_note_write, s);
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    if (kdump_write(s, s->note_buf, s->note_size, offset_note) < 0) {
+        dump_error(s, "dump: failed to write elf notes.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* both bitmaps: every page of the ranges is dumped */
+static int kdump_write_bitmaps(KdumpState *k, off_t offset)
+{
+    DumpState *s = k->s;
+    size_t len = (size_t)k->bitmap_blocks / 2 * TARGET_PAGE_SIZE;
+    uint8_t *bitmap = g_malloc0(len);
+    uint64_t pfn, end;
+    int i, ret = 0;
+
+    for (i = 0; i < s->nb_ranges; i++) {
+        pfn = s->ranges[i].addr >> TARGET_PAGE_BITS;
+        end = pfn + (s->ranges[i].size >> TARGET_PAGE_BITS);
+        for (; pfn < end; pfn++) {
+            bitmap[pfn / CHAR_BIT] |= 1 << (pfn % CHAR_BIT);
+        }
+    }
+    if (kdump_write(s, bitmap, len, offset) < 0 ||
+        kdump_write(s, bitmap, len, offset + len) < 0) {
+        dump_error(s, "dump: failed to write kdump bitmap.\n");
+        ret = -1;
+    }
+    g_free(bitmap);
+    return ret;
+}
+
+/* host address of the PAGE-th page of the dump */
+static uint8_t *dump_page(DumpState *s, int64_t page)
+{
+    int64_t pos = page << TARGET_PAGE_BITS;
+    int lo = 0, hi = s->nb_ranges - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (s->ranges[mid].pos <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return s->ranges[lo].host + (pos - s->ranges[lo].pos);
+}
+
+static void kdump_compress_batch(KdumpState *k, KdumpBatch *b)
+{
+    int64_t first = b->index * KDUMP_BATCH_PAGES;
+    uLongf len;
+    int i;
+
+    b->nb_pages = MIN(KDUMP_BATCH_PAGES, k->nb_pages - first);
+    b->used = 0;
+    for (i = 0; i < b->nb_pages; i++) {
+        uint8_t *page = dump_page(k->s, first + i);
+
+        if (buffer_is_zero(page, TARGET_PAGE_SIZE)) {
+            b->size[i] = 0;
+            continue;
+        }
+        len = compressBound(TARGET_PAGE_SIZE);
+        if (compress2(b->data + b->used, &len, page, TARGET_PAGE_SIZE,
+                      Z_BEST_SPEED) == Z_OK && len < TARGET_PAGE_SIZE) {
+            b->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+        } else {
+            memcpy(b->data + b->used, page, TARGET_PAGE_SIZE);
+            len = TARGET_PAGE_SIZE;
+            b->flags[i] = 0;
         }
+        b->size[i] = len;
+        b->used += len;
     }
+}
+
+static void *kdump_compress_thread(void *opaque)
+{
+    KdumpState *k = opaque;
+    KdumpBatch *b;
+    int64_t index;
+
+    qemu_mutex_lock(&k->lock);
+    while (!k->abort && k->next_batch < k->nb_batches) {
+        index = k->next_batch++;
+        b = &k->slots[index % k->nb_slots];
+        while (!k->abort && b->index != -1) {
+            qemu_cond_wait(&k->cond, &k->lock);
+        }
+        if (k->abort) {
+            break;
+        }
+        b->index = index;
+        b->ready = false;
+        qemu_mutex_unlock(&k->lock);
+
+        kdump_compress_batch(k, b);
 
+        qemu_mutex_lock(&k->lock);
+        b->ready = true;
+        qemu_cond_broadcast(&k->cond);
+    }
+    qemu_mutex_unlock(&k->lock);
+    return NULL;
+}
+
+/* write the page descriptors and data of batch B */
+static int kdump_write_batch(KdumpState *k, KdumpBatch *b, off_t desc_offset,
+                             off_t zero_offset, off_t *data_offset)
+{
+    DumpState *s = k->s;
+    int endian = s->dump_info.d_endian;
+    PageDescriptor desc[KDUMP_BATCH_PAGES];
+    off_t offset = *data_offset;
+    int i;
+
+    for (i = 0; i < b->nb_pages; i++) {
+        if (b->size[i]) {
+            desc[i].offset = cpu_convert_to_target64(offset, endian);
+            desc[i].size = cpu_convert_to_target32(b->size[i], endian);
+            desc[i].flags = cpu_convert_to_target32(b->flags[i], endian);
+            offset += b->size[i];
+        } else {
+            desc[i].offset = cpu_convert_to_target64(zero_offset, endian);
+            desc[i].size = cpu_convert_to_target32(TARGET_PAGE_SIZE, endian);
+            desc[i].flags = 0;
+        }
+        desc[i].page_flags = 0;
+    }
+
+    if (kdump_write(s, desc, b->nb_pages * sizeof(desc[0]), desc_offset) < 0 ||
+        (b->used && kdump_write(s, b->data, b->used, *data_offset) < 0)) {
+        return -1;
+    }
+    *data_offset = offset;
+    dump_add_progress((int64_t)b->nb_pages << TARGET_PAGE_BITS);
     return 0;
 }
 
+static int kdump_range_cmp(const void *a, const void *b)
+{
+    const DumpRange *ra = a, *rb = b;
+
+    return ra->addr < rb->addr ? -1 : ra->addr > rb->addr;
+}
+
+static int create_kdump(DumpState *s)
+{
+    KdumpState k;
+    QemuThread threads[DUMP_THREADS_MAX];
+    CPUArchState *env;
+    uint8_t *zero_page;
+    off_t bitmap_offset, desc_offset, zero_offset, data_offset;
+    int64_t index, pos;
+    int i, nb_threads = dump_nb_threads(), ret = 0;
+
+    /* descriptors go in page frame order */
+    qsort(s->ranges, s->nb_ranges, sizeof(DumpRange), kdump_range_cmp);
+    for (i = 0, pos = 0; i < s->nb_ranges; i++) {
+        s->ranges[i].pos = pos;
+        pos += s->ranges[i].size;
+    }
+
+    memset(&k, 0, sizeof(k));
+    k.s = s;
+    k.nb_pages = dump_total_size >> TARGET_PAGE_BITS;
+    k.max_mapnr = (s->ranges[s->nb_ranges - 1].addr +
+                   s->ranges[s->nb_ranges - 1].size) >> TARGET_PAGE_BITS;
+    k.sub_hdr_blocks = DIV_ROUND_UP(sizeof(KdumpSubHeader64) + s->note_size,
+                                    TARGET_PAGE_SIZE);
+    k.bitmap_blocks = 2 * DIV_ROUND_UP(DIV_ROUND_UP(k.max_mapnr, CHAR_BIT),
+                                       TARGET_PAGE_SIZE);
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        k.nr_cpus++;
+    }
+
+    bitmap_offset = (off_t)(1 + k.sub_hdr_blocks) * TARGET_PAGE_SIZE;
+    desc_offset = bitmap_offset + (off_t)k.bitmap_blocks * TARGET_PAGE_SIZE;
+    zero_offset = desc_offset + k.nb_pages * sizeof(PageDescriptor);
+    data_offset = zero_offset + TARGET_PAGE_SIZE;
+
+    if ((s->kdump_flat && kdump_write_flat_header(s) < 0) ||
+        kdump_write_headers(&k) < 0 ||
+        kdump_write_bitmaps(&k, bitmap_offset) < 0) {
+        if (!s->error) {
+            dump_error(s, "dump: failed to write kdump header.\n");
+        }
+        return -1;
+    }
+
+    zero_page = g_malloc0(TARGET_PAGE_SIZE);
+    ret = kdump_write(s, zero_page, TARGET_PAGE_SIZE, zero_offset);
+    g_free(zero_page);
+    if (ret < 0) {
+        dump_error(s, "dump: failed to save memory.\n");
+        return -1;
+    }
+
+    qemu_mutex_init(&k.lock);
+    qemu_cond_init(&k.cond);
+    k.nb_batches = DIV_ROUND_UP(k.nb_pages, KDUMP_BATCH_PAGES);
+    k.nb_slots = 2 * nb_threads;
+    k.slots = g_new0(KdumpBatch, k.nb_slots);
+    for (i = 0; i < k.nb_slots; i++) {
+        k.slots[i].index = -1;
+        k.slots[i].data = g_malloc(KDUMP_BATCH_PAGES *
+                                   compressBound(TARGET_PAGE_SIZE));
+    }
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_create(&threads[i], kdump_compress_thread, &k,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (index = 0; index < k.nb_batches && !ret; index++) {
+        KdumpBatch *b = &k.slots[index % k.nb_slots];
+
+        qemu_mutex_lock(&k.lock);
+        while (b->index != index || !b->ready) {
+            qemu_cond_wait(&k.cond, &k.lock);
+        }
+        qemu_mutex_unlock(&k.lock);
+
+        ret = kdump_write_batch(&k, b, desc_offset, zero_offset,
+                                &data_offset);
+        desc_offset += b->nb_pages * sizeof(PageDescriptor);
+
+        qemu_mutex_lock(&k.lock);
+        b->index = -1;
+        k.abort = ret < 0;
+        qemu_cond_broadcast(&k.cond);
+        qemu_mutex_unlock(&k.lock);
+    }
+
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    for (i = 0; i < k.nb_slots; i++) {
+        g_free(k.slots[i].data);
+    }
+    g_free(k.slots);
+    qemu_cond_destroy(&k.cond);
+    qemu_mutex_destroy(&k.lock);
+
+    if (!ret) {
+        if (s->kdump_flat) {
+            ret = kdump_write_flat_end(s);
+        } else {
+            ret = ftruncate(s->fd, data_offset);
+        }
+    }
+    if (ret < 0) {
+        dump_error(s, "dump: failed to save memory.\n");
+        return -1;
+    }
+    return 0;
+}
+#endif
+
 /* get the memory's offset in the vmcore */
 static target_phys_addr_t get_offset(target_phys_addr_t phys_addr,
                                      DumpState *s)
@@ -553,7 +1311,7 @@ static int dump_begin(DumpState *s)
         }
 
         /* write notes to vmcore */
-        if (write_elf64_notes(s) < 0) {
+        if (write_elf64_notes(fd_write_vmcore, s) < 0) {
             return -1;
         }
 
@@ -576,7 +1334,7 @@ static int dump_begin(DumpState *s)
         }
 
         /* write notes to vmcore */
-        if (write_elf32_notes(s) < 0) {
+        if (write_elf32_notes(fd_write_vmcore, s) < 0) {
             return -1;
         }
     }
@@ -584,74 +1342,183 @@ static int dump_begin(DumpState *s)
     return 0;
 }
 
-/* write PT_LOAD to vmcore */
-static int dump_completed(DumpState *s)
+#ifndef _WIN32
+/* Run FN in the main loop, which owns the dirty log and the run state */
+static void dump_main_bh(void *opaque)
 {
-    dump_cleanup(s);
-    return 0;
+    DumpState *s = opaque;
+
+    s->main_fn(s);
+    qemu_mutex_lock(&s->main_lock);
+    s->main_done = true;
+    qemu_cond_signal(&s->main_cond);
+    qemu_mutex_unlock(&s->main_lock);
 }
 
-static int get_next_block(DumpState *s, RAMBlock *block)
+static void dump_run_in_main(DumpState *s, void (*fn)(DumpState *s))
 {
-    while (1) {
-        block = QLIST_NEXT(block, next);
-        if (!block) {
-            /* no more block */
-            return 1;
-        }
+    s->main_fn = fn;
+    s->main_done = false;
+    qemu_bh_schedule(s->main_bh);
+    qemu_mutex_lock(&s->main_lock);
+    while (!s->main_done) {
+        qemu_cond_wait(&s->main_cond, &s->main_lock);
+    }
+    qemu_mutex_unlock(&s->main_lock);
+}
 
-        s->start = 0;
-        s->block = block;
-        if (s->has_filter) {
-            if (block->offset >= s->begin + s->length ||
-                block->offset + block->length <= s->begin) {
-                /* This block is out of the range */
+static void dump_live_start(DumpState *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_ranges; i++) {
+        memory_region_reset_dirty(s->ranges[i].mr, s->ranges[i].mr_offset,
+                                  s->ranges[i].size, DIRTY_MEMORY_DUMP);
+    }
+    memory_global_dirty_log_start();
+    s->dirty_log = true;
+}
+
+/* Record the pages written since the last call in dirty[] */
+static void dump_collect_dirty(DumpState *s)
+{
+    int64_t off;
+    int i;
+
+    memory_global_sync_dirty_bitmap(get_system_memory());
+    s->nb_dirty = 0;
+    for (i = 0; i < s->nb_ranges; i++) {
+        DumpRange *r = &s->ranges[i];
+
+        for (off = 0; off < r->size; off += TARGET_PAGE_SIZE) {
+            if (!memory_region_get_dirty(r->mr, r->mr_offset + off,
+                                         TARGET_PAGE_SIZE,
+                                         DIRTY_MEMORY_DUMP)) {
                 continue;
             }
-
-            if (s->begin > block->offset) {
-                s->start = s->begin - block->offset;
+            if (s->nb_dirty == s->dirty_size) {
+                s->dirty_size = MAX(s->dirty_size * 2, 1024);
+                s->dirty = g_renew(int64_t, s->dirty, s->dirty_size);
             }
+            s->dirty[s->nb_dirty++] = r->pos + off;
         }
+        memory_region_reset_dirty(r->mr, r->mr_offset, r->size,
+                                  DIRTY_MEMORY_DUMP);
+    }
+}
 
-        return 0;
+static void dump_live_stop(DumpState *s)
+{
+    ArchDumpInfo info;
+    CPUArchState *env;
+
+    if (runstate_is_running()) {
+        vm_stop(RUN_STATE_SAVE_VM);
+        s->resume = true;
+    }
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        cpu_synchronize_state(env);
+    }
+
+    dump_collect_dirty(s);
+    memory_global_dirty_log_stop();
+    s->dirty_log = false;
+
+    /* the headers were sized for the mode the guest was in at the start */
+    if (cpu_get_dump_info(&info) < 0 ||
+        info.d_machine != s->dump_info.d_machine ||
+        info.d_class != s->dump_info.d_class) {
+        dump_error(s, "dump: the guest changed mode during the dump.\n");
     }
 }
 
-/* write all memory to vmcore */
-static int dump_iterate(DumpState *s)
+/* rewrite the pages in dirty[], a run of contiguous pages at a time */
+static int dump_write_dirty(DumpState *s)
 {
-    RAMBlock *block;
-    int64_t size;
-    int ret;
+    int64_t i, n, max = DUMP_CHUNK_SIZE / TARGET_PAGE_SIZE;
+    uint8_t *host;
+
+    for (i = 0; i < s->nb_dirty; i += n) {
+        host = dump_page(s, s->dirty[i] >> TARGET_PAGE_BITS);
+        for (n = 1; i + n < s->nb_dirty && n < max &&
+             s->dirty[i + n] == s->dirty[i] + n * TARGET_PAGE_SIZE &&
+             dump_page(s, s->dirty[i + n] >> TARGET_PAGE_BITS) ==
+             host + n * TARGET_PAGE_SIZE; n++) {
+            /* extend the run */
+        }
+        if (pwrite_full(s->fd, host, n * TARGET_PAGE_SIZE,
+                        s->memory_offset + s->dirty[i]) < 0) {
+            dump_error(s, "dump: failed to save memory.\n");
+            return -1;
+        }
+        __sync_fetch_and_add(&dump_total_size, n * TARGET_PAGE_SIZE);
+        dump_add_progress(n * TARGET_PAGE_SIZE);
+    }
+    return 0;
+}
 
-    while (1) {
-        block = s->block;
+/*
+ * Memory first, while the guest runs, then the pages it dirtied, pass
+ * after pass.  The guest is stopped for the last pass only; the headers
+ * and the CPU notes are written after it, so that they match the memory.
+ */
+static int dump_live(DumpState *s)
+{
+    int pass;
 
-        size = block->length;
-        if (s->has_filter) {
-            size -= s->start;
-            if (s->begin + s->length < block->offset + block->length) {
-                size -= block->offset + block->length - (s->begin + s->length);
-            }
+    if (write_memory_parallel(s) < 0) {
+        return -1;
+    }
+    for (pass = 0; pass < DUMP_LIVE_MAX_PASSES; pass++) {
+        dump_run_in_main(s, dump_collect_dirty);
+        if (s->nb_dirty <= DUMP_LIVE_MIN_DIRTY) {
+            break;
         }
-        ret = write_memory(s, block, s->start, size);
-        if (ret == -1) {
-            return ret;
+        if (dump_write_dirty(s) < 0) {
+            return -1;
         }
+    }
+
+    dump_run_in_main(s, dump_live_stop);
+    if (s->error || dump_write_dirty(s) < 0) {
+        return -1;
+    }
+    return dump_begin(s);
+}
+#endif
 
-        ret = get_next_block(s, block);
-        if (ret == 1) {
-            dump_completed(s);
-            return 0;
+/* write all memory to vmcore */
+static int dump_iterate(DumpState *s)
+{
+    int i;
+
+#ifndef _WIN32
+    if (s->seekable) {
+        return write_memory_parallel(s);
+    }
+#endif
+    for (i = 0; i < s->nb_ranges; i++) {
+        if (write_memory(s, s->ranges[i].host, s->ranges[i].size) < 0) {
+            return -1;
         }
     }
+
+    return 0;
 }
 
 static int create_vmcore(DumpState *s)
 {
     int ret;
 
+#ifndef _WIN32
+    if (s->kdump) {
+        return create_kdump(s);
+    }
+    if (s->live) {
+        return dump_live(s);
+    }
+#endif
+
     ret = dump_begin(s);
     if (ret < 0) {
         return -1;
@@ -665,42 +1532,54 @@ static int create_vmcore(DumpState *s)
     return 0;
 }
 
-static ram_addr_t get_start_block(DumpState *s)
+/* the parts of the RAMBlocks to dump, in the order of get_offset() */
+static void get_ranges(DumpState *s)
 {
     RAMBlock *block;
+    int64_t start, size, pos = 0;
 
-    if (!s->has_filter) {
-        s->block = QLIST_FIRST(&ram_list.blocks);
-        return 0;
-    }
-
+    s->ranges = NULL;
+    s->nb_ranges = 0;
     QLIST_FOREACH(block, &ram_list.blocks, next) {
-        if (block->offset >= s->begin + s->length ||
-            block->offset + block->length <= s->begin) {
-            /* This block is out of the range */
-            continue;
+        start = 0;
+        size = block->length;
+        if (s->has_filter) {
+            if (block->offset >= s->begin + s->length ||
+                block->offset + block->length <= s->begin) {
+                /* This block is out of the range */
+                continue;
+            }
+            if (s->begin > block->offset) {
+                start = s->begin - block->offset;
+            }
+            size -= start;
+            if (s->begin + s->length < block->offset + block->length) {
+                size -= block->offset + block->length - (s->begin + s->length);
+            }
         }
 
-        s->block = block;
-        if (s->begin > block->offset) {
-            s->start = s->begin - block->offset;
-        } else {
-            s->start = 0;
-        }
-        return s->start;
+        s->ranges = g_renew(DumpRange, s->ranges, s->nb_ranges + 1);
+        s->ranges[s->nb_ranges].host = block->host + start;
+        s->ranges[s->nb_ranges].mr = block->mr;
+        s->ranges[s->nb_ranges].mr_offset = start;
+        s->ranges[s->nb_ranges].addr = block->offset + start;
+        s->ranges[s->nb_ranges].size = size;
+        s->ranges[s->nb_ranges].pos = pos;
+        s->nb_ranges++;
+        pos += size;
     }
-
-    return -1;
+    dump_total_size = pos;
 }
 
-static int dump_init(DumpState *s, int fd, bool paging, bool has_filter,
-                     int64_t begin, int64_t length, Error **errp)
+static int dump_init(DumpState *s, int fd, bool seekable, bool paging,
+                     bool has_filter, int64_t begin, int64_t length,
+                     Error **errp)
 {
     CPUArchState *env;
     int nr_cpus;
     int ret;
 
-    if (runstate_is_running()) {
+    if (runstate_is_running() && !s->live) {
         vm_stop(RUN_STATE_SAVE_VM);
         s->resume = true;
     } else {
@@ -709,14 +1588,17 @@ static int dump_init(DumpState *s, int fd, bool paging, bool has_filter,
 
     s->errp = errp;
     s->fd = fd;
+    s->seekable = seekable;
+    s->error = NULL;
     s->has_filter = has_filter;
     s->begin = begin;
     s->length = length;
-    s->start = get_start_block(s);
-    if (s->start == -1) {
+    get_ranges(s);
+    if (!s->nb_ranges) {
         error_set(errp, QERR_INVALID_PARAMETER, "begin");
         goto cleanup;
     }
+    dump_written_size = 0;
 
     /*
      * get dump info: endian, class and architecture.
@@ -747,7 +1629,10 @@ static int dump_init(DumpState *s, int fd, bool paging, bool has_filter,
 
     /* get memory mapping */
     memory_mapping_list_init(&s->list);
-    if (paging) {
+    if (s->kdump) {
+        /* no program headers: the kdump format maps pages by frame */
+        return 0;
+    } else if (paging) {
         qemu_get_guest_memory_mapping(&s->list);
     } else {
         qemu_get_guest_simple_memory_mapping(&s->list);
@@ -802,6 +1687,7 @@ static int dump_init(DumpState *s, int fd, bool paging, bool has_filter,
     return 0;
 
 cleanup:
+    g_free(s->ranges);
     if (s->resume) {
         vm_start();
     }
@@ -809,15 +1695,53 @@ cleanup:
     return -1;
 }
 
+static void dump_finish_bh(void *opaque)
+{
+    DumpState *s = opaque;
+
+    qemu_thread_join(&s->thread);
+    qemu_bh_delete(s->bh);
+    if (s->error) {
+        fprintf(stderr, "%s", s->error);
+    }
+    dump_status = s->error ? DUMP_STATUS_FAILED : DUMP_STATUS_COMPLETED;
+    dump_cleanup(s);
+    g_free(s);
+}
+
+static void *dump_thread(void *opaque)
+{
+    DumpState *s = opaque;
+
+    if (create_vmcore(s) < 0 && !s->error) {
+        s->error = "dump: failed to write vmcore.\n";
+    }
+    qemu_bh_schedule(s->bh);
+    return NULL;
+}
+
+bool dump_in_progress(void)
+{
+    return dump_status == DUMP_STATUS_ACTIVE;
+}
+
 void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
                            int64_t begin, bool has_length, int64_t length,
-                           Error **errp)
+                           bool has_detach, bool detach, bool has_format,
+                           DumpGuestMemoryFormat format, bool has_live,
+                           bool live, Error **errp)
 {
     const char *p;
     int fd = -1;
+    bool seekable = false;
     DumpState *s;
+    struct stat st;
     int ret;
 
+    if (dump_in_progress()) {
+        error_setg(errp, "a dump is already in progress");
+        return;
+    }
     if (has_begin && !has_length) {
         error_set(errp, QERR_MISSING_PARAMETER, "length");
         return;
@@ -826,6 +1750,46 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         error_set(errp, QERR_MISSING_PARAMETER, "begin");
         return;
     }
+    if (!has_format) {
+        format = DUMP_GUEST_MEMORY_FORMAT_ELF;
+    }
+    if (format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
+#ifdef _WIN32
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+#endif
+        if (paging) {
+            error_setg(errp, "paging cannot be used with the kdump format");
+            return;
+        }
+        if (has_begin && ((begin | length) & ~TARGET_PAGE_MASK)) {
+            error_setg(errp, "begin and length must be page aligned with "
+                       "the kdump format");
+            return;
+        }
+    }
+    if (has_live && live) {
+#ifdef _WIN32
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+#endif
+        if (paging || format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
+            error_setg(errp, "a live dump is only written in the elf format, "
+                       "without paging");
+            return;
+        }
+        if (has_begin && ((begin | length) & ~TARGET_PAGE_MASK)) {
+            error_setg(errp, "begin and length must be page aligned for a "
+                       "live dump");
+            return;
+        }
+        if (migration_is_active(migrate_get_current())) {
+            error_set(errp, QERR_MIGRATION_ACTIVE);
+            return;
+        }
+    } else {
+        live = false;
+    }
 
 #if !defined(WIN32)
     if (strstart(file, "fd:", &p)) {
@@ -849,17 +1813,72 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         return;
     }
 
-    s = g_malloc(sizeof(DumpState));
+    /*
+     * Only a truncated regular file reads back skipped pages as zeroes;
+     * pipes cannot seek and devices keep whatever was there before.
+     */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 0) {
+        seekable = true;
+    }
+
+    /* pages are rewritten in place */
+    if (live && !seekable) {
+        error_setg(errp, "a live dump needs an empty regular file");
+        close(fd);
+        return;
+    }
+
+    s = g_malloc0(sizeof(DumpState));
+    if (format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
+        s->kdump = true;
+        s->kdump_flat = fstat(fd, &st) < 0 || !S_ISREG(st.st_mode);
+    }
+    s->live = live;
 
-    ret = dump_init(s, fd, paging, has_begin, begin, length, errp);
+    ret = dump_init(s, fd, seekable, paging, has_begin, begin, length, errp);
     if (ret < 0) {
         g_free(s);
         return;
     }
 
-    if (create_vmcore(s) < 0 && !error_is_set(s->errp)) {
+#ifndef _WIN32
+    if (live) {
+        qemu_mutex_init(&s->main_lock);
+        qemu_cond_init(&s->main_cond);
+        s->main_bh = qemu_bh_new(dump_main_bh, s);
+        dump_live_start(s);
+        detach = has_detach = true;
+    }
+#endif
+
+    if (has_detach && detach) {
+        /* unless live, the guest stays stopped, but the monitor is free
+           meanwhile */
+        s->detach = true;
+        s->errp = NULL;
+        s->bh = qemu_bh_new(dump_finish_bh, s);
+        dump_status = DUMP_STATUS_ACTIVE;
+        qemu_thread_create(&s->thread, dump_thread, s, QEMU_THREAD_JOINABLE);
+        return;
+    }
+
+    s->detach = false;
+    ret = create_vmcore(s);
+    dump_status = ret < 0 ? DUMP_STATUS_FAILED : DUMP_STATUS_COMPLETED;
+    dump_cleanup(s);
+    if (ret < 0 && !error_is_set(errp)) {
         error_set(errp, QERR_IO_ERROR);
     }
 
     g_free(s);
 }
+
+DumpInfo *qmp_query_dump(Error **errp)
+{
+    DumpInfo *info = g_malloc0(sizeof(*info));
+
+    info->status = dump_status;
+    info->completed = dump_written_size;
+    info->total = dump_total_size;
+    return info;
+}
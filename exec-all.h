@@ -118,8 +118,9 @@ static inline void tlb_flush(CPUArchState *env, int flush_global)
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* The physical hash table starts with 2^CODE_GEN_PHYS_HASH_MIN_BITS
+   buckets and is doubled whenever there are more TBs than buckets.  */
+#define CODE_GEN_PHYS_HASH_MIN_BITS 12
 
 #define MIN_CODE_GEN_BUFFER_SIZE     (1024 * 1024)
 
@@ -146,7 +147,8 @@ struct TranslationBlock {
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
     uint16_t cflags;    /* compile flags */
-#define CF_COUNT_MASK  0x7fff
+#define CF_COUNT_MASK  0x3fff
+#define CF_TRACE       0x4000 /* Retranslated hot code, see tb_gen_trace.  */
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
 
     uint8_t *tc_ptr;    /* pointer to the translated code */
@@ -172,6 +174,11 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* number of executions, counted only with -tcg-profile or while
+       tcg_trace_threshold is non-zero and the target supports traces */
+    uint32_t exec_count;
+    /* number of returns to cpu_exec() from this TB, with -tcg-profile */
+    uint32_t exit_count;
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -189,9 +196,22 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+extern TranslationBlock **tb_phys_hash;
+extern unsigned int tb_phys_hash_mask;
+
+/* Hash the whole lookup key, so that TBs for the same physical address
+   but different CPU state land in different buckets.  */
+static inline unsigned int tb_phys_hash_func(tb_page_addr_t phys_pc,
+                                             target_ulong pc,
+                                             uint64_t flags,
+                                             target_ulong cs_base)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    uint64_t h;
+
+    h = (uint64_t)phys_pc ^ ((uint64_t)pc << 23) ^ ((uint64_t)cs_base << 7) ^
+        (flags * 0x9e3779b97f4a7c15ULL);
+    h *= 0xff51afd7ed558ccdULL;
+    return (h >> 32) & tb_phys_hash_mask;
 }
 
 void tb_free(TranslationBlock *tb);
@@ -199,8 +219,7 @@ void tb_flush(CPUArchState *env);
 void tb_link_page(TranslationBlock *tb,
                   tb_page_addr_t phys_pc, tb_page_addr_t phys_page2);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
-
-extern TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+void tb_gen_trace(CPUArchState *env, TranslationBlock *tb);
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -289,6 +308,26 @@ TranslationBlock *tb_find_pc(uintptr_t pc_ptr);
 
 extern spinlock_t tb_lock;
 
+#if defined(CONFIG_USER_ONLY)
+static inline void tb_lock_acquire(void)
+{
+}
+
+static inline void tb_lock_release(void)
+{
+}
+
+static inline void tb_lock_reset(void)
+{
+}
+#else
+/* spin_lock(&tb_lock) is only real for user mode emulation; these cover
+   system emulation with one thread per vCPU (-tcg-threads multi).  */
+void tb_lock_acquire(void);
+void tb_lock_release(void);
+void tb_lock_reset(void);
+#endif
+
 extern int tb_invalidated_flag;
 
 /* The return address may point to the start of the next instruction.
@@ -321,6 +360,18 @@ void io_mem_write(struct MemoryRegion *mr, target_phys_addr_t addr,
 
 void tlb_fill(CPUArchState *env1, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
+bool tlb_victim_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page);
+
+static inline unsigned int tlb_size(CPUArchState *env)
+{
+    return (env->tlb_mask >> CPU_TLB_ENTRY_BITS) + 1;
+}
+
+static inline unsigned int tlb_index(CPUArchState *env, target_ulong addr)
+{
+    return (addr >> TARGET_PAGE_BITS) & (env->tlb_mask >> CPU_TLB_ENTRY_BITS);
+}
 
 #include "softmmu_defs.h"
 
@@ -45,6 +45,7 @@ int cpu_physical_memory_set_dirty_tracking(int enable);
 #define VGA_DIRTY_FLAG       0x01
 #define CODE_DIRTY_FLAG      0x02
 #define MIGRATION_DIRTY_FLAG 0x08
+#define DUMP_DIRTY_FLAG      0x10
 
 static inline int cpu_physical_memory_get_dirty_flags(ram_addr_t addr)
 {
@@ -35,6 +35,8 @@
 #include "qemu-timer.h"
 #include "memory.h"
 #include "exec-memory.h"
+#include "bitmap.h"
+#include "disas.h"
 #if defined(CONFIG_USER_ONLY)
 #include <qemu.h>
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -55,9 +57,13 @@
 #else /* !CONFIG_USER_ONLY */
 #include "xen-mapcache.h"
 #include "trace.h"
+#include "sysemu.h"
+#include "qemu-thread.h"
+#include "main-loop.h"
 #endif
 
 #include "cputlb.h"
+#include "qemu-barrier.h"
 
 #define WANT_EXEC_OBSOLETE
 #include "exec-obsolete.h"
@@ -81,11 +87,78 @@
 
 static TranslationBlock *tbs;
 static int code_gen_max_blocks;
-TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+TranslationBlock **tb_phys_hash;
+unsigned int tb_phys_hash_mask;
 static int nb_tbs;
+
+/* The code buffer and tbs[] are split into code_gen_regions regions that
+   are filled in turn.  When the last one is full the oldest region is
+   evicted, instead of flushing the whole buffer.  */
+#define CODE_GEN_MAX_REGIONS 8
+static int code_gen_regions;
+static int code_gen_region;             /* region being filled */
+static unsigned long code_gen_region_size;
+static unsigned long code_gen_region_max_size;
+static int code_gen_region_blocks;
+static int region_nb_tbs[CODE_GEN_MAX_REGIONS];
+static uint8_t *region_code_end[CODE_GEN_MAX_REGIONS];
+
+/* Approximate set of guest PCs whose TB was thrown away, used to count
+   retranslations.  */
+#define TB_EVICTED_BITS 16
+static DECLARE_BITMAP(tb_evicted_map, 1 << TB_EVICTED_BITS);
+
 /* any access to the tbs or the page table must use this lock */
 spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
 
+/* Set by "-tcg-threads multi": every vCPU runs cpu_exec() on its own host
+   thread.  Never set for user mode emulation.  */
+bool mttcg_enabled;
+
+/* Set by "-tcg-traces": TBs executed this many times are retranslated
+   as traces that run through forward branches.  0 disables counting.  */
+unsigned int tcg_trace_threshold;
+
+/* Set by "-tcg-profile": every TB counts its executions and its returns
+   to cpu_exec(), for "info tbs".  */
+bool tcg_tb_profile;
+
+/* /tmp/perf-<pid>.map, written by "-tcg-perfmap" so that perf can name
+   samples in the code buffer after the guest code they came from.  */
+static FILE *tb_perfmap;
+
+#if !defined(CONFIG_USER_ONLY)
+/* With multi-threaded TCG, vCPU threads translate and invalidate code
+   concurrently and tb_lock_acquire() serializes them.  The lock nests
+   within a thread, because invalidation may retranslate the current TB,
+   and tb_lock_reset() drops it when a vCPU longjmps out of cpu_exec().
+   Without mttcg_enabled these are no-ops.  */
+static QemuMutex tb_mutex;
+static DEFINE_TLS(int, tb_lock_depth);
+
+void tb_lock_acquire(void)
+{
+    if (mttcg_enabled && tls_var(tb_lock_depth)++ == 0) {
+        qemu_mutex_lock(&tb_mutex);
+    }
+}
+
+void tb_lock_release(void)
+{
+    if (mttcg_enabled && --tls_var(tb_lock_depth) == 0) {
+        qemu_mutex_unlock(&tb_mutex);
+    }
+}
+
+void tb_lock_reset(void)
+{
+    if (mttcg_enabled && tls_var(tb_lock_depth)) {
+        tls_var(tb_lock_depth) = 0;
+        qemu_mutex_unlock(&tb_mutex);
+    }
+}
+#endif
+
 #if defined(__arm__) || defined(__sparc__)
 /* The prologue must be reachable with a direct jump. ARM and Sparc64
  have limited branch ranges (possibly also PPC) so place it in a
@@ -210,6 +283,21 @@ static unsigned phys_map_nodes_nb, phys_map_nodes_nb_alloc;
    The bottom level has pointers to MemoryRegionSections.  */
 static PhysPageEntry phys_map = { .ptr = PHYS_MAP_NODE_NIL, .is_leaf = 0 };
 
+/* Bumped whenever the map is rebuilt, to invalidate the lookup caches.  */
+static unsigned phys_map_generation = 1;
+
+/* Last bottom-level node that phys_page_find went through.  Accesses
+   tend to hit the same L2_SIZE pages over and over (a DMA buffer, a
+   device's registers), so this saves walking the upper levels.  It is
+   per thread because several vCPU threads may look up concurrently.  */
+typedef struct PhysPageCache {
+    unsigned generation;
+    target_phys_addr_t index;
+    uint16_t node;
+} PhysPageCache;
+
+static DEFINE_TLS(PhysPageCache, phys_page_cache);
+
 static void io_mem_init(void);
 static void memory_map_init(void);
 
@@ -219,6 +307,10 @@ static MemoryRegion io_mem_watch;
 /* statistics */
 static int tb_flush_count;
 static int tb_phys_invalidate_count;
+static int tb_region_evict_count;
+static int tb_evicted_count;
+static int tb_retranslate_count;
+static int tb_trace_count;
 
 #ifdef _WIN32
 static void map_exec(void *addr, long size)
@@ -468,15 +560,27 @@ static void phys_page_set(target_phys_addr_t index, target_phys_addr_t nb,
 
 MemoryRegionSection *phys_page_find(target_phys_addr_t index)
 {
+    PhysPageCache *cache = &tls_var(phys_page_cache);
     PhysPageEntry lp = phys_map;
     PhysPageEntry *p;
     int i;
     uint16_t s_index = phys_section_unassigned;
 
+    if (cache->generation == phys_map_generation
+        && cache->index == (index >> L2_BITS)) {
+        p = phys_map_nodes[cache->node];
+        return &phys_sections[p[index & (L2_SIZE - 1)].ptr];
+    }
+
     for (i = P_L2_LEVELS - 1; i >= 0 && !lp.is_leaf; i--) {
         if (lp.ptr == PHYS_MAP_NODE_NIL) {
             goto not_found;
         }
+        if (i == 0) {
+            cache->generation = phys_map_generation;
+            cache->index = index >> L2_BITS;
+            cache->node = lp.ptr;
+        }
         p = phys_map_nodes[lp.ptr];
         lp = p[(index >> (i * L2_BITS)) & (L2_SIZE - 1)];
     }
@@ -512,6 +616,8 @@ static uint8_t static_code_gen_buffer[DEFAULT_CODE_GEN_BUFFER_SIZE]
 
 static void code_gen_alloc(unsigned long tb_size)
 {
+    int i;
+
 #ifdef USE_STATIC_CODE_GEN_BUFFER
     code_gen_buffer = static_code_gen_buffer;
     code_gen_buffer_size = DEFAULT_CODE_GEN_BUFFER_SIZE;
@@ -602,10 +708,22 @@ static void code_gen_alloc(unsigned long tb_size)
 #endif
 #endif /* !USE_STATIC_CODE_GEN_BUFFER */
     map_exec(code_gen_prologue, sizeof(code_gen_prologue));
-    code_gen_buffer_max_size = code_gen_buffer_size -
+    /* each region must leave room for the largest possible TB */
+    code_gen_regions = code_gen_buffer_size /
+        (8 * TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
+    code_gen_regions = MAX(1, MIN(code_gen_regions, CODE_GEN_MAX_REGIONS));
+    code_gen_region_size = code_gen_buffer_size / code_gen_regions;
+    code_gen_region_max_size = code_gen_region_size -
         (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
-    code_gen_max_blocks = code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
+    code_gen_buffer_max_size = code_gen_region_max_size * code_gen_regions;
+    code_gen_region_blocks = code_gen_region_size / CODE_GEN_AVG_BLOCK_SIZE;
+    code_gen_max_blocks = code_gen_region_blocks * code_gen_regions;
     tbs = g_malloc(code_gen_max_blocks * sizeof(TranslationBlock));
+    for (i = 0; i < code_gen_regions; i++) {
+        region_code_end[i] = code_gen_buffer + i * code_gen_region_size;
+    }
+    tb_phys_hash_mask = (1 << CODE_GEN_PHYS_HASH_MIN_BITS) - 1;
+    tb_phys_hash = g_malloc0((tb_phys_hash_mask + 1) * sizeof(void *));
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -618,6 +736,9 @@ void tcg_exec_init(unsigned long tb_size)
     code_gen_ptr = code_gen_buffer;
     tcg_register_jit(code_gen_buffer, code_gen_buffer_size);
     page_init();
+#if !defined(CONFIG_USER_ONLY)
+    qemu_mutex_init(&tb_mutex);
+#endif
 #if !defined(CONFIG_USER_ONLY) || !defined(CONFIG_USE_GUEST_BASE)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
@@ -700,6 +821,7 @@ void cpu_exec_init(CPUArchState *env)
     QTAILQ_INIT(&env->watchpoints);
 #ifndef CONFIG_USER_ONLY
     env->thread_id = qemu_get_thread_id();
+    tlb_init(env);
 #endif
     *penv = env;
 #if defined(CONFIG_USER_ONLY)
@@ -712,28 +834,55 @@ void cpu_exec_init(CPUArchState *env)
 #endif
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+static inline uint8_t *region_code_start(int r)
+{
+    return code_gen_buffer + r * code_gen_region_size;
+}
+
+static inline uint8_t *region_code_ptr(int r)
+{
+    return r == code_gen_region ? code_gen_ptr : region_code_end[r];
+}
+
+static inline TranslationBlock *region_tbs(int r)
+{
+    return tbs + r * code_gen_region_blocks;
+}
+
+static inline unsigned int tb_evicted_hash(target_ulong pc)
+{
+    return ((uint64_t)pc * 0x9e3779b97f4a7c15ULL) >> (64 - TB_EVICTED_BITS);
+}
+
+/* Allocate a new translation block. Return NULL if the current region
+   has too many translation blocks or too much generated code. */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
     TranslationBlock *tb;
+    int r = code_gen_region;
 
-    if (nb_tbs >= code_gen_max_blocks ||
-        (code_gen_ptr - code_gen_buffer) >= code_gen_buffer_max_size)
+    if (region_nb_tbs[r] >= code_gen_region_blocks ||
+        (code_gen_ptr - region_code_start(r)) >= code_gen_region_max_size)
         return NULL;
-    tb = &tbs[nb_tbs++];
+    tb = &region_tbs(r)[region_nb_tbs[r]++];
+    nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->exit_count = 0;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    int r = code_gen_region;
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (nb_tbs > 0 && tb == &tbs[nb_tbs - 1]) {
+    if (region_nb_tbs[r] > 0 && tb == &region_tbs(r)[region_nb_tbs[r] - 1]) {
         code_gen_ptr = tb->tc_ptr;
+        region_nb_tbs[r]--;
         nb_tbs--;
     }
 }
@@ -783,6 +932,17 @@ static void page_flush_tb(void)
 void tb_flush(CPUArchState *env1)
 {
     CPUArchState *env;
+    int i, j;
+
+#if !defined(CONFIG_USER_ONLY)
+    /* other vCPUs may be executing translated code: let the vCPU threads
+       flush once they have all left cpu_exec() */
+    if (mttcg_enabled && !tcg_exclusive_held()) {
+        tcg_request_tb_flush();
+        return;
+    }
+#endif
+    tb_lock_acquire();
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
            (unsigned long)(code_gen_ptr - code_gen_buffer),
@@ -792,19 +952,28 @@ void tb_flush(CPUArchState *env1)
     if ((unsigned long)(code_gen_ptr - code_gen_buffer) > code_gen_buffer_size)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
 
+    for (i = 0; i < code_gen_regions; i++) {
+        for (j = 0; j < region_nb_tbs[i]; j++) {
+            set_bit(tb_evicted_hash(region_tbs(i)[j].pc), tb_evicted_map);
+        }
+        region_nb_tbs[i] = 0;
+        region_code_end[i] = region_code_start(i);
+    }
     nb_tbs = 0;
+    code_gen_region = 0;
 
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
         memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
     }
 
-    memset (tb_phys_hash, 0, CODE_GEN_PHYS_HASH_SIZE * sizeof (void *));
+    memset(tb_phys_hash, 0, (tb_phys_hash_mask + 1) * sizeof(void *));
     page_flush_tb();
 
     code_gen_ptr = code_gen_buffer;
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tb_flush_count++;
+    tb_lock_release();
 }
 
 #ifdef DEBUG_TB_CHECK
@@ -814,7 +983,7 @@ static void tb_invalidate_check(target_ulong address)
     TranslationBlock *tb;
     int i;
     address &= TARGET_PAGE_MASK;
-    for(i = 0;i < CODE_GEN_PHYS_HASH_SIZE; i++) {
+    for(i = 0;i <= tb_phys_hash_mask; i++) {
         for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
             if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
                   address >= tb->pc + tb->size)) {
@@ -832,7 +1001,7 @@ static void tb_page_check(void)
     TranslationBlock *tb;
     int i, flags1, flags2;
 
-    for(i = 0;i < CODE_GEN_PHYS_HASH_SIZE; i++) {
+    for(i = 0;i <= tb_phys_hash_mask; i++) {
         for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
             flags1 = page_get_flags(tb->pc);
             flags2 = page_get_flags(tb->pc + tb->size - 1);
@@ -923,7 +1092,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
+    h = tb_phys_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
     tb_remove(&tb_phys_hash[h], tb,
               offsetof(TranslationBlock, phys_hash_next));
 
@@ -1024,6 +1193,76 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+/* TBs already invalidated because their code was modified have been
+   removed from the physical hash table.  */
+static bool tb_is_hashed(TranslationBlock *tb)
+{
+    TranslationBlock *tb1;
+    tb_page_addr_t phys_pc;
+    unsigned int h;
+
+    phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    h = tb_phys_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    for (tb1 = tb_phys_hash[h]; tb1 != NULL; tb1 = tb1->phys_hash_next) {
+        if (tb1 == tb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Start filling the next region after throwing away the TBs it holds,
+   which are the oldest ones.  Jumps into them from other regions are
+   reset by tb_phys_invalidate.  */
+static void tb_evict_next_region(void)
+{
+    TranslationBlock *tb;
+    int r, i;
+
+    region_code_end[code_gen_region] = code_gen_ptr;
+    r = (code_gen_region + 1) % code_gen_regions;
+    for (i = 0; i < region_nb_tbs[r]; i++) {
+        tb = &region_tbs(r)[i];
+        if (tb_is_hashed(tb)) {
+            tb_phys_invalidate(tb, -1);
+            set_bit(tb_evicted_hash(tb->pc), tb_evicted_map);
+            tb_evicted_count++;
+        }
+    }
+    nb_tbs -= region_nb_tbs[r];
+    region_nb_tbs[r] = 0;
+    code_gen_region = r;
+    code_gen_ptr = region_code_start(r);
+    region_code_end[r] = code_gen_ptr;
+    tb_region_evict_count++;
+}
+
+void tcg_perfmap_open(void)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "/tmp/perf-%d.map", getpid());
+    tb_perfmap = fopen(name, "w");
+    if (!tb_perfmap) {
+        fprintf(stderr, "Could not open %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    /* perf may read the map while QEMU is still running */
+    setvbuf(tb_perfmap, NULL, _IOLBF, 0);
+}
+
+/* One line per TB: host start and size in hex, then the symbol name.
+   Later lines for the same host range override earlier ones, so code
+   buffer reuse after an eviction or flush is handled by perf itself. */
+static void tb_perfmap_write(TranslationBlock *tb, int code_gen_size)
+{
+    const char *symbol = lookup_symbol(tb->pc);
+
+    fprintf(tb_perfmap, "%" PRIxPTR " %x guest:" TARGET_FMT_lx "%s%s%s\n",
+            (uintptr_t)tb->tc_ptr, code_gen_size, tb->pc,
+            symbol[0] ? " (" : "", symbol, symbol[0] ? ")" : "");
+}
+
 TranslationBlock *tb_gen_code(CPUArchState *env,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -1037,13 +1276,28 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        if (mttcg_enabled) {
+            /* the flush is deferred until all vCPUs have stopped; leave
+               cpu_exec() so that this one gets there too */
+            tb_flush(env);
+            tb_lock_reset();
+            env->exception_index = EXCP_INTERRUPT;
+            cpu_loop_exit(env);
+        }
+        if (code_gen_regions > 1) {
+            tb_evict_next_region();
+        } else {
+            /* flush must be done */
+            tb_flush(env);
+        }
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
         tb_invalidated_flag = 1;
     }
+    if (test_and_clear_bit(tb_evicted_hash(pc), tb_evicted_map)) {
+        tb_retranslate_count++;
+    }
     tc_ptr = code_gen_ptr;
     tb->tc_ptr = tc_ptr;
     tb->cs_base = cs_base;
@@ -1060,9 +1314,35 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
     tb_link_page(tb, phys_pc, phys_page2);
+    if (tb_perfmap) {
+        tb_perfmap_write(tb, code_gen_size);
+    }
     return tb;
 }
 
+/* Retranslate a TB whose execution counter reached tcg_trace_threshold.
+   The new TB is translated with CF_TRACE and replaces the old one in the
+   hash table.  Called from cpu_exec() while the TB is not executing.  */
+void tb_gen_trace(CPUArchState *env, TranslationBlock *tb)
+{
+    target_ulong pc, cs_base;
+    uint64_t flags;
+
+    spin_lock(&tb_lock);
+    tb_lock_acquire();
+    /* another vCPU may have got here first */
+    if (!(tb->cflags & CF_TRACE) && tb_is_hashed(tb)) {
+        pc = tb->pc;
+        cs_base = tb->cs_base;
+        flags = tb->flags;
+        tb_phys_invalidate(tb, -1);
+        tb_gen_code(env, pc, cs_base, flags, CF_TRACE);
+        tb_trace_count++;
+    }
+    tb_lock_release();
+    spin_unlock(&tb_lock);
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1104,9 +1384,12 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
     int current_flags = 0;
 #endif /* TARGET_HAS_PRECISE_SMC */
 
+    tb_lock_acquire();
     p = page_find(start >> TARGET_PAGE_BITS);
-    if (!p)
+    if (!p) {
+        tb_lock_release();
         return;
+    }
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD &&
         is_cpu_write_access) {
@@ -1187,9 +1470,11 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
            itself */
         env->current_tb = NULL;
         tb_gen_code(env, current_pc, current_cs_base, current_flags, 1);
+        tb_lock_reset();
         cpu_resume_from_signal(env, NULL);
     }
 #endif
+    tb_lock_release();
 }
 
 /* len must be <= 8 and start must be a multiple of len */
@@ -1206,9 +1491,12 @@ static inline void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
                   (intptr_t)cpu_single_env->segs[R_CS].base);
     }
 #endif
+    tb_lock_acquire();
     p = page_find(start >> TARGET_PAGE_BITS);
-    if (!p)
+    if (!p) {
+        tb_lock_release();
         return;
+    }
     if (p->code_bitmap) {
         offset = start & ~TARGET_PAGE_MASK;
         b = p->code_bitmap[offset >> 3] >> (offset & 7);
@@ -1218,6 +1506,7 @@ static inline void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     do_invalidate:
         tb_invalidate_phys_page_range(start, start + len, 1);
     }
+    tb_lock_release();
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1339,6 +1628,30 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 #endif /* TARGET_HAS_SMC */
 }
 
+/* Double the number of buckets of the physical hash table and rehash
+   all chains.  Called with the tb lock held.  */
+static void tb_phys_hash_grow(void)
+{
+    TranslationBlock **old_hash = tb_phys_hash;
+    unsigned int old_mask = tb_phys_hash_mask;
+    TranslationBlock *tb, *next;
+    tb_page_addr_t phys_pc;
+    unsigned int i, h;
+
+    tb_phys_hash_mask = old_mask * 2 + 1;
+    tb_phys_hash = g_malloc0((tb_phys_hash_mask + 1) * sizeof(void *));
+    for (i = 0; i <= old_mask; i++) {
+        for (tb = old_hash[i]; tb != NULL; tb = next) {
+            next = tb->phys_hash_next;
+            phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+            h = tb_phys_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+            tb->phys_hash_next = tb_phys_hash[h];
+            tb_phys_hash[h] = tb;
+        }
+    }
+    g_free(old_hash);
+}
+
 /* add a new TB and link it to the physical page tables. phys_page2 is
    (-1) to indicate that only one page contains the TB. */
 void tb_link_page(TranslationBlock *tb,
@@ -1351,7 +1664,10 @@ void tb_link_page(TranslationBlock *tb,
        before we are done.  */
     mmap_lock();
     /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
+    if (nb_tbs > tb_phys_hash_mask + 1) {
+        tb_phys_hash_grow();
+    }
+    h = tb_phys_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
     ptb = &tb_phys_hash[h];
     tb->phys_hash_next = *ptb;
     *ptb = tb;
@@ -1381,24 +1697,27 @@ void tb_link_page(TranslationBlock *tb,
 
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
    tb[1].tc_ptr. Return NULL if not found */
-TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
+static TranslationBlock *tb_find_pc_locked(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    int m_min, m_max, m, r;
     uintptr_t v;
-    TranslationBlock *tb;
+    TranslationBlock *tb, *rtbs;
 
-    if (nb_tbs <= 0)
+    if (tc_ptr < (uintptr_t)code_gen_buffer) {
         return NULL;
-    if (tc_ptr < (uintptr_t)code_gen_buffer ||
-        tc_ptr >= (uintptr_t)code_gen_ptr) {
+    }
+    r = (tc_ptr - (uintptr_t)code_gen_buffer) / code_gen_region_size;
+    if (r >= code_gen_regions || region_nb_tbs[r] <= 0 ||
+        tc_ptr >= (uintptr_t)region_code_ptr(r)) {
         return NULL;
     }
     /* binary search (cf Knuth) */
+    rtbs = region_tbs(r);
     m_min = 0;
-    m_max = nb_tbs - 1;
+    m_max = region_nb_tbs[r] - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tbs[m];
+        tb = &rtbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr)
             return tb;
@@ -1408,7 +1727,17 @@ TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tbs[m_max];
+    return &rtbs[m_max];
+}
+
+TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
+{
+    TranslationBlock *tb;
+
+    tb_lock_acquire();
+    tb = tb_find_pc_locked(tc_ptr);
+    tb_lock_release();
+    return tb;
 }
 
 static void tb_reset_jump_recursive(TranslationBlock *tb);
@@ -1705,6 +2034,8 @@ static void tcg_handle_interrupt(CPUArchState *env, int mask)
             && (mask & ~old_mask) != 0) {
             cpu_abort(env, "Raised interrupt while not in I/O function");
         }
+    } else if (mttcg_enabled) {
+        env->exit_request = 1;
     } else {
         cpu_unlink_tb(env);
     }
@@ -1729,7 +2060,11 @@ void cpu_reset_interrupt(CPUArchState *env, int mask)
 void cpu_exit(CPUArchState *env)
 {
     env->exit_request = 1;
-    cpu_unlink_tb(env);
+    /* with multi-threaded TCG, TBs test exit_request on entry instead of
+       being unchained under the feet of the thread executing them */
+    if (!mttcg_enabled) {
+        cpu_unlink_tb(env);
+    }
 }
 
 void cpu_abort(CPUArchState *env, const char *fmt, ...)
@@ -2212,6 +2547,7 @@ static void destroy_all_mappings(void)
 {
     destroy_l2_mapping(&phys_map, P_L2_LEVELS - 1);
     phys_map_nodes_reset();
+    phys_map_generation++;
 }
 
 static uint16_t phys_section_add(MemoryRegionSection *section)
@@ -2358,9 +2694,6 @@ static void *file_ram_alloc(RAMBlock *block,
     char *filename;
     void *area;
     int fd;
-#ifdef MAP_POPULATE
-    int flags;
-#endif
     unsigned long hpagesize;
 
     hpagesize = gethugepagesize(path);
@@ -2401,16 +2734,12 @@ static void *file_ram_alloc(RAMBlock *block,
     if (ftruncate(fd, memory))
         perror("ftruncate");
 
-#ifdef MAP_POPULATE
-    /* NB: MAP_POPULATE won't exhaustively alloc all phys pages in the case
-     * MAP_PRIVATE is requested.  For mem_prealloc we mmap as MAP_SHARED
-     * to sidestep this quirk.
+    /* With mem_prealloc, the pages are faulted in by ram_block_setup_host
+     * once the block is bound to its host NUMA nodes.  vhost-user backends
+     * map the same file, so they must see our stores.
      */
-    flags = mem_prealloc ? MAP_POPULATE | MAP_SHARED : MAP_PRIVATE;
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, flags, fd, 0);
-#else
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-#endif
+    area = mmap(0, memory, PROT_READ | PROT_WRITE,
+                mem_share ? MAP_SHARED : MAP_PRIVATE, fd, 0);
     if (area == MAP_FAILED) {
         perror("file_ram_alloc: can't mmap RAM pages");
         close(fd);
@@ -2528,6 +2857,343 @@ static int memory_try_enable_merging(void *addr, size_t len)
     return qemu_madvise(addr, len, QEMU_MADV_MERGEABLE);
 }
 
+/*
+ * Read-mostly index of ram_list.blocks, sorted by offset, used to
+ * translate ram addresses without walking or reordering the list.  A new
+ * index is published whenever a block is added or removed; lookups never
+ * write shared state, and each thread remembers the last block it hit.
+ *
+ * Updates hold the iothread lock and, with MTTCG, run in an exclusive
+ * section, so threads holding the iothread lock and vCPU threads inside
+ * cpu_exec() look blocks up directly.  Any other thread, e.g. one running
+ * an AioContext, enters a read section: it counts itself in one of
+ * ram_block_readers[], picked by the parity of ram_block_epoch.  After
+ * publishing a new index, an update flips the epoch and waits for the
+ * readers of the old parity to leave before the old index and a removed
+ * block are freed.  The host pointer of a block stays valid after the
+ * read section for as long as the caller keeps the block from being
+ * unplugged.
+ */
+typedef struct RAMBlockIndex {
+    unsigned version;
+    int nb;
+    RAMBlock *blocks[];
+} RAMBlockIndex;
+
+static RAMBlockIndex *ram_block_index;
+static unsigned ram_block_epoch;
+static int ram_block_readers[2];
+static DEFINE_TLS(RAMBlock *, ram_block_mru);
+static DEFINE_TLS(unsigned, ram_block_mru_version);
+
+static int ram_block_compare(const void *a, const void *b)
+{
+    const RAMBlock *ba = *(RAMBlock * const *)a;
+    const RAMBlock *bb = *(RAMBlock * const *)b;
+
+    return ba->offset < bb->offset ? -1 : ba->offset > bb->offset;
+}
+
+/* Can the current thread run concurrently with an index update? */
+static bool ram_block_lookup_unlocked(void)
+{
+    return !qemu_mutex_iothread_locked() &&
+           !(mttcg_enabled && cpu_single_env && cpu_single_env->running);
+}
+
+/* Returns the reader count to drop in ram_block_read_unlock(), or -1 */
+static int ram_block_read_lock(void)
+{
+    unsigned epoch;
+
+    if (!ram_block_lookup_unlocked()) {
+        return -1;
+    }
+    for (;;) {
+        epoch = ram_block_epoch;
+        __sync_fetch_and_add(&ram_block_readers[epoch & 1], 1);
+        /* if the epoch moved, the update may not have seen us */
+        if (epoch == *(volatile unsigned *)&ram_block_epoch) {
+            return epoch & 1;
+        }
+        __sync_fetch_and_sub(&ram_block_readers[epoch & 1], 1);
+    }
+}
+
+static void ram_block_read_unlock(int readers)
+{
+    if (readers >= 0) {
+        __sync_fetch_and_sub(&ram_block_readers[readers], 1);
+    }
+}
+
+/* Wait until no read section can still see the previous index */
+static void ram_block_synchronize(void)
+{
+    unsigned epoch = ram_block_epoch;
+
+    smp_mb();
+    ram_block_epoch = epoch + 1;
+    smp_mb();
+    while (*(volatile int *)&ram_block_readers[epoch & 1]) {
+        g_usleep(10);
+    }
+}
+
+static void ram_block_index_update(void)
+{
+    RAMBlockIndex *old = ram_block_index, *index;
+    RAMBlock *block;
+    int nb = 0;
+
+    assert(qemu_mutex_iothread_locked());
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        nb++;
+    }
+    index = g_malloc(sizeof(*index) + nb * sizeof(index->blocks[0]));
+    index->version = old ? old->version + 1 : 1;
+    index->nb = 0;
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        index->blocks[index->nb++] = block;
+    }
+    qsort(index->blocks, nb, sizeof(index->blocks[0]), ram_block_compare);
+
+    /* vCPU threads look blocks up without the iothread lock */
+    if (mttcg_enabled) {
+        tcg_exclusive_start();
+    }
+    smp_wmb();
+    ram_block_index = index;
+    if (mttcg_enabled) {
+        tcg_exclusive_end();
+    }
+    ram_block_synchronize();
+    g_free(old);
+}
+
+/* Outside of the iothread lock and of cpu_exec(), call this and use the
+ * block within ram_block_read_lock()/ram_block_read_unlock().
+ */
+static RAMBlock *ram_block_find(ram_addr_t addr)
+{
+    RAMBlockIndex *index = ram_block_index;
+    RAMBlock *block = tls_var(ram_block_mru);
+    int lo, hi;
+
+    smp_rmb();
+    if (!index) {
+        return NULL;
+    }
+    /* the version check comes first: a stale block may have been freed */
+    if (block && tls_var(ram_block_mru_version) == index->version
+        && addr - block->offset < block->length) {
+        return block;
+    }
+
+    lo = 0;
+    hi = index->nb - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        block = index->blocks[mid];
+        if (addr < block->offset) {
+            hi = mid - 1;
+        } else if (addr - block->offset >= block->length) {
+            lo = mid + 1;
+        } else {
+            tls_var(ram_block_mru) = block;
+            tls_var(ram_block_mru_version) = index->version;
+            return block;
+        }
+    }
+    return NULL;
+}
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#define MPOL_BIND       2
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE    (1 << 1)
+#endif
+#endif
+
+/* Size of the host pages backing BLOCK */
+static size_t ram_block_page_size(RAMBlock *block)
+{
+#if defined(__linux__) && !defined(TARGET_S390X)
+    if (block->fd) {
+        return gethugepagesize(mem_path);
+    }
+#endif
+    return getpagesize();
+}
+
+/* Place each guest NUMA node's share of the main RAM block on the host
+   nodes given with -numa hostnodes=.  Like the ACPI tables, this assumes
+   that the nodes take consecutive parts of the block in node order. */
+static void ram_block_bind_numa(RAMBlock *block)
+{
+#if defined(__linux__) && defined(__NR_mbind)
+    static const int modes[] = {
+        [NUMA_POLICY_PREFERRED] = MPOL_PREFERRED,
+        [NUMA_POLICY_BIND] = MPOL_BIND,
+        [NUMA_POLICY_INTERLEAVE] = MPOL_INTERLEAVE,
+    };
+    size_t pagesize = ram_block_page_size(block);
+    ram_addr_t start = 0, end = 0;
+    int i;
+
+    if (block->length != TARGET_PAGE_ALIGN(ram_size)) {
+        return;
+    }
+    for (i = 0; i < nb_numa_nodes && start < block->length; i++, start = end) {
+        unsigned long mask = node_host_nodes[i];
+
+        end = start + node_mem[i];
+        end = i == nb_numa_nodes - 1 || end >= block->length
+            ? QEMU_ALIGN_UP(block->length, pagesize)
+            : QEMU_ALIGN_DOWN(end, pagesize);
+        if (!mask || end <= start) {
+            continue;
+        }
+        if (syscall(__NR_mbind, block->host + start, end - start,
+                    modes[node_host_policy[i]], &mask, sizeof(mask) * 8 + 1,
+                    MPOL_MF_MOVE) < 0) {
+            fprintf(stderr, "qemu: cannot bind memory of NUMA node %d: %s\n",
+                    i, strerror(errno));
+        }
+    }
+#endif
+}
+
+#define RAM_PREALLOC_THREADS_MAX 16
+
+typedef struct RAMPreallocJob {
+    QemuThread thread;
+    uint8_t *start;
+    size_t len;
+    size_t pagesize;
+} RAMPreallocJob;
+
+static void *ram_prealloc_thread(void *opaque)
+{
+    RAMPreallocJob *job = opaque;
+    size_t i;
+
+    for (i = 0; i < job->len; i += job->pagesize) {
+        volatile uint8_t *p = job->start + i;
+        *p = *p;
+    }
+    return NULL;
+}
+
+/* Fault in the whole block with one thread per host CPU */
+static void ram_block_prealloc(RAMBlock *block)
+{
+    size_t pagesize = ram_block_page_size(block);
+    size_t pages = DIV_ROUND_UP(block->length, pagesize);
+    size_t per_thread;
+    RAMPreallocJob *jobs;
+    int i, nb_threads = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    nb_threads = MAX(1, MIN(sysconf(_SC_NPROCESSORS_ONLN),
+                            RAM_PREALLOC_THREADS_MAX));
+#endif
+    nb_threads = MIN(nb_threads, pages);
+    per_thread = DIV_ROUND_UP(pages, nb_threads) * pagesize;
+
+    jobs = g_new0(RAMPreallocJob, nb_threads);
+    for (i = 0; i < nb_threads; i++) {
+        jobs[i].start = block->host + i * per_thread;
+        jobs[i].len = MIN(per_thread, block->length - MIN(block->length,
+                                                          i * per_thread));
+        jobs[i].pagesize = pagesize;
+        qemu_thread_create(&jobs[i].thread, ram_prealloc_thread, &jobs[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_join(&jobs[i].thread);
+    }
+    g_free(jobs);
+}
+
+/* Host side setup of guest RAM that QEMU allocated itself */
+static void ram_block_setup_host(RAMBlock *block)
+{
+#if defined(__linux__) && !defined(TARGET_S390X)
+    if (!block->fd) {
+        qemu_madvise(block->host, block->length, QEMU_MADV_HUGEPAGE);
+    }
+#else
+    qemu_madvise(block->host, block->length, QEMU_MADV_HUGEPAGE);
+#endif
+    if (nb_numa_nodes) {
+        ram_block_bind_numa(block);
+    }
+    /* after binding, so that the pages are allocated on the right nodes */
+    if (mem_prealloc) {
+        ram_block_prealloc(block);
+    }
+}
+
+#define RAM_INFO_SAMPLES 1024
+
+/* Print the host nodes holding a sample of BLOCK's pages */
+static void ram_block_print_nodes(FILE *f, fprintf_function cpu_fprintf,
+                                  RAMBlock *block)
+{
+#if defined(__linux__) && defined(__NR_move_pages)
+    void *pages[RAM_INFO_SAMPLES];
+    int status[RAM_INFO_SAMPLES];
+    unsigned count[MAX_NODES + 1] = { 0 };
+    size_t pagesize = ram_block_page_size(block);
+    size_t nb_pages = DIV_ROUND_UP(block->length, pagesize);
+    size_t step;
+    int i, n = MIN(nb_pages, RAM_INFO_SAMPLES);
+
+    step = nb_pages / n;
+    for (i = 0; i < n; i++) {
+        pages[i] = block->host + i * step * pagesize;
+    }
+    /* with no target nodes, move_pages only reports where pages are */
+    if (syscall(__NR_move_pages, 0, n, pages, NULL, status, 0) < 0) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        count[status[i] >= 0 && status[i] < MAX_NODES
+              ? status[i] : MAX_NODES]++;
+    }
+    for (i = 0; i < MAX_NODES; i++) {
+        if (count[i]) {
+            cpu_fprintf(f, " node%d %u%%", i, count[i] * 100 / n);
+        }
+    }
+    if (count[MAX_NODES]) {
+        cpu_fprintf(f, " not present %u%%", count[MAX_NODES] * 100 / n);
+    }
+#endif
+}
+
+void ram_block_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    RAMBlock *block;
+
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        cpu_fprintf(f, "%s: offset " RAM_ADDR_FMT " size " RAM_ADDR_FMT
+                    " host %p", block->idstr, block->offset, block->length,
+                    block->host);
+        if (block->host) {
+            ram_block_print_nodes(f, cpu_fprintf, block);
+        }
+        cpu_fprintf(f, "\n");
+    }
+}
+
 ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                                    MemoryRegion *mr)
 {
@@ -2566,8 +3232,12 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
         }
     }
     new_block->length = size;
+    if (new_block->host && !(new_block->flags & RAM_PREALLOC_MASK)) {
+        ram_block_setup_host(new_block);
+    }
 
     QLIST_INSERT_HEAD(&ram_list.blocks, new_block, next);
+    ram_block_index_update();
 
     ram_list.phys_dirty = g_realloc(ram_list.phys_dirty,
                                        last_ram_offset() >> TARGET_PAGE_BITS);
@@ -2595,6 +3265,7 @@ void qemu_ram_free_from_ptr(ram_addr_t addr)
     QLIST_FOREACH(block, &ram_list.blocks, next) {
         if (addr == block->offset) {
             QLIST_REMOVE(block, next);
+            ram_block_index_update();
             g_free(block);
             return;
         }
@@ -2605,9 +3276,13 @@ void qemu_ram_free(ram_addr_t addr)
 {
     RAMBlock *block;
 
+    /* detached dump threads read guest RAM through block->host */
+    assert(!dump_in_progress());
+
     QLIST_FOREACH(block, &ram_list.blocks, next) {
         if (addr == block->offset) {
             QLIST_REMOVE(block, next);
+            ram_block_index_update();
             if (block->flags & RAM_PREALLOC_MASK) {
                 ;
             } else if (mem_path) {
@@ -2665,6 +3340,9 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
 #else
                         flags |= MAP_PRIVATE;
 #endif
+                        if (mem_share) {
+                            flags = (flags & ~MAP_PRIVATE) | MAP_SHARED;
+                        }
                         area = mmap(vaddr, length, PROT_READ | PROT_WRITE,
                                     flags, block->fd, offset);
                     } else {
@@ -2711,66 +3389,38 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
  */
 void *qemu_get_ram_ptr(ram_addr_t addr)
 {
-    RAMBlock *block;
-
-    QLIST_FOREACH(block, &ram_list.blocks, next) {
-        if (addr - block->offset < block->length) {
-            /* Move this entry to to start of the list.  */
-            if (block != QLIST_FIRST(&ram_list.blocks)) {
-                QLIST_REMOVE(block, next);
-                QLIST_INSERT_HEAD(&ram_list.blocks, block, next);
-            }
-            if (xen_enabled()) {
-                /* We need to check if the requested address is in the RAM
-                 * because we don't want to map the entire memory in QEMU.
-                 * In that case just map until the end of the page.
-                 */
-                if (block->offset == 0) {
-                    return xen_map_cache(addr, 0, 0);
-                } else if (block->host == NULL) {
-                    block->host =
-                        xen_map_cache(block->offset, block->length, 1);
-                }
-            }
-            return block->host + (addr - block->offset);
-        }
-    }
-
-    fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
-    abort();
-
-    return NULL;
+    return qemu_safe_ram_ptr(addr);
 }
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
- * Same as qemu_get_ram_ptr but avoid reordering ramblocks.
+ * Lookups no longer reorder the block list, so this is now the same
+ * as qemu_get_ram_ptr.
  */
 void *qemu_safe_ram_ptr(ram_addr_t addr)
 {
-    RAMBlock *block;
+    int readers = ram_block_read_lock();
+    RAMBlock *block = ram_block_find(addr);
+    void *ptr;
 
-    QLIST_FOREACH(block, &ram_list.blocks, next) {
-        if (addr - block->offset < block->length) {
-            if (xen_enabled()) {
-                /* We need to check if the requested address is in the RAM
-                 * because we don't want to map the entire memory in QEMU.
-                 * In that case just map until the end of the page.
-                 */
-                if (block->offset == 0) {
-                    return xen_map_cache(addr, 0, 0);
-                } else if (block->host == NULL) {
-                    block->host =
-                        xen_map_cache(block->offset, block->length, 1);
-                }
-            }
-            return block->host + (addr - block->offset);
+    if (!block) {
+        fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
+        abort();
+    }
+    if (xen_enabled()) {
+        /* We need to check if the requested address is in the RAM
+         * because we don't want to map the entire memory in QEMU.
+         * In that case just map until the end of the page.
+         */
+        if (block->offset == 0) {
+            return xen_map_cache(addr, 0, 0);
+        } else if (block->host == NULL) {
+            block->host =
+                xen_map_cache(block->offset, block->length, 1);
         }
     }
-
-    fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
-    abort();
-
-    return NULL;
+    ptr = block->host + (addr - block->offset);
+    ram_block_read_unlock(readers);
+    return ptr;
 }
 
 /* Return a host pointer to guest's ram. Similar to qemu_get_ram_ptr
@@ -2783,18 +3433,20 @@ void *qemu_ram_ptr_length(ram_addr_t addr, ram_addr_t *size)
     if (xen_enabled()) {
         return xen_map_cache(addr, *size, 1);
     } else {
-        RAMBlock *block;
+        int readers = ram_block_read_lock();
+        RAMBlock *block = ram_block_find(addr);
+        void *ptr;
 
-        QLIST_FOREACH(block, &ram_list.blocks, next) {
-            if (addr - block->offset < block->length) {
-                if (addr - block->offset + *size > block->length)
-                    *size = block->length - addr + block->offset;
-                return block->host + (addr - block->offset);
-            }
+        if (!block) {
+            fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
+            abort();
         }
-
-        fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
-        abort();
+        if (addr - block->offset + *size > block->length) {
+            *size = block->length - addr + block->offset;
+        }
+        ptr = block->host + (addr - block->offset);
+        ram_block_read_unlock(readers);
+        return ptr;
     }
 }
 
@@ -2803,6 +3455,27 @@ void qemu_put_ram_ptr(void *addr)
     trace_qemu_put_ram_ptr(addr);
 }
 
+/* Return the file descriptor backing the RAM block that contains @addr,
+   or -1 if that block is not file backed.  On success *@offset is set to
+   the offset of @addr within the file.  */
+int qemu_get_ram_fd(ram_addr_t addr, ram_addr_t *offset)
+{
+#if defined(__linux__) && !defined(TARGET_S390X)
+    int readers = ram_block_read_lock();
+    RAMBlock *block = ram_block_find(addr);
+    int fd = -1;
+
+    if (block && block->fd) {
+        *offset = addr - block->offset;
+        fd = block->fd;
+    }
+    ram_block_read_unlock(readers);
+    return fd;
+#else
+    return -1;
+#endif
+}
+
 int qemu_ram_addr_from_host(void *ptr, ram_addr_t *ram_addr)
 {
     RAMBlock *block;
@@ -3168,6 +3841,10 @@ static void io_mem_init(void)
 
 static void core_begin(MemoryListener *listener)
 {
+    /* vCPU threads walk the physical map without the iothread lock */
+    if (mttcg_enabled) {
+        tcg_exclusive_start();
+    }
     destroy_all_mappings();
     phys_sections_clear();
     phys_map.ptr = PHYS_MAP_NODE_NIL;
@@ -3187,6 +3864,9 @@ static void core_commit(MemoryListener *listener)
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
         tlb_flush(env, 1);
     }
+    if (mttcg_enabled) {
+        tcg_exclusive_end();
+    }
 }
 
 static void core_region_add(MemoryListener *listener,
@@ -4165,39 +4845,49 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    int used_buckets, max_chain, chain, hashed_tbs, buckets, r;
+    unsigned int tlb_min, tlb_max;
+    ptrdiff_t code_size;
     TranslationBlock *tb;
+    CPUArchState *env;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for(i = 0; i < nb_tbs; i++) {
-        tb = &tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size)
-            max_target_code_size = tb->size;
-        if (tb->page_addr[1] != -1)
-            cross_page++;
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    /* vCPU threads may be translating, evicting or growing the hash */
+    tb_lock_acquire();
+    for (r = 0; r < code_gen_regions; r++) {
+        code_size += region_code_ptr(r) - region_code_start(r);
+        for (i = 0; i < region_nb_tbs[r]; i++) {
+            tb = &region_tbs(r)[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size)
+                max_target_code_size = tb->size;
+            if (tb->page_addr[1] != -1)
+                cross_page++;
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%ld\n",
-                code_gen_ptr - code_gen_buffer, code_gen_buffer_max_size);
+    cpu_fprintf(f, "gen code size       %td/%ld (%d regions)\n",
+                code_size, code_gen_buffer_max_size, code_gen_regions);
     cpu_fprintf(f, "TB count            %d/%d\n", 
                 nb_tbs, code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
                 nb_tbs ? target_code_size / nb_tbs : 0,
                 max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-                nb_tbs ? (code_gen_ptr - code_gen_buffer) / nb_tbs : 0,
-                target_code_size ? (double) (code_gen_ptr - code_gen_buffer) / target_code_size : 0);
+                nb_tbs ? code_size / nb_tbs : 0,
+                target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n",
             cross_page,
             nb_tbs ? (cross_page * 100) / nb_tbs : 0);
@@ -4206,13 +4896,125 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 nb_tbs ? (direct_jmp_count * 100) / nb_tbs : 0,
                 direct_jmp2_count,
                 nb_tbs ? (direct_jmp2_count * 100) / nb_tbs : 0);
+
+    used_buckets = 0;
+    max_chain = 0;
+    hashed_tbs = 0;
+    for (i = 0; i <= tb_phys_hash_mask; i++) {
+        chain = 0;
+        for (tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
+            chain++;
+        }
+        if (chain) {
+            used_buckets++;
+        }
+        hashed_tbs += chain;
+        if (chain > max_chain) {
+            max_chain = chain;
+        }
+    }
+    buckets = tb_phys_hash_mask + 1;
+    tb_lock_release();
+    cpu_fprintf(f, "TB hash buckets     %d/%d (%d%% used)\n",
+                used_buckets, buckets,
+                (int)((int64_t)used_buckets * 100 / buckets));
+    cpu_fprintf(f, "TB hash chain len   avg %0.2f max %d\n",
+                used_buckets ? (double)hashed_tbs / used_buckets : 0,
+                max_chain);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d (%d TBs)\n",
+                tb_region_evict_count, tb_evicted_count);
+    cpu_fprintf(f, "TB retranslations   %d\n", tb_retranslate_count);
+    cpu_fprintf(f, "TB hot traces       %d\n", tb_trace_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB page flushes    %d\n", tlb_flush_page_count);
+    cpu_fprintf(f, "TLB miss count      %d (victim TLB hits %d%%)\n",
+                tlb_miss_count,
+                tlb_miss_count ?
+                (int)((int64_t)tlb_victim_hit_count * 100 / tlb_miss_count) : 0);
+    tlb_min = CPU_TLB_DYN_MAX_SIZE;
+    tlb_max = 0;
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        tlb_min = MIN(tlb_min, tlb_size(env));
+        tlb_max = MAX(tlb_max, tlb_size(env));
+    }
+    cpu_fprintf(f, "TLB entries         %u-%u (%d resizes)\n",
+                tlb_min, tlb_max, tlb_resize_count);
     tcg_dump_info(f, cpu_fprintf);
 }
 
+/* Copied under tb_lock, the TB may be evicted once it is dropped */
+typedef struct TBProfile {
+    target_ulong pc;
+    void *tc_ptr;
+    int size;
+    int host_size;
+    uint32_t exec_count;
+    uint32_t exit_count;
+    uint16_t cflags;
+} TBProfile;
+
+static int tb_profile_cmp(const void *a, const void *b)
+{
+    const TBProfile *pa = a, *pb = b;
+
+    if (pa->exec_count != pb->exec_count) {
+        return pa->exec_count < pb->exec_count ? 1 : -1;
+    }
+    return 0;
+}
+
+/* Print the @count most executed TBs that are still in the hash table.  */
+void dump_tb_profile(FILE *f, fprintf_function cpu_fprintf, int count)
+{
+    TBProfile *prof;
+    TranslationBlock *tb;
+    uint8_t *end;
+    int i, n, r;
+
+    if (!tcg_tb_profile) {
+        cpu_fprintf(f, "TB profiling is disabled, use -tcg-profile\n");
+        return;
+    }
+    tb_lock_acquire();
+    prof = g_malloc(nb_tbs * sizeof(*prof));
+    n = 0;
+    for (r = 0; r < code_gen_regions; r++) {
+        for (i = 0; i < region_nb_tbs[r]; i++) {
+            tb = &region_tbs(r)[i];
+            if (!tb_is_hashed(tb)) {
+                continue;
+            }
+            /* TBs of a region are laid out in allocation order */
+            end = i + 1 < region_nb_tbs[r] ? tb[1].tc_ptr : region_code_ptr(r);
+            prof[n].pc = tb->pc;
+            prof[n].tc_ptr = tb->tc_ptr;
+            prof[n].size = tb->size;
+            prof[n].host_size = end - (uint8_t *)tb->tc_ptr;
+            prof[n].exec_count = tb->exec_count;
+            prof[n].exit_count = tb->exit_count;
+            prof[n].cflags = tb->cflags;
+            n++;
+        }
+    }
+    tb_lock_release();
+    qsort(prof, n, sizeof(*prof), tb_profile_cmp);
+
+    cpu_fprintf(f, "%-18s %-18s %6s %6s %10s %10s\n", "guest pc", "host pc",
+                "guest", "host", "execs", "exits");
+    for (i = 0; i < n && i < count; i++) {
+        cpu_fprintf(f, "0x" TARGET_FMT_lx "%*s %-18p %6d %6d %10u %10u %s%s\n",
+                    prof[i].pc, 16 - (int)sizeof(target_ulong) * 2, "",
+                    prof[i].tc_ptr, prof[i].size, prof[i].host_size,
+                    prof[i].exec_count, prof[i].exit_count,
+                    prof[i].cflags & CF_TRACE ? "trace " : "",
+                    lookup_symbol(prof[i].pc));
+    }
+    g_free(prof);
+}
+
 /*
  * A helper function for the _utterly broken_ virtio device model to find out if
  * it's running on a big endian machine. Don't do this at home kids!
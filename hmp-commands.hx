@@ -943,9 +943,12 @@ ETEXI
 #if defined(CONFIG_HAVE_CORE_DUMP)
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:-p,filename:F,begin:i?,length:i?",
-        .params     = "[-p] filename [begin] [length]",
+        .args_type  = "paging:-p,detach:-d,zlib:-z,live:-l,filename:F,begin:i?,length:i?",
+        .params     = "[-p] [-d] [-z] [-l] filename [begin] [length]",
         .help       = "dump guest memory to file"
+                      "\n\t\t\t -d: write the dump in the background"
+                      "\n\t\t\t -z: kdump-compressed format, with zlib"
+                      "\n\t\t\t -l: keep the guest running while dumping"
                       "\n\t\t\t begin(optional): the starting physical address"
                       "\n\t\t\t length(optional): the memory size, in bytes",
         .mhandler.cmd = hmp_dump_guest_memory,
@@ -953,12 +956,15 @@ ETEXI
 
 
 STEXI
-@item dump-guest-memory [-p] @var{protocol} @var{begin} @var{length}
+@item dump-guest-memory [-p] [-d] [-z] [-l] @var{protocol} @var{begin} @var{length}
 @findex dump-guest-memory
 Dump guest memory to @var{protocol}. The file can be processed with crash or
 gdb.
   filename: dump file name
     paging: do paging to get guest's memory mapping
+    detach: return at once; see "info dump" for the progress
+      zlib: write the kdump-compressed format, readable by crash
+      live: keep the guest running, and only stop it at the end
      begin: the starting physical address. It's optional, and should be
             specified with length together.
     length: the memory size, in bytes. It's optional, and should be specified
@@ -1458,8 +1464,14 @@ show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only
 show the active virtual memory mappings (i386 only)
 @item info jit
 show dynamic compiler info
+@item info tbs
+show the most executed translation blocks (requires -tcg-profile)
+@item info dump
+show the progress of the current or last guest memory dump
 @item info numa
 show NUMA information
+@item info ramblock
+show RAM blocks and the host NUMA nodes their memory is on
 @item info kvm
 show KVM information
 @item info usb
@@ -1468,6 +1480,8 @@ show USB devices plugged on the virtual USB hub
 show all USB host devices
 @item info profile
 show profiling information
+@item info timers
+show the pending timers and the rearm/fire counts of each clock
 @item info capture
 show information about active capturing
 @item info snapshots
@@ -352,6 +352,7 @@ void hmp_info_vnc(Monitor *mon)
     VncInfo *info;
     Error *err = NULL;
     VncClientInfoList *client;
+    VncEncodingStatsList *enc;
 
     info = qmp_query_vnc(&err);
     if (err) {
@@ -386,6 +387,23 @@ void hmp_info_vnc(Monitor *mon)
             monitor_printf(mon, "    username: %s\n",
                            client->value->has_sasl_username ?
                            client->value->sasl_username : "none");
+            monitor_printf(mon, "     updates: %" PRId64 " (%" PRId64
+                           " bytes, %" PRId64 " us encoding)\n",
+                           client->value->updates,
+                           client->value->encoded_bytes,
+                           client->value->encode_time / 1000);
+            monitor_printf(mon, "  bytes sent: %" PRId64 "\n",
+                           client->value->bytes_sent);
+            for (enc = client->value->encodings; enc; enc = enc->next) {
+                monitor_printf(mon, "  %10s: %" PRId64 " rects, %" PRId64
+                               " -> %" PRId64 " bytes (%.1f:1), %" PRId64
+                               " us\n",
+                               enc->value->name, enc->value->rects,
+                               enc->value->raw_bytes, enc->value->bytes,
+                               enc->value->bytes ? (double)enc->value->raw_bytes
+                                                   / enc->value->bytes : 0.0,
+                               enc->value->time / 1000);
+            }
         }
     }
 
@@ -1064,6 +1082,9 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
 {
     Error *errp = NULL;
     int paging = qdict_get_try_bool(qdict, "paging", 0);
+    int detach = qdict_get_try_bool(qdict, "detach", 0);
+    int zlib = qdict_get_try_bool(qdict, "zlib", 0);
+    int live = qdict_get_try_bool(qdict, "live", 0);
     const char *file = qdict_get_str(qdict, "filename");
     bool has_begin = qdict_haskey(qdict, "begin");
     bool has_length = qdict_haskey(qdict, "length");
@@ -1081,11 +1102,36 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     prot = g_strconcat("file:", file, NULL);
 
     qmp_dump_guest_memory(paging, prot, has_begin, begin, has_length, length,
+                          true, detach, zlib,
+                          DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZLIB, true, live,
                           &errp);
     hmp_handle_error(mon, &errp);
     g_free(prot);
 }
 
+void hmp_info_dump(Monitor *mon)
+{
+    DumpInfo *info;
+
+    info = qmp_query_dump(NULL);
+    if (!info) {
+        return;
+    }
+
+    monitor_printf(mon, "Status: %s\n", DumpStatus_lookup[info->status]);
+    if (info->status != DUMP_STATUS_NONE) {
+        monitor_printf(mon, "Progress: %" PRId64 " of %" PRId64 " MB",
+                       info->completed >> 20, info->total >> 20);
+        if (info->total) {
+            monitor_printf(mon, " (%" PRId64 "%%)",
+                           info->completed * 100 / info->total);
+        }
+        monitor_printf(mon, "\n");
+    }
+
+    qapi_free_DumpInfo(info);
+}
+
 void hmp_netdev_add(Monitor *mon, const QDict *qdict)
 {
     Error *err = NULL;
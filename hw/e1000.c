@@ -29,11 +29,13 @@
 #include "pci.h"
 #include "net.h"
 #include "net/checksum.h"
+#include "net/tap.h"
 #include "loader.h"
 #include "sysemu.h"
 #include "dma.h"
 
 #include "e1000_hw.h"
+#include "virtio-net.h"
 
 #define E1000_DEBUG
 
@@ -59,6 +61,10 @@ static int debugflags = DBGBIT(TXERR) | DBGBIT(GENERAL);
 #define PNPMMIO_SIZE      0x20000
 #define MIN_BUF_SIZE      60 /* Min. octets in an ethernet frame sans FCS */
 
+/* Max. number of descriptors fetched from guest memory in one DMA */
+#define E1000_TX_BATCH    32
+#define E1000_RX_BATCH    16
+
 /*
  * HW models:
  *  E1000_DEV_ID_82540EM works with Windows and Linux
@@ -127,6 +133,20 @@ typedef struct E1000State_st {
     } eecd_state;
 
     QEMUTimer *autoneg_timer;
+
+    /* Interrupt mitigation (ITR, RADV, TADV) */
+    QEMUTimer *mit_timer;
+    bool mit_timer_on;          /* mitigation delay window is open */
+    bool mit_irq_level;         /* last level driven on the irq line */
+    uint32_t mit_ide;           /* a tx descriptor asked for delayed irq */
+
+    /* peer is a tap that takes a virtio_net_hdr with every frame */
+    bool has_vnet;
+
+/* Compatibility flags for migration to/from qemu 1.2.0 and older */
+#define E1000_FLAG_MIT_BIT 0
+#define E1000_FLAG_MIT (1 << E1000_FLAG_MIT_BIT)
+    uint32_t compat_flags;
 } E1000State;
 
 #define	defreg(x)	x = (E1000_##x>>2)
@@ -141,7 +161,8 @@ enum {
     defreg(TORH),	defreg(TORL),	defreg(TOTH),	defreg(TOTL),
     defreg(TPR),	defreg(TPT),	defreg(TXDCTL),	defreg(WUFC),
     defreg(RA),		defreg(MTA),	defreg(CRCERRS),defreg(VFTA),
-    defreg(VET),
+    defreg(VET),	defreg(RDTR),	defreg(RADV),	defreg(TADV),
+    defreg(ITR),
 };
 
 static void
@@ -220,16 +241,71 @@ static const uint32_t mac_reg_init[] = {
                 E1000_MANC_RMCP_EN,
 };
 
+static inline void
+mit_update_delay(uint32_t *curr, uint32_t value)
+{
+    if (value && (*curr == 0 || value < *curr)) {
+        *curr = value;
+    }
+}
+
 static void
 set_interrupt_cause(E1000State *s, int index, uint32_t val)
 {
+    uint32_t pending_ints;
+    uint32_t mit_delay;
+
     if (val && (E1000_DEVID >= E1000_DEV_ID_82547EI_MOBILE)) {
         /* Only for 8257x */
         val |= E1000_ICR_INT_ASSERTED;
     }
     s->mac_reg[ICR] = val;
     s->mac_reg[ICS] = val;
-    qemu_set_irq(s->dev.irq[0], (s->mac_reg[IMS] & s->mac_reg[ICR]) != 0);
+
+    pending_ints = (s->mac_reg[IMS] & s->mac_reg[ICR]);
+    if (!s->mit_irq_level && pending_ints) {
+        /*
+         * This is a rising edge.  Inside the mitigation window it is
+         * postponed until the window closes, otherwise a new window is
+         * opened according to ITR (256ns units) and, for the causes
+         * they apply to, RADV and TADV (1024ns units).  RDTR only
+         * enables RADV; the relative TIDV/RDTR timers are not emulated.
+         */
+        if (s->mit_timer_on) {
+            return;
+        }
+        if (s->compat_flags & E1000_FLAG_MIT) {
+            mit_delay = 0;
+            if (s->mit_ide &&
+                (pending_ints & (E1000_ICR_TXQE | E1000_ICR_TXDW))) {
+                mit_update_delay(&mit_delay, s->mac_reg[TADV] * 4);
+            }
+            if (s->mac_reg[RDTR] && (pending_ints & E1000_ICS_RXT0)) {
+                mit_update_delay(&mit_delay, s->mac_reg[RADV] * 4);
+            }
+            mit_update_delay(&mit_delay, s->mac_reg[ITR]);
+
+            if (mit_delay) {
+                s->mit_timer_on = 1;
+                qemu_mod_timer(s->mit_timer, qemu_get_clock_ns(vm_clock) +
+                               mit_delay * 256);
+            }
+            s->mit_ide = 0;
+        }
+    }
+
+    s->mit_irq_level = (pending_ints != 0);
+    qemu_set_irq(s->dev.irq[0], s->mit_irq_level);
+}
+
+static void
+e1000_mit_timer(void *opaque)
+{
+    E1000State *s = opaque;
+
+    s->mit_timer_on = 0;
+    /* Deliver whatever became pending while the window was open */
+    set_interrupt_cause(s, 0, s->mac_reg[ICR]);
 }
 
 static void
@@ -268,6 +344,10 @@ static void e1000_reset(void *opaque)
     E1000State *d = opaque;
 
     qemu_del_timer(d->autoneg_timer);
+    qemu_del_timer(d->mit_timer);
+    d->mit_timer_on = 0;
+    d->mit_irq_level = 0;
+    d->mit_ide = 0;
     memset(d->phy_reg, 0, sizeof d->phy_reg);
     memmove(d->phy_reg, phy_reg_init, sizeof phy_reg_init);
     memset(d->mac_reg, 0, sizeof d->mac_reg);
@@ -443,22 +523,76 @@ fcs_len(E1000State *s)
     return (s->mac_reg[RCTL] & E1000_RCTL_SECRC) ? 0 : 4;
 }
 
+static ssize_t e1000_receive_frame(E1000State *s, const uint8_t *buf,
+                                   size_t size);
+
+/*
+ * Checksum and segmentation offloads can be handed to the peer only
+ * when it takes a virtio_net_hdr, and never in PHY loopback mode.
+ */
+static inline bool
+e1000_tx_offload(E1000State *s)
+{
+    return s->has_vnet && !(s->phy_reg[PHY_CTRL] & MII_CR_LOOPBACK);
+}
+
 static void
-e1000_send_packet(E1000State *s, const uint8_t *buf, int size)
+e1000_send_packet(E1000State *s, struct virtio_net_hdr *hdr,
+                  const uint8_t *buf, int size)
 {
+    struct virtio_net_hdr nohdr;
+    struct iovec iov[2];
+
     if (s->phy_reg[PHY_CTRL] & MII_CR_LOOPBACK) {
-        s->nic->nc.info->receive(&s->nic->nc, buf, size);
+        e1000_receive_frame(s, buf, size);
+    } else if (s->has_vnet) {
+        if (!hdr) {
+            memset(&nohdr, 0, sizeof(nohdr));
+            hdr = &nohdr;
+        }
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(*hdr);
+        iov[1].iov_base = (uint8_t *)buf;
+        iov[1].iov_len = size;
+        qemu_sendv_packet(&s->nic->nc, iov, 2);
     } else {
         qemu_send_packet(&s->nic->nc, buf, size);
     }
 }
 
+static void
+xmit_frame(E1000State *s, struct virtio_net_hdr *hdr)
+{
+    struct e1000_tx *tp = &s->tx;
+
+    if (tp->vlan_needed) {
+        memmove(tp->vlan, tp->data, 4);
+        memmove(tp->data, tp->data + 4, 8);
+        memcpy(tp->data + 8, tp->vlan_header, 4);
+        e1000_send_packet(s, hdr, tp->vlan, tp->size + 4);
+    } else
+        e1000_send_packet(s, hdr, tp->data, tp->size);
+}
+
+static void
+update_tx_stats(E1000State *s, unsigned int frames, unsigned int bytes)
+{
+    unsigned int n;
+
+    s->mac_reg[TPT] += frames;
+    s->mac_reg[GPTC] += frames;
+    n = s->mac_reg[TOTL];
+    if ((s->mac_reg[TOTL] += bytes) < n)
+        s->mac_reg[TOTH]++;
+}
+
 static void
 xmit_seg(E1000State *s)
 {
     uint16_t len, *sp;
-    unsigned int frames = s->tx.tso_frames, css, sofar, n;
+    unsigned int frames = s->tx.tso_frames, css, sofar;
     struct e1000_tx *tp = &s->tx;
+    struct virtio_net_hdr hdr, *hdrp = NULL;
 
     if (tp->tse && tp->cptse) {
         css = tp->ipcss;
@@ -494,22 +628,77 @@ xmit_seg(E1000State *s)
         tp->tso_frames++;
     }
 
-    if (tp->sum_needed & E1000_TXD_POPTS_TXSM)
-        putsum(tp->data, tp->size, tp->tucso, tp->tucss, tp->tucse);
+    if (tp->sum_needed & E1000_TXD_POPTS_TXSM) {
+        if (e1000_tx_offload(s) && !(tp->tse && tp->cptse) &&
+            (!tp->tucse || tp->tucse + 1 >= tp->size)) {
+            /* Let the host fill in the checksum */
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            hdr.csum_start = tp->tucss + (tp->vlan_needed ? 4 : 0);
+            hdr.csum_offset = tp->tucso - tp->tucss;
+            hdrp = &hdr;
+        } else {
+            putsum(tp->data, tp->size, tp->tucso, tp->tucss, tp->tucse);
+        }
+    }
     if (tp->sum_needed & E1000_TXD_POPTS_IXSM)
         putsum(tp->data, tp->size, tp->ipcso, tp->ipcss, tp->ipcse);
-    if (tp->vlan_needed) {
-        memmove(tp->vlan, tp->data, 4);
-        memmove(tp->data, tp->data + 4, 8);
-        memcpy(tp->data + 8, tp->vlan_header, 4);
-        e1000_send_packet(s, tp->vlan, tp->size + 4);
-    } else
-        e1000_send_packet(s, tp->data, tp->size);
-    s->mac_reg[TPT]++;
-    s->mac_reg[GPTC]++;
-    n = s->mac_reg[TOTL];
-    if ((s->mac_reg[TOTL] += s->tx.size) < n)
-        s->mac_reg[TOTH]++;
+    xmit_frame(s, hdrp);
+    update_tx_stats(s, 1, s->tx.size);
+}
+
+/*
+ * Can the TSO context of the current packet be passed to the peer as
+ * a single GSO frame?  Only IPv4/TCP is handled, and the whole frame
+ * must fit in tp->data; everything else is segmented in software.
+ */
+static inline bool
+tso_offload_possible(E1000State *s)
+{
+    struct e1000_tx *tp = &s->tx;
+
+    return e1000_tx_offload(s) && tp->ip && tp->tcp && tp->mss &&
+           tp->hdr_len + tp->paylen <= sizeof(tp->data);
+}
+
+/* Send a whole TSO packet to the host and let it do the segmentation. */
+static void
+xmit_gso(E1000State *s)
+{
+    struct e1000_tx *tp = &s->tx;
+    struct virtio_net_hdr hdr;
+    unsigned int css = tp->ipcss, frames, phsum, len;
+    int vlan_len = tp->vlan_needed ? 4 : 0;
+    uint16_t *sp;
+
+    /* IP total length covers the whole frame; the host fixes it up */
+    cpu_to_be16wu((uint16_t *)(tp->data + css + 2), tp->size - css);
+
+    /*
+     * The guest left a pseudo-header checksum without the length in
+     * the TCP header, while the host expects one that includes it.
+     */
+    len = tp->size - tp->tucss;
+    sp = (uint16_t *)(tp->data + tp->tucso);
+    phsum = be16_to_cpup(sp) + len;
+    phsum = (phsum >> 16) + (phsum & 0xffff);
+    cpu_to_be16wu(sp, phsum);
+
+    if (tp->sum_needed & E1000_TXD_POPTS_IXSM)
+        putsum(tp->data, tp->size, tp->ipcso, tp->ipcss, tp->ipcse);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    hdr.hdr_len = tp->hdr_len + vlan_len;
+    hdr.gso_size = tp->mss;
+    hdr.csum_start = tp->tucss + vlan_len;
+    hdr.csum_offset = tp->tucso - tp->tucss;
+    xmit_frame(s, &hdr);
+
+    /* Account for the frames the host puts on the wire */
+    frames = DIV_ROUND_UP(tp->size - tp->hdr_len, tp->mss);
+    update_tx_stats(s, frames, tp->size + (frames - 1) * tp->hdr_len);
 }
 
 static void
@@ -523,6 +712,7 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     struct e1000_context_desc *xp = (struct e1000_context_desc *)dp;
     struct e1000_tx *tp = &s->tx;
 
+    s->mit_ide |= (txd_lower & E1000_TXD_CMD_IDE);
     if (dtype == E1000_TXD_CMD_DEXT) {	// context descriptor
         op = le32_to_cpu(xp->cmd_and_length);
         tp->ipcss = xp->lower_setup.ip_fields.ipcss;
@@ -564,7 +754,13 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     }
         
     addr = le64_to_cpu(dp->buffer_addr);
-    if (tp->tse && tp->cptse) {
+    if (tp->tse && tp->cptse && tso_offload_possible(s)) {
+        /* Gather the whole packet, the host will segment it */
+        hdr = tp->hdr_len;
+        split_size = MIN(sizeof(tp->data) - tp->size, split_size);
+        pci_dma_read(&s->dev, addr, tp->data + tp->size, split_size);
+        tp->size += split_size;
+    } else if (tp->tse && tp->cptse) {
         hdr = tp->hdr_len;
         msh = hdr + tp->mss;
         do {
@@ -595,7 +791,11 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
 
     if (!(txd_lower & E1000_TXD_CMD_EOP))
         return;
-    if (!(tp->tse && tp->cptse && tp->size < hdr))
+    if (tp->tse && tp->cptse && tso_offload_possible(s)) {
+        if (tp->size > hdr) {
+            xmit_gso(s);
+        }
+    } else if (!(tp->tse && tp->cptse && tp->size < hdr))
         xmit_seg(s);
     tp->tso_frames = 0;
     tp->sum_needed = 0;
@@ -627,12 +827,34 @@ static uint64_t tx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+/*
+ * Number of descriptors that can be fetched with one DMA starting at
+ * index @head: stop at @tail, at the end of the ring and at @max.
+ */
+static unsigned int
+desc_batch_size(unsigned int head, unsigned int tail, unsigned int ring_size,
+                unsigned int max)
+{
+    unsigned int count;
+
+    if (head >= ring_size) {
+        /* bogus head; fall back to one descriptor at a time */
+        return 1;
+    }
+    count = ring_size - head;
+    if (tail > head && tail - head < count) {
+        count = tail - head;
+    }
+    return MIN(count, max);
+}
+
 static void
 start_xmit(E1000State *s)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc descs[E1000_TX_BATCH], *dp;
     uint32_t tdh_start = s->mac_reg[TDH], cause = E1000_ICS_TXQE;
+    unsigned int i, count;
 
     if (!(s->mac_reg[TCTL] & E1000_TCTL_EN)) {
         DBGOUT(TX, "tx disabled\n");
@@ -640,30 +862,37 @@ start_xmit(E1000State *s)
     }
 
     while (s->mac_reg[TDH] != s->mac_reg[TDT]) {
+        count = desc_batch_size(s->mac_reg[TDH], s->mac_reg[TDT],
+                                s->mac_reg[TDLEN] / sizeof(descs[0]),
+                                E1000_TX_BATCH);
         base = tx_desc_base(s) +
                sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
-        pci_dma_read(&s->dev, base, &desc, sizeof(desc));
-
-        DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
-               (void *)(intptr_t)desc.buffer_addr, desc.lower.data,
-               desc.upper.data);
-
-        process_tx_desc(s, &desc);
-        cause |= txdesc_writeback(s, base, &desc);
-
-        if (++s->mac_reg[TDH] * sizeof(desc) >= s->mac_reg[TDLEN])
-            s->mac_reg[TDH] = 0;
-        /*
-         * the following could happen only if guest sw assigns
-         * bogus values to TDT/TDLEN.
-         * there's nothing too intelligent we could do about this.
-         */
-        if (s->mac_reg[TDH] == tdh_start) {
-            DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
-                   tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
-            break;
+        pci_dma_read(&s->dev, base, descs, count * sizeof(descs[0]));
+
+        for (i = 0; i < count; i++) {
+            dp = &descs[i];
+            DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
+                   (void *)(intptr_t)dp->buffer_addr, dp->lower.data,
+                   dp->upper.data);
+
+            process_tx_desc(s, dp);
+            cause |= txdesc_writeback(s, base + i * sizeof(*dp), dp);
+
+            if (++s->mac_reg[TDH] * sizeof(*dp) >= s->mac_reg[TDLEN])
+                s->mac_reg[TDH] = 0;
+            /*
+             * the following could happen only if guest sw assigns
+             * bogus values to TDT/TDLEN.
+             * there's nothing too intelligent we could do about this.
+             */
+            if (s->mac_reg[TDH] == tdh_start) {
+                DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
+                       tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
+                goto out;
+            }
         }
     }
+out:
     set_ics(s, 0, cause);
 }
 
@@ -771,12 +1000,11 @@ static uint64_t rx_desc_base(E1000State *s)
 }
 
 static ssize_t
-e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+e1000_receive_frame(E1000State *s, const uint8_t *buf, size_t size)
 {
-    E1000State *s = DO_UPCAST(NICState, nc, nc)->opaque;
-    struct e1000_rx_desc desc;
+    struct e1000_rx_desc descs[E1000_RX_BATCH], *dp;
     dma_addr_t base;
-    unsigned int n, rdt;
+    unsigned int n, rdt, i, count;
     uint32_t rdh_start;
     uint16_t vlan_special = 0;
     uint8_t vlan_status = 0, vlan_offset = 0;
@@ -815,47 +1043,62 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
             return -1;
     }
     do {
-        desc_size = total_size - desc_offset;
-        if (desc_size > s->rxbuf_size) {
-            desc_size = s->rxbuf_size;
-        }
-        base = rx_desc_base(s) + sizeof(desc) * s->mac_reg[RDH];
-        pci_dma_read(&s->dev, base, &desc, sizeof(desc));
-        desc.special = vlan_special;
-        desc.status |= (vlan_status | E1000_RXD_STAT_DD);
-        if (desc.buffer_addr) {
-            if (desc_offset < size) {
-                size_t copy_size = size - desc_offset;
-                if (copy_size > s->rxbuf_size) {
-                    copy_size = s->rxbuf_size;
+        /*
+         * Fetch the descriptors the rest of the frame needs with one
+         * DMA read (bounded by the end of the ring), fill them, and
+         * write them back together once the data is in place.
+         */
+        count = desc_batch_size(s->mac_reg[RDH], s->mac_reg[RDT],
+                                s->mac_reg[RDLEN] / sizeof(descs[0]),
+                                DIV_ROUND_UP(total_size - desc_offset,
+                                             s->rxbuf_size));
+        count = MIN(count, E1000_RX_BATCH);
+        base = rx_desc_base(s) + sizeof(descs[0]) * s->mac_reg[RDH];
+        pci_dma_read(&s->dev, base, descs, count * sizeof(descs[0]));
+
+        for (i = 0; i < count && desc_offset < total_size; i++) {
+            dp = &descs[i];
+            desc_size = total_size - desc_offset;
+            if (desc_size > s->rxbuf_size) {
+                desc_size = s->rxbuf_size;
+            }
+            dp->special = vlan_special;
+            dp->status |= (vlan_status | E1000_RXD_STAT_DD);
+            if (dp->buffer_addr) {
+                if (desc_offset < size) {
+                    size_t copy_size = size - desc_offset;
+                    if (copy_size > s->rxbuf_size) {
+                        copy_size = s->rxbuf_size;
+                    }
+                    pci_dma_write(&s->dev, le64_to_cpu(dp->buffer_addr),
+                                  buf + desc_offset + vlan_offset, copy_size);
                 }
-                pci_dma_write(&s->dev, le64_to_cpu(desc.buffer_addr),
-                              buf + desc_offset + vlan_offset, copy_size);
+                desc_offset += desc_size;
+                dp->length = cpu_to_le16(desc_size);
+                if (desc_offset >= total_size) {
+                    dp->status |= E1000_RXD_STAT_EOP | E1000_RXD_STAT_IXSM;
+                } else {
+                    /* Guest zeroing out status is not a hardware requirement.
+                       Clear EOP in case guest didn't do it. */
+                    dp->status &= ~E1000_RXD_STAT_EOP;
+                }
+            } else { // as per intel docs; skip descriptors with null buf addr
+                DBGOUT(RX, "Null RX descriptor!!\n");
             }
-            desc_offset += desc_size;
-            desc.length = cpu_to_le16(desc_size);
-            if (desc_offset >= total_size) {
-                desc.status |= E1000_RXD_STAT_EOP | E1000_RXD_STAT_IXSM;
-            } else {
-                /* Guest zeroing out status is not a hardware requirement.
-                   Clear EOP in case guest didn't do it. */
-                desc.status &= ~E1000_RXD_STAT_EOP;
+
+            if (++s->mac_reg[RDH] * sizeof(*dp) >= s->mac_reg[RDLEN])
+                s->mac_reg[RDH] = 0;
+            s->check_rxov = 1;
+            /* see comment in start_xmit; same here */
+            if (s->mac_reg[RDH] == rdh_start) {
+                DBGOUT(RXERR, "RDH wraparound @%x, RDT %x, RDLEN %x\n",
+                       rdh_start, s->mac_reg[RDT], s->mac_reg[RDLEN]);
+                pci_dma_write(&s->dev, base, descs, (i + 1) * sizeof(*dp));
+                set_ics(s, 0, E1000_ICS_RXO);
+                return -1;
             }
-        } else { // as per intel docs; skip descriptors with null buf addr
-            DBGOUT(RX, "Null RX descriptor!!\n");
-        }
-        pci_dma_write(&s->dev, base, &desc, sizeof(desc));
-
-        if (++s->mac_reg[RDH] * sizeof(desc) >= s->mac_reg[RDLEN])
-            s->mac_reg[RDH] = 0;
-        s->check_rxov = 1;
-        /* see comment in start_xmit; same here */
-        if (s->mac_reg[RDH] == rdh_start) {
-            DBGOUT(RXERR, "RDH wraparound @%x, RDT %x, RDLEN %x\n",
-                   rdh_start, s->mac_reg[RDT], s->mac_reg[RDLEN]);
-            set_ics(s, 0, E1000_ICS_RXO);
-            return -1;
         }
+        pci_dma_write(&s->dev, base, descs, i * sizeof(descs[0]));
     } while (desc_offset < total_size);
 
     s->mac_reg[GPRC]++;
@@ -871,8 +1114,8 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 
     n = E1000_ICS_RXT0;
     if ((rdt = s->mac_reg[RDT]) < s->mac_reg[RDH])
-        rdt += s->mac_reg[RDLEN] / sizeof(desc);
-    if (((rdt - s->mac_reg[RDH]) * sizeof(desc)) <= s->mac_reg[RDLEN] >>
+        rdt += s->mac_reg[RDLEN] / sizeof(descs[0]);
+    if (((rdt - s->mac_reg[RDH]) * sizeof(descs[0])) <= s->mac_reg[RDLEN] >>
         s->rxbuf_min_shift)
         n |= E1000_ICS_RXDMT0;
 
@@ -881,6 +1124,24 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     return size;
 }
 
+static ssize_t
+e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    E1000State *s = DO_UPCAST(NICState, nc, nc)->opaque;
+    size_t hdr_len = s->has_vnet ? sizeof(struct virtio_net_hdr) : 0;
+    ssize_t ret;
+
+    /*
+     * No offloads are enabled on the tap, so the header never carries
+     * anything we need to look at; just strip it.
+     */
+    if (size < hdr_len) {
+        return size;
+    }
+    ret = e1000_receive_frame(s, buf + hdr_len, size - hdr_len);
+    return ret < 0 ? ret : size;
+}
+
 static uint32_t
 mac_readreg(E1000State *s, int index)
 {
@@ -981,7 +1242,8 @@ static uint32_t (*macreg_readops[])(E1000State *, int) = {
     getreg(TORL),	getreg(TOTL),	getreg(IMS),	getreg(TCTL),
     getreg(RDH),	getreg(RDT),	getreg(VET),	getreg(ICS),
     getreg(TDBAL),	getreg(TDBAH),	getreg(RDBAH),	getreg(RDBAL),
-    getreg(TDLEN),	getreg(RDLEN),
+    getreg(TDLEN),	getreg(RDLEN),	getreg(RDTR),	getreg(RADV),
+    getreg(TADV),	getreg(ITR),
 
     [TOTH] = mac_read_clr8,	[TORH] = mac_read_clr8,	[GPRC] = mac_read_clr4,
     [GPTC] = mac_read_clr4,	[TPR] = mac_read_clr4,	[TPT] = mac_read_clr4,
@@ -1003,6 +1265,8 @@ static void (*macreg_writeops[])(E1000State *, int, uint32_t) = {
     [TDH] = set_16bit,	[RDH] = set_16bit,	[RDT] = set_rdt,
     [IMC] = set_imc,	[IMS] = set_ims,	[ICR] = set_icr,
     [EECD] = set_eecd,	[RCTL] = set_rx_control, [CTRL] = set_ctrl,
+    [RDTR] = set_16bit,	[RADV] = set_16bit,	[TADV] = set_16bit,
+    [ITR] = set_16bit,
     [RA ... RA+31] = &mac_writereg,
     [MTA ... MTA+127] = &mac_writereg,
     [VFTA ... VFTA+127] = &mac_writereg,
@@ -1079,11 +1343,59 @@ static bool is_version_1(void *opaque, int version_id)
     return version_id == 1;
 }
 
+static void e1000_pre_save(void *opaque)
+{
+    E1000State *s = opaque;
+
+    /* An open mitigation window is not migrated; close it now */
+    if (s->mit_timer_on) {
+        qemu_del_timer(s->mit_timer);
+        e1000_mit_timer(s);
+    }
+}
+
+static int e1000_post_load(void *opaque, int version_id)
+{
+    E1000State *s = opaque;
+
+    /*
+     * The mitigation window was closed before saving, so the irq line
+     * simply follows ICR & IMS.
+     */
+    s->mit_ide = 0;
+    s->mit_timer_on = 0;
+    s->mit_irq_level = (s->mac_reg[IMS] & s->mac_reg[ICR]) != 0;
+    return 0;
+}
+
+static bool e1000_mit_state_needed(void *opaque)
+{
+    E1000State *s = opaque;
+
+    return s->compat_flags & E1000_FLAG_MIT;
+}
+
+static const VMStateDescription vmstate_e1000_mit_state = {
+    .name = "e1000/mit_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(mac_reg[RDTR], E1000State),
+        VMSTATE_UINT32(mac_reg[RADV], E1000State),
+        VMSTATE_UINT32(mac_reg[TADV], E1000State),
+        VMSTATE_UINT32(mac_reg[ITR], E1000State),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_e1000 = {
     .name = "e1000",
     .version_id = 2,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
+    .pre_save = e1000_pre_save,
+    .post_load = e1000_post_load,
     .fields      = (VMStateField []) {
         VMSTATE_PCI_DEVICE(dev, E1000State),
         VMSTATE_UNUSED_TEST(is_version_1, 4), /* was instance id */
@@ -1154,6 +1466,14 @@ static const VMStateDescription vmstate_e1000 = {
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, MTA, 128),
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, VFTA, 128),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection[]) {
+        {
+            .vmsd = &vmstate_e1000_mit_state,
+            .needed = e1000_mit_state_needed,
+        }, {
+            /* empty */
+        }
     }
 };
 
@@ -1203,6 +1523,8 @@ pci_e1000_uninit(PCIDevice *dev)
 
     qemu_del_timer(d->autoneg_timer);
     qemu_free_timer(d->autoneg_timer);
+    qemu_del_timer(d->mit_timer);
+    qemu_free_timer(d->mit_timer);
     memory_region_destroy(&d->mmio);
     memory_region_destroy(&d->io);
     qemu_del_net_client(&d->nic->nc);
@@ -1254,9 +1576,21 @@ static int pci_e1000_init(PCIDevice *pci_dev)
 
     qemu_format_nic_info_str(&d->nic->nc, macaddr);
 
+    /*
+     * With a vnet_hdr capable tap as peer, checksum offload and TSO
+     * are handed to the host kernel instead of being done here.
+     */
+    if (d->nic->nc.peer &&
+        d->nic->nc.peer->info->type == NET_CLIENT_OPTIONS_KIND_TAP &&
+        tap_has_vnet_hdr(d->nic->nc.peer)) {
+        tap_using_vnet_hdr(d->nic->nc.peer, 1);
+        d->has_vnet = true;
+    }
+
     add_boot_device_path(d->conf.bootindex, &pci_dev->qdev, "/ethernet-phy@0");
 
     d->autoneg_timer = qemu_new_timer_ms(vm_clock, e1000_autoneg_timer, d);
+    d->mit_timer = qemu_new_timer_ns(vm_clock, e1000_mit_timer, d);
 
     return 0;
 }
@@ -1269,6 +1603,8 @@ static void qdev_e1000_reset(DeviceState *dev)
 
 static Property e1000_properties[] = {
     DEFINE_NIC_PROPERTIES(E1000State, conf),
+    DEFINE_PROP_BIT("mitigation", E1000State,
+                    compat_flags, E1000_FLAG_MIT_BIT, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
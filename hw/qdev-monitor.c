@@ -21,6 +21,7 @@
 #include "monitor.h"
 #include "qmp-commands.h"
 #include "arch_init.h"
+#include "sysemu.h"
 
 /*
  * Aliases were a bad idea from the start.  Let's keep them
@@ -590,6 +591,13 @@ int do_device_add(Monitor *mon, const QDict *qdict, QObject **ret_data)
         qemu_opts_del(opts);
         return 0;
     }
+    /* unwinding a failed device_add frees RAM, see qemu_ram_free() */
+    if (dump_in_progress()) {
+        qerror_report(ERROR_CLASS_GENERIC_ERROR,
+                      "guest memory is being dumped");
+        qemu_opts_del(opts);
+        return -1;
+    }
     if (!qdev_device_add(opts)) {
         qemu_opts_del(opts);
         return -1;
@@ -607,6 +615,12 @@ void qmp_device_del(const char *id, Error **errp)
         return;
     }
 
+    /* a detached dump is still reading the device's RAM */
+    if (dump_in_progress()) {
+        error_setg(errp, "guest memory is being dumped");
+        return;
+    }
+
     qdev_unplug(dev, errp);
 }
 
@@ -100,8 +100,9 @@ static void qxl_render_update_area_unlocked(PCIQXLDevice *qxl)
     VGACommonState *vga = &qxl->vga;
     int i;
     DisplaySurface *surface = vga->ds->surface;
+    bool resized = qxl->guest_primary.resized;
 
-    if (qxl->guest_primary.resized) {
+    if (resized) {
         qxl->guest_primary.resized = 0;
         qxl->guest_primary.data = memory_region_get_ram_ptr(&qxl->vga.vram);
         qxl_set_rect_to_surface(qxl, &qxl->dirty[0]);
@@ -113,15 +114,21 @@ static void qxl_render_update_area_unlocked(PCIQXLDevice *qxl)
                qxl->guest_primary.bytes_pp,
                qxl->guest_primary.bits_pp);
     }
-    if (surface->width != qxl->guest_primary.surface.width ||
+    /* A new primary may keep the size but change the format or flip the
+       stride, which a surface sharing the old one can't follow */
+    if (resized ||
+        surface->width != qxl->guest_primary.surface.width ||
         surface->height != qxl->guest_primary.surface.height) {
         if (qxl->guest_primary.qxl_stride > 0) {
+            /* Display the guest primary surface in place: qxl_blit()
+               has nothing to do then.  */
             qemu_free_displaysurface(vga->ds);
-            qemu_create_displaysurface_from(qxl->guest_primary.surface.width,
-                                            qxl->guest_primary.surface.height,
-                                            qxl->guest_primary.bits_pp,
-                                            qxl->guest_primary.abs_stride,
-                                            qxl->guest_primary.data);
+            vga->ds->surface =
+                qemu_create_displaysurface_from(qxl->guest_primary.surface.width,
+                                                qxl->guest_primary.surface.height,
+                                                qxl->guest_primary.bits_pp,
+                                                qxl->guest_primary.abs_stride,
+                                                qxl->guest_primary.data);
         } else {
             qemu_resize_displaysurface(vga->ds,
                     qxl->guest_primary.surface.width,
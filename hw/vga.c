@@ -1686,7 +1686,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         height != s->last_height ||
         s->last_depth != depth) {
 #if defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
-        if (depth == 16 || depth == 32) {
+        if (depth == 15 || depth == 16 || depth == 32) {
 #else
         if (depth == 32) {
 #endif
@@ -0,0 +1,372 @@
+/*
+ * vhost backend
+ *
+ * Dispatches vhost requests either to the in-kernel vhost device or to a
+ * vhost-user backend process listening on a UNIX domain socket.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "vhost.h"
+#include "vhost-backend.h"
+#include "vhost-user.h"
+#include "qemu-common.h"
+#include "qemu-error.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/vhost.h>
+
+static int vhost_kernel_call(struct vhost_dev *dev, unsigned long int request,
+                             void *arg)
+{
+    int fd = dev->control;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_KERNEL);
+
+    return ioctl(fd, request, arg);
+}
+
+static int vhost_kernel_init(struct vhost_dev *dev)
+{
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_KERNEL);
+
+    return 0;
+}
+
+static int vhost_kernel_cleanup(struct vhost_dev *dev)
+{
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_KERNEL);
+
+    return 0;
+}
+
+static const VhostOps kernel_ops = {
+    .backend_type = VHOST_BACKEND_TYPE_KERNEL,
+    .vhost_call = vhost_kernel_call,
+    .vhost_backend_init = vhost_kernel_init,
+    .vhost_backend_cleanup = vhost_kernel_cleanup,
+};
+
+static unsigned long int ioctl_to_vhost_user_request[VHOST_USER_MAX] = {
+    -1,                     /* VHOST_USER_NONE */
+    VHOST_GET_FEATURES,     /* VHOST_USER_GET_FEATURES */
+    VHOST_SET_FEATURES,     /* VHOST_USER_SET_FEATURES */
+    VHOST_SET_OWNER,        /* VHOST_USER_SET_OWNER */
+    VHOST_RESET_OWNER,      /* VHOST_USER_RESET_OWNER */
+    VHOST_SET_MEM_TABLE,    /* VHOST_USER_SET_MEM_TABLE */
+    VHOST_SET_LOG_BASE,     /* VHOST_USER_SET_LOG_BASE */
+    VHOST_SET_LOG_FD,       /* VHOST_USER_SET_LOG_FD */
+    VHOST_SET_VRING_NUM,    /* VHOST_USER_SET_VRING_NUM */
+    VHOST_SET_VRING_ADDR,   /* VHOST_USER_SET_VRING_ADDR */
+    VHOST_SET_VRING_BASE,   /* VHOST_USER_SET_VRING_BASE */
+    VHOST_GET_VRING_BASE,   /* VHOST_USER_GET_VRING_BASE */
+    VHOST_SET_VRING_KICK,   /* VHOST_USER_SET_VRING_KICK */
+    VHOST_SET_VRING_CALL,   /* VHOST_USER_SET_VRING_CALL */
+    VHOST_SET_VRING_ERR     /* VHOST_USER_SET_VRING_ERR */
+};
+
+static VhostUserRequest vhost_user_request_translate(unsigned long int request)
+{
+    VhostUserRequest idx;
+
+    for (idx = 0; idx < VHOST_USER_MAX; idx++) {
+        if (ioctl_to_vhost_user_request[idx] == request) {
+            break;
+        }
+    }
+
+    return (idx == VHOST_USER_MAX) ? VHOST_USER_NONE : idx;
+}
+
+static int vhost_user_recv(struct vhost_dev *dev, VhostUserMsg *msg)
+{
+    int fd = dev->control;
+    ssize_t r;
+
+    r = qemu_recv_full(fd, msg, VHOST_USER_HDR_SIZE, 0);
+    if (r != VHOST_USER_HDR_SIZE) {
+        error_report("vhost-user: failed to read reply header");
+        goto fail;
+    }
+
+    if (msg->flags != (VHOST_USER_REPLY_MASK | VHOST_USER_VERSION)) {
+        error_report("vhost-user: bad reply flags 0x%x", msg->flags);
+        goto fail;
+    }
+
+    if (msg->size > sizeof(*msg) - VHOST_USER_HDR_SIZE) {
+        error_report("vhost-user: reply payload too large (%u bytes)",
+                     msg->size);
+        goto fail;
+    }
+
+    if (msg->size) {
+        r = qemu_recv_full(fd, (uint8_t *)msg + VHOST_USER_HDR_SIZE,
+                           msg->size, 0);
+        if (r != msg->size) {
+            error_report("vhost-user: failed to read reply payload");
+            goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    errno = EPROTO;
+    return -1;
+}
+
+static int vhost_user_send(struct vhost_dev *dev, VhostUserMsg *msg,
+                           int *fds, int fd_num)
+{
+    int fd = dev->control;
+    size_t fd_size = fd_num * sizeof(int);
+    char control[CMSG_SPACE(VHOST_MEMORY_MAX_NREGIONS * sizeof(int))];
+    struct msghdr msgh;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t r;
+
+    memset(&msgh, 0, sizeof(msgh));
+    memset(control, 0, sizeof(control));
+
+    iov.iov_base = msg;
+    iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+
+    if (fd_num) {
+        assert(fd_num <= VHOST_MEMORY_MAX_NREGIONS);
+        msgh.msg_control = control;
+        msgh.msg_controllen = CMSG_SPACE(fd_size);
+
+        cmsg = CMSG_FIRSTHDR(&msgh);
+        cmsg->cmsg_len = CMSG_LEN(fd_size);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(cmsg), fds, fd_size);
+    }
+
+    do {
+        r = sendmsg(fd, &msgh, 0);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0) {
+        return -1;
+    }
+    if (r != iov.iov_len) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
+                           void *arg)
+{
+    VhostUserMsg msg;
+    VhostUserRequest msg_request;
+    struct vhost_vring_file *file;
+    struct vhost_vring_state *state;
+    struct vhost_vring_addr *addr;
+    struct vhost_memory *mem;
+    int need_reply = 0;
+    int fds[VHOST_MEMORY_MAX_NREGIONS];
+    int i, fd;
+    size_t fd_num = 0;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
+
+    msg_request = vhost_user_request_translate(request);
+    msg.request = msg_request;
+    msg.flags = VHOST_USER_VERSION;
+    msg.size = 0;
+
+    switch (msg_request) {
+    case VHOST_USER_GET_FEATURES:
+        need_reply = 1;
+        break;
+
+    case VHOST_USER_SET_FEATURES:
+        msg.u64 = *((uint64_t *) arg);
+        msg.size = sizeof(msg.u64);
+        break;
+
+    case VHOST_USER_SET_OWNER:
+    case VHOST_USER_RESET_OWNER:
+        break;
+
+    case VHOST_USER_SET_MEM_TABLE:
+        mem = arg;
+        if (mem->nregions > VHOST_MEMORY_MAX_NREGIONS) {
+            error_report("vhost-user: too many memory regions (%u)",
+                         mem->nregions);
+            errno = E2BIG;
+            return -1;
+        }
+        for (i = 0; i < mem->nregions; ++i) {
+            struct vhost_memory_region *reg = mem->regions + i;
+            ram_addr_t ram_addr, offset;
+
+            if (qemu_ram_addr_from_host((void *)(uintptr_t)reg->userspace_addr,
+                                        &ram_addr) < 0) {
+                errno = EFAULT;
+                return -1;
+            }
+            fd = qemu_get_ram_fd(ram_addr, &offset);
+            if (fd < 0) {
+                error_report("vhost-user: guest RAM must be allocated with "
+                             "-mem-path and -mem-share");
+                errno = EINVAL;
+                return -1;
+            }
+            msg.memory.regions[i].guest_phys_addr = reg->guest_phys_addr;
+            msg.memory.regions[i].memory_size = reg->memory_size;
+            msg.memory.regions[i].userspace_addr = reg->userspace_addr;
+            msg.memory.regions[i].mmap_offset = offset;
+            fds[fd_num++] = fd;
+        }
+        msg.memory.nregions = fd_num;
+        msg.memory.padding = 0;
+        msg.size = sizeof(msg.memory.nregions) + sizeof(msg.memory.padding) +
+            fd_num * sizeof(VhostUserMemoryRegion);
+        break;
+
+    case VHOST_USER_SET_LOG_BASE:
+    case VHOST_USER_SET_LOG_FD:
+        /* Dirty logging needs a shared log; not supported yet. */
+        errno = ENOSYS;
+        return -1;
+
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_BASE:
+        state = arg;
+        msg.state.index = state->index;
+        msg.state.num = state->num;
+        msg.size = sizeof(msg.state);
+        break;
+
+    case VHOST_USER_GET_VRING_BASE:
+        state = arg;
+        msg.state.index = state->index;
+        msg.state.num = 0;
+        msg.size = sizeof(msg.state);
+        need_reply = 1;
+        break;
+
+    case VHOST_USER_SET_VRING_ADDR:
+        addr = arg;
+        msg.addr.index = addr->index;
+        msg.addr.flags = addr->flags;
+        msg.addr.desc_user_addr = addr->desc_user_addr;
+        msg.addr.used_user_addr = addr->used_user_addr;
+        msg.addr.avail_user_addr = addr->avail_user_addr;
+        msg.addr.log_guest_addr = addr->log_guest_addr;
+        msg.size = sizeof(msg.addr);
+        break;
+
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+    case VHOST_USER_SET_VRING_ERR:
+        file = arg;
+        msg.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+        msg.size = sizeof(msg.u64);
+        if (file->fd >= 0) {
+            fds[fd_num++] = file->fd;
+        } else {
+            msg.u64 |= VHOST_USER_VRING_NOFD_MASK;
+        }
+        break;
+
+    default:
+        error_report("vhost-user: unsupported request 0x%lx", request);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (vhost_user_send(dev, &msg, fds, fd_num) < 0) {
+        return -1;
+    }
+
+    if (need_reply) {
+        if (vhost_user_recv(dev, &msg) < 0) {
+            return -1;
+        }
+
+        if (msg_request != msg.request) {
+            error_report("vhost-user: received unexpected reply %d "
+                         "to request %d", msg.request, msg_request);
+            errno = EPROTO;
+            return -1;
+        }
+
+        switch (msg_request) {
+        case VHOST_USER_GET_FEATURES:
+            if (msg.size != sizeof(msg.u64)) {
+                errno = EPROTO;
+                return -1;
+            }
+            *((uint64_t *) arg) = msg.u64;
+            break;
+        case VHOST_USER_GET_VRING_BASE:
+            if (msg.size != sizeof(msg.state)) {
+                errno = EPROTO;
+                return -1;
+            }
+            state = arg;
+            state->num = msg.state.num;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int vhost_user_init(struct vhost_dev *dev)
+{
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
+
+    /* The socket is already connected; there is nothing to open. */
+    return 0;
+}
+
+static int vhost_user_cleanup(struct vhost_dev *dev)
+{
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
+
+    return 0;
+}
+
+static const VhostOps user_ops = {
+    .backend_type = VHOST_BACKEND_TYPE_USER,
+    .vhost_call = vhost_user_call,
+    .vhost_backend_init = vhost_user_init,
+    .vhost_backend_cleanup = vhost_user_cleanup,
+};
+
+int vhost_set_backend_type(struct vhost_dev *dev,
+                           VhostBackendType backend_type)
+{
+    int r = 0;
+
+    switch (backend_type) {
+    case VHOST_BACKEND_TYPE_KERNEL:
+        dev->vhost_ops = &kernel_ops;
+        break;
+    case VHOST_BACKEND_TYPE_USER:
+        dev->vhost_ops = &user_ops;
+        break;
+    default:
+        error_report("Unknown vhost backend type");
+        r = -1;
+    }
+
+    return r;
+}
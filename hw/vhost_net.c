@@ -15,6 +15,7 @@
 
 #include "net.h"
 #include "net/tap.h"
+#include "net/vhost-user.h"
 
 #include "virtio-net.h"
 #include "vhost_net.h"
@@ -85,8 +86,11 @@ static int vhost_net_get_fd(NetClientState *backend)
     switch (backend->info->type) {
     case NET_CLIENT_OPTIONS_KIND_TAP:
         return tap_get_fd(backend);
+    case NET_CLIENT_OPTIONS_KIND_VHOST_USER:
+        /* the backend process owns the data path */
+        return 0;
     default:
-        fprintf(stderr, "vhost-net requires tap backend\n");
+        fprintf(stderr, "vhost-net requires tap or vhost-user backend\n");
         return -EBADFD;
     }
 }
@@ -95,6 +99,7 @@ struct vhost_net *vhost_net_init(NetClientState *backend, int devfd,
                                  bool force)
 {
     int r;
+    bool is_tap;
     struct vhost_net *net = g_malloc(sizeof *net);
     if (!backend) {
         fprintf(stderr, "vhost-net requires backend to be setup\n");
@@ -104,16 +109,20 @@ struct vhost_net *vhost_net_init(NetClientState *backend, int devfd,
     if (r < 0) {
         goto fail;
     }
+    is_tap = backend->info->type == NET_CLIENT_OPTIONS_KIND_TAP;
     net->nc = backend;
-    net->dev.backend_features = tap_has_vnet_hdr(backend) ? 0 :
+    net->dev.backend_features = !is_tap || tap_has_vnet_hdr(backend) ? 0 :
         (1 << VHOST_NET_F_VIRTIO_NET_HDR);
-    net->backend = r;
+    net->backend = is_tap ? r : -1;
 
-    r = vhost_dev_init(&net->dev, devfd, "/dev/vhost-net", force);
+    r = vhost_dev_init(&net->dev, devfd, "/dev/vhost-net",
+                       is_tap ? VHOST_BACKEND_TYPE_KERNEL :
+                       VHOST_BACKEND_TYPE_USER, force);
     if (r < 0) {
         goto fail;
     }
-    if (!tap_has_vnet_hdr_len(backend,
+    if (is_tap &&
+        !tap_has_vnet_hdr_len(backend,
                               sizeof(struct virtio_net_hdr_mrg_rxbuf))) {
         net->dev.features &= ~(1 << VIRTIO_NET_F_MRG_RXBUF);
     }
@@ -150,7 +159,8 @@ int vhost_net_start(struct vhost_net *net,
     if (r < 0) {
         goto fail_notifiers;
     }
-    if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
+    if (net->backend >= 0 &&
+        (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF))) {
         tap_set_vnet_hdr_len(net->nc,
                              sizeof(struct virtio_net_hdr_mrg_rxbuf));
     }
@@ -160,6 +170,11 @@ int vhost_net_start(struct vhost_net *net,
         goto fail_start;
     }
 
+    if (net->backend < 0) {
+        /* vhost-user: the backend process already owns the rings */
+        return 0;
+    }
+
     net->nc->info->poll(net->nc, false);
     qemu_set_fd_handler(net->backend, NULL, NULL, NULL);
     file.fd = net->backend;
@@ -193,6 +208,11 @@ void vhost_net_stop(struct vhost_net *net,
 {
     struct vhost_vring_file file = { .fd = -1 };
 
+    if (net->backend < 0) {
+        vhost_dev_stop(&net->dev, dev);
+        vhost_dev_disable_notifiers(&net->dev, dev);
+        return;
+    }
     for (file.index = 0; file.index < net->dev.nvqs; ++file.index) {
         int r = ioctl(net->dev.control, VHOST_NET_SET_BACKEND, &file);
         assert(r >= 0);
@@ -208,7 +228,8 @@ void vhost_net_stop(struct vhost_net *net,
 void vhost_net_cleanup(struct vhost_net *net)
 {
     vhost_dev_cleanup(&net->dev);
-    if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
+    if (net->backend >= 0 &&
+        (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF))) {
         tap_set_vnet_hdr_len(net->nc, sizeof(struct virtio_net_hdr));
     }
     g_free(net);
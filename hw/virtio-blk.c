@@ -16,6 +16,7 @@
 #include "trace.h"
 #include "hw/block-common.h"
 #include "blockdev.h"
+#include "iothread.h"
 #include "virtio-blk.h"
 #include "scsi-defs.h"
 #ifdef __linux__
@@ -33,6 +34,13 @@ typedef struct VirtIOBlock
     VirtIOBlkConf *blk;
     unsigned short sector_mask;
     DeviceState *qdev;
+
+    /* Set when requests run in an I/O thread; their completions are
+     * queued on done and handed to the main loop by done_bh */
+    AioContext *ctx;
+    QemuMutex done_lock;
+    struct VirtIOBlockReq *done;
+    QEMUBH *done_bh;
 } VirtIOBlock;
 
 static VirtIOBlock *to_virtio_blk(VirtIODevice *vdev)
@@ -50,6 +58,8 @@ typedef struct VirtIOBlockReq
     QEMUIOVector qiov;
     struct VirtIOBlockReq *next;
     BlockAcctCookie acct;
+    BlockDriverCompletionFunc *complete;
+    int ret;
 } VirtIOBlockReq;
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, int status)
@@ -114,6 +124,47 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
     g_free(req);
 }
 
+/* Runs in the I/O thread; the virtqueue belongs to the main loop */
+static void virtio_blk_complete_deferred(void *opaque, int ret)
+{
+    VirtIOBlockReq *req = opaque;
+    VirtIOBlock *s = req->dev;
+
+    req->ret = ret;
+    qemu_mutex_lock(&s->done_lock);
+    req->next = s->done;
+    s->done = req;
+    qemu_mutex_unlock(&s->done_lock);
+    qemu_bh_schedule(s->done_bh);
+}
+
+static void virtio_blk_done_bh(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    VirtIOBlockReq *req, *next;
+
+    qemu_mutex_lock(&s->done_lock);
+    req = s->done;
+    s->done = NULL;
+    qemu_mutex_unlock(&s->done_lock);
+
+    for (; req; req = next) {
+        next = req->next;
+        req->complete(req, req->ret);
+    }
+}
+
+/* The completion callback to pass to the block layer for @req */
+static BlockDriverCompletionFunc *virtio_blk_cb(VirtIOBlockReq *req,
+                                                BlockDriverCompletionFunc *cb)
+{
+    if (!req->dev->ctx) {
+        return cb;
+    }
+    req->complete = cb;
+    return virtio_blk_complete_deferred;
+}
+
 static VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s)
 {
     VirtIOBlockReq *req = g_malloc(sizeof(*req));
@@ -290,7 +341,8 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
      * Make sure all outstanding writes are posted to the backing device.
      */
     virtio_submit_multiwrite(req->dev->bs, mrb);
-    bdrv_aio_flush(req->dev->bs, virtio_blk_flush_complete, req);
+    bdrv_aio_flush(req->dev->bs, virtio_blk_cb(req, virtio_blk_flush_complete),
+                   req);
 }
 
 static void virtio_blk_handle_write(VirtIOBlockReq *req, MultiReqBuffer *mrb)
@@ -321,7 +373,7 @@ static void virtio_blk_handle_write(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     blkreq->sector = sector;
     blkreq->nb_sectors = req->qiov.size / BDRV_SECTOR_SIZE;
     blkreq->qiov = &req->qiov;
-    blkreq->cb = virtio_blk_rw_complete;
+    blkreq->cb = virtio_blk_cb(req, virtio_blk_rw_complete);
     blkreq->opaque = req;
     blkreq->error = 0;
 
@@ -348,7 +400,7 @@ static void virtio_blk_handle_read(VirtIOBlockReq *req)
     }
     bdrv_aio_readv(req->dev->bs, sector, &req->qiov,
                    req->qiov.size / BDRV_SECTOR_SIZE,
-                   virtio_blk_rw_complete, req);
+                   virtio_blk_cb(req, virtio_blk_rw_complete), req);
 }
 
 static void virtio_blk_handle_request(VirtIOBlockReq *req,
@@ -407,11 +459,17 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
         .num_writes = 0,
     };
 
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
     while ((req = virtio_blk_get_request(s))) {
         virtio_blk_handle_request(req, &mrb);
     }
 
     virtio_submit_multiwrite(s->bs, &mrb);
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
 
     /*
      * FIXME: Want to check for completions before returning to guest mode,
@@ -433,12 +491,18 @@ static void virtio_blk_dma_restart_bh(void *opaque)
 
     s->rq = NULL;
 
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
     while (req) {
         virtio_blk_handle_request(req, &mrb);
         req = req->next;
     }
 
     virtio_submit_multiwrite(s->bs, &mrb);
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
 }
 
 static void virtio_blk_dma_restart_cb(void *opaque, int running,
@@ -603,6 +667,7 @@ static const BlockDevOps virtio_block_ops = {
 VirtIODevice *virtio_blk_init(DeviceState *dev, VirtIOBlkConf *blk)
 {
     VirtIOBlock *s;
+    AioContext *ctx = NULL;
     static int virtio_blk_id;
 
     if (!blk->conf.bs) {
@@ -619,6 +684,25 @@ VirtIODevice *virtio_blk_init(DeviceState *dev, VirtIOBlkConf *blk)
         return NULL;
     }
 
+    if (blk->iothread) {
+        IOThread *iothread = iothread_find(blk->iothread);
+        int ret;
+
+        if (!iothread) {
+            error_report("iothread '%s' not found", blk->iothread);
+            return NULL;
+        }
+        ctx = iothread_get_aio_context(iothread);
+        aio_context_acquire(ctx);
+        ret = bdrv_set_aio_context(blk->conf.bs, ctx);
+        aio_context_release(ctx);
+        if (ret < 0) {
+            error_report("drive cannot be used with an iothread: %s",
+                         strerror(-ret));
+            return NULL;
+        }
+    }
+
     s = (VirtIOBlock *)virtio_common_init("virtio-blk", VIRTIO_ID_BLOCK,
                                           sizeof(struct virtio_blk_config),
                                           sizeof(VirtIOBlock));
@@ -633,6 +717,11 @@ VirtIODevice *virtio_blk_init(DeviceState *dev, VirtIOBlkConf *blk)
     s->blk = blk;
     s->rq = NULL;
     s->sector_mask = (s->conf->logical_block_size / BDRV_SECTOR_SIZE) - 1;
+    s->ctx = ctx;
+    if (ctx) {
+        qemu_mutex_init(&s->done_lock);
+        s->done_bh = qemu_bh_new(virtio_blk_done_bh, s);
+    }
 
     s->vq = virtio_add_queue(&s->vdev, 128, virtio_blk_handle_output);
 
@@ -652,6 +741,16 @@ VirtIODevice *virtio_blk_init(DeviceState *dev, VirtIOBlkConf *blk)
 void virtio_blk_exit(VirtIODevice *vdev)
 {
     VirtIOBlock *s = to_virtio_blk(vdev);
+
+    if (s->ctx) {
+        /* completes the requests in flight; their completions follow */
+        aio_context_acquire(s->ctx);
+        bdrv_set_aio_context(s->bs, qemu_get_aio_context());
+        aio_context_release(s->ctx);
+        virtio_blk_done_bh(s);
+        qemu_bh_delete(s->done_bh);
+        qemu_mutex_destroy(&s->done_lock);
+    }
     unregister_savevm(s->qdev, "virtio-blk", s);
     blockdev_mark_auto_del(s->bs);
     virtio_cleanup(vdev);
@@ -105,6 +105,7 @@ struct VirtIOBlkConf
     char *serial;
     uint32_t scsi;
     uint32_t config_wce;
+    char *iothread;
 };
 
 #define DEFINE_VIRTIO_BLK_FEATURES(_state, _field) \
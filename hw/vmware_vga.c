@@ -311,23 +311,27 @@ static inline void vmsvga_update_rect(struct vmsvga_state_s *s,
         h = s->height - y;
     }
 
-    line = h;
-    bypl = s->bypp * s->width;
-    width = s->bypp * w;
-    start = s->bypp * x + bypl * y;
-    src = s->vga.vram_ptr + start;
-    dst = ds_get_data(s->vga.ds) + start;
-
-    for (; line > 0; line --, src += bypl, dst += bypl)
-        memcpy(dst, src, width);
+    if (!is_buffer_shared(s->vga.ds->surface)) {
+        line = h;
+        bypl = s->bypp * s->width;
+        width = s->bypp * w;
+        start = s->bypp * x + bypl * y;
+        src = s->vga.vram_ptr + start;
+        dst = ds_get_data(s->vga.ds) + start;
+
+        for (; line > 0; line --, src += bypl, dst += bypl)
+            memcpy(dst, src, width);
+    }
 
     dpy_update(s->vga.ds, x, y, w, h);
 }
 
 static inline void vmsvga_update_screen(struct vmsvga_state_s *s)
 {
-    memcpy(ds_get_data(s->vga.ds), s->vga.vram_ptr,
-           s->bypp * s->width * s->height);
+    if (!is_buffer_shared(s->vga.ds->surface)) {
+        memcpy(ds_get_data(s->vga.ds), s->vga.vram_ptr,
+               s->bypp * s->width * s->height);
+    }
     dpy_update(s->vga.ds, 0, 0, s->width, s->height);
 }
 
@@ -941,7 +945,12 @@ static inline void vmsvga_size(struct vmsvga_state_s *s)
     if (s->new_width != s->width || s->new_height != s->height) {
         s->width = s->new_width;
         s->height = s->new_height;
-        qemu_console_resize(s->vga.ds, s->width, s->height);
+        /* The framebuffer is in the display's own pixel format (see
+           s->depth), so the display can read it straight from VRAM.  */
+        qemu_free_displaysurface(s->vga.ds);
+        s->vga.ds->surface = qemu_create_displaysurface_from(s->width,
+                s->height, s->depth, s->bypp * s->width, s->vga.vram_ptr);
+        dpy_resize(s->vga.ds);
         s->invalidated = 1;
     }
 }
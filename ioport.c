@@ -28,6 +28,7 @@
 #include "ioport.h"
 #include "trace.h"
 #include "memory.h"
+#include "main-loop.h"
 
 /***********************************************************/
 /* IO Port */
@@ -65,8 +66,17 @@ static uint32_t ioport_read(int index, uint32_t address)
         default_ioport_readl
     };
     IOPortReadFunc *func = ioport_read_table[index][address];
+    uint32_t data;
+
     if (!func)
         func = default_func[index];
+    /* multi-threaded TCG vCPUs run without the iothread lock */
+    if (mttcg_enabled && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        data = func(ioport_opaque[address], address);
+        qemu_mutex_unlock_iothread();
+        return data;
+    }
     return func(ioport_opaque[address], address);
 }
 
@@ -80,6 +90,12 @@ static void ioport_write(int index, uint32_t address, uint32_t data)
     IOPortWriteFunc *func = ioport_write_table[index][address];
     if (!func)
         func = default_func[index];
+    if (mttcg_enabled && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        func(ioport_opaque[address], address, data);
+        qemu_mutex_unlock_iothread();
+        return;
+    }
     func(ioport_opaque[address], address, data);
 }
 
@@ -0,0 +1,115 @@
+/*
+ * Event loop threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu-error.h"
+#include "qemu-thread.h"
+#include "iothread.h"
+
+struct IOThread {
+    char *id;
+    QemuThread thread;
+    AioContext *ctx;
+
+    /* Never written; its flush handler makes aio_poll block when idle */
+    int idle_fds[2];
+
+    QTAILQ_ENTRY(IOThread) next;
+};
+
+static QTAILQ_HEAD(, IOThread) iothreads =
+    QTAILQ_HEAD_INITIALIZER(iothreads);
+
+static void iothread_idle_read(void *opaque)
+{
+}
+
+static int iothread_idle_flush(void *opaque)
+{
+    return 1;
+}
+
+static int iothread_idle_init(IOThread *iothread)
+{
+#ifndef _WIN32
+    return qemu_eventfd(iothread->idle_fds);
+#else
+    /* aio_context_new already failed */
+    return -1;
+#endif
+}
+
+static void *iothread_run(void *opaque)
+{
+    IOThread *iothread = opaque;
+
+    for (;;) {
+        aio_context_acquire(iothread->ctx);
+        aio_poll(iothread->ctx, true);
+        aio_context_release(iothread->ctx);
+    }
+    return NULL;
+}
+
+int iothread_create(QemuOpts *opts)
+{
+    const char *id = qemu_opts_id(opts);
+    IOThread *iothread;
+    AioContext *ctx;
+
+    if (!id) {
+        error_report("-iothread: id is required");
+        return -1;
+    }
+    if (iothread_find(id)) {
+        error_report("-iothread: duplicate id '%s'", id);
+        return -1;
+    }
+
+    ctx = aio_context_new();
+    if (!ctx) {
+        error_report("-iothread: event loop threads are not supported "
+                     "on this host");
+        return -1;
+    }
+
+    iothread = g_malloc0(sizeof(*iothread));
+    iothread->id = g_strdup(id);
+    iothread->ctx = ctx;
+    if (iothread_idle_init(iothread) == -1) {
+        error_report("-iothread: cannot create descriptor: %s",
+                     strerror(errno));
+        aio_context_free(ctx);
+        g_free(iothread->id);
+        g_free(iothread);
+        return -1;
+    }
+    aio_set_fd_handler(ctx, iothread->idle_fds[0], iothread_idle_read, NULL,
+                       iothread_idle_flush, iothread);
+
+    QTAILQ_INSERT_TAIL(&iothreads, iothread, next);
+    qemu_thread_create(&iothread->thread, iothread_run, iothread,
+                       QEMU_THREAD_DETACHED);
+    return 0;
+}
+
+IOThread *iothread_find(const char *id)
+{
+    IOThread *iothread;
+
+    QTAILQ_FOREACH(iothread, &iothreads, next) {
+        if (!strcmp(iothread->id, id)) {
+            return iothread;
+        }
+    }
+    return NULL;
+}
+
+AioContext *iothread_get_aio_context(IOThread *iothread)
+{
+    return iothread->ctx;
+}
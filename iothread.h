@@ -0,0 +1,37 @@
+/*
+ * Event loop threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef IOTHREAD_H
+#define IOTHREAD_H
+
+#include "qemu-aio.h"
+#include "qemu-option.h"
+
+typedef struct IOThread IOThread;
+
+/**
+ * iothread_create: Start the thread described by an -iothread option.
+ *
+ * The thread runs its own AioContext until QEMU exits.  Returns 0 on
+ * success, -1 after reporting an error.
+ */
+int iothread_create(QemuOpts *opts);
+
+/**
+ * iothread_find: Return the thread with id @id, or NULL.
+ */
+IOThread *iothread_find(const char *id);
+
+/**
+ * iothread_get_aio_context: Return the context run by @iothread.
+ *
+ * Other threads must acquire it with aio_context_acquire before using
+ * the block devices attached to it.
+ */
+AioContext *iothread_get_aio_context(IOThread *iothread);
+
+#endif
@@ -39,6 +39,7 @@ struct qemu_laio_state {
     io_context_t ctx;
     int efd;
     int count;
+    AioContext *aio_context;
 };
 
 static inline ssize_t io_event_ret(struct io_event *ev)
@@ -200,6 +201,23 @@ out_free_aiocb:
     return NULL;
 }
 
+void laio_detach_aio_context(void *s_)
+{
+    struct qemu_laio_state *s = s_;
+
+    aio_set_fd_handler(s->aio_context, s->efd, NULL, NULL, NULL, NULL);
+    s->aio_context = NULL;
+}
+
+void laio_attach_aio_context(void *s_, AioContext *new_context)
+{
+    struct qemu_laio_state *s = s_;
+
+    s->aio_context = new_context;
+    aio_set_fd_handler(new_context, s->efd, qemu_laio_completion_cb, NULL,
+        qemu_laio_flush_cb, s);
+}
+
 void *laio_init(void)
 {
     struct qemu_laio_state *s;
@@ -213,9 +231,7 @@ void *laio_init(void)
     if (io_setup(MAX_EVENTS, &s->ctx) != 0)
         goto out_close_efd;
 
-    qemu_aio_set_fd_handler(s->efd, qemu_laio_completion_cb, NULL,
-        qemu_laio_flush_cb, s);
-
+    laio_attach_aio_context(s, qemu_get_aio_context());
     return s;
 
 out_close_efd:
@@ -3186,6 +3186,16 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tcg_traces(const char *arg)
+{
+    tcg_trace_threshold = strtoul(arg, NULL, 0);
+}
+
+static void handle_arg_tcg_perfmap(const char *arg)
+{
+    tcg_perfmap_open();
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3240,6 +3250,10 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tcg-traces", "QEMU_TCG_TRACES",  true,  handle_arg_tcg_traces,
+     "count",      "retranslate blocks executed 'count' times as traces"},
+    {"tcg-perfmap", "QEMU_TCG_PERFMAP", false, handle_arg_tcg_perfmap,
+     "",           "write /tmp/perf-<pid>.map for the translated code"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
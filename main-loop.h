@@ -89,6 +89,20 @@ int main_loop_init(void);
  */
 int main_loop_wait(int nonblocking);
 
+/**
+ * qemu_poll_ns: Wait for events on an array of file descriptors.
+ *
+ * Like g_poll, but with a timeout in nanoseconds.  On hosts that have
+ * ppoll the timeout is honored with full precision, otherwise it is
+ * rounded up to the next millisecond.
+ *
+ * @fds: The descriptors and the events to wait for.
+ * @nfds: The number of entries in @fds.
+ * @timeout: The timeout in nanoseconds, or a negative value to wait
+ * until an event occurs.
+ */
+int qemu_poll_ns(GPollFD *fds, guint nfds, int64_t timeout);
+
 /**
  * qemu_notify_event: Force processing of pending events.
  *
@@ -353,11 +367,21 @@ void qemu_mutex_lock_iothread(void);
  */
 void qemu_mutex_unlock_iothread(void);
 
+/**
+ * qemu_mutex_iothread_locked: Return whether the calling thread holds
+ * the main loop mutex.
+ *
+ * Multi-threaded TCG vCPUs execute guest code without the mutex and use
+ * this to decide whether they must take it before calling into device
+ * emulation.
+ */
+bool qemu_mutex_iothread_locked(void);
+
 /* internal interfaces */
 
 void qemu_fd_register(int fd);
-void qemu_iohandler_fill(int *pnfds, fd_set *readfds, fd_set *writefds, fd_set *xfds);
-void qemu_iohandler_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds, int rc);
+void qemu_iohandler_fill(GArray *pollfds);
+void qemu_iohandler_poll(GArray *pollfds, int rc);
 
 void qemu_bh_schedule_idle(QEMUBH *bh);
 int qemu_bh_poll(void);
@@ -18,14 +18,27 @@
 #include "ioport.h"
 #include "bitops.h"
 #include "kvm.h"
+#include "main-loop.h"
+#include "qemu-timer.h"
 #include <assert.h>
 
 #define WANT_EXEC_OBSOLETE
 #include "exec-obsolete.h"
 
 unsigned memory_region_transaction_depth = 0;
+static bool memory_region_update_pending = false;
+static bool ioeventfd_update_pending = false;
 static bool global_dirty_log = false;
 
+/* Statistics for "info mtree" */
+static struct {
+    unsigned commits;
+    unsigned updates;
+    unsigned unchanged;
+    unsigned ioeventfd_only;
+    int64_t update_time;
+} memory_topology_stats;
+
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
 
@@ -268,6 +281,22 @@ static void flatview_destroy(FlatView *view)
     g_free(view->ranges);
 }
 
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; ++i) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool can_merge(FlatRange *r1, FlatRange *r2)
 {
     return int128_eq(addrrange_end(r1->addr), r2->addr.start)
@@ -718,10 +747,10 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
-static void address_space_update_topology(AddressSpace *as)
+static void address_space_update_topology(AddressSpace *as,
+                                          FlatView new_view)
 {
     FlatView old_view = as->current_map;
-    FlatView new_view = generate_memory_topology(as->root);
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
@@ -731,6 +760,56 @@ static void address_space_update_topology(AddressSpace *as)
     address_space_update_ioeventfds(as);
 }
 
+/*
+ * Render the new views first and only replay them to the listeners if
+ * one of them differs from the current one.  Listeners may do expensive
+ * work on begin/commit (the core listener rebuilds the physical page map
+ * and flushes every TLB), and many transactions end up not changing the
+ * flattened view at all: regions that are not mapped yet, PCI BARs
+ * programmed with their old value, and so on.
+ */
+static void memory_region_update_topology(void)
+{
+    FlatView mem_view, io_view;
+    bool mem_changed = false, io_changed = false;
+    int64_t start = get_clock();
+
+    flatview_init(&mem_view);
+    flatview_init(&io_view);
+    if (address_space_memory.root) {
+        mem_view = generate_memory_topology(address_space_memory.root);
+        mem_changed = !flatview_equal(&mem_view,
+                                      &address_space_memory.current_map);
+    }
+    if (address_space_io.root) {
+        io_view = generate_memory_topology(address_space_io.root);
+        io_changed = !flatview_equal(&io_view, &address_space_io.current_map);
+    }
+
+    if (!mem_changed && !io_changed) {
+        flatview_destroy(&mem_view);
+        flatview_destroy(&io_view);
+        memory_topology_stats.unchanged++;
+        if (ioeventfd_update_pending) {
+            address_space_update_ioeventfds(&address_space_memory);
+            address_space_update_ioeventfds(&address_space_io);
+        }
+    } else {
+        MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+
+        if (address_space_memory.root) {
+            address_space_update_topology(&address_space_memory, mem_view);
+        }
+        if (address_space_io.root) {
+            address_space_update_topology(&address_space_io, io_view);
+        }
+
+        MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+        memory_topology_stats.updates++;
+    }
+    memory_topology_stats.update_time += get_clock() - start;
+}
+
 void memory_region_transaction_begin(void)
 {
     qemu_flush_coalesced_mmio_buffer();
@@ -742,16 +821,17 @@ void memory_region_transaction_commit(void)
     assert(memory_region_transaction_depth);
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
-        MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
-
-        if (address_space_memory.root) {
-            address_space_update_topology(&address_space_memory);
+        memory_topology_stats.commits++;
+        if (memory_region_update_pending) {
+            memory_region_update_topology();
+        } else if (ioeventfd_update_pending) {
+            /* only ioeventfds changed, the flattened views are still valid */
+            address_space_update_ioeventfds(&address_space_memory);
+            address_space_update_ioeventfds(&address_space_io);
+            memory_topology_stats.ioeventfd_only++;
         }
-        if (address_space_io.root) {
-            address_space_update_topology(&address_space_io);
-        }
-
-        MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+        memory_region_update_pending = false;
+        ioeventfd_update_pending = false;
     }
 }
 
@@ -1062,6 +1142,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1097,6 +1178,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
 }
@@ -1106,6 +1188,7 @@ void memory_region_rom_device_set_readable(MemoryRegion *mr, bool readable)
     if (mr->readable != readable) {
         memory_region_transaction_begin();
         mr->readable = readable;
+        memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
 }
@@ -1229,6 +1312,7 @@ void memory_region_add_eventfd(MemoryRegion *mr,
     memmove(&mr->ioeventfds[i+1], &mr->ioeventfds[i],
             sizeof(*mr->ioeventfds) * (mr->ioeventfd_nb-1 - i));
     mr->ioeventfds[i] = mrfd;
+    ioeventfd_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1260,6 +1344,7 @@ void memory_region_del_eventfd(MemoryRegion *mr,
     --mr->ioeventfd_nb;
     mr->ioeventfds = g_realloc(mr->ioeventfds,
                                   sizeof(*mr->ioeventfds)*mr->ioeventfd_nb + 1);
+    ioeventfd_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1303,6 +1388,7 @@ static void memory_region_add_subregion_common(MemoryRegion *mr,
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1333,6 +1419,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
     assert(subregion->parent == mr);
     subregion->parent = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1343,6 +1430,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
 
@@ -1377,6 +1465,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, target_phys_addr_t offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1511,6 +1600,7 @@ void set_system_memory_map(MemoryRegion *mr)
 {
     memory_region_transaction_begin();
     address_space_memory.root = mr;
+    memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
 
@@ -1518,17 +1608,33 @@ void set_system_io_map(MemoryRegion *mr)
 {
     memory_region_transaction_begin();
     address_space_io.root = mr;
+    memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
 
 uint64_t io_mem_read(MemoryRegion *mr, target_phys_addr_t addr, unsigned size)
 {
+    uint64_t val;
+
+    /* multi-threaded TCG vCPUs run without the iothread lock */
+    if (mttcg_enabled && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        val = memory_region_dispatch_read(mr, addr, size);
+        qemu_mutex_unlock_iothread();
+        return val;
+    }
     return memory_region_dispatch_read(mr, addr, size);
 }
 
 void io_mem_write(MemoryRegion *mr, target_phys_addr_t addr,
                   uint64_t val, unsigned size)
 {
+    if (mttcg_enabled && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        memory_region_dispatch_write(mr, addr, val, size);
+        qemu_mutex_unlock_iothread();
+        return;
+    }
     memory_region_dispatch_write(mr, addr, val, size);
 }
 
@@ -1662,4 +1768,11 @@ void mtree_info(fprintf_function mon_printf, void *f)
     QTAILQ_FOREACH_SAFE(ml, &ml_head, queue, ml2) {
         g_free(ml);
     }
+
+    mon_printf(f, "topology: %u commits, %u updates, %u unchanged, "
+               "%u ioeventfd only, %" PRId64 " us\n",
+               memory_topology_stats.commits, memory_topology_stats.updates,
+               memory_topology_stats.unchanged,
+               memory_topology_stats.ioeventfd_only,
+               memory_topology_stats.update_time / 1000);
 }
@@ -53,7 +53,7 @@ static NotifierList migration_state_notifiers =
    migrations at once.  For now we don't need to add
    dynamic creation of migration */
 
-static MigrationState *migrate_get_current(void)
+MigrationState *migrate_get_current(void)
 {
     static MigrationState current_migration = {
         .state = MIG_STATE_SETUP,
@@ -494,6 +494,12 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    /* a live dump owns the dirty log until it stops the guest */
+    if (dump_in_progress()) {
+        error_setg(errp, "guest memory is being dumped");
+        return;
+    }
+
     if (qemu_savevm_state_blocked(errp)) {
         return;
     }
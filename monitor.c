@@ -927,6 +927,16 @@ static void do_info_jit(Monitor *mon)
     dump_exec_info((FILE *)mon, monitor_fprintf);
 }
 
+static void do_info_ramblock(Monitor *mon)
+{
+    ram_block_info((FILE *)mon, monitor_fprintf);
+}
+
+static void do_info_tbs(Monitor *mon)
+{
+    dump_tb_profile((FILE *)mon, monitor_fprintf, 20);
+}
+
 static void do_info_history(Monitor *mon)
 {
     int i;
@@ -2545,6 +2555,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler info",
         .mhandler.info = do_info_jit,
     },
+    {
+        .name       = "tbs",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the most executed translation blocks",
+        .mhandler.info = do_info_tbs,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
@@ -2552,6 +2569,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show KVM information",
         .mhandler.info = hmp_info_kvm,
     },
+    {
+        .name       = "dump",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the progress of the guest memory dump",
+        .mhandler.info = hmp_info_dump,
+    },
     {
         .name       = "numa",
         .args_type  = "",
@@ -2559,6 +2583,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show NUMA information",
         .mhandler.info = do_info_numa,
     },
+    {
+        .name       = "ramblock",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show RAM blocks and their host NUMA placement",
+        .mhandler.info = do_info_ramblock,
+    },
     {
         .name       = "usb",
         .args_type  = "",
@@ -2580,6 +2611,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show profiling information",
         .mhandler.info = do_info_profile,
     },
+    {
+        .name       = "timers",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show timer statistics",
+        .mhandler.info = do_info_timers,
+    },
     {
         .name       = "capture",
         .args_type  = "",
@@ -0,0 +1,91 @@
+/*
+ * vhost-user network backend
+ *
+ * The data path lives in a separate process that QEMU talks to over a
+ * UNIX domain socket (see hw/vhost-user.h for the protocol).  This net
+ * client only carries the vhost control state; packets are never
+ * exchanged through the QEMU net layer once vhost is running.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "net/vhost-user.h"
+
+#include "net.h"
+#include "qemu-error.h"
+#include "qemu_socket.h"
+#include "hw/vhost_net.h"
+
+typedef struct VhostUserState {
+    NetClientState nc;
+    VHostNetState *vhost_net;
+} VhostUserState;
+
+static ssize_t vhost_user_receive(NetClientState *nc, const uint8_t *buf,
+                                  size_t size)
+{
+    /* Only reached when the guest driver runs without vhost; there is
+     * no userspace data path to the backend, so drop the packet. */
+    return size;
+}
+
+static void vhost_user_cleanup(NetClientState *nc)
+{
+    VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
+
+    if (s->vhost_net) {
+        vhost_net_cleanup(s->vhost_net);
+        s->vhost_net = NULL;
+    }
+}
+
+static NetClientInfo net_vhost_user_info = {
+    .type = NET_CLIENT_OPTIONS_KIND_VHOST_USER,
+    .size = sizeof(VhostUserState),
+    .receive = vhost_user_receive,
+    .cleanup = vhost_user_cleanup,
+};
+
+VHostNetState *vhost_user_get_vhost_net(NetClientState *nc)
+{
+    VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_OPTIONS_KIND_VHOST_USER);
+    return s->vhost_net;
+}
+
+int net_init_vhost_user(const NetClientOptions *opts, const char *name,
+                        NetClientState *peer)
+{
+    const NetdevVhostUserOptions *vhost_user;
+    NetClientState *nc;
+    VhostUserState *s;
+    int fd;
+
+    assert(opts->kind == NET_CLIENT_OPTIONS_KIND_VHOST_USER);
+    vhost_user = opts->vhost_user;
+
+    fd = unix_connect(vhost_user->path);
+    if (fd < 0) {
+        error_report("vhost-user: could not connect to %s", vhost_user->path);
+        return -1;
+    }
+
+    nc = qemu_new_net_client(&net_vhost_user_info, peer, "vhost-user", name);
+    snprintf(nc->info_str, sizeof(nc->info_str), "path=%s,fd=%d",
+             vhost_user->path, fd);
+
+    s = DO_UPCAST(VhostUserState, nc, nc);
+
+    /* the vhost device takes ownership of fd */
+    s->vhost_net = vhost_net_init(nc, fd, true);
+    if (!s->vhost_net) {
+        error_report("vhost-user: backend %s could not be initialized",
+                     vhost_user->path);
+        qemu_del_net_client(nc);
+        return -1;
+    }
+
+    return 0;
+}
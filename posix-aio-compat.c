@@ -35,6 +35,8 @@
 
 static void do_spawn_thread(void);
 
+typedef struct PosixAioState PosixAioState;
+
 struct qemu_paiocb {
     BlockDriverAIOCB common;
     int aio_fildes;
@@ -51,13 +53,17 @@ struct qemu_paiocb {
     int aio_type;
     ssize_t ret;
     int active;
+    PosixAioState *state;
     struct qemu_paiocb *next;
 };
 
-typedef struct PosixAioState {
+/* Completion notifier, one per AioContext that submitted requests */
+struct PosixAioState {
     int rfd, wfd;
+    AioContext *ctx;
     struct qemu_paiocb *first_aio;
-} PosixAioState;
+    QLIST_ENTRY(PosixAioState) next;
+};
 
 
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
@@ -71,6 +77,8 @@ static int new_threads = 0;     /* backlog of threads we need to create */
 static int pending_threads = 0; /* threads created but not running yet */
 static QEMUBH *new_thread_bh;
 static QTAILQ_HEAD(, qemu_paiocb) request_list;
+static QLIST_HEAD(, PosixAioState) posix_aio_states =
+    QLIST_HEAD_INITIALIZER(posix_aio_states);
 
 #ifdef CONFIG_PREADV
 static int preadv_present = 1;
@@ -310,7 +318,7 @@ static ssize_t handle_aiocb_rw(struct qemu_paiocb *aiocb)
     return nbytes;
 }
 
-static void posix_aio_notify_event(void);
+static void posix_aio_notify_event(PosixAioState *s);
 
 static void *aio_thread(void *unused)
 {
@@ -321,6 +329,7 @@ static void *aio_thread(void *unused)
 
     while (1) {
         struct qemu_paiocb *aiocb;
+        PosixAioState *state;
         ssize_t ret = 0;
         qemu_timeval tv;
         struct timespec ts;
@@ -373,11 +382,13 @@ static void *aio_thread(void *unused)
             break;
         }
 
+        /* aiocb may be freed as soon as ret is set, fetch the state first */
+        state = aiocb->state;
         mutex_lock(&lock);
         aiocb->ret = ret;
         mutex_unlock(&lock);
 
-        posix_aio_notify_event();
+        posix_aio_notify_event(state);
     }
 
     cur_threads--;
@@ -532,12 +543,12 @@ static int posix_aio_flush(void *opaque)
 
 static PosixAioState *posix_aio_state;
 
-static void posix_aio_notify_event(void)
+static void posix_aio_notify_event(PosixAioState *s)
 {
     char byte = 0;
     ssize_t ret;
 
-    ret = write(posix_aio_state->wfd, &byte, sizeof(byte));
+    ret = write(s->wfd, &byte, sizeof(byte));
     if (ret < 0 && errno != EAGAIN)
         die("write()");
 }
@@ -547,7 +558,7 @@ static void paio_remove(struct qemu_paiocb *acb)
     struct qemu_paiocb **pacb;
 
     /* remove the callback from the queue */
-    pacb = &posix_aio_state->first_aio;
+    pacb = &acb->state->first_aio;
     for(;;) {
         if (*pacb == NULL) {
             fprintf(stderr, "paio_remove: aio request not found!\n");
@@ -587,6 +598,62 @@ static void paio_cancel(BlockDriverAIOCB *blockacb)
     paio_remove(acb);
 }
 
+static PosixAioState *posix_aio_state_new(AioContext *ctx)
+{
+    PosixAioState *s;
+    int fds[2];
+
+    if (qemu_pipe(fds) == -1) {
+        fprintf(stderr, "failed to create pipe\n");
+        return NULL;
+    }
+
+    s = g_malloc0(sizeof(PosixAioState));
+    s->rfd = fds[0];
+    s->wfd = fds[1];
+    s->ctx = ctx;
+
+    fcntl(s->rfd, F_SETFL, O_NONBLOCK);
+    fcntl(s->wfd, F_SETFL, O_NONBLOCK);
+
+    aio_set_fd_handler(ctx, s->rfd, posix_aio_read, NULL, posix_aio_flush, s);
+    return s;
+}
+
+/*
+ * Return the completion notifier for requests submitted from CTX.  The
+ * main loop's is created by paio_init, the others on first use; they
+ * are never freed, just like the main loop's.
+ */
+static PosixAioState *posix_aio_get_state(AioContext *ctx)
+{
+    PosixAioState *s;
+
+    if (ctx == posix_aio_state->ctx) {
+        return posix_aio_state;
+    }
+
+    mutex_lock(&lock);
+    QLIST_FOREACH(s, &posix_aio_states, next) {
+        if (s->ctx == ctx) {
+            break;
+        }
+    }
+    mutex_unlock(&lock);
+    if (s) {
+        return s;
+    }
+
+    /* Only the thread running ctx submits from it, so no one races us */
+    s = posix_aio_state_new(ctx);
+    if (s) {
+        mutex_lock(&lock);
+        QLIST_INSERT_HEAD(&posix_aio_states, s, next);
+        mutex_unlock(&lock);
+    }
+    return s;
+}
+
 static AIOPool raw_aio_pool = {
     .aiocb_size         = sizeof(struct qemu_paiocb),
     .cancel             = paio_cancel,
@@ -609,8 +676,13 @@ BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
     acb->aio_nbytes = nb_sectors * 512;
     acb->aio_offset = sector_num * 512;
 
-    acb->next = posix_aio_state->first_aio;
-    posix_aio_state->first_aio = acb;
+    acb->state = posix_aio_get_state(bdrv_get_aio_context(bs));
+    if (!acb->state) {
+        qemu_aio_release(acb);
+        return NULL;
+    }
+    acb->next = acb->state->first_aio;
+    acb->state->first_aio = acb;
 
     trace_paio_submit(acb, opaque, sector_num, nb_sectors, type);
     qemu_paio_submit(acb);
@@ -630,8 +702,13 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
     acb->aio_ioctl_buf = buf;
     acb->aio_ioctl_cmd = req;
 
-    acb->next = posix_aio_state->first_aio;
-    posix_aio_state->first_aio = acb;
+    acb->state = posix_aio_get_state(bdrv_get_aio_context(bs));
+    if (!acb->state) {
+        qemu_aio_release(acb);
+        return NULL;
+    }
+    acb->next = acb->state->first_aio;
+    acb->state->first_aio = acb;
 
     qemu_paio_submit(acb);
     return &acb->common;
@@ -640,29 +717,16 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
 int paio_init(void)
 {
     PosixAioState *s;
-    int fds[2];
     int ret;
 
     if (posix_aio_state)
         return 0;
 
-    s = g_malloc(sizeof(PosixAioState));
-
-    s->first_aio = NULL;
-    if (qemu_pipe(fds) == -1) {
-        fprintf(stderr, "failed to create pipe\n");
-        g_free(s);
+    s = posix_aio_state_new(qemu_get_aio_context());
+    if (!s) {
         return -1;
     }
 
-    s->rfd = fds[0];
-    s->wfd = fds[1];
-
-    fcntl(s->rfd, F_SETFL, O_NONBLOCK);
-    fcntl(s->wfd, F_SETFL, O_NONBLOCK);
-
-    qemu_aio_set_fd_handler(s->rfd, posix_aio_read, NULL, posix_aio_flush, s);
-
     ret = pthread_attr_init(&attr);
     if (ret)
         die2(ret, "pthread_attr_init");
@@ -16,6 +16,9 @@
 
 #include "qemu-common.h"
 #include "qemu-char.h"
+#include "qemu-queue.h"
+#include "qemu-thread.h"
+#include "qemu-timer.h"
 
 typedef struct BlockDriverAIOCB BlockDriverAIOCB;
 typedef void BlockDriverCompletionFunc(void *opaque, int ret);
@@ -41,6 +44,173 @@ void qemu_aio_release(void *p);
 /* Returns 1 if there are still outstanding AIO requests; 0 otherwise */
 typedef int (AioFlushHandler)(void *opaque);
 
+typedef struct AioHandler AioHandler;
+
+struct AioContext {
+    /* Anchor of the list of Bottom Halves belonging to the context */
+    struct QEMUBH *first_bh;
+
+    /* Serializes insertion and removal of bottom halves, which can be
+     * created from any thread */
+    QemuMutex bh_lock;
+
+    /* Nesting level of aio_bh_poll; deleted bottom halves are only
+     * freed at level zero */
+    int walking_bh;
+
+    /* The list of registered AIO handlers */
+    QLIST_HEAD(, AioHandler) aio_handlers;
+
+    /* This is a simple lock used to protect the aio_handlers list.
+     * Specifically, it's used to ensure that no callbacks are removed while
+     * we're walking and dispatching callbacks.
+     */
+    int walking_handlers;
+
+    /* The descriptors passed to qemu_poll_ns, rebuilt by every aio_poll */
+    GArray *pollfds;
+
+    /* Timers run by aio_poll, one list per clock */
+    QEMUTimerList *timer_lists[3];
+
+    /* The main loop's context: its handlers are also registered with
+     * the main loop, which runs its bottom halves and timers */
+    bool main_loop;
+
+    /* aio_notify writes to notify_fds[1] to wake up aio_poll */
+    int notify_fds[2];
+
+    /* Coroutines woken up by qemu_co_queue_next() while this context was
+     * current; co_queue_bh enters them.  The bottom half is created on
+     * first use and deleted by aio_context_free(). */
+    QTAILQ_HEAD(, Coroutine) co_queue_wakeup;
+    struct QEMUBH *co_queue_bh;
+
+    /* Hands the context over between the threads that run it, in the
+     * order they asked for it; see aio_context_acquire */
+    QemuMutex owner_lock;
+    QemuCond owner_cond;
+    QemuThread owner;
+    int owner_depth;
+    unsigned int next_ticket;
+    unsigned int now_serving;
+};
+
+/**
+ * aio_context_new: Allocate a new AioContext.
+ *
+ * An AioContext bundles file descriptor handlers, bottom halves and
+ * timers, and is run by calling aio_poll() on it.  Each context must
+ * only be run by one thread at a time; that thread is the one that
+ * executes all of its callbacks.  Only bottom halves may be created
+ * and scheduled from other threads.
+ *
+ * Returns NULL if the notification descriptors cannot be created.
+ * Contexts other than the main loop's are only available on POSIX hosts.
+ */
+AioContext *aio_context_new(void);
+
+/**
+ * aio_context_free: Free an AioContext created with aio_context_new.
+ *
+ * All file descriptor handlers and timers must have been removed.
+ */
+void aio_context_free(AioContext *ctx);
+
+/**
+ * aio_context_acquire: Become the thread that runs @ctx.
+ *
+ * A thread that is not the one dedicated to @ctx, usually one holding
+ * the iothread lock, must acquire the context before submitting requests
+ * to or polling the block devices attached to it.  If another thread
+ * owns @ctx, it is woken up from aio_poll and the caller waits for it to
+ * call aio_context_release.  Threads are served in the order in which
+ * they asked, and a thread may acquire a context it already owns.
+ *
+ * The main loop's context is protected by the iothread lock instead, and
+ * acquiring or releasing it does nothing.
+ */
+void aio_context_acquire(AioContext *ctx);
+
+/**
+ * aio_context_release: Let the next waiting thread run @ctx.
+ */
+void aio_context_release(AioContext *ctx);
+
+/**
+ * qemu_get_aio_context: Return the main loop's AioContext.
+ *
+ * The bottom halves and file descriptor handlers of this context are
+ * run by main_loop_wait, and qemu_bh_new, qemu_aio_set_fd_handler and
+ * qemu_aio_wait operate on it.
+ */
+AioContext *qemu_get_aio_context(void);
+
+/**
+ * qemu_get_current_aio_context: Return the AioContext that the calling
+ * thread is running with aio_poll, or the main loop's context.
+ */
+AioContext *qemu_get_current_aio_context(void);
+
+/**
+ * aio_notify: Force processing of pending events.
+ *
+ * Wake up the thread that is blocked in aio_poll on @ctx, so that it
+ * recalculates its timeout and the descriptors it waits on.  Can be
+ * called from any thread.
+ */
+void aio_notify(AioContext *ctx);
+
+/**
+ * aio_bh_new: Allocate a new bottom half structure that runs in @ctx.
+ *
+ * Like qemu_bh_new, but the callback is invoked by the thread running
+ * @ctx.  qemu_bh_schedule, qemu_bh_cancel and qemu_bh_delete work on it
+ * as usual.
+ */
+QEMUBH *aio_bh_new(AioContext *ctx, QEMUBHFunc *cb, void *opaque);
+
+/* Run the scheduled bottom halves of @ctx.  Return 1 if a non-idle
+ * one was run. */
+int aio_bh_poll(AioContext *ctx);
+
+/* Lower *@timeout (in milliseconds) according to the scheduled bottom
+ * halves of @ctx. */
+void aio_bh_update_timeout(AioContext *ctx, uint32_t *timeout);
+
+/**
+ * aio_timer_new: Allocate a timer that fires in @ctx.
+ *
+ * The timer is used with the usual qemu_mod_timer/qemu_del_timer
+ * functions, but it must only be modified by the thread running @ctx.
+ * Timers of the main loop's context are ordinary main loop timers.
+ */
+QEMUTimer *aio_timer_new(AioContext *ctx, QEMUClock *clock, int scale,
+                         QEMUTimerCB *cb, void *opaque);
+
+/**
+ * aio_poll: Make progress in the AIO work of @ctx.
+ *
+ * Run the scheduled bottom halves and the expired timers of @ctx; if
+ * there were none, wait for events on its file descriptors and dispatch
+ * them.  If @blocking is false the descriptors are only polled.
+ *
+ * Return false if there was no pending AIO operation (no flush handler
+ * returned 1 and no timer is armed), true otherwise.  A thread that runs
+ * a context until told to stop should therefore keep a handler whose
+ * flush callback returns 1 while it is running.
+ */
+bool aio_poll(AioContext *ctx, bool blocking);
+
+/* Register a file descriptor and associated callbacks in @ctx, like
+ * qemu_aio_set_fd_handler does for the main loop's context. */
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioFlushHandler *io_flush,
+                        void *opaque);
+
 /* Flush any pending AIO operation. This function will block until all
  * outstanding AIO operations have been completed or cancelled. */
 void qemu_aio_flush(void);
@@ -258,6 +258,7 @@ typedef struct NICInfo NICInfo;
 typedef struct HCIInfo HCIInfo;
 typedef struct AudioState AudioState;
 typedef struct BlockDriverState BlockDriverState;
+typedef struct AioContext AioContext;
 typedef struct DriveInfo DriveInfo;
 typedef struct DisplayState DisplayState;
 typedef struct DisplayChangeListener DisplayChangeListener;
@@ -316,6 +317,10 @@ typedef struct PCIHostDeviceAddress {
 
 void tcg_exec_init(unsigned long tb_size);
 bool tcg_enabled(void);
+extern bool mttcg_enabled;
+extern unsigned int tcg_trace_threshold;
+extern bool tcg_tb_profile;
+void tcg_perfmap_open(void);
 
 void cpu_exec_init_all(void);
 
@@ -334,6 +339,7 @@ struct qemu_work_item {
     void (*func)(void *data);
     void *data;
     int done;
+    int free;
 };
 
 #ifdef CONFIG_USER_ONLY
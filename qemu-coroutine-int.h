@@ -41,6 +41,10 @@ struct Coroutine {
     QTAILQ_ENTRY(Coroutine) co_queue_next;
 };
 
+/* Pool size and stack guard settings, for the backends that support them */
+extern unsigned int coroutine_pool_max_size;
+extern bool coroutine_stack_guard;
+
 Coroutine *qemu_coroutine_new(void);
 void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
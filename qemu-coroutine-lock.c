@@ -26,31 +26,37 @@
 #include "qemu-coroutine.h"
 #include "qemu-coroutine-int.h"
 #include "qemu-queue.h"
-#include "main-loop.h"
+#include "qemu-aio.h"
 #include "trace.h"
 
-static QTAILQ_HEAD(, Coroutine) unlock_bh_queue =
-    QTAILQ_HEAD_INITIALIZER(unlock_bh_queue);
-static QEMUBH* unlock_bh;
-
+/* Coroutines woken up by qemu_co_queue_next are entered from a bottom
+ * half in the AioContext that is current in the thread that woke them up,
+ * so that draining that context also runs them. */
 static void qemu_co_queue_next_bh(void *opaque)
 {
+    AioContext *ctx = opaque;
     Coroutine *next;
 
     trace_qemu_co_queue_next_bh();
-    while ((next = QTAILQ_FIRST(&unlock_bh_queue))) {
-        QTAILQ_REMOVE(&unlock_bh_queue, next, co_queue_next);
+    while ((next = QTAILQ_FIRST(&ctx->co_queue_wakeup))) {
+        QTAILQ_REMOVE(&ctx->co_queue_wakeup, next, co_queue_next);
         qemu_coroutine_enter(next, NULL);
     }
 }
 
-void qemu_co_queue_init(CoQueue *queue)
+static AioContext *qemu_co_queue_wakeup_context(void)
 {
-    QTAILQ_INIT(&queue->entries);
+    AioContext *ctx = qemu_get_current_aio_context();
 
-    if (!unlock_bh) {
-        unlock_bh = qemu_bh_new(qemu_co_queue_next_bh, NULL);
+    if (!ctx->co_queue_bh) {
+        ctx->co_queue_bh = aio_bh_new(ctx, qemu_co_queue_next_bh, ctx);
     }
+    return ctx;
+}
+
+void qemu_co_queue_init(CoQueue *queue)
+{
+    QTAILQ_INIT(&queue->entries);
 }
 
 void coroutine_fn qemu_co_queue_wait(CoQueue *queue)
@@ -75,10 +81,12 @@ bool qemu_co_queue_next(CoQueue *queue)
 
     next = QTAILQ_FIRST(&queue->entries);
     if (next) {
+        AioContext *ctx = qemu_co_queue_wakeup_context();
+
         QTAILQ_REMOVE(&queue->entries, next, co_queue_next);
-        QTAILQ_INSERT_TAIL(&unlock_bh_queue, next, co_queue_next);
+        QTAILQ_INSERT_TAIL(&ctx->co_queue_wakeup, next, co_queue_next);
         trace_qemu_co_queue_next(next);
-        qemu_bh_schedule(unlock_bh);
+        qemu_bh_schedule(ctx->co_queue_bh);
     }
 
     return (next != NULL);
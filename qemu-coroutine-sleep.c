@@ -13,6 +13,7 @@
 
 #include "qemu-coroutine.h"
 #include "qemu-timer.h"
+#include "qemu-aio.h"
 
 typedef struct CoSleepCB {
     QEMUTimer *ts;
@@ -31,7 +32,8 @@ void coroutine_fn co_sleep_ns(QEMUClock *clock, int64_t ns)
     CoSleepCB sleep_cb = {
         .co = qemu_coroutine_self(),
     };
-    sleep_cb.ts = qemu_new_timer(clock, SCALE_NS, co_sleep_cb, &sleep_cb);
+    sleep_cb.ts = aio_timer_new(qemu_get_current_aio_context(), clock,
+                                SCALE_NS, co_sleep_cb, &sleep_cb);
     qemu_mod_timer(sleep_cb.ts, qemu_get_clock_ns(clock) + ns);
     qemu_coroutine_yield();
     qemu_del_timer(sleep_cb.ts);
@@ -17,6 +17,19 @@
 #include "qemu-coroutine.h"
 #include "qemu-coroutine-int.h"
 
+unsigned int coroutine_pool_max_size = 64;
+bool coroutine_stack_guard;
+
+void qemu_coroutine_set_pool_size(unsigned int size)
+{
+    coroutine_pool_max_size = size;
+}
+
+void qemu_coroutine_set_stack_guard(bool enable)
+{
+    coroutine_stack_guard = enable;
+}
+
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry)
 {
     Coroutine *co = qemu_coroutine_new();
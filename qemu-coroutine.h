@@ -95,6 +95,24 @@ Coroutine *coroutine_fn qemu_coroutine_self(void);
  */
 bool qemu_in_coroutine(void);
 
+/**
+ * Set the number of terminated coroutines each thread keeps for reuse
+ *
+ * Larger pools avoid allocating new stacks when many requests are in flight
+ * at once, at the cost of memory held by idle threads.  The default is 64.
+ * After shrinking the pool, a thread frees its excess coroutines the next
+ * time it creates one.
+ */
+void qemu_coroutine_set_pool_size(unsigned int size);
+
+/**
+ * Put a guard page below the stacks of coroutines created from now on
+ *
+ * A stack overflow then crashes right away instead of corrupting memory.
+ * Coroutines reused from the pool keep the stack they were created with.
+ * Backends that cannot protect their stacks ignore this.
+ */
+void qemu_coroutine_set_stack_guard(bool enable);
 
 
 /**
@@ -99,12 +99,15 @@ specifies the maximum number of hotpluggable CPUs.
 ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n"
+    "         [,hostnodes=node[-node]][,policy=bind|preferred|interleave]\n",
+    QEMU_ARCH_ALL)
 STEXI
 @item -numa @var{opts}
 @findex -numa
 Simulate a multi node NUMA system. If mem and cpus are omitted, resources
-are split equally.
+are split equally.  @option{hostnodes} places the node's memory on the given
+host NUMA nodes, following @option{policy} (@code{bind} by default).
 ETEXI
 
 DEF("fda", HAS_ARG, QEMU_OPTION_fda,
@@ -417,13 +420,22 @@ STEXI
 Allocate guest RAM from a temporarily created file in @var{path}.
 ETEXI
 
+DEF("mem-share", 0, QEMU_OPTION_mem_share,
+    "-mem-share      map -mem-path backed guest RAM shared with other processes\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -mem-share
+Map the file given with -mem-path with @code{MAP_SHARED} so that other
+processes, such as a vhost-user backend, can access guest RAM.
+ETEXI
+
 #ifdef MAP_POPULATE
 DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
-    "-mem-prealloc   preallocate guest memory (use with -mem-path)\n",
+    "-mem-prealloc   preallocate guest memory\n",
     QEMU_ARCH_ALL)
 STEXI
 @item -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate guest memory at startup, using several threads.
 ETEXI
 #endif
 
@@ -1333,6 +1345,11 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                on host and listening for incoming connections on 'socketpath'.\n"
     "                Use group 'groupname' and mode 'octalmode' to change default\n"
     "                ownership and permissions for communication port.\n"
+#endif
+#ifdef CONFIG_LINUX
+    "-netdev vhost-user,id=str,path=socketpath\n"
+    "                hand the virtio-net data path to a vhost-user backend\n"
+    "                listening on 'socketpath' (needs -mem-path and -mem-share)\n"
 #endif
     "-net dump[,vlan=n][,file=f][,len=n]\n"
     "                dump traffic on vlan 'n' to file 'f' (max n bytes per packet)\n"
@@ -1347,6 +1364,9 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "bridge|"
 #ifdef CONFIG_VDE
     "vde|"
+#endif
+#ifdef CONFIG_LINUX
+    "vhost-user|"
 #endif
     "socket],id=str[,option][,option][,...]\n", QEMU_ARCH_ALL)
 STEXI
@@ -1657,6 +1677,21 @@ vde_switch -F -sock /tmp/myswitch
 qemu-system-i386 linux.img -net nic -net vde,sock=/tmp/myswitch
 @end example
 
+@item -netdev vhost-user,id=@var{id},path=@var{socketpath}
+Connect to a vhost-user backend process listening on the UNIX domain socket
+@var{socketpath}.  The backend receives the guest memory layout and the
+virtqueue eventfds and runs the virtio-net data path itself.  Guest RAM must
+be shared with the backend, so QEMU has to be started with @option{-mem-path}
+and @option{-mem-share}.  Live migration is blocked while a vhost-user
+backend is in use.
+
+Example:
+@example
+qemu-system-x86_64 -m 1024 -mem-path /dev/hugepages -mem-share \
+    -netdev vhost-user,id=net0,path=/tmp/vhost.sock \
+    -device virtio-net-pci,netdev=net0 linux.img
+@end example
+
 @item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}]
 Dump network traffic on VLAN @var{n} to file @var{file} (@file{qemu-vlan0.pcap} by default).
 At most @var{len} bytes (64k by default) per packet are stored. The file format is
@@ -2540,6 +2575,8 @@ STEXI
 @findex -clock
 Force the use of the given methods for timer alarm. To see what timers
 are available use -clock ?.
+The default, @code{poll}, does not use signals: the main loop sleeps
+until the first timer expires.
 ETEXI
 
 HXCOMM Options deprecated by -rtc
@@ -2692,6 +2729,56 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg-threads", HAS_ARG, QEMU_OPTION_tcg_threads, \
+    "-tcg-threads single|multi\n"
+    "                run all TCG vCPUs on one host thread (default) or give\n"
+    "                each vCPU its own thread\n", QEMU_ARCH_I386 | QEMU_ARCH_ARM)
+STEXI
+@item -tcg-threads single|multi
+@findex -tcg-threads
+With @option{multi}, every emulated CPU executes translated code on its own
+host thread, so that SMP guests can use several host cores.  The default,
+@option{single}, runs all emulated CPUs round-robin on one thread.
+@option{multi} is only available on x86 hosts and cannot be combined with
+@option{-icount}.  Locked x86 instructions stop all other CPUs while they
+execute.
+ETEXI
+
+DEF("tcg-traces", HAS_ARG, QEMU_OPTION_tcg_traces, \
+    "-tcg-traces n   retranslate blocks executed n times as traces\n",
+    QEMU_ARCH_I386)
+STEXI
+@item -tcg-traces @var{n}
+@findex -tcg-traces
+Count how often each translated block runs, and translate it again once it
+has run @var{n} times.  The new translation goes on through forward jumps
+and not-taken forward branches, so that hot code paths become a single
+block.  The default, 0, disables counting.  Traces cannot be used together
+with @option{-icount}.
+ETEXI
+
+DEF("tcg-profile", 0, QEMU_OPTION_tcg_profile, \
+    "-tcg-profile    count executions of each translated block\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg-profile
+@findex -tcg-profile
+Count how often each translated block runs and how often it returns to the
+main execution loop.  The monitor command @code{info tbs} lists the most
+executed blocks.
+ETEXI
+
+DEF("tcg-perfmap", 0, QEMU_OPTION_tcg_perfmap, \
+    "-tcg-perfmap    write /tmp/perf-<pid>.map for the translated code\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg-perfmap
+@findex -tcg-perfmap
+Write the host address range of every translated block, with its guest
+address and symbol, to @file{/tmp/perf-<pid>.map}.  @command{perf report}
+uses this file to attribute samples in translated code to guest code.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n",
     QEMU_ARCH_ALL)
@@ -2770,6 +2857,21 @@ Enable Seccomp mode 2 system call filter. 'on' will enable syscall filtering and
 disable it.  The default is 'off'.
 ETEXI
 
+DEF("iothread", HAS_ARG, QEMU_OPTION_iothread, \
+    "-iothread id=id\n"
+    "                start a thread that runs block I/O for the devices\n"
+    "                whose 'iothread' property is set to id\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -iothread id=@var{id}
+@findex -iothread
+Start a thread with its own event loop.  Block devices that support it,
+such as virtio-blk, can be told to submit and complete their requests in
+this thread with @code{-device virtio-blk-pci,iothread=@var{id},...}.
+Only the raw, qcow2, file and host_device block drivers can be used in
+an I/O thread.
+ETEXI
+
 DEF("readconfig", HAS_ARG, QEMU_OPTION_readconfig,
     "-readconfig <file>\n", QEMU_ARCH_ALL)
 STEXI
@@ -30,6 +30,7 @@
 #include "hw/hw.h"
 
 #include "qemu-timer.h"
+#include "qemu-thread.h"
 
 #ifdef _WIN32
 #include <mmsystem.h>
@@ -42,22 +43,41 @@
 #define QEMU_CLOCK_VIRTUAL  1
 #define QEMU_CLOCK_HOST     2
 
+struct QEMUTimerList {
+    QEMUClock *clock;
+
+    /* Binary min-heap of the pending timers, ordered by expire_time */
+    QEMUTimer **heap;
+    int nb_timers;
+    int heap_size;
+
+    /* Called when the first deadline of the list changes */
+    QEMUTimerListNotifyCB *notify_cb;
+    void *notify_opaque;
+};
+
 struct QEMUClock {
-    QEMUTimer *active_timers;
+    /* The timers run by the main loop, driven by the alarm timer */
+    QEMUTimerList timer_list;
 
     NotifierList reset_notifiers;
     int64_t last;
 
     int type;
     bool enabled;
+
+    /* Statistics for "info timers".  Timer lists run by other threads
+       update them too, without locking, so they are only indicative. */
+    uint64_t rearms;
+    uint64_t fires;
 };
 
 struct QEMUTimer {
     int64_t expire_time;	/* in nanoseconds */
-    QEMUClock *clock;
+    QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    int heap_index;             /* -1 if the timer is not pending */
     int scale;
 };
 
@@ -78,42 +98,123 @@ struct qemu_alarm_timer {
 
 static struct qemu_alarm_timer *alarm_timer;
 
+/* The thread that runs the main loop timers */
+static QemuThread alarm_thread;
+
 static bool qemu_timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
 {
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
-static int64_t qemu_next_alarm_deadline(void)
+static QEMUTimer *qemu_timer_list_head(QEMUTimerList *tl)
 {
-    int64_t delta = INT64_MAX;
-    int64_t rtdelta;
+    return tl->nb_timers ? tl->heap[0] : NULL;
+}
 
-    if (!use_icount && vm_clock->enabled && vm_clock->active_timers) {
-        delta = vm_clock->active_timers->expire_time -
-                     qemu_get_clock_ns(vm_clock);
-    }
-    if (host_clock->enabled && host_clock->active_timers) {
-        int64_t hdelta = host_clock->active_timers->expire_time -
-                 qemu_get_clock_ns(host_clock);
-        if (hdelta < delta) {
-            delta = hdelta;
+static void timer_heap_set(QEMUTimerList *tl, int i, QEMUTimer *ts)
+{
+    tl->heap[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *tl, int i)
+{
+    QEMUTimer *ts = tl->heap[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (tl->heap[parent]->expire_time <= ts->expire_time) {
+            break;
         }
+        timer_heap_set(tl, i, tl->heap[parent]);
+        i = parent;
     }
-    if (rt_clock->enabled && rt_clock->active_timers) {
-        rtdelta = (rt_clock->active_timers->expire_time -
-                 qemu_get_clock_ns(rt_clock));
-        if (rtdelta < delta) {
-            delta = rtdelta;
+    timer_heap_set(tl, i, ts);
+}
+
+static void timer_heap_sift_down(QEMUTimerList *tl, int i)
+{
+    QEMUTimer *ts = tl->heap[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= tl->nb_timers) {
+            break;
+        }
+        if (child + 1 < tl->nb_timers &&
+            tl->heap[child + 1]->expire_time < tl->heap[child]->expire_time) {
+            child++;
         }
+        if (ts->expire_time <= tl->heap[child]->expire_time) {
+            break;
+        }
+        timer_heap_set(tl, i, tl->heap[child]);
+        i = child;
+    }
+    timer_heap_set(tl, i, ts);
+}
+
+static void timer_heap_insert(QEMUTimerList *tl, QEMUTimer *ts)
+{
+    if (tl->nb_timers == tl->heap_size) {
+        tl->heap_size = MAX(16, tl->heap_size * 2);
+        tl->heap = g_renew(QEMUTimer *, tl->heap, tl->heap_size);
     }
+    tl->heap[tl->nb_timers++] = ts;
+    timer_heap_sift_up(tl, tl->nb_timers - 1);
+}
 
-    return delta;
+static void timer_heap_remove(QEMUTimerList *tl, QEMUTimer *ts)
+{
+    int i = ts->heap_index;
+    QEMUTimer *last;
+
+    ts->heap_index = -1;
+    last = tl->heap[--tl->nb_timers];
+    if (last == ts) {
+        return;
+    }
+    /* Move the last timer into the hole, then restore the heap order */
+    timer_heap_set(tl, i, last);
+    if (i > 0 && tl->heap[(i - 1) / 2]->expire_time > last->expire_time) {
+        timer_heap_sift_up(tl, i);
+    } else {
+        timer_heap_sift_down(tl, i);
+    }
+}
+
+/* Nanoseconds until the first timer of CLOCK expires, or -1 */
+static int64_t qemu_clock_deadline_ns(QEMUClock *clock)
+{
+    return qemu_timer_list_deadline_ns(&clock->timer_list);
+}
+
+int64_t qemu_timers_deadline_ns(void)
+{
+    int64_t deadline = -1;
+
+    /* With icount the vcpu thread wakes us up when vm_clock expires */
+    if (!use_icount) {
+        deadline = qemu_clock_deadline_ns(vm_clock);
+    }
+    deadline = qemu_soonest_timeout(deadline,
+                                    qemu_clock_deadline_ns(host_clock));
+    deadline = qemu_soonest_timeout(deadline,
+                                    qemu_clock_deadline_ns(rt_clock));
+    return deadline;
 }
 
 static void qemu_rearm_alarm_timer(struct qemu_alarm_timer *t)
 {
-    int64_t nearest_delta_ns = qemu_next_alarm_deadline();
-    if (nearest_delta_ns < INT64_MAX) {
+    int64_t nearest_delta_ns;
+
+    if (!t->rearm) {
+        return;
+    }
+    nearest_delta_ns = qemu_timers_deadline_ns();
+    if (nearest_delta_ns >= 0) {
         t->rearm(t, nearest_delta_ns);
     }
 }
@@ -121,6 +222,9 @@ static void qemu_rearm_alarm_timer(struct qemu_alarm_timer *t)
 /* TODO: MIN_TIMER_REARM_NS should be optimized */
 #define MIN_TIMER_REARM_NS 250000
 
+static int poll_start_timer(struct qemu_alarm_timer *t);
+static void poll_stop_timer(struct qemu_alarm_timer *t);
+
 #ifdef _WIN32
 
 static int mm_start_timer(struct qemu_alarm_timer *t);
@@ -148,6 +252,7 @@ static void dynticks_rearm_timer(struct qemu_alarm_timer *t, int64_t delta);
 #endif /* _WIN32 */
 
 static struct qemu_alarm_timer alarm_timers[] = {
+    {"poll", poll_start_timer, poll_stop_timer, NULL},
 #ifndef _WIN32
 #ifdef __linux__
     {"dynticks", dynticks_start_timer,
@@ -237,6 +342,7 @@ static QEMUClock *qemu_new_clock(int type)
     clock->type = type;
     clock->enabled = true;
     clock->last = INT64_MIN;
+    clock->timer_list.clock = clock;
     notifier_list_init(&clock->reset_notifiers);
     return clock;
 }
@@ -252,22 +358,24 @@ void qemu_clock_enable(QEMUClock *clock, bool enabled)
 
 int64_t qemu_clock_has_timers(QEMUClock *clock)
 {
-    return !!clock->active_timers;
+    return !!clock->timer_list.nb_timers;
 }
 
 int64_t qemu_clock_expired(QEMUClock *clock)
 {
-    return (clock->active_timers &&
-            clock->active_timers->expire_time < qemu_get_clock_ns(clock));
+    QEMUTimer *head = qemu_timer_list_head(&clock->timer_list);
+
+    return head && head->expire_time < qemu_get_clock_ns(clock);
 }
 
 int64_t qemu_clock_deadline(QEMUClock *clock)
 {
     /* To avoid problems with overflow limit this to 2^32.  */
     int64_t delta = INT32_MAX;
+    QEMUTimer *head = qemu_timer_list_head(&clock->timer_list);
 
-    if (clock->active_timers) {
-        delta = clock->active_timers->expire_time - qemu_get_clock_ns(clock);
+    if (head) {
+        delta = head->expire_time - qemu_get_clock_ns(clock);
     }
     if (delta < 0) {
         delta = 0;
@@ -275,19 +383,61 @@ int64_t qemu_clock_deadline(QEMUClock *clock)
     return delta;
 }
 
-QEMUTimer *qemu_new_timer(QEMUClock *clock, int scale,
-                          QEMUTimerCB *cb, void *opaque)
+QEMUTimerList *qemu_new_timer_list(QEMUClock *clock,
+                                   QEMUTimerListNotifyCB *cb, void *opaque)
+{
+    QEMUTimerList *tl;
+
+    tl = g_malloc0(sizeof(QEMUTimerList));
+    tl->clock = clock;
+    tl->notify_cb = cb;
+    tl->notify_opaque = opaque;
+    return tl;
+}
+
+void qemu_free_timer_list(QEMUTimerList *tl)
+{
+    assert(!tl->nb_timers);
+    g_free(tl->heap);
+    g_free(tl);
+}
+
+QEMUClock *qemu_timer_list_clock(QEMUTimerList *tl)
+{
+    return tl->clock;
+}
+
+int64_t qemu_timer_list_deadline_ns(QEMUTimerList *tl)
+{
+    int64_t delta;
+
+    if (!tl->clock->enabled || !tl->nb_timers) {
+        return -1;
+    }
+    delta = tl->heap[0]->expire_time - qemu_get_clock_ns(tl->clock);
+    return MAX(delta, 0);
+}
+
+QEMUTimer *qemu_new_timer_on_list(QEMUTimerList *tl, int scale,
+                                  QEMUTimerCB *cb, void *opaque)
 {
     QEMUTimer *ts;
 
     ts = g_malloc0(sizeof(QEMUTimer));
-    ts->clock = clock;
+    ts->timer_list = tl;
     ts->cb = cb;
     ts->opaque = opaque;
     ts->scale = scale;
+    ts->heap_index = -1;
     return ts;
 }
 
+QEMUTimer *qemu_new_timer(QEMUClock *clock, int scale,
+                          QEMUTimerCB *cb, void *opaque)
+{
+    return qemu_new_timer_on_list(&clock->timer_list, scale, cb, opaque);
+}
+
 void qemu_free_timer(QEMUTimer *ts)
 {
     g_free(ts);
@@ -296,20 +446,8 @@ void qemu_free_timer(QEMUTimer *ts)
 /* stop a timer, but do not dealloc it */
 void qemu_del_timer(QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
-
-    /* NOTE: this code must be signal safe because
-       qemu_timer_expired() can be called from a signal. */
-    pt = &ts->clock->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            *pt = t->next;
-            break;
-        }
-        pt = &t->next;
+    if (ts->heap_index >= 0) {
+        timer_heap_remove(ts->timer_list, ts);
     }
 }
 
@@ -317,33 +455,42 @@ void qemu_del_timer(QEMUTimer *ts)
    >= expire_time. The corresponding callback will be called. */
 void qemu_mod_timer_ns(QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimerList *tl = ts->timer_list;
+    QEMUTimer *old_head = qemu_timer_list_head(tl);
+    int64_t old_deadline = old_head ? old_head->expire_time : INT64_MAX;
 
-    qemu_del_timer(ts);
+    tl->clock->rearms++;
+    if (ts->heap_index >= 0) {
+        /* Already pending: move it up or down the heap in place */
+        bool earlier = expire_time < ts->expire_time;
 
-    /* add the timer in the sorted list */
-    /* NOTE: this code must be signal safe because
-       qemu_timer_expired() can be called from a signal. */
-    pt = &ts->clock->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!qemu_timer_expired_ns(t, expire_time)) {
-            break;
+        ts->expire_time = expire_time;
+        if (earlier) {
+            timer_heap_sift_up(tl, ts->heap_index);
+        } else {
+            timer_heap_sift_down(tl, ts->heap_index);
         }
-        pt = &t->next;
+    } else {
+        ts->expire_time = expire_time;
+        timer_heap_insert(tl, ts);
     }
-    ts->expire_time = expire_time;
-    ts->next = *pt;
-    *pt = ts;
 
-    /* Rearm if necessary  */
-    if (pt == &ts->clock->active_timers) {
+    /* Rearm if the first deadline moved earlier.  A later one only costs
+       a spurious wakeup, after which the deadline is recomputed.  */
+    if (tl->heap[0] == ts && expire_time < old_deadline) {
+        if (tl->notify_cb) {
+            tl->notify_cb(tl->notify_opaque);
+            return;
+        }
         if (!alarm_timer->pending) {
             qemu_rearm_alarm_timer(alarm_timer);
         }
         /* Interrupt execution to force deadline recalculation.  */
-        qemu_clock_warp(ts->clock);
-        if (use_icount) {
+        qemu_clock_warp(tl->clock);
+        /* The main loop recomputes its timeout before polling again, so
+           only wake it up if it may already be waiting.  */
+        if (use_icount || (!alarm_timer->rearm &&
+                           !qemu_thread_is_self(&alarm_thread))) {
             qemu_notify_event();
         }
     }
@@ -356,13 +503,7 @@ void qemu_mod_timer(QEMUTimer *ts, int64_t expire_time)
 
 bool qemu_timer_pending(QEMUTimer *ts)
 {
-    QEMUTimer *t;
-    for (t = ts->clock->active_timers; t != NULL; t = t->next) {
-        if (t == ts) {
-            return true;
-        }
-    }
-    return false;
+    return ts->heap_index >= 0;
 }
 
 bool qemu_timer_expired(QEMUTimer *timer_head, int64_t current_time)
@@ -370,27 +511,36 @@ bool qemu_timer_expired(QEMUTimer *timer_head, int64_t current_time)
     return qemu_timer_expired_ns(timer_head, current_time * timer_head->scale);
 }
 
-void qemu_run_timers(QEMUClock *clock)
+bool qemu_run_timer_list(QEMUTimerList *tl)
 {
     QEMUTimer *ts;
     int64_t current_time;
-   
-    if (!clock->enabled)
-        return;
+    bool progress = false;
+
+    if (!tl->clock->enabled) {
+        return false;
+    }
 
-    current_time = qemu_get_clock_ns(clock);
+    current_time = qemu_get_clock_ns(tl->clock);
     for(;;) {
-        ts = clock->active_timers;
+        ts = qemu_timer_list_head(tl);
         if (!qemu_timer_expired_ns(ts, current_time)) {
             break;
         }
         /* remove timer from the list before calling the callback */
-        clock->active_timers = ts->next;
-        ts->next = NULL;
+        timer_heap_remove(tl, ts);
+        tl->clock->fires++;
 
         /* run the callback (the timer list can be modified) */
         ts->cb(ts->opaque);
+        progress = true;
     }
+    return progress;
+}
+
+void qemu_run_timers(QEMUClock *clock)
+{
+    qemu_run_timer_list(&clock->timer_list);
 }
 
 int64_t qemu_get_clock_ns(QEMUClock *clock)
@@ -440,6 +590,24 @@ uint64_t qemu_timer_expire_time_ns(QEMUTimer *ts)
     return qemu_timer_pending(ts) ? ts->expire_time : -1;
 }
 
+static void qemu_clock_info(Monitor *mon, const char *name, QEMUClock *clock)
+{
+    monitor_printf(mon, "%-5s %s, %d pending, deadline %" PRId64
+                   " ns, %" PRIu64 " rearms, %" PRIu64 " fires\n",
+                   name, clock->enabled ? "enabled" : "disabled",
+                   clock->timer_list.nb_timers, qemu_clock_deadline_ns(clock),
+                   clock->rearms, clock->fires);
+}
+
+void do_info_timers(Monitor *mon)
+{
+    monitor_printf(mon, "alarm timer: %s\n",
+                   alarm_timer ? alarm_timer->name : "none");
+    qemu_clock_info(mon, "rt", rt_clock);
+    qemu_clock_info(mon, "vm", vm_clock);
+    qemu_clock_info(mon, "host", host_clock);
+}
+
 void qemu_run_all_timers(void)
 {
     alarm_timer->pending = false;
@@ -471,6 +639,17 @@ static void host_alarm_handler(int host_signum)
     qemu_notify_event();
 }
 
+/* The main loop passes the timer deadlines to poll as its timeout, so
+   this alarm timer has nothing to arm and does not interrupt anybody.  */
+static int poll_start_timer(struct qemu_alarm_timer *t)
+{
+    return 0;
+}
+
+static void poll_stop_timer(struct qemu_alarm_timer *t)
+{
+}
+
 #if defined(__linux__)
 
 #include "compatfd.h"
@@ -759,6 +938,7 @@ int init_timer_alarm(void)
     }
 
     atexit(quit_timers);
+    qemu_thread_get_self(&alarm_thread);
     alarm_timer = t;
     return 0;
 
@@ -16,7 +16,9 @@
 #define SCALE_NS 1
 
 typedef struct QEMUClock QEMUClock;
+typedef struct QEMUTimerList QEMUTimerList;
 typedef void QEMUTimerCB(void *opaque);
+typedef void QEMUTimerListNotifyCB(void *opaque);
 
 /* The real time clock should be used only for stuff which does not
    change the virtual machine state, as it is run even if the virtual
@@ -49,6 +51,22 @@ void qemu_unregister_clock_reset_notifier(QEMUClock *clock,
 
 QEMUTimer *qemu_new_timer(QEMUClock *clock, int scale,
                           QEMUTimerCB *cb, void *opaque);
+
+/* Timer lists hold timers that are not run by the main loop, but by
+   whoever owns the list (for example an AioContext).  @cb is called
+   whenever the first deadline of the list changes, so that the owner
+   can recompute its timeout.  A disabled clock keeps its timers from
+   firing, but the owner is not notified when it is enabled again. */
+QEMUTimerList *qemu_new_timer_list(QEMUClock *clock,
+                                   QEMUTimerListNotifyCB *cb, void *opaque);
+void qemu_free_timer_list(QEMUTimerList *tl);
+QEMUClock *qemu_timer_list_clock(QEMUTimerList *tl);
+/* nanoseconds until the first timer expires, or -1 if none is pending */
+int64_t qemu_timer_list_deadline_ns(QEMUTimerList *tl);
+/* run the expired timers, return whether any was run */
+bool qemu_run_timer_list(QEMUTimerList *tl);
+QEMUTimer *qemu_new_timer_on_list(QEMUTimerList *tl, int scale,
+                                  QEMUTimerCB *cb, void *opaque);
 void qemu_free_timer(QEMUTimer *ts);
 void qemu_del_timer(QEMUTimer *ts);
 void qemu_mod_timer_ns(QEMUTimer *ts, int64_t expire_time);
@@ -59,9 +77,20 @@ uint64_t qemu_timer_expire_time_ns(QEMUTimer *ts);
 
 void qemu_run_timers(QEMUClock *clock);
 void qemu_run_all_timers(void);
+/* nanoseconds until the first main loop timer expires, or -1 if none */
+int64_t qemu_timers_deadline_ns(void);
 void configure_alarms(char const *opt);
 void init_clocks(void);
 int init_timer_alarm(void);
+void do_info_timers(Monitor *mon);
+
+/* Return the earlier of two timeouts in nanoseconds, where -1 means
+   "no timeout".  */
+static inline int64_t qemu_soonest_timeout(int64_t timeout1, int64_t timeout2)
+{
+    /* -1 is UINT64_MAX when compared as unsigned */
+    return ((uint64_t) timeout1 < (uint64_t) timeout2) ? timeout1 : timeout2;
+}
 
 int64_t cpu_get_ticks(void);
 void cpu_enable_ticks(void);
@@ -698,7 +698,7 @@ EQMP
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:b,protocol:s,begin:i?,end:i?",
+        .args_type  = "paging:b,protocol:s,begin:i?,end:i?,detach:b?,format:s?,live:b?",
         .params     = "-p protocol [begin] [length]",
         .help       = "dump guest memory to file",
         .user_print = monitor_user_noop,
@@ -720,6 +720,11 @@ Arguments:
            with length together (json-int)
 - "length": the memory size, in bytes. It's optional, and should be specified
             with begin together (json-int)
+- "detach": return at once and write the dump in the background (json-bool)
+- "format": "elf" (default) or "kdump-zlib", the kdump-compressed format with
+            zlib-compressed pages (json-string)
+- "live": keep the guest running while the dump is written; implies
+          "detach" (json-bool)
 
 Example:
 
@@ -730,6 +735,32 @@ Notes:
 
 (1) All boolean arguments default to false
 
+EQMP
+
+    {
+        .name       = "query-dump",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_dump,
+    },
+
+SQMP
+query-dump
+----------
+
+Show the progress of the current or last guest memory dump.
+
+Return a json-object with the following information:
+
+- "status": "none", "active", "completed" or "failed" (json-string)
+- "completed": bytes of guest memory processed so far (json-int)
+- "total": bytes of guest memory to dump (json-int)
+
+Example:
+
+-> { "execute": "query-dump" }
+<- { "return": { "status": "active", "completed": 1073741824,
+                 "total": 4294967296 } }
+
 EQMP
 
     {
@@ -2134,6 +2165,17 @@ Clients are described by a json-object, each one contain the following:
 - "service": client's port number (json-string)
 - "x509_dname": TLS dname (json-string, optional)
 - "sasl_username": SASL username (json-string, optional)
+- "updates": framebuffer updates encoded for the client (json-int)
+- "encode-time": time spent encoding them, in nanoseconds (json-int)
+- "encoded-bytes": size of the encoded updates (json-int)
+- "bytes-sent": bytes written to the client socket (json-int)
+- "encodings": per encoding statistics (json-array, optional), each one a
+  json-object with:
+    - "name": encoding name (json-string)
+    - "rects": rectangles encoded (json-int)
+    - "raw-bytes": their size in the client's pixel format (json-int)
+    - "bytes": size of the encoded data (json-int)
+    - "time": time spent encoding, in nanoseconds (json-int)
 
 Example:
 
@@ -2149,7 +2191,20 @@ Example:
             {
                "host":"127.0.0.1",
                "service":"50401",
-               "family":"ipv4"
+               "family":"ipv4",
+               "updates":1843,
+               "encode-time":2211520367,
+               "encoded-bytes":93128754,
+               "bytes-sent":93145210,
+               "encodings":[
+                  {
+                     "name":"tight",
+                     "rects":25112,
+                     "raw-bytes":1208219648,
+                     "bytes":93066122,
+                     "time":2203911552
+                  }
+               ]
             }
          ]
       }
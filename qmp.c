@@ -153,6 +153,9 @@ void qmp_cont(Error **errp)
         return;
     } else if (runstate_check(RUN_STATE_SUSPENDED)) {
         return;
+    } else if (dump_in_progress()) {
+        error_setg(errp, "guest memory is being dumped");
+        return;
     }
 
     bdrv_iterate(iostatus_bdrv_it, NULL);
@@ -29,7 +29,7 @@ extern int ctty_closed;
 extern char *slirp_tty;
 extern char *exec_shell;
 extern u_int curtime;
-extern fd_set *global_readfds, *global_writefds, *global_xfds;
+extern GArray *global_pollfds;
 extern struct in_addr loopback_addr;
 extern unsigned long loopback_mask;
 extern char *username;
@@ -17,7 +17,13 @@
 
 #include <slirp.h>
 
-#define MBUF_THRESH 30
+/*
+ * Number of mbufs kept on the free list before m_free() starts
+ * returning them to the allocator.  This has to cover a full scaled
+ * TCP window worth of segments, or bulk transfers end up doing a
+ * malloc()/free() pair for every packet.
+ */
+#define MBUF_THRESH 256
 
 /*
  * Find a nice value for msize
@@ -39,8 +39,8 @@ static const uint8_t special_ethaddr[ETH_ALEN] = {
 
 static const uint8_t zero_ethaddr[ETH_ALEN] = { 0, 0, 0, 0, 0, 0 };
 
-/* XXX: suppress those select globals */
-fd_set *global_readfds, *global_writefds, *global_xfds;
+/* pollfds being dispatched by slirp_pollfds_poll(), NULL otherwise */
+GArray *global_pollfds;
 
 u_int curtime;
 static u_int time_fasttimo, last_slowtimo;
@@ -259,7 +259,6 @@ void slirp_cleanup(Slirp *slirp)
 
 #define CONN_CANFSEND(so) (((so)->so_state & (SS_FCANTSENDMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
 #define CONN_CANFRCV(so) (((so)->so_state & (SS_FCANTRCVMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
-#define UPD_NFDS(x) if (nfds < (x)) nfds = (x)
 
 void slirp_update_timeout(uint32_t *timeout)
 {
@@ -268,23 +267,35 @@ void slirp_update_timeout(uint32_t *timeout)
     }
 }
 
-void slirp_select_fill(int *pnfds,
-                       fd_set *readfds, fd_set *writefds, fd_set *xfds)
+static void slirp_pollfds_add(GArray *pollfds, struct socket *so, int events)
+{
+    GPollFD pfd = {
+        .fd = so->s,
+        .events = events,
+    };
+
+    so->pollfds_idx = pollfds->len;
+    g_array_append_val(pollfds, pfd);
+}
+
+static int slirp_revents(GArray *pollfds, struct socket *so)
+{
+    if (so->pollfds_idx == -1) {
+        return 0;
+    }
+    return g_array_index(pollfds, GPollFD, so->pollfds_idx).revents;
+}
+
+void slirp_pollfds_fill(GArray *pollfds)
 {
     Slirp *slirp;
     struct socket *so, *so_next;
-    int nfds;
+    int events;
 
     if (QTAILQ_EMPTY(&slirp_instances)) {
         return;
     }
 
-    /* fail safe */
-    global_readfds = NULL;
-    global_writefds = NULL;
-    global_xfds = NULL;
-
-    nfds = *pnfds;
 	/*
 	 * First, TCP sockets
 	 */
@@ -301,6 +312,7 @@ void slirp_select_fill(int *pnfds,
 		for (so = slirp->tcb.so_next; so != &slirp->tcb;
 		     so = so_next) {
 			so_next = so->so_next;
+			so->pollfds_idx = -1;
 
 			/*
 			 * See if we need a tcp_fasttimo
@@ -319,8 +331,8 @@ void slirp_select_fill(int *pnfds,
 			 * Set for reading sockets which are accepting
 			 */
 			if (so->so_state & SS_FACCEPTCONN) {
-                                FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
+				slirp_pollfds_add(pollfds, so,
+						  G_IO_IN | G_IO_HUP | G_IO_ERR);
 				continue;
 			}
 
@@ -328,8 +340,7 @@ void slirp_select_fill(int *pnfds,
 			 * Set for writing sockets which are connecting
 			 */
 			if (so->so_state & SS_ISFCONNECTING) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
+				slirp_pollfds_add(pollfds, so, G_IO_OUT | G_IO_ERR);
 				continue;
 			}
 
@@ -337,9 +348,9 @@ void slirp_select_fill(int *pnfds,
 			 * Set for writing if we are connected, can send more, and
 			 * we have something to send
 			 */
+			events = 0;
 			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
+				events |= G_IO_OUT | G_IO_ERR;
 			}
 
 			/*
@@ -347,9 +358,11 @@ void slirp_select_fill(int *pnfds,
 			 * receive more, and we have room for it XXX /2 ?
 			 */
 			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-				FD_SET(so->s, readfds);
-				FD_SET(so->s, xfds);
-				UPD_NFDS(so->s);
+				events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
+			}
+
+			if (events) {
+				slirp_pollfds_add(pollfds, so, events);
 			}
 		}
 
@@ -359,6 +372,7 @@ void slirp_select_fill(int *pnfds,
 		for (so = slirp->udb.so_next; so != &slirp->udb;
 		     so = so_next) {
 			so_next = so->so_next;
+			so->pollfds_idx = -1;
 
 			/*
 			 * See if it's timed out
@@ -382,8 +396,8 @@ void slirp_select_fill(int *pnfds,
 			 * (XXX <= 4 ?)
 			 */
 			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-				FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
+				slirp_pollfds_add(pollfds, so,
+						  G_IO_IN | G_IO_HUP | G_IO_ERR);
 			}
 		}
 
@@ -393,6 +407,7 @@ void slirp_select_fill(int *pnfds,
                 for (so = slirp->icmp.so_next; so != &slirp->icmp;
                      so = so_next) {
                     so_next = so->so_next;
+                    so->pollfds_idx = -1;
 
                     /*
                      * See if it's timed out
@@ -407,17 +422,14 @@ void slirp_select_fill(int *pnfds,
                     }
 
                     if (so->so_state & SS_ISFCONNECTED) {
-                        FD_SET(so->s, readfds);
-                        UPD_NFDS(so->s);
+                        slirp_pollfds_add(pollfds, so,
+                                          G_IO_IN | G_IO_HUP | G_IO_ERR);
                     }
                 }
 	}
-
-        *pnfds = nfds;
 }
 
-void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
-                       int select_error)
+void slirp_pollfds_poll(GArray *pollfds, int select_error)
 {
     Slirp *slirp;
     struct socket *so, *so_next;
@@ -427,9 +439,7 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
         return;
     }
 
-    global_readfds = readfds;
-    global_writefds = writefds;
-    global_xfds = xfds;
+    global_pollfds = pollfds;
 
     curtime = qemu_get_clock_ms(rt_clock);
 
@@ -459,7 +469,7 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
 			so_next = so->so_next;
 
 			/*
-			 * FD_ISSET is meaningless on these sockets
+			 * revents is meaningless on these sockets
 			 * (and they can crash the program)
 			 */
 			if (so->so_state & SS_NOFDREF || so->s == -1)
@@ -470,12 +480,13 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
 			 * This will soread as well, so no need to
 			 * test for readfds below if this succeeds
 			 */
-			if (FD_ISSET(so->s, xfds))
+			if (slirp_revents(pollfds, so) & G_IO_PRI)
 			   sorecvoob(so);
 			/*
 			 * Check sockets for reading
 			 */
-			else if (FD_ISSET(so->s, readfds)) {
+			else if (slirp_revents(pollfds, so) &
+				 (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
 				/*
 				 * Check for incoming connections
 				 */
@@ -493,7 +504,7 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
 			/*
 			 * Check sockets for writing
 			 */
-			if (FD_ISSET(so->s, writefds)) {
+			if (slirp_revents(pollfds, so) & (G_IO_OUT | G_IO_ERR)) {
 			  /*
 			   * Check for non-blocking, still-connecting sockets
 			   */
@@ -576,7 +587,9 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
 		     so = so_next) {
 			so_next = so->so_next;
 
-			if (so->s != -1 && FD_ISSET(so->s, readfds)) {
+			if (so->s != -1 &&
+			    (slirp_revents(pollfds, so) &
+			     (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
                             sorecvfrom(so);
                         }
 		}
@@ -588,7 +601,9 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
                      so = so_next) {
                      so_next = so->so_next;
 
-                    if (so->s != -1 && FD_ISSET(so->s, readfds)) {
+                    if (so->s != -1 &&
+                        (slirp_revents(pollfds, so) &
+                         (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
                         icmp_receive(so);
                     }
                 }
@@ -597,14 +612,8 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
         if_start(slirp);
     }
 
-	/* clear global file descriptor sets.
-	 * these reside on the stack in vl.c
-	 * so they're unusable if we're not in
-	 * slirp_select_fill or slirp_select_poll.
-	 */
-	 global_readfds = NULL;
-	 global_writefds = NULL;
-	 global_xfds = NULL;
+    /* the array belongs to the main loop and is refilled next iteration */
+    global_pollfds = NULL;
 }
 
 static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
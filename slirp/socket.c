@@ -51,6 +51,7 @@ socreate(Slirp *slirp)
     so->so_state = SS_NOFDREF;
     so->s = -1;
     so->slirp = slirp;
+    so->pollfds_idx = -1;
   }
   return(so);
 }
@@ -680,8 +681,9 @@ sofcantrcvmore(struct socket *so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
 		shutdown(so->s,0);
-		if(global_writefds) {
-		  FD_CLR(so->s,global_writefds);
+		if (global_pollfds && so->pollfds_idx != -1) {
+		  g_array_index(global_pollfds, GPollFD, so->pollfds_idx).revents &=
+		      ~(G_IO_OUT | G_IO_ERR);
 		}
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
@@ -698,11 +700,9 @@ sofcantsendmore(struct socket *so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
             shutdown(so->s,1);           /* send FIN to fhost */
-            if (global_readfds) {
-                FD_CLR(so->s,global_readfds);
-            }
-            if (global_xfds) {
-                FD_CLR(so->s,global_xfds);
+            if (global_pollfds && so->pollfds_idx != -1) {
+                g_array_index(global_pollfds, GPollFD, so->pollfds_idx).revents &=
+                    ~(G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI);
             }
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
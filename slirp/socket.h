@@ -19,6 +19,7 @@ struct socket {
   struct socket *so_next,*so_prev;      /* For a linked list of sockets */
 
   int s;                           /* The actual socket */
+  int pollfds_idx;                 /* GPollFD GArray index, -1 if unpolled */
 
   Slirp *slirp;			   /* managing slirp instance */
 
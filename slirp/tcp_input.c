@@ -97,6 +97,8 @@
 	} \
 }
 #endif
+
+static void tcp_setscale(struct tcpcb *tp);
 static void tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt,
                           struct tcpiphdr *ti);
 static void tcp_xmit_timer(register struct tcpcb *tp, int rtt);
@@ -396,7 +398,11 @@ findso:
 	if (tp->t_state == TCPS_CLOSED)
 		goto drop;
 
-	tiwin = ti->ti_win;
+	/* Unscale the window into a 32-bit value (RFC 1323) */
+	if ((tiflags & TH_SYN) == 0)
+		tiwin = (u_long)ti->ti_win << tp->snd_scale;
+	else
+		tiwin = ti->ti_win;
 
 	/*
 	 * Segment received on connection.
@@ -683,6 +689,9 @@ findso:
 			soisfconnected(so);
 			tp->t_state = TCPS_ESTABLISHED;
 
+			/* Do window scaling on this connection? */
+			tcp_setscale(tp);
+
 			(void) tcp_reass(tp, (struct tcpiphdr *)0,
 				(struct mbuf *)0);
 			/*
@@ -862,6 +871,8 @@ trimthenstep6:
 		    SEQ_GT(ti->ti_ack, tp->snd_max))
 			goto dropwithreset;
 		tp->t_state = TCPS_ESTABLISHED;
+		/* Do window scaling? */
+		tcp_setscale(tp);
 		/*
 		 * The sent SYN is ack'ed with our sequence number +1
 		 * The first data byte already in the buffer will get
@@ -1317,6 +1328,15 @@ tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti)
 			NTOHS(mss);
 			(void) tcp_mss(tp, mss);	/* sets t_maxseg */
 			break;
+
+		case TCPOPT_WINDOW:
+			if (optlen != TCPOLEN_WINDOW)
+				continue;
+			if (!(ti->ti_flags & TH_SYN))
+				continue;
+			tp->t_flags |= TF_RCVD_SCALE;
+			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
+			break;
 		}
 	}
 }
@@ -1478,7 +1498,30 @@ tcp_mss(struct tcpcb *tp, u_int offer)
                                                (mss - (TCP_RCVSPACE % mss)) :
                                                0));
 
+	/*
+	 * Compute the window scale we will request: the smallest shift
+	 * that lets the advertised window cover the whole receive buffer.
+	 */
+	tp->request_r_scale = 0;
+	while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
+	       (TCP_MAXWIN << tp->request_r_scale) < so->so_rcv.sb_datalen)
+		tp->request_r_scale++;
+
 	DEBUG_MISC((dfd, " returning mss = %d\n", mss));
 
 	return mss;
 }
+
+/*
+ * Enable window scaling once the connection is established, but
+ * only if both ends asked for it in their SYN segments.
+ */
+static void
+tcp_setscale(struct tcpcb *tp)
+{
+	if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+	    (TF_RCVD_SCALE|TF_REQ_SCALE)) {
+		tp->snd_scale = tp->requested_s_scale;
+		tp->rcv_scale = tp->request_r_scale;
+	}
+}
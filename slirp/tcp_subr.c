@@ -41,8 +41,8 @@
 #include <slirp.h>
 
 /* patchable/settable parameters for tcp */
-/* Don't do rfc1323 performance enhancements */
-#define TCP_DO_RFC1323 0
+/* Do rfc1323 window scaling (timestamps are not implemented) */
+#define TCP_DO_RFC1323 1
 
 /*
  * Tcp initialization
@@ -191,7 +191,7 @@ tcp_newtcpcb(struct socket *so)
 	tp->seg_next = tp->seg_prev = (struct tcpiphdr*)tp;
 	tp->t_maxseg = TCP_MSS;
 
-	tp->t_flags = TCP_DO_RFC1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	tp->t_flags = TCP_DO_RFC1323 ? TF_REQ_SCALE : 0;
 	tp->t_socket = so;
 
 	/*
@@ -38,6 +38,9 @@ void vm_start(void);
 void vm_stop(RunState state);
 void vm_stop_force_state(RunState state);
 
+/* True while a detached dump-guest-memory keeps the guest stopped */
+bool dump_in_progress(void);
+
 typedef enum WakeupReason {
     QEMU_WAKEUP_REASON_OTHER = 0,
     QEMU_WAKEUP_REASON_RTC,
@@ -137,6 +140,16 @@ extern int nb_numa_nodes;
 extern uint64_t node_mem[MAX_NODES];
 extern unsigned long *node_cpumask[MAX_NODES];
 
+/* Host NUMA placement of each guest node's memory (-numa hostnodes=) */
+enum {
+    NUMA_POLICY_DEFAULT,
+    NUMA_POLICY_PREFERRED,
+    NUMA_POLICY_BIND,
+    NUMA_POLICY_INTERLEAVE,
+};
+extern uint64_t node_host_nodes[MAX_NODES];
+extern int node_host_policy[MAX_NODES];
+
 #define MAX_OPTION_ROMS 16
 typedef struct QEMUOptionRom {
     const char *name;
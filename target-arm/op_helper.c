@@ -53,6 +53,7 @@ uint32_t HELPER(neon_tbl)(CPUARMState *env, uint32_t ireg, uint32_t def,
 #if !defined(CONFIG_USER_ONLY)
 
 #include "softmmu_exec.h"
+#include "main-loop.h"
 
 #define MMUSUFFIX _mmu
 
@@ -91,6 +92,103 @@ void tlb_fill(CPUARMState *env, target_ulong addr, int is_write, int mmu_idx,
         raise_exception(env, env->exception_index);
     }
 }
+
+static uint32_t strex_stopped(CPUARMState *env, uint32_t addr, uint64_t old,
+                              uint64_t val, uint32_t size)
+{
+    uint64_t cur;
+
+    qemu_mutex_lock_iothread();
+    tcg_exclusive_start();
+    switch (size) {
+    case 0:
+        cur = cpu_ldub_data(env, addr);
+        break;
+    case 1:
+        cur = cpu_lduw_data(env, addr);
+        break;
+    case 2:
+        cur = cpu_ldl_data(env, addr);
+        break;
+    default:
+        cur = cpu_ldq_data(env, addr);
+        break;
+    }
+    if (cur == old) {
+        switch (size) {
+        case 0:
+            cpu_stb_data(env, addr, val);
+            break;
+        case 1:
+            cpu_stw_data(env, addr, val);
+            break;
+        case 2:
+            cpu_stl_data(env, addr, val);
+            break;
+        default:
+            cpu_stq_data(env, addr, val);
+            break;
+        }
+    }
+    tcg_exclusive_end();
+    qemu_mutex_unlock_iothread();
+    return cur != old;
+}
+
+/* Store exclusive with one thread per vCPU (-tcg-threads multi): the
+   comparison against the value seen by the load exclusive and the store
+   must be a single atomic operation on the host.  Returns the status to
+   be written to Rd.  */
+uint32_t HELPER(strex)(CPUARMState *env, uint32_t addr, uint64_t val,
+                       uint32_t size)
+{
+    int mmu_idx = cpu_mmu_index(env);
+    int index = tlb_index(env, addr);
+    target_ulong tlb_addr;
+    uint64_t old;
+    void *host;
+    bool ok;
+
+    if (addr != env->exclusive_addr) {
+        return 1;
+    }
+    old = env->exclusive_val;
+    if (size == 3) {
+        old |= (uint64_t)env->exclusive_high << 32;
+    }
+
+    tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+    if ((addr & TARGET_PAGE_MASK) !=
+        (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+        tlb_fill(env, addr, 1, mmu_idx, GETPC());
+        tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+    }
+    if (tlb_addr & ~TARGET_PAGE_MASK) {
+        /* I/O, or RAM whose writes must go through the slow path */
+        return strex_stopped(env, addr, old, val, size);
+    }
+
+    host = (void *)((uintptr_t)addr + env->tlb_table[mmu_idx][index].addend);
+    switch (size) {
+    case 0:
+        ok = __sync_bool_compare_and_swap((uint8_t *)host, (uint8_t)old,
+                                          (uint8_t)val);
+        break;
+    case 1:
+        ok = __sync_bool_compare_and_swap((uint16_t *)host, tswap16(old),
+                                          tswap16(val));
+        break;
+    case 2:
+        ok = __sync_bool_compare_and_swap((uint32_t *)host, tswap32(old),
+                                          tswap32(val));
+        break;
+    default:
+        ok = __sync_bool_compare_and_swap((uint64_t *)host, tswap64(old),
+                                          tswap64(val));
+        break;
+    }
+    return !ok;
+}
 #endif
 
 /* FIXME: Pass an explicit pointer to QF to CPUARMState, and move saturating
@@ -758,7 +758,9 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    /* The Thumb bit is part of the TB flags, so the jump cache lookup
+       at the end of the TB picks up the state change.  */
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -2635,17 +2637,10 @@ static int disas_vfp_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
                     tmp = load_reg(s, rd);
                     if (insn & (1 << 23)) {
                         /* VDUP */
-                        if (size == 0) {
-                            gen_neon_dup_u8(tmp, 0);
-                        } else if (size == 1) {
-                            gen_neon_dup_low16(tmp);
-                        }
-                        for (n = 0; n <= pass * 2; n++) {
-                            tmp2 = tcg_temp_new_i32();
-                            tcg_gen_mov_i32(tmp2, tmp);
-                            neon_store_reg(rn, n, tmp2);
-                        }
-                        neon_store_reg(rn, n, tmp);
+                        tcg_gen_vec_env_dup_i32(cpu_env,
+                                                vfp_reg_offset(1, rn),
+                                                pass ? 16 : 8, size, tmp);
+                        tcg_temp_free_i32(tmp);
                     } else {
                         /* VMOV */
                         switch (size) {
@@ -3512,8 +3507,8 @@ static void gen_nop_hint(DisasContext *s, int val)
 static inline void gen_neon_add(int size, TCGv t0, TCGv t1)
 {
     switch (size) {
-    case 0: gen_helper_neon_add_u8(t0, t0, t1); break;
-    case 1: gen_helper_neon_add_u16(t0, t0, t1); break;
+    case 0: tcg_gen_vec_add8_i32(t0, t0, t1); break;
+    case 1: tcg_gen_vec_add16_i32(t0, t0, t1); break;
     case 2: tcg_gen_add_i32(t0, t0, t1); break;
     default: abort();
     }
@@ -3522,8 +3517,8 @@ static inline void gen_neon_add(int size, TCGv t0, TCGv t1)
 static inline void gen_neon_rsb(int size, TCGv t0, TCGv t1)
 {
     switch (size) {
-    case 0: gen_helper_neon_sub_u8(t0, t1, t0); break;
-    case 1: gen_helper_neon_sub_u16(t0, t1, t0); break;
+    case 0: tcg_gen_vec_sub8_i32(t0, t1, t0); break;
+    case 1: tcg_gen_vec_sub16_i32(t0, t1, t0); break;
     case 2: tcg_gen_sub_i32(t0, t1, t0); break;
     default: return;
     }
@@ -4422,6 +4417,64 @@ static const uint8_t neon_2rm_sizes[] = {
     [NEON_2RM_VCVT_UF] = 0x4,
 };
 
+static const TCGVecOp3 neon_add_op[4] = {
+    { tcg_gen_vec_add8_i64, tcg_gen_add8_v128 },
+    { tcg_gen_vec_add16_i64, tcg_gen_add16_v128 },
+    { tcg_gen_vec_add32_i64, tcg_gen_add32_v128 },
+    { tcg_gen_add_i64, tcg_gen_add64_v128 },
+};
+
+static const TCGVecOp3 neon_sub_op[4] = {
+    { tcg_gen_vec_sub8_i64, tcg_gen_sub8_v128 },
+    { tcg_gen_vec_sub16_i64, tcg_gen_sub16_v128 },
+    { tcg_gen_vec_sub32_i64, tcg_gen_sub32_v128 },
+    { tcg_gen_sub_i64, tcg_gen_sub64_v128 },
+};
+
+static const TCGVecOp3 neon_ceq_op[3] = {
+    { tcg_gen_vec_cmpeq8_i64, tcg_gen_cmpeq8_v128 },
+    { tcg_gen_vec_cmpeq16_i64, tcg_gen_cmpeq16_v128 },
+    { tcg_gen_vec_cmpeq32_i64, tcg_gen_cmpeq32_v128 },
+};
+
+static const TCGVecOp3 neon_logic_op[8] = {
+    [0] = { tcg_gen_and_i64, tcg_gen_and_v128 }, /* VAND */
+    [1] = { tcg_gen_andc_i64, tcg_gen_andc_v128 }, /* VBIC */
+    [2] = { tcg_gen_or_i64, tcg_gen_or_v128 }, /* VORR */
+    [4] = { tcg_gen_xor_i64, tcg_gen_xor_v128 }, /* VEOR */
+};
+
+/* Expand the elementwise three register insns that have a TCG vector
+   form on the whole D or Q register.  Return nonzero if done.  */
+static int gen_neon_3r_vec(int op, int u, int size, int q,
+                           int rd, int rn, int rm)
+{
+    const TCGVecOp3 *vop;
+
+    switch (op) {
+    case NEON_3R_VADD_VSUB:
+        vop = u ? &neon_sub_op[size] : &neon_add_op[size];
+        break;
+    case NEON_3R_VTST_VCEQ:
+        if (!u) {
+            return 0;
+        }
+        vop = &neon_ceq_op[size];
+        break;
+    case NEON_3R_LOGIC:
+        vop = &neon_logic_op[(u << 2) | size];
+        if (!vop->fni8) {
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+    tcg_gen_vec_env_3(cpu_env, vfp_reg_offset(1, rd), vfp_reg_offset(1, rn),
+                      vfp_reg_offset(1, rm), q ? 16 : 8, vop);
+    return 1;
+}
+
 /* Translate a NEON data processing instruction.  Return nonzero if the
    instruction is invalid.
    We process data in a mixture of 32-bit and 64-bit chunks.
@@ -4463,6 +4516,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
         if (q && ((rd | rn | rm) & 1)) {
             return 1;
         }
+        if (gen_neon_3r_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -4702,8 +4758,8 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                 gen_neon_add(size, tmp, tmp2);
             } else { /* VSUB */
                 switch (size) {
-                case 0: gen_helper_neon_sub_u8(tmp, tmp, tmp2); break;
-                case 1: gen_helper_neon_sub_u16(tmp, tmp, tmp2); break;
+                case 0: tcg_gen_vec_sub8_i32(tmp, tmp, tmp2); break;
+                case 1: tcg_gen_vec_sub16_i32(tmp, tmp, tmp2); break;
                 case 2: tcg_gen_sub_i32(tmp, tmp, tmp2); break;
                 default: abort();
                 }
@@ -4719,8 +4775,8 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                 }
             } else { /* VCEQ */
                 switch (size) {
-                case 0: gen_helper_neon_ceq_u8(tmp, tmp, tmp2); break;
-                case 1: gen_helper_neon_ceq_u16(tmp, tmp, tmp2); break;
+                case 0: tcg_gen_vec_cmpeq8_i32(tmp, tmp, tmp2); break;
+                case 1: tcg_gen_vec_cmpeq16_i32(tmp, tmp, tmp2); break;
                 case 2: gen_helper_neon_ceq_u32(tmp, tmp, tmp2); break;
                 default: abort();
                 }
@@ -6003,8 +6059,8 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                         case NEON_2RM_VCEQ0:
                             tmp2 = tcg_const_i32(0);
                             switch(size) {
-                            case 0: gen_helper_neon_ceq_u8(tmp, tmp, tmp2); break;
-                            case 1: gen_helper_neon_ceq_u16(tmp, tmp, tmp2); break;
+                            case 0: tcg_gen_vec_cmpeq8_i32(tmp, tmp, tmp2); break;
+                            case 1: tcg_gen_vec_cmpeq16_i32(tmp, tmp, tmp2); break;
                             case 2: gen_helper_neon_ceq_u32(tmp, tmp, tmp2); break;
                             default: abort();
                             }
@@ -6430,9 +6486,11 @@ static void gen_logicq_cc(TCGv_i64 val)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   In system emulation mode with a single TCG thread only one CPU will be
+   running at once, so this sequence is effectively atomic; with one
+   thread per vCPU a helper does the store with a host compare-and-swap.
+   In user emulation mode we throw an exception and handle the atomic
+   operation elsewhere.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv addr, int size)
 {
@@ -6487,6 +6545,26 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     int done_label;
     int fail_label;
 
+    if (mttcg_enabled) {
+        TCGv_i64 val = tcg_temp_new_i64();
+
+        tmp = load_reg(s, rt);
+        if (size == 3) {
+            TCGv tmp2 = load_reg(s, rt2);
+            tcg_gen_concat_i32_i64(val, tmp, tmp2);
+            tcg_temp_free_i32(tmp2);
+        } else {
+            tcg_gen_extu_i32_i64(val, tmp);
+        }
+        tcg_temp_free_i32(tmp);
+        tmp = tcg_const_i32(size);
+        gen_helper_strex(cpu_R[rd], cpu_env, addr, val, tmp);
+        tcg_temp_free_i32(tmp);
+        tcg_temp_free_i64(val);
+        tcg_gen_movi_i32(cpu_exclusive_addr, -1);
+        return;
+    }
+
     /* if (env->exclusive_addr == addr && env->exclusive_val == [addr]) {
          [addr] = {Rt};
          {Rd} = 0;
@@ -9927,8 +10005,11 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* indirect branch: chain through the jump cache if possible */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
+        default:
         case DISAS_UPDATE:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
@@ -36,6 +36,9 @@
 
 #define TARGET_HAS_ICE 1
 
+/* support for retranslating hot TBs with CF_TRACE */
+#define TARGET_HAS_TRACES 1
+
 #ifdef TARGET_X86_64
 #define ELF_MACHINE	EM_X86_64
 #else
@@ -22,6 +22,7 @@
 
 #if !defined(CONFIG_USER_ONLY)
 #include "softmmu_exec.h"
+#include "main-loop.h"
 #endif /* !defined(CONFIG_USER_ONLY) */
 
 /* broken thread support */
@@ -30,11 +31,29 @@ static spinlock_t global_cpu_lock = SPIN_LOCK_UNLOCKED;
 
 void helper_lock(void)
 {
+#if !defined(CONFIG_USER_ONLY)
+    /* With one thread per vCPU, plain stores from other vCPUs must not
+       interleave with the locked instruction either: stop them all.  */
+    if (mttcg_enabled) {
+        qemu_mutex_lock_iothread();
+        tcg_exclusive_start();
+        qemu_mutex_unlock_iothread();
+        return;
+    }
+#endif
     spin_lock(&global_cpu_lock);
 }
 
 void helper_unlock(void)
 {
+#if !defined(CONFIG_USER_ONLY)
+    if (mttcg_enabled) {
+        qemu_mutex_lock_iothread();
+        tcg_exclusive_end();
+        qemu_mutex_unlock_iothread();
+        return;
+    }
+#endif
     spin_unlock(&global_cpu_lock);
 }
 
@@ -98,6 +98,7 @@ typedef struct DisasContext {
     int tf;     /* TF cpu flag */
     int singlestep_enabled; /* "hardware" single step enabled */
     int jmp_opt; /* use direct block chaining for direct jumps */
+    int trace; /* hot TB: translate through forward branches */
     int mem_index; /* select memory access functions */
     uint64_t flags; /* all execution flags */
     struct TranslationBlock *tb;
@@ -2357,6 +2358,17 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     }
 }
 
+/* In a trace, a forward jump to 'eip' on the first page of the TB is
+   followed instead of ending the TB.  The TB size then covers the
+   skipped bytes too, which only makes invalidation conservative.  */
+static inline int gen_trace_follow(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    return s->trace && pc >= s->pc &&
+           (pc & TARGET_PAGE_MASK) == (s->tb->pc & TARGET_PAGE_MASK);
+}
+
 static inline void gen_jcc(DisasContext *s, int b,
                            target_ulong val, target_ulong next_eip)
 {
@@ -2364,7 +2376,15 @@ static inline void gen_jcc(DisasContext *s, int b,
 
     cc_op = s->cc_op;
     gen_update_cc_op(s);
-    if (s->jmp_opt) {
+    if (s->trace && val > next_eip) {
+        /* forward branches are predicted not taken: leave the trace
+           through the jump cache if taken, and go on translating */
+        l1 = gen_new_label();
+        gen_jcc1(s, cc_op, b ^ 1, l1);
+        gen_jmp_im(val);
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
+        gen_set_label(l1);
+    } else if (s->jmp_opt) {
         l1 = gen_new_label();
         gen_jcc1(s, cc_op, b, l1);
         
@@ -2748,8 +2768,9 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 }
 
 /* generate a generic end of block. Trace exception is also generated
-   if needed */
-static void gen_eob(DisasContext *s)
+   if needed. If JR is set, the next TB is looked up in the jump cache
+   instead of returning to the main loop. */
+static void gen_eob_worker(DisasContext *s, int jr)
 {
     if (s->cc_op != CC_OP_DYNAMIC)
         gen_op_set_cc_op(s->cc_op);
@@ -2763,12 +2784,25 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    gen_eob_worker(s, 0);
+}
+
+/* end of block after an indirect branch (call/jmp Ev, ret) */
+static void gen_jr(DisasContext *s)
+{
+    gen_eob_worker(s, 1);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -3012,6 +3046,51 @@ static const SSEFunc_0_epp sse_op_table2[3 * 8][2] = {
     [16 + 7] = { NULL, gen_helper_pslldq_xmm },
 };
 
+static void gen_pandn_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_andc_i64(d, b, a);
+}
+
+static void gen_pandn_v128(TCGv_v128 d, TCGv_v128 a, TCGv_v128 b)
+{
+    tcg_gen_andc_v128(d, b, a);
+}
+
+/* Integer and logical operations of sse_op_table1 that are expanded
+   inline for both the MMX and the SSE form.  The SSE form uses host
+   vector registers if there are any.  */
+static const TCGVecOp3 sse_op_inline[256] = {
+    [0x54] = { tcg_gen_and_i64, tcg_gen_and_v128 }, /* andps, andpd */
+    [0x55] = { gen_pandn_i64, gen_pandn_v128 }, /* andnps, andnpd */
+    [0x56] = { tcg_gen_or_i64, tcg_gen_or_v128 }, /* orps, orpd */
+    [0x57] = { tcg_gen_xor_i64, tcg_gen_xor_v128 }, /* xorps, xorpd */
+    [0x74] = { tcg_gen_vec_cmpeq8_i64, tcg_gen_cmpeq8_v128 }, /* pcmpeqb */
+    [0x75] = { tcg_gen_vec_cmpeq16_i64, tcg_gen_cmpeq16_v128 }, /* pcmpeqw */
+    [0x76] = { tcg_gen_vec_cmpeq32_i64, tcg_gen_cmpeq32_v128 }, /* pcmpeql */
+    [0xd4] = { tcg_gen_add_i64, tcg_gen_add64_v128 }, /* paddq */
+    [0xdb] = { tcg_gen_and_i64, tcg_gen_and_v128 }, /* pand */
+    [0xdf] = { gen_pandn_i64, gen_pandn_v128 }, /* pandn */
+    [0xeb] = { tcg_gen_or_i64, tcg_gen_or_v128 }, /* por */
+    [0xef] = { tcg_gen_xor_i64, tcg_gen_xor_v128 }, /* pxor */
+    [0xf8] = { tcg_gen_vec_sub8_i64, tcg_gen_sub8_v128 }, /* psubb */
+    [0xf9] = { tcg_gen_vec_sub16_i64, tcg_gen_sub16_v128 }, /* psubw */
+    [0xfa] = { tcg_gen_vec_sub32_i64, tcg_gen_sub32_v128 }, /* psubl */
+    [0xfb] = { tcg_gen_sub_i64, tcg_gen_sub64_v128 }, /* psubq */
+    [0xfc] = { tcg_gen_vec_add8_i64, tcg_gen_add8_v128 }, /* paddb */
+    [0xfd] = { tcg_gen_vec_add16_i64, tcg_gen_add16_v128 }, /* paddw */
+    [0xfe] = { tcg_gen_vec_add32_i64, tcg_gen_add32_v128 }, /* paddl */
+};
+
+/* Likewise for the shifts by immediate of sse_op_table2.  */
+static const TCGVecOp2i sse_op_inline2[3 * 8] = {
+    [0 + 2] = { tcg_gen_vec_shr16i_i64, tcg_gen_shri16_v128 }, /* psrlw */
+    [0 + 6] = { tcg_gen_vec_shl16i_i64, tcg_gen_shli16_v128 }, /* psllw */
+    [8 + 2] = { tcg_gen_vec_shr32i_i64, tcg_gen_shri32_v128 }, /* psrld */
+    [8 + 6] = { tcg_gen_vec_shl32i_i64, tcg_gen_shli32_v128 }, /* pslld */
+    [16 + 2] = { tcg_gen_vec_shr64i_i64, tcg_gen_shri64_v128 }, /* psrlq */
+    [16 + 6] = { tcg_gen_vec_shl64i_i64, tcg_gen_shli64_v128 }, /* psllq */
+};
+
 static const SSEFunc_0_epi sse_op_table3ai[] = {
     gen_helper_cvtsi2ss,
     gen_helper_cvtsi2sd
@@ -3175,6 +3254,7 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
     SSEFunc_0_eppi sse_fn_eppi;
     SSEFunc_0_ppi sse_fn_ppi;
     SSEFunc_0_eppt sse_fn_eppt;
+    const TCGVecOp2i *sse_op2i;
 
     b &= 0xff;
     if (s->prefix & PREFIX_DATA)
@@ -3561,6 +3641,25 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
 	        goto illegal_op;
             }
             val = cpu_ldub_code(cpu_single_env, s->pc++);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto illegal_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            sse_op2i = &sse_op_inline2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)];
+            if (sse_op2i->fni8) {
+                tcg_gen_vec_env_2i(cpu_env, op2_offset, op2_offset,
+                                   is_xmm ? 16 : 8, val, sse_op2i);
+                break;
+            }
             if (is_xmm) {
                 gen_op_movl_T0_im(val);
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,xmm_t0.XMM_L(0)));
@@ -3574,18 +3673,6 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto illegal_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4182,6 +4269,12 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (b1 < 2 && sse_op_inline[b].fni8) {
+                tcg_gen_vec_env_3(cpu_env, op1_offset, op1_offset,
+                                  op2_offset, is_xmm ? 16 : 8,
+                                  &sse_op_inline[b]);
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4749,7 +4842,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             gen_movtl_T1_im(next_eip);
             gen_push_T1(s);
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -4776,7 +4869,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             if (s->dflag == 0)
                 gen_op_andl_T0_ffff();
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -6304,7 +6397,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         gen_pop_T0(s);
@@ -6312,7 +6405,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(cpu_single_env, s->pc);
@@ -6409,6 +6502,10 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             tval &= 0xffff;
         else if(!CODE64(s))
             tval &= 0xffffffff;
+        if (gen_trace_follow(s, tval)) {
+            s->pc = s->cs_base + tval;
+            break;
+        }
         gen_jmp(s, tval);
         break;
     case 0xea: /* ljmp im */
@@ -6430,6 +6527,10 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         tval += s->pc - s->cs_base;
         if (s->dflag == 0)
             tval &= 0xffff;
+        if (gen_trace_follow(s, tval)) {
+            s->pc = s->cs_base + tval;
+            break;
+        }
         gen_jmp(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
@@ -7938,6 +8039,8 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
                     || (flags & HF_SOFTMMU_MASK)
 #endif
                     );
+    dc->trace = (tb->cflags & CF_TRACE) && dc->jmp_opt &&
+                !(flags & HF_RF_MASK);
 #if 0
     /* check addseg logic */
     if (!dc->addseg && (dc->vm86 || !dc->pe || !dc->code32))
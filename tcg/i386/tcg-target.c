@@ -27,6 +27,9 @@ static const char * const tcg_target_reg_names[TCG_TARGET_NB_REGS] = {
 #if TCG_TARGET_REG_BITS == 64
     "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
     "%r8",  "%r9",  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+    "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+    "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+    "%xmm12", "%xmm13", "%xmm14", "%xmm15",
 #else
     "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
 #endif
@@ -50,6 +53,22 @@ static const int tcg_target_reg_alloc_order[] = {
     TCG_REG_RSI,
     TCG_REG_RDI,
     TCG_REG_RAX,
+    TCG_REG_XMM0,
+    TCG_REG_XMM1,
+    TCG_REG_XMM2,
+    TCG_REG_XMM3,
+    TCG_REG_XMM4,
+    TCG_REG_XMM5,
+    TCG_REG_XMM6,
+    TCG_REG_XMM7,
+    TCG_REG_XMM8,
+    TCG_REG_XMM9,
+    TCG_REG_XMM10,
+    TCG_REG_XMM11,
+    TCG_REG_XMM12,
+    TCG_REG_XMM13,
+    TCG_REG_XMM14,
+    TCG_REG_XMM15,
 #else
     TCG_REG_EBX,
     TCG_REG_ESI,
@@ -98,6 +117,14 @@ static const int tcg_target_call_oarg_regs[] = {
 # define TCG_REG_L1 TCG_REG_EDX
 #endif
 
+/* The SSE registers available for vectors.  They are all call clobbered;
+   the Win64 ABI preserves %xmm6 to %xmm15, so those are not used.  */
+#if defined(_WIN64)
+# define TCG_REG_XMM_MASK (0x003fu << TCG_REG_XMM0)
+#else
+# define TCG_REG_XMM_MASK (0xffffu << TCG_REG_XMM0)
+#endif
+
 static uint8_t *tb_ret_addr;
 
 static void patch_reloc(uint8_t *code_ptr, int type,
@@ -175,6 +202,10 @@ static int target_parse_constraint(TCGArgConstraint *ct, const char **pct_str)
             tcg_regset_set32(ct->u.regs, 0, 0xff);
         }
         break;
+    case 'x':
+        ct->ct |= TCG_CT_REG;
+        tcg_regset_set32(ct->u.regs, 0, TCG_REG_XMM_MASK);
+        break;
 
         /* qemu_ld/st address constraint */
     case 'L':
@@ -242,6 +273,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 # define P_REXB_R	0
 # define P_REXB_RM	0
 #endif
+#define P_SIMDF3	0x4000		/* 0xf3 opcode prefix */
 
 #define OPC_ARITH_EvIz	(0x81)
 #define OPC_ARITH_EvIb	(0x83)
@@ -287,6 +319,38 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
+/* SSE2 integer instructions, on %xmm registers.  */
+#define OPC_MOVDQA_VxWx	(0x6f | P_EXT | P_DATA16)
+#define OPC_MOVDQU_VxWx	(0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx	(0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVD_VyEy	(0x6e | P_EXT | P_DATA16)
+#define OPC_PADDB	(0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW	(0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD	(0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ	(0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND	(0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN	(0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB	(0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW	(0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD	(0x76 | P_EXT | P_DATA16)
+#define OPC_POR		(0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib	(0x71 | P_EXT | P_DATA16) /* /2 psrl, /6 psll */
+#define OPC_PSHIFTD_Ib	(0x72 | P_EXT | P_DATA16)
+#define OPC_PSHIFTQ_Ib	(0x73 | P_EXT | P_DATA16)
+#define OPC_PSHUFD	(0x70 | P_EXT | P_DATA16)
+#define OPC_PSUBB	(0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW	(0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD	(0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ	(0xfb | P_EXT | P_DATA16)
+#define OPC_PUNPCKLBW	(0x60 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLWD	(0x61 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLQDQ	(0x6c | P_EXT | P_DATA16)
+#define OPC_PXOR	(0xef | P_EXT | P_DATA16)
+
+/* Group 12-14 opcode extensions for the SSE shifts by immediate.  */
+#define EXT_PSRL 2
+#define EXT_PSLL 6
+
 /* Group 1 opcode extensions for 0x80-0x83.
    These are also used as modifiers for OPC_ARITH.  */
 #define ARITH_ADD 0
@@ -357,13 +421,18 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     int rex;
 
     if (opc & P_DATA16) {
-        /* We should never be asking for both 16 and 64-bit operation.  */
-        assert((opc & P_REXW) == 0);
+        /* We should never be asking for both 16 and 64-bit operation.
+           Moving a 64-bit register to %xmm is the only 0x66 insn here
+           where REX.W does not select the operand size.  */
+        assert((opc & P_REXW) == 0 || opc == (OPC_MOVD_VyEy | P_REXW));
         tcg_out8(s, 0x66);
     }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) >> 8;		/* REX.W */
@@ -394,6 +463,9 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    }
     if (opc & P_EXT) {
         tcg_out8(s, 0x0f);
     }
@@ -521,6 +593,9 @@ static inline void tcg_out_mov(TCGContext *s, TCGType type,
 {
     if (arg != ret) {
         int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+        if (type == TCG_TYPE_V128) {
+            opc = OPC_MOVDQA_VxWx;
+        }
         tcg_out_modrm(s, opc, ret, arg);
     }
 }
@@ -571,6 +646,9 @@ static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
                               TCGReg arg1, tcg_target_long arg2)
 {
     int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    if (type == TCG_TYPE_V128) {
+        opc = OPC_MOVDQU_VxWx;
+    }
     tcg_out_modrm_offset(s, opc, ret, arg1, arg2);
 }
 
@@ -578,6 +656,9 @@ static inline void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, tcg_target_long arg2)
 {
     int opc = OPC_MOVL_EvGv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    if (type == TCG_TYPE_V128) {
+        opc = OPC_MOVDQU_WxVx;
+    }
     tcg_out_modrm_offset(s, opc, arg, arg1, arg2);
 }
 
@@ -1047,8 +1128,9 @@ static inline void tcg_out_tlb_load(TCGContext *s, int addrlo_idx,
 
     tgen_arithi(s, ARITH_AND + rexw, r0,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + rexw, r1,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* and tlb_mask(env), r1 -- the TLB size varies at run time */
+    tcg_out_modrm_offset(s, OPC_ARITH_GvEv + (ARITH_AND << 3) + rexw, r1,
+                         TCG_AREG0, offsetof(CPUArchState, tlb_mask));
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + P_REXW, r1, TCG_AREG0, r1, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
@@ -1494,7 +1576,12 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
-            /* direct jump method */
+            /* direct jump method.  Keep the displacement 4-byte aligned
+               so that patching it is atomic for vCPUs executing it
+               concurrently.  */
+            while (((tcg_target_long)s->code_ptr + 1) & 3) {
+                tcg_out8(s, 0x90); /* nop */
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = s->code_ptr - s->code_buf;
             tcg_out32(s, 0);
@@ -1505,6 +1592,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp *reg */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out_calli(s, args[0]);
@@ -1811,6 +1902,108 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_ext32s_i64:
         tcg_out_ext32s(s, args[0], args[1]);
         break;
+
+    case INDEX_op_ld_v128:
+        tcg_out_ld(s, TCG_TYPE_V128, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_v128:
+        tcg_out_st(s, TCG_TYPE_V128, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_dup8_v128:
+        tcg_out_modrm(s, OPC_MOVD_VyEy, args[0], args[1]);
+        tcg_out_modrm(s, OPC_PUNPCKLBW, args[0], args[0]);
+        tcg_out_modrm(s, OPC_PUNPCKLWD, args[0], args[0]);
+        tcg_out_modrm(s, OPC_PSHUFD, args[0], args[0]);
+        tcg_out8(s, 0);
+        break;
+    case INDEX_op_dup16_v128:
+        tcg_out_modrm(s, OPC_MOVD_VyEy, args[0], args[1]);
+        tcg_out_modrm(s, OPC_PUNPCKLWD, args[0], args[0]);
+        tcg_out_modrm(s, OPC_PSHUFD, args[0], args[0]);
+        tcg_out8(s, 0);
+        break;
+    case INDEX_op_dup32_v128:
+        tcg_out_modrm(s, OPC_MOVD_VyEy, args[0], args[1]);
+        tcg_out_modrm(s, OPC_PSHUFD, args[0], args[0]);
+        tcg_out8(s, 0);
+        break;
+    case INDEX_op_dup64_v128:
+        tcg_out_modrm(s, OPC_MOVD_VyEy | P_REXW, args[0], args[1]);
+        tcg_out_modrm(s, OPC_PUNPCKLQDQ, args[0], args[0]);
+        break;
+
+    case INDEX_op_and_v128:
+        c = OPC_PAND;
+        goto gen_vec_arith;
+    case INDEX_op_or_v128:
+        c = OPC_POR;
+        goto gen_vec_arith;
+    case INDEX_op_xor_v128:
+        c = OPC_PXOR;
+        goto gen_vec_arith;
+    case INDEX_op_andc_v128:
+        /* pandn complements its destination, which is aliased to the
+           second input */
+        c = OPC_PANDN;
+        goto gen_vec_arith;
+    case INDEX_op_add8_v128:
+        c = OPC_PADDB;
+        goto gen_vec_arith;
+    case INDEX_op_add16_v128:
+        c = OPC_PADDW;
+        goto gen_vec_arith;
+    case INDEX_op_add32_v128:
+        c = OPC_PADDD;
+        goto gen_vec_arith;
+    case INDEX_op_add64_v128:
+        c = OPC_PADDQ;
+        goto gen_vec_arith;
+    case INDEX_op_sub8_v128:
+        c = OPC_PSUBB;
+        goto gen_vec_arith;
+    case INDEX_op_sub16_v128:
+        c = OPC_PSUBW;
+        goto gen_vec_arith;
+    case INDEX_op_sub32_v128:
+        c = OPC_PSUBD;
+        goto gen_vec_arith;
+    case INDEX_op_sub64_v128:
+        c = OPC_PSUBQ;
+        goto gen_vec_arith;
+    case INDEX_op_cmpeq8_v128:
+        c = OPC_PCMPEQB;
+        goto gen_vec_arith;
+    case INDEX_op_cmpeq16_v128:
+        c = OPC_PCMPEQW;
+        goto gen_vec_arith;
+    case INDEX_op_cmpeq32_v128:
+        c = OPC_PCMPEQD;
+    gen_vec_arith:
+        tcg_out_modrm(s, c, args[0],
+                      opc == INDEX_op_andc_v128 ? args[1] : args[2]);
+        break;
+
+    case INDEX_op_shli16_v128:
+        tcg_out_modrm(s, OPC_PSHIFTW_Ib, EXT_PSLL, args[0]);
+        goto gen_vec_shift;
+    case INDEX_op_shli32_v128:
+        tcg_out_modrm(s, OPC_PSHIFTD_Ib, EXT_PSLL, args[0]);
+        goto gen_vec_shift;
+    case INDEX_op_shli64_v128:
+        tcg_out_modrm(s, OPC_PSHIFTQ_Ib, EXT_PSLL, args[0]);
+        goto gen_vec_shift;
+    case INDEX_op_shri16_v128:
+        tcg_out_modrm(s, OPC_PSHIFTW_Ib, EXT_PSRL, args[0]);
+        goto gen_vec_shift;
+    case INDEX_op_shri32_v128:
+        tcg_out_modrm(s, OPC_PSHIFTD_Ib, EXT_PSRL, args[0]);
+        goto gen_vec_shift;
+    case INDEX_op_shri64_v128:
+        tcg_out_modrm(s, OPC_PSHIFTQ_Ib, EXT_PSRL, args[0]);
+    gen_vec_shift:
+        /* any count not below the element width clears the element */
+        tcg_out8(s, args[2] > 0xff ? 0xff : args[2]);
+        break;
 #endif
 
     OP_32_64(deposit):
@@ -1839,6 +2032,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_call, { "ri" } },
     { INDEX_op_br, { } },
     { INDEX_op_mov_i32, { "r", "r" } },
@@ -1982,6 +2176,37 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_qemu_st16, { "L", "L", "L" } },
     { INDEX_op_qemu_st32, { "L", "L", "L" } },
     { INDEX_op_qemu_st64, { "L", "L", "L", "L" } },
+#endif
+#if TCG_TARGET_REG_BITS == 64
+    { INDEX_op_mov_v128, { "x", "x" } },
+    { INDEX_op_ld_v128, { "x", "r" } },
+    { INDEX_op_st_v128, { "x", "r" } },
+    { INDEX_op_dup8_v128, { "x", "r" } },
+    { INDEX_op_dup16_v128, { "x", "r" } },
+    { INDEX_op_dup32_v128, { "x", "r" } },
+    { INDEX_op_dup64_v128, { "x", "r" } },
+
+    { INDEX_op_and_v128, { "x", "0", "x" } },
+    { INDEX_op_or_v128, { "x", "0", "x" } },
+    { INDEX_op_xor_v128, { "x", "0", "x" } },
+    { INDEX_op_andc_v128, { "x", "x", "0" } },
+    { INDEX_op_add8_v128, { "x", "0", "x" } },
+    { INDEX_op_add16_v128, { "x", "0", "x" } },
+    { INDEX_op_add32_v128, { "x", "0", "x" } },
+    { INDEX_op_add64_v128, { "x", "0", "x" } },
+    { INDEX_op_sub8_v128, { "x", "0", "x" } },
+    { INDEX_op_sub16_v128, { "x", "0", "x" } },
+    { INDEX_op_sub32_v128, { "x", "0", "x" } },
+    { INDEX_op_sub64_v128, { "x", "0", "x" } },
+    { INDEX_op_cmpeq8_v128, { "x", "0", "x" } },
+    { INDEX_op_cmpeq16_v128, { "x", "0", "x" } },
+    { INDEX_op_cmpeq32_v128, { "x", "0", "x" } },
+    { INDEX_op_shli16_v128, { "x", "0" } },
+    { INDEX_op_shli32_v128, { "x", "0" } },
+    { INDEX_op_shli64_v128, { "x", "0" } },
+    { INDEX_op_shri16_v128, { "x", "0" } },
+    { INDEX_op_shri32_v128, { "x", "0" } },
+    { INDEX_op_shri64_v128, { "x", "0" } },
 #endif
     { -1 },
 };
@@ -2052,6 +2277,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr lookups that miss: exit with next_tb = 0
+       so that cpu_exec does not try to chain the previous TB.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2074,6 +2304,8 @@ static void tcg_target_init(TCGContext *s)
     if (TCG_TARGET_REG_BITS == 64) {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V128], 0,
+                         TCG_REG_XMM_MASK);
     } else {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xff);
     }
@@ -2091,6 +2323,7 @@ static void tcg_target_init(TCGContext *s)
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R9);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R10);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R11);
+        tcg_regset_set32(tcg_target_call_clobber_regs, 0, TCG_REG_XMM_MASK);
     }
 
     tcg_regset_clear(s->reserved_regs);
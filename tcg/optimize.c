@@ -46,10 +46,36 @@ struct tcg_temp_info {
     uint16_t prev_copy;
     uint16_t next_copy;
     tcg_target_ulong val;
+    tcg_target_ulong mask; /* bits that may be non-zero */
 };
 
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
 
+/* Values known to be in CPU state: the load OP from env + OFS would give
+   the value of TEMP.  Entries come from loads and from full width stores,
+   and are dropped when TEMP is overwritten or the memory may change.  */
+#define TCG_ENV_VALUES 16
+
+struct tcg_env_value {
+    TCGOpcode op;
+    tcg_target_long ofs;
+    TCGArg temp;
+};
+
+static struct tcg_env_value env_values[TCG_ENV_VALUES];
+static int nb_env_values;
+
+static void forget_env_values_of_temp(TCGArg temp)
+{
+    int i;
+
+    for (i = 0; i < nb_env_values; i++) {
+        if (env_values[i].temp == temp) {
+            env_values[i--] = env_values[--nb_env_values];
+        }
+    }
+}
+
 /* Reset TEMP's state to TCG_TEMP_UNDEF.  If TEMP only had one copy, remove
    the copy flag from the left temp.  */
 static void reset_temp(TCGArg temp)
@@ -63,6 +89,91 @@ static void reset_temp(TCGArg temp)
         }
     }
     temps[temp].state = TCG_TEMP_UNDEF;
+    temps[temp].mask = -1;
+    if (nb_env_values) {
+        forget_env_values_of_temp(temp);
+    }
+}
+
+/* Forget everything, e.g. at the end of a basic block.  */
+static void reset_all_temps(int nb_temps)
+{
+    int i;
+
+    for (i = 0; i < nb_temps; i++) {
+        temps[i].state = TCG_TEMP_UNDEF;
+        temps[i].mask = -1;
+    }
+    nb_env_values = 0;
+}
+
+static bool temp_is_env(TCGContext *s, TCGArg temp)
+{
+    return s->temps[temp].fixed_reg && s->temps[temp].reg == TCG_AREG0;
+}
+
+/* Size in bytes of the memory accessed by a ld/st op.  */
+static int ldst_size(TCGOpcode op)
+{
+    switch (op) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_st_v128:
+        return 16;
+    default:
+        return 8;
+    }
+}
+
+/* A store of SIZE bytes to env + OFS: drop the values it overwrites.  */
+static void forget_env_values(TCGOpcode op, tcg_target_long ofs)
+{
+    int i, size = ldst_size(op);
+
+    for (i = 0; i < nb_env_values; i++) {
+        if (env_values[i].ofs < ofs + size
+            && ofs < env_values[i].ofs + ldst_size(env_values[i].op)) {
+            env_values[i--] = env_values[--nb_env_values];
+        }
+    }
+}
+
+static void record_env_value(TCGOpcode op, tcg_target_long ofs, TCGArg temp)
+{
+    if (nb_env_values == TCG_ENV_VALUES) {
+        /* drop the oldest one */
+        memmove(env_values, env_values + 1,
+                (TCG_ENV_VALUES - 1) * sizeof(env_values[0]));
+        nb_env_values--;
+    }
+    env_values[nb_env_values].op = op;
+    env_values[nb_env_values].ofs = ofs;
+    env_values[nb_env_values].temp = temp;
+    nb_env_values++;
+}
+
+static int find_env_value(TCGOpcode op, tcg_target_long ofs)
+{
+    int i;
+
+    for (i = 0; i < nb_env_values; i++) {
+        if (env_values[i].op == op && env_values[i].ofs == ofs) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 static int op_bits(TCGOpcode op)
@@ -149,6 +260,7 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGArg *gen_args,
                 temps[src].prev_copy = src;
             }
             temps[dst].state = TCG_TEMP_COPY;
+            temps[dst].mask = temps[src].mask;
             temps[dst].next_copy = temps[src].next_copy;
             temps[dst].prev_copy = src;
             temps[temps[dst].next_copy].prev_copy = dst;
@@ -159,11 +271,19 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGArg *gen_args,
         gen_args[1] = src;
 }
 
-static void tcg_opt_gen_movi(TCGArg *gen_args, TCGArg dst, TCGArg val)
+static void tcg_opt_gen_movi(TCGContext *s, TCGArg *gen_args,
+                             TCGArg dst, TCGArg val)
 {
         reset_temp(dst);
         temps[dst].state = TCG_TEMP_CONST;
         temps[dst].val = val;
+        temps[dst].mask = val;
+#if TCG_TARGET_REG_BITS == 64
+        /* the high half of a 32-bit value is not defined */
+        if (s->temps[dst].type == TCG_TYPE_I32) {
+            temps[dst].mask |= ~(tcg_target_ulong)0xffffffffu;
+        }
+#endif
         gen_args[0] = dst;
         gen_args[1] = val;
 }
@@ -396,7 +516,8 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
     TCGOpcode op;
     const TCGOpDef *def;
     TCGArg *gen_args;
-    TCGArg tmp;
+    TCGArg tmp, dst;
+    tcg_target_ulong mask, partmask, affected;
     TCGCond cond;
 
     /* Array VALS has an element for each temp.
@@ -406,7 +527,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
 
     nb_temps = s->nb_temps;
     nb_globals = s->nb_globals;
-    memset(temps, 0, nb_temps * sizeof(struct tcg_temp_info));
+    reset_all_temps(nb_temps);
 
     nb_ops = tcg_opc_ptr - gen_opc_buf;
     gen_args = args;
@@ -500,7 +621,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             if (temps[args[1]].state == TCG_TEMP_CONST
                 && temps[args[1]].val == 0) {
                 gen_opc_buf[op_index] = op_to_movi(op);
-                tcg_opt_gen_movi(gen_args, args[0], 0);
+                tcg_opt_gen_movi(s, gen_args, args[0], 0);
                 args += 3;
                 gen_args += 2;
                 continue;
@@ -549,7 +670,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             if ((temps[args[2]].state == TCG_TEMP_CONST
                 && temps[args[2]].val == 0)) {
                 gen_opc_buf[op_index] = op_to_movi(op);
-                tcg_opt_gen_movi(gen_args, args[0], 0);
+                tcg_opt_gen_movi(s, gen_args, args[0], 0);
                 args += 3;
                 gen_args += 2;
                 continue;
@@ -585,7 +706,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
         CASE_OP_32_64(xor):
             if (temps_are_copies(args[1], args[2])) {
                 gen_opc_buf[op_index] = op_to_movi(op);
-                tcg_opt_gen_movi(gen_args, args[0], 0);
+                tcg_opt_gen_movi(s, gen_args, args[0], 0);
                 gen_args += 2;
                 args += 3;
                 continue;
@@ -595,6 +716,100 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             break;
         }
 
+        /* Simplify using known-zero bits: drop the op if it cannot change
+           any bit that may be set, or replace it by 0 if no bit can be
+           set.  MASK is the set of bits of the result that may be
+           non-zero.  */
+        dst = args[0];
+        mask = -1;
+        affected = -1;
+        switch (op) {
+        CASE_OP_32_64(ext8u):
+            mask = 0xff;
+            goto and_const;
+        CASE_OP_32_64(ext16u):
+            mask = 0xffff;
+            goto and_const;
+        case INDEX_op_ext32u_i64:
+            mask = 0xffffffffU;
+            goto and_const;
+        CASE_OP_32_64(and):
+            mask = temps[args[2]].mask;
+            if (temps[args[2]].state == TCG_TEMP_CONST) {
+        and_const:
+                affected = temps[args[1]].mask & ~mask;
+            }
+            mask = temps[args[1]].mask & mask;
+            break;
+        CASE_OP_32_64(or):
+        CASE_OP_32_64(xor):
+            mask = temps[args[1]].mask | temps[args[2]].mask;
+            break;
+        CASE_OP_32_64(shr):
+            if (temps[args[2]].state == TCG_TEMP_CONST
+                && temps[args[2]].val < op_bits(op)) {
+                tmp = temps[args[1]].mask;
+                if (op_bits(op) == 32) {
+                    tmp &= 0xffffffffU;
+                }
+                mask = tmp >> temps[args[2]].val;
+            }
+            break;
+        CASE_OP_32_64(shl):
+            if (temps[args[2]].state == TCG_TEMP_CONST
+                && temps[args[2]].val < op_bits(op)) {
+                mask = temps[args[1]].mask << temps[args[2]].val;
+            }
+            break;
+        CASE_OP_32_64(setcond):
+            mask = 1;
+            break;
+        CASE_OP_32_64(ld8u):
+            mask = 0xff;
+            break;
+        CASE_OP_32_64(ld16u):
+            mask = 0xffff;
+            break;
+        case INDEX_op_ld32u_i64:
+            mask = 0xffffffffU;
+            break;
+        default:
+            break;
+        }
+
+        /* 32-bit ops leave the high half of the register undefined. */
+        partmask = mask;
+        if (op_bits(op) == 32) {
+            mask |= ~(tcg_target_ulong)0xffffffffU;
+            partmask &= 0xffffffffU;
+            affected &= 0xffffffffU;
+        }
+
+        if (partmask == 0) {
+            gen_opc_buf[op_index] = op_to_movi(op);
+            tcg_opt_gen_movi(s, gen_args, dst, 0);
+            args += def->nb_args;
+            gen_args += 2;
+            s->opt_known_bits++;
+            continue;
+        }
+        if (affected == 0) {
+            if (temps_are_copies(dst, args[1])) {
+                gen_opc_buf[op_index] = INDEX_op_nop;
+            } else if (temps[args[1]].state == TCG_TEMP_CONST) {
+                gen_opc_buf[op_index] = op_to_movi(op);
+                tcg_opt_gen_movi(s, gen_args, dst, temps[args[1]].val);
+                gen_args += 2;
+            } else {
+                gen_opc_buf[op_index] = op_to_mov(op);
+                tcg_opt_gen_mov(s, gen_args, dst, args[1]);
+                gen_args += 2;
+            }
+            args += def->nb_args;
+            s->opt_known_bits++;
+            continue;
+        }
+
         /* Propagate constants through copy operations and do constant
            folding.  Constants will be substituted to arguments by register
            allocator where needed and possible.  Also detect copies. */
@@ -618,7 +833,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             args[1] = temps[args[1]].val;
             /* fallthrough */
         CASE_OP_32_64(movi):
-            tcg_opt_gen_movi(gen_args, args[0], args[1]);
+            tcg_opt_gen_movi(s, gen_args, args[0], args[1]);
             gen_args += 2;
             args += 2;
             break;
@@ -633,7 +848,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             if (temps[args[1]].state == TCG_TEMP_CONST) {
                 gen_opc_buf[op_index] = op_to_movi(op);
                 tmp = do_constant_folding(op, temps[args[1]].val, 0);
-                tcg_opt_gen_movi(gen_args, args[0], tmp);
+                tcg_opt_gen_movi(s, gen_args, args[0], tmp);
             } else {
                 reset_temp(args[0]);
                 gen_args[0] = args[0];
@@ -663,7 +878,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 gen_opc_buf[op_index] = op_to_movi(op);
                 tmp = do_constant_folding(op, temps[args[1]].val,
                                           temps[args[2]].val);
-                tcg_opt_gen_movi(gen_args, args[0], tmp);
+                tcg_opt_gen_movi(s, gen_args, args[0], tmp);
                 gen_args += 2;
             } else {
                 reset_temp(args[0]);
@@ -681,7 +896,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 tmp = ((1ull << args[4]) - 1);
                 tmp = (temps[args[1]].val & ~(tmp << args[3]))
                       | ((temps[args[2]].val & tmp) << args[3]);
-                tcg_opt_gen_movi(gen_args, args[0], tmp);
+                tcg_opt_gen_movi(s, gen_args, args[0], tmp);
                 gen_args += 2;
             } else {
                 reset_temp(args[0]);
@@ -698,7 +913,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             tmp = do_constant_folding_cond(op, args[1], args[2], args[3]);
             if (tmp != 2) {
                 gen_opc_buf[op_index] = op_to_movi(op);
-                tcg_opt_gen_movi(gen_args, args[0], tmp);
+                tcg_opt_gen_movi(s, gen_args, args[0], tmp);
                 gen_args += 2;
             } else {
                 reset_temp(args[0]);
@@ -714,7 +929,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             tmp = do_constant_folding_cond(op, args[0], args[1], args[2]);
             if (tmp != 2) {
                 if (tmp) {
-                    memset(temps, 0, nb_temps * sizeof(struct tcg_temp_info));
+                    reset_all_temps(nb_temps);
                     gen_opc_buf[op_index] = INDEX_op_br;
                     gen_args[0] = args[3];
                     gen_args += 1;
@@ -722,7 +937,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                     gen_opc_buf[op_index] = INDEX_op_nop;
                 }
             } else {
-                memset(temps, 0, nb_temps * sizeof(struct tcg_temp_info));
+                reset_all_temps(nb_temps);
                 reset_temp(args[0]);
                 gen_args[0] = args[0];
                 gen_args[1] = args[1];
@@ -739,7 +954,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                     gen_opc_buf[op_index] = INDEX_op_nop;
                 } else if (temps[args[4-tmp]].state == TCG_TEMP_CONST) {
                     gen_opc_buf[op_index] = op_to_movi(op);
-                    tcg_opt_gen_movi(gen_args, args[0], temps[args[4-tmp]].val);
+                    tcg_opt_gen_movi(s, gen_args, args[0], temps[args[4-tmp]].val);
                     gen_args += 2;
                 } else {
                     gen_opc_buf[op_index] = op_to_mov(op);
@@ -758,8 +973,75 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             }
             args += 6;
             break;
+        CASE_OP_32_64(ld8u):
+        CASE_OP_32_64(ld8s):
+        CASE_OP_32_64(ld16u):
+        CASE_OP_32_64(ld16s):
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+        case INDEX_op_ld_i64:
+            /* Reuse the value of an earlier load from, or store to, the
+               same CPU state field.  */
+            i = temp_is_env(s, args[1]) ? find_env_value(op, args[2]) : -1;
+            if (i >= 0) {
+                tmp = env_values[i].temp;
+                if (temps_are_copies(args[0], tmp)) {
+                    gen_opc_buf[op_index] = INDEX_op_nop;
+                } else if (temps[tmp].state == TCG_TEMP_CONST) {
+                    gen_opc_buf[op_index] = op_to_movi(op);
+                    tcg_opt_gen_movi(s, gen_args, args[0], temps[tmp].val);
+                    gen_args += 2;
+                } else {
+                    gen_opc_buf[op_index] = op_to_mov(op);
+                    tcg_opt_gen_mov(s, gen_args, args[0], tmp);
+                    gen_args += 2;
+                }
+                s->opt_env_loads++;
+                args += 3;
+                break;
+            }
+            reset_temp(args[0]);
+            if (temp_is_env(s, args[1]) && args[0] != args[1]) {
+                record_env_value(op, args[2], args[0]);
+            }
+            gen_args[0] = args[0];
+            gen_args[1] = args[1];
+            gen_args[2] = args[2];
+            gen_args += 3;
+            args += 3;
+            break;
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st_i32:
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i64:
+        case INDEX_op_st_v128:
+            if (temp_is_env(s, args[1])) {
+                forget_env_values(op, args[2]);
+                /* a later full width load gives back the stored value */
+                if (op == INDEX_op_st_i32) {
+                    record_env_value(INDEX_op_ld_i32, args[2], args[0]);
+                } else if (op == INDEX_op_st_i64) {
+                    record_env_value(INDEX_op_ld_i64, args[2], args[0]);
+                }
+            } else {
+                /* the store could alias anything */
+                nb_env_values = 0;
+            }
+            gen_args[0] = args[0];
+            gen_args[1] = args[1];
+            gen_args[2] = args[2];
+            gen_args += 3;
+            args += 3;
+            break;
         case INDEX_op_call:
             nb_call_args = (args[0] >> 16) + (args[0] & 0xffff);
+            /* TCG_CALL_CONST helpers do not touch the TCG globals, but
+               may still write CPU state in memory; only pure ones can't */
+            if (!(args[nb_call_args + 1] & TCG_CALL_PURE)) {
+                nb_env_values = 0;
+            }
             if (!(args[nb_call_args + 1] & (TCG_CALL_CONST | TCG_CALL_PURE))) {
                 for (i = 0; i < nb_globals; i++) {
                     reset_temp(i);
@@ -782,8 +1064,12 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                is the end of a basic block, otherwise we only trash the
                output args.  */
             if (def->flags & TCG_OPF_BB_END) {
-                memset(temps, 0, nb_temps * sizeof(struct tcg_temp_info));
+                reset_all_temps(nb_temps);
             } else {
+                if (def->flags & TCG_OPF_CALL_CLOBBER) {
+                    /* qemu_ld/st may call helpers that change CPU state */
+                    nb_env_values = 0;
+                }
                 for (i = 0; i < def->nb_oargs; i++) {
                     reset_temp(args[i]);
                 }
@@ -795,6 +1081,12 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             gen_args += def->nb_args;
             break;
         }
+
+        /* Remember which bits of the result may be set.  */
+        if (mask != (tcg_target_ulong)-1
+            && temps[dst].state == TCG_TEMP_UNDEF) {
+            temps[dst].mask = mask;
+        }
     }
 
     return gen_args;
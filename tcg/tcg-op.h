@@ -2299,6 +2299,533 @@ static inline void tcg_gen_movcond_i64(TCGCond cond, TCGv_i64 ret,
 #endif
 }
 
+/***************************************/
+/* Vector operations on 8, 16 or 32 bit elements packed in an i32 or an
+   i64, with no carry or borrow crossing element boundaries.  Front ends
+   use them to expand guest SIMD instructions inline instead of calling
+   helpers that process one element at a time.  @m has the most
+   significant bit of every element set.  */
+
+static inline void tcg_gen_vec_add_mask_i32(TCGv_i32 d, TCGv_i32 a,
+                                            TCGv_i32 b, uint32_t m)
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+    TCGv_i32 t3 = tcg_temp_new_i32();
+
+    tcg_gen_andi_i32(t1, a, ~m);
+    tcg_gen_andi_i32(t2, b, ~m);
+    tcg_gen_xor_i32(t3, a, b);
+    tcg_gen_add_i32(d, t1, t2);
+    tcg_gen_andi_i32(t3, t3, m);
+    tcg_gen_xor_i32(d, d, t3);
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+    tcg_temp_free_i32(t3);
+}
+
+static inline void tcg_gen_vec_sub_mask_i32(TCGv_i32 d, TCGv_i32 a,
+                                            TCGv_i32 b, uint32_t m)
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+    TCGv_i32 t3 = tcg_temp_new_i32();
+
+    tcg_gen_ori_i32(t1, a, m);
+    tcg_gen_andi_i32(t2, b, ~m);
+    tcg_gen_eqv_i32(t3, a, b);
+    tcg_gen_sub_i32(d, t1, t2);
+    tcg_gen_andi_i32(t3, t3, m);
+    tcg_gen_xor_i32(d, d, t3);
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+    tcg_temp_free_i32(t3);
+}
+
+/* Set each element to all ones if equal, to zero otherwise.  */
+static inline void tcg_gen_vec_cmpeq_mask_i32(TCGv_i32 d, TCGv_i32 a,
+                                              TCGv_i32 b, uint32_t m,
+                                              int bits)
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+
+    /* the top bit of an element of t1 is set if the element of a ^ b
+       is not zero */
+    tcg_gen_xor_i32(t2, a, b);
+    tcg_gen_andi_i32(t1, t2, ~m);
+    tcg_gen_addi_i32(t1, t1, ~m);
+    tcg_gen_or_i32(t1, t1, t2);
+    tcg_gen_not_i32(t1, t1);
+    tcg_gen_andi_i32(t1, t1, m);
+    /* spread the top bit over the whole element */
+    tcg_gen_shri_i32(t2, t1, bits - 1);
+    tcg_gen_sub_i32(d, t1, t2);
+    tcg_gen_or_i32(d, d, t1);
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+}
+
+static inline void tcg_gen_vec_add8_i32(TCGv_i32 d, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_vec_add_mask_i32(d, a, b, 0x80808080);
+}
+
+static inline void tcg_gen_vec_add16_i32(TCGv_i32 d, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_vec_add_mask_i32(d, a, b, 0x80008000);
+}
+
+static inline void tcg_gen_vec_sub8_i32(TCGv_i32 d, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_vec_sub_mask_i32(d, a, b, 0x80808080);
+}
+
+static inline void tcg_gen_vec_sub16_i32(TCGv_i32 d, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_vec_sub_mask_i32(d, a, b, 0x80008000);
+}
+
+static inline void tcg_gen_vec_cmpeq8_i32(TCGv_i32 d, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_vec_cmpeq_mask_i32(d, a, b, 0x80808080, 8);
+}
+
+static inline void tcg_gen_vec_cmpeq16_i32(TCGv_i32 d, TCGv_i32 a,
+                                           TCGv_i32 b)
+{
+    tcg_gen_vec_cmpeq_mask_i32(d, a, b, 0x80008000, 16);
+}
+
+static inline void tcg_gen_vec_add_mask_i64(TCGv_i64 d, TCGv_i64 a,
+                                            TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andi_i64(t1, a, ~m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_sub_mask_i64(TCGv_i64 d, TCGv_i64 a,
+                                            TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_ori_i64(t1, a, m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_cmpeq_mask_i64(TCGv_i64 d, TCGv_i64 a,
+                                              TCGv_i64 b, uint64_t m,
+                                              int bits)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+
+    tcg_gen_xor_i64(t2, a, b);
+    tcg_gen_andi_i64(t1, t2, ~m);
+    tcg_gen_addi_i64(t1, t1, ~m);
+    tcg_gen_or_i64(t1, t1, t2);
+    tcg_gen_not_i64(t1, t1);
+    tcg_gen_andi_i64(t1, t1, m);
+    tcg_gen_shri_i64(t2, t1, bits - 1);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_or_i64(d, d, t1);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+}
+
+/* Shift every element left or right (logical) by @c.  Elements are
+   cleared when @c is not smaller than their width.  */
+static inline void tcg_gen_vec_shli_mask_i64(TCGv_i64 d, TCGv_i64 a,
+                                             int64_t c, uint64_t m,
+                                             int bits)
+{
+    uint64_t elt = (1ull << bits) - 1;
+
+    if (c >= bits) {
+        tcg_gen_movi_i64(d, 0);
+    } else {
+        tcg_gen_shli_i64(d, a, c);
+        tcg_gen_andi_i64(d, d, (m >> (bits - 1)) * ((elt << c) & elt));
+    }
+}
+
+static inline void tcg_gen_vec_shri_mask_i64(TCGv_i64 d, TCGv_i64 a,
+                                             int64_t c, uint64_t m,
+                                             int bits)
+{
+    uint64_t elt = (1ull << bits) - 1;
+
+    if (c >= bits) {
+        tcg_gen_movi_i64(d, 0);
+    } else {
+        tcg_gen_shri_i64(d, a, c);
+        tcg_gen_andi_i64(d, d, (m >> (bits - 1)) * (elt >> c));
+    }
+}
+
+#define TCG_VEC_MASK8_I64   0x8080808080808080ull
+#define TCG_VEC_MASK16_I64  0x8000800080008000ull
+#define TCG_VEC_MASK32_I64  0x8000000080000000ull
+
+static inline void tcg_gen_vec_add8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_add_mask_i64(d, a, b, TCG_VEC_MASK8_I64);
+}
+
+static inline void tcg_gen_vec_add16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_add_mask_i64(d, a, b, TCG_VEC_MASK16_I64);
+}
+
+static inline void tcg_gen_vec_add32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_add_mask_i64(d, a, b, TCG_VEC_MASK32_I64);
+}
+
+static inline void tcg_gen_vec_sub8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_sub_mask_i64(d, a, b, TCG_VEC_MASK8_I64);
+}
+
+static inline void tcg_gen_vec_sub16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_sub_mask_i64(d, a, b, TCG_VEC_MASK16_I64);
+}
+
+static inline void tcg_gen_vec_sub32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_sub_mask_i64(d, a, b, TCG_VEC_MASK32_I64);
+}
+
+static inline void tcg_gen_vec_cmpeq8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_vec_cmpeq_mask_i64(d, a, b, TCG_VEC_MASK8_I64, 8);
+}
+
+static inline void tcg_gen_vec_cmpeq16_i64(TCGv_i64 d, TCGv_i64 a,
+                                           TCGv_i64 b)
+{
+    tcg_gen_vec_cmpeq_mask_i64(d, a, b, TCG_VEC_MASK16_I64, 16);
+}
+
+static inline void tcg_gen_vec_cmpeq32_i64(TCGv_i64 d, TCGv_i64 a,
+                                           TCGv_i64 b)
+{
+    tcg_gen_vec_cmpeq_mask_i64(d, a, b, TCG_VEC_MASK32_I64, 32);
+}
+
+static inline void tcg_gen_vec_shl16i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_vec_shli_mask_i64(d, a, c, TCG_VEC_MASK16_I64, 16);
+}
+
+static inline void tcg_gen_vec_shl32i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_vec_shli_mask_i64(d, a, c, TCG_VEC_MASK32_I64, 32);
+}
+
+static inline void tcg_gen_vec_shl64i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    if (c >= 64) {
+        tcg_gen_movi_i64(d, 0);
+    } else {
+        tcg_gen_shli_i64(d, a, c);
+    }
+}
+
+static inline void tcg_gen_vec_shr16i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_vec_shri_mask_i64(d, a, c, TCG_VEC_MASK16_I64, 16);
+}
+
+static inline void tcg_gen_vec_shr32i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_vec_shri_mask_i64(d, a, c, TCG_VEC_MASK32_I64, 32);
+}
+
+static inline void tcg_gen_vec_shr64i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    if (c >= 64) {
+        tcg_gen_movi_i64(d, 0);
+    } else {
+        tcg_gen_shri_i64(d, a, c);
+    }
+}
+
+/* Vector registers held in CPU state: apply @fni to each 64 bit chunk of
+   the @oprsz bytes at offsets @aofs and @bofs from @env and store the
+   results at @dofs.  @oprsz is a multiple of 8, and @dofs may be equal
+   to @aofs or @bofs.  */
+static inline void tcg_gen_vec_env_3_i64(TCGv_ptr env, tcg_target_long dofs,
+                                         tcg_target_long aofs,
+                                         tcg_target_long bofs, int oprsz,
+                                         void (*fni)(TCGv_i64, TCGv_i64,
+                                                     TCGv_i64))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        tcg_gen_ld_i64(t1, env, bofs + i);
+        fni(t0, t0, t1);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(t1);
+}
+
+/* Likewise with an immediate second operand.  */
+static inline void tcg_gen_vec_env_2i_i64(TCGv_ptr env, tcg_target_long dofs,
+                                          tcg_target_long aofs, int oprsz,
+                                          int64_t c,
+                                          void (*fni)(TCGv_i64, TCGv_i64,
+                                                      int64_t))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        fni(t0, t0, c);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+/* 128-bit vector operations.  They are only present if
+   TCG_TARGET_HAS_v128; the tcg_gen_vec_env_* functions below fall back
+   to the 64 bit expansions above otherwise.  */
+
+static inline void tcg_gen_op2_v128(TCGOpcode opc, TCGv_v128 arg1,
+                                    TCGv_v128 arg2)
+{
+    *gen_opc_ptr++ = opc;
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg1);
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg2);
+}
+
+static inline void tcg_gen_op3_v128(TCGOpcode opc, TCGv_v128 arg1,
+                                    TCGv_v128 arg2, TCGv_v128 arg3)
+{
+    *gen_opc_ptr++ = opc;
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg1);
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg2);
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg3);
+}
+
+static inline void tcg_gen_op2i_v128(TCGOpcode opc, TCGv_v128 arg1,
+                                     TCGv_v128 arg2, TCGArg arg3)
+{
+    *gen_opc_ptr++ = opc;
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg1);
+    *gen_opparam_ptr++ = GET_TCGV_V128(arg2);
+    *gen_opparam_ptr++ = arg3;
+}
+
+static inline void tcg_gen_ldst_op_v128(TCGOpcode opc, TCGv_v128 val,
+                                        TCGv_ptr base, TCGArg offset)
+{
+    *gen_opc_ptr++ = opc;
+    *gen_opparam_ptr++ = GET_TCGV_V128(val);
+    *gen_opparam_ptr++ = GET_TCGV_PTR(base);
+    *gen_opparam_ptr++ = offset;
+}
+
+static inline void tcg_gen_mov_v128(TCGv_v128 ret, TCGv_v128 arg)
+{
+    if (GET_TCGV_V128(ret) != GET_TCGV_V128(arg)) {
+        tcg_gen_op2_v128(INDEX_op_mov_v128, ret, arg);
+    }
+}
+
+static inline void tcg_gen_ld_v128(TCGv_v128 ret, TCGv_ptr arg2,
+                                   tcg_target_long offset)
+{
+    tcg_gen_ldst_op_v128(INDEX_op_ld_v128, ret, arg2, offset);
+}
+
+static inline void tcg_gen_st_v128(TCGv_v128 arg1, TCGv_ptr arg2,
+                                   tcg_target_long offset)
+{
+    tcg_gen_ldst_op_v128(INDEX_op_st_v128, arg1, arg2, offset);
+}
+
+/* Replicate the low 8, 16, 32 or 64 bits of @arg (vece 0 to 3) to
+   every element of @ret.  */
+static inline void tcg_gen_dup_i64_v128(int vece, TCGv_v128 ret, TCGv_i64 arg)
+{
+    static const TCGOpcode dup_op[4] = {
+        INDEX_op_dup8_v128, INDEX_op_dup16_v128,
+        INDEX_op_dup32_v128, INDEX_op_dup64_v128
+    };
+
+    *gen_opc_ptr++ = dup_op[vece];
+    *gen_opparam_ptr++ = GET_TCGV_V128(ret);
+    *gen_opparam_ptr++ = GET_TCGV_I64(arg);
+}
+
+#define TCG_GEN_V128_OP3(name)                                          \
+static inline void tcg_gen_##name##_v128(TCGv_v128 ret, TCGv_v128 arg1, \
+                                         TCGv_v128 arg2)                \
+{                                                                       \
+    tcg_gen_op3_v128(INDEX_op_##name##_v128, ret, arg1, arg2);          \
+}
+
+TCG_GEN_V128_OP3(and)
+TCG_GEN_V128_OP3(or)
+TCG_GEN_V128_OP3(xor)
+TCG_GEN_V128_OP3(andc)
+TCG_GEN_V128_OP3(add8)
+TCG_GEN_V128_OP3(add16)
+TCG_GEN_V128_OP3(add32)
+TCG_GEN_V128_OP3(add64)
+TCG_GEN_V128_OP3(sub8)
+TCG_GEN_V128_OP3(sub16)
+TCG_GEN_V128_OP3(sub32)
+TCG_GEN_V128_OP3(sub64)
+TCG_GEN_V128_OP3(cmpeq8)
+TCG_GEN_V128_OP3(cmpeq16)
+TCG_GEN_V128_OP3(cmpeq32)
+
+#undef TCG_GEN_V128_OP3
+
+#define TCG_GEN_V128_OP2I(name)                                         \
+static inline void tcg_gen_##name##_v128(TCGv_v128 ret, TCGv_v128 arg1, \
+                                         int64_t arg2)                  \
+{                                                                       \
+    tcg_gen_op2i_v128(INDEX_op_##name##_v128, ret, arg1, arg2);         \
+}
+
+TCG_GEN_V128_OP2I(shli16)
+TCG_GEN_V128_OP2I(shli32)
+TCG_GEN_V128_OP2I(shli64)
+TCG_GEN_V128_OP2I(shri16)
+TCG_GEN_V128_OP2I(shri32)
+TCG_GEN_V128_OP2I(shri64)
+
+#undef TCG_GEN_V128_OP2I
+
+/* A vector operation on CPU state, as the 128-bit op used when the host
+   has vector registers and as its 64 bit expansion.  */
+typedef struct TCGVecOp3 {
+    void (*fni8)(TCGv_i64, TCGv_i64, TCGv_i64);
+    void (*fnv)(TCGv_v128, TCGv_v128, TCGv_v128);
+} TCGVecOp3;
+
+typedef struct TCGVecOp2i {
+    void (*fni8)(TCGv_i64, TCGv_i64, int64_t);
+    void (*fnv)(TCGv_v128, TCGv_v128, int64_t);
+} TCGVecOp2i;
+
+/* Like tcg_gen_vec_env_3_i64(), using host vector registers for every
+   16 bytes when possible.  */
+static inline void tcg_gen_vec_env_3(TCGv_ptr env, tcg_target_long dofs,
+                                     tcg_target_long aofs,
+                                     tcg_target_long bofs, int oprsz,
+                                     const TCGVecOp3 *op)
+{
+    TCGv_v128 t0, t1;
+    int i;
+
+    if (!TCG_TARGET_HAS_v128 || oprsz % 16 != 0) {
+        tcg_gen_vec_env_3_i64(env, dofs, aofs, bofs, oprsz, op->fni8);
+        return;
+    }
+    t0 = tcg_temp_new_v128();
+    t1 = tcg_temp_new_v128();
+    for (i = 0; i < oprsz; i += 16) {
+        tcg_gen_ld_v128(t0, env, aofs + i);
+        tcg_gen_ld_v128(t1, env, bofs + i);
+        op->fnv(t0, t0, t1);
+        tcg_gen_st_v128(t0, env, dofs + i);
+    }
+    tcg_temp_free_v128(t0);
+    tcg_temp_free_v128(t1);
+}
+
+static inline void tcg_gen_vec_env_2i(TCGv_ptr env, tcg_target_long dofs,
+                                      tcg_target_long aofs, int oprsz,
+                                      int64_t c, const TCGVecOp2i *op)
+{
+    TCGv_v128 t0;
+    int i;
+
+    if (!TCG_TARGET_HAS_v128 || oprsz % 16 != 0) {
+        tcg_gen_vec_env_2i_i64(env, dofs, aofs, oprsz, c, op->fni8);
+        return;
+    }
+    t0 = tcg_temp_new_v128();
+    for (i = 0; i < oprsz; i += 16) {
+        tcg_gen_ld_v128(t0, env, aofs + i);
+        op->fnv(t0, t0, c);
+        tcg_gen_st_v128(t0, env, dofs + i);
+    }
+    tcg_temp_free_v128(t0);
+}
+
+/* Replicate the low 8, 16 or 32 bits of @in (vece 0 to 2) over the
+   @oprsz bytes at offset @dofs from @env.  @oprsz is a multiple of 8.  */
+static inline void tcg_gen_vec_env_dup_i32(TCGv_ptr env, tcg_target_long dofs,
+                                           int oprsz, int vece, TCGv_i32 in)
+{
+    TCGv_i32 t32;
+    TCGv_i64 t64;
+    TCGv_v128 tv;
+    int i = 0;
+
+    if (TCG_TARGET_HAS_v128 && oprsz >= 16) {
+        t64 = tcg_temp_new_i64();
+        tv = tcg_temp_new_v128();
+        tcg_gen_extu_i32_i64(t64, in);
+        tcg_gen_dup_i64_v128(vece, tv, t64);
+        for (; i + 16 <= oprsz; i += 16) {
+            tcg_gen_st_v128(tv, env, dofs + i);
+        }
+        tcg_temp_free_v128(tv);
+        tcg_temp_free_i64(t64);
+    }
+    t32 = tcg_temp_new_i32();
+    switch (vece) {
+    case 0:
+        tcg_gen_ext8u_i32(t32, in);
+        tcg_gen_muli_i32(t32, t32, 0x01010101);
+        break;
+    case 1:
+        tcg_gen_ext16u_i32(t32, in);
+        tcg_gen_muli_i32(t32, t32, 0x00010001);
+        break;
+    default:
+        tcg_gen_mov_i32(t32, in);
+        break;
+    }
+    for (; i < oprsz; i += 4) {
+        tcg_gen_st_i32(t32, env, dofs + i);
+    }
+    tcg_temp_free_i32(t32);
+}
+
 /***************************************/
 /* QEMU specific operations. Their type depend on the QEMU CPU
    type. */
@@ -2359,6 +2886,32 @@ static inline void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/* End the TB with an indirect jump: look the current CPU state up in the
+   jump cache and branch straight to the translated code if it is there,
+   otherwise return to the main loop as tcg_gen_exit_tb(0) would.  */
+static inline void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env)
+{
+    if (TCG_TARGET_HAS_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        TCGArg args[1];
+        int sizemask = 0;
+
+        sizemask |= tcg_gen_sizemask(0, TCG_TARGET_REG_BITS == 64, 0);
+        sizemask |= tcg_gen_sizemask(1, TCG_TARGET_REG_BITS == 64, 0);
+        args[0] = GET_TCGV_PTR(env);
+        tcg_gen_helperN(tcg_helper_lookup_tb_ptr, 0, sizemask,
+                        GET_TCGV_PTR(ptr), 1, args);
+#if TCG_TARGET_REG_BITS == 32
+        tcg_gen_op1_i32(INDEX_op_goto_ptr, TCGV_PTR_TO_NAT(ptr));
+#else
+        tcg_gen_op1_i64(INDEX_op_goto_ptr, TCGV_PTR_TO_NAT(ptr));
+#endif
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
 #if TCG_TARGET_REG_BITS == 32
 static inline void tcg_gen_qemu_ld8u(TCGv ret, TCGv addr, int mem_index)
 {
@@ -159,6 +159,40 @@ DEF(eqv_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_eqv_i64))
 DEF(nand_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nand_i64))
 DEF(nor_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nor_i64))
 
+/* 128-bit vectors of packed 8, 16, 32 or 64-bit elements.  Shifts by
+   an immediate not smaller than the element width give zero.  */
+#define IMPLV128  IMPL(TCG_TARGET_HAS_v128)
+
+DEF(mov_v128, 1, 1, 0, IMPLV128)
+DEF(ld_v128, 1, 1, 1, IMPLV128)
+DEF(st_v128, 0, 2, 1, TCG_OPF_SIDE_EFFECTS | IMPLV128)
+DEF(dup8_v128, 1, 1, 0, IMPLV128) /* from the low bits of an i64 */
+DEF(dup16_v128, 1, 1, 0, IMPLV128)
+DEF(dup32_v128, 1, 1, 0, IMPLV128)
+DEF(dup64_v128, 1, 1, 0, IMPLV128)
+
+DEF(and_v128, 1, 2, 0, IMPLV128)
+DEF(or_v128, 1, 2, 0, IMPLV128)
+DEF(xor_v128, 1, 2, 0, IMPLV128)
+DEF(andc_v128, 1, 2, 0, IMPLV128)
+DEF(add8_v128, 1, 2, 0, IMPLV128)
+DEF(add16_v128, 1, 2, 0, IMPLV128)
+DEF(add32_v128, 1, 2, 0, IMPLV128)
+DEF(add64_v128, 1, 2, 0, IMPLV128)
+DEF(sub8_v128, 1, 2, 0, IMPLV128)
+DEF(sub16_v128, 1, 2, 0, IMPLV128)
+DEF(sub32_v128, 1, 2, 0, IMPLV128)
+DEF(sub64_v128, 1, 2, 0, IMPLV128)
+DEF(cmpeq8_v128, 1, 2, 0, IMPLV128)
+DEF(cmpeq16_v128, 1, 2, 0, IMPLV128)
+DEF(cmpeq32_v128, 1, 2, 0, IMPLV128)
+DEF(shli16_v128, 1, 1, 1, IMPLV128)
+DEF(shli32_v128, 1, 1, 1, IMPLV128)
+DEF(shli64_v128, 1, 1, 1, IMPLV128)
+DEF(shri16_v128, 1, 1, 1, IMPLV128)
+DEF(shri32_v128, 1, 1, 1, IMPLV128)
+DEF(shri64_v128, 1, 1, 1, IMPLV128)
+
 /* QEMU specific */
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
 DEF(debug_insn_start, 0, 0, 2, 0)
@@ -167,6 +201,8 @@ DEF(debug_insn_start, 0, 0, 1, 0)
 #endif
 DEF(exit_tb, 0, 0, 1, TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)
 DEF(goto_tb, 0, 0, 1, TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)
+DEF(goto_ptr, 0, 1, 0, TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+    IMPL(TCG_TARGET_HAS_goto_ptr))
 /* Note: even if TARGET_LONG_BITS is not defined, the INDEX_op
    constants must be defined */
 #if TCG_TARGET_REG_BITS == 32
@@ -242,4 +278,5 @@ DEF(qemu_st64, 0, 2, 1, TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS)
 
 #undef IMPL
 #undef IMPL64
+#undef IMPLV128
 #undef DEF
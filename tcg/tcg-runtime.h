@@ -15,4 +15,7 @@ int64_t tcg_helper_rem_i64(int64_t arg1, int64_t arg2);
 uint64_t tcg_helper_divu_i64(uint64_t arg1, uint64_t arg2);
 uint64_t tcg_helper_remu_i64(uint64_t arg1, uint64_t arg2);
 
+/* cpu-exec.c */
+void *tcg_helper_lookup_tb_ptr(void *env);
+
 #endif
@@ -97,7 +97,7 @@ TCGOpDef tcg_op_defs[] = {
 };
 const size_t tcg_op_defs_max = ARRAY_SIZE(tcg_op_defs);
 
-static TCGRegSet tcg_target_available_regs[2];
+static TCGRegSet tcg_target_available_regs[TCG_TYPE_COUNT];
 static TCGRegSet tcg_target_call_clobber_regs;
 
 /* XXX: move that inside the context */
@@ -537,6 +537,20 @@ void tcg_temp_free_i64(TCGv_i64 arg)
     tcg_temp_free_internal(GET_TCGV_I64(arg));
 }
 
+TCGv_v128 tcg_temp_new_v128(void)
+{
+    int idx;
+
+    assert(TCG_TARGET_HAS_v128);
+    idx = tcg_temp_new_internal(TCG_TYPE_V128, 0);
+    return MAKE_TCGV_V128(idx);
+}
+
+void tcg_temp_free_v128(TCGv_v128 arg)
+{
+    tcg_temp_free_internal(GET_TCGV_V128(arg));
+}
+
 TCGv_i32 tcg_const_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -1453,21 +1467,24 @@ static void check_regs(TCGContext *s)
 static void temp_allocate_frame(TCGContext *s, int temp)
 {
     TCGTemp *ts;
+    tcg_target_long size;
+
     ts = &s->temps[temp];
+    /* vector slots are accessed with unaligned loads and stores */
+    size = ts->type == TCG_TYPE_V128 ? 16 : sizeof(tcg_target_long);
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
     s->current_frame_offset = (s->current_frame_offset +
                                (tcg_target_long)sizeof(tcg_target_long) - 1) &
         ~(sizeof(tcg_target_long) - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_reg = s->frame_reg;
     ts->mem_allocated = 1;
-    s->current_frame_offset += (tcg_target_long)sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 /* free register 'reg' by spilling the corresponding temporary if necessary */
@@ -2034,6 +2051,28 @@ static void dump_op_count(void)
 #endif
 
 
+#ifdef DEBUG_DISAS
+/* Number of ops that will be turned into host code.  */
+static int tcg_count_ops(TCGContext *s)
+{
+    const uint16_t *opc_ptr;
+    int n = 0;
+
+    for (opc_ptr = gen_opc_buf; opc_ptr < gen_opc_ptr; opc_ptr++) {
+        switch (*opc_ptr) {
+        case INDEX_op_nop:
+        case INDEX_op_nopn:
+        case INDEX_op_debug_insn_start:
+            break;
+        default:
+            n++;
+            break;
+        }
+    }
+    return n;
+}
+#endif
+
 static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
                                       long search_pc)
 {
@@ -2042,6 +2081,9 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     const TCGOpDef *def;
     unsigned int dead_args;
     const TCGArg *args;
+#ifdef DEBUG_DISAS
+    int nb_ops_in = 0;
+#endif
 
 #ifdef DEBUG_DISAS
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP))) {
@@ -2049,8 +2091,14 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
         tcg_dump_ops(s);
         qemu_log("\n");
     }
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT))) {
+        nb_ops_in = tcg_count_ops(s);
+    }
 #endif
 
+    s->opt_known_bits = 0;
+    s->opt_env_loads = 0;
+
 #ifdef CONFIG_PROFILER
     s->opt_time -= profile_getclock();
 #endif
@@ -2075,7 +2123,9 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT))) {
         qemu_log("OP after optimization and liveness analysis:\n");
         tcg_dump_ops(s);
-        qemu_log("\n");
+        qemu_log("ops: %d -> %d (known bits %d, env loads %d)\n\n",
+                 nb_ops_in, tcg_count_ops(s),
+                 s->opt_known_bits, s->opt_env_loads);
     }
 #endif
 
@@ -2101,6 +2151,7 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
         switch(opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
+        case INDEX_op_mov_v128:
             dead_args = s->op_dead_args[op_index];
             tcg_reg_alloc_mov(s, def, args, dead_args);
             break;
@@ -89,6 +89,13 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_deposit_i64_valid(ofs, len) 1
 #endif
 
+#ifndef TCG_TARGET_HAS_goto_ptr
+#define TCG_TARGET_HAS_goto_ptr         0
+#endif
+#ifndef TCG_TARGET_HAS_v128
+#define TCG_TARGET_HAS_v128             0
+#endif
+
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
 #define TCG_TARGET_HAS_div2_i32         0
@@ -153,6 +160,7 @@ typedef struct TCGPool {
 typedef enum TCGType {
     TCG_TYPE_I32,
     TCG_TYPE_I64,
+    TCG_TYPE_V128, /* only if TCG_TARGET_HAS_v128 */
     TCG_TYPE_COUNT, /* number of different types */
 
     /* An alias for the size of the host register.  */
@@ -186,6 +194,7 @@ typedef tcg_target_ulong TCGArg;
    In addition we do typechecking for different types of variables.  TCGv_i32
    and TCGv_i64 are 32/64-bit variables respectively.  TCGv and TCGv_ptr
    are aliases for target_ulong and host pointer sized values respectively.
+   TCGv_v128 holds 16 bytes of packed elements in a host vector register.
  */
 
 #ifdef CONFIG_DEBUG_TCG
@@ -208,15 +217,22 @@ typedef struct {
     int iptr;
 } TCGv_ptr;
 
+typedef struct {
+    int v128;
+} TCGv_v128;
+
 #define MAKE_TCGV_I32(i) __extension__                  \
     ({ TCGv_i32 make_tcgv_tmp = {i}; make_tcgv_tmp;})
 #define MAKE_TCGV_I64(i) __extension__                  \
     ({ TCGv_i64 make_tcgv_tmp = {i}; make_tcgv_tmp;})
 #define MAKE_TCGV_PTR(i) __extension__                  \
     ({ TCGv_ptr make_tcgv_tmp = {i}; make_tcgv_tmp; })
+#define MAKE_TCGV_V128(i) __extension__                 \
+    ({ TCGv_v128 make_tcgv_tmp = {i}; make_tcgv_tmp; })
 #define GET_TCGV_I32(t) ((t).i32)
 #define GET_TCGV_I64(t) ((t).i64)
 #define GET_TCGV_PTR(t) ((t).iptr)
+#define GET_TCGV_V128(t) ((t).v128)
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) MAKE_TCGV_I32(GET_TCGV_I64(t))
 #define TCGV_HIGH(t) MAKE_TCGV_I32(GET_TCGV_I64(t) + 1)
@@ -226,6 +242,7 @@ typedef struct {
 
 typedef int TCGv_i32;
 typedef int TCGv_i64;
+typedef int TCGv_v128;
 #if TCG_TARGET_REG_BITS == 32
 #define TCGv_ptr TCGv_i32
 #else
@@ -234,9 +251,11 @@ typedef int TCGv_i64;
 #define MAKE_TCGV_I32(x) (x)
 #define MAKE_TCGV_I64(x) (x)
 #define MAKE_TCGV_PTR(x) (x)
+#define MAKE_TCGV_V128(x) (x)
 #define GET_TCGV_I32(t) (t)
 #define GET_TCGV_I64(t) (t)
 #define GET_TCGV_PTR(t) (t)
+#define GET_TCGV_V128(t) (t)
 
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) (t)
@@ -392,6 +411,8 @@ struct TCGContext {
     int frame_reg;
 
     uint8_t *code_ptr;
+    /* code that returns 0 to cpu_exec, for goto_ptr misses */
+    void *code_gen_epilogue;
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
     TCGHelperInfo *helpers;
@@ -399,6 +420,10 @@ struct TCGContext {
     int allocated_helpers;
     int helpers_sorted;
 
+    /* simplifications done by the optimizer on the current TB */
+    int opt_known_bits; /* ops removed thanks to known-zero bits */
+    int opt_env_loads;  /* loads from CPU state replaced by a move */
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -491,6 +516,11 @@ static inline TCGv_i64 tcg_temp_local_new_i64(void)
 void tcg_temp_free_i64(TCGv_i64 arg);
 char *tcg_get_arg_str_i64(TCGContext *s, char *buf, int buf_size, TCGv_i64 arg);
 
+/* Vector temporaries are never local: their value does not survive
+   the end of a basic block.  */
+TCGv_v128 tcg_temp_new_v128(void);
+void tcg_temp_free_v128(TCGv_v128 arg);
+
 #if defined(CONFIG_DEBUG_TCG)
 /* If you call tcg_clear_temp_count() at the start of a section of
  * code which is not supposed to leak any TCG temporaries, then
@@ -427,11 +427,23 @@ static void tcg_out64(TCGContext *s, uint64_t v)
     s->code_ptr += sizeof(v);
 }
 
-/* Write opcode. */
+/* Write opcode, followed by the address of its handler for threaded code.
+   The size is filled in when the op is complete. */
 static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
 {
     tcg_out8(s, op);
     tcg_out8(s, 0);
+#ifdef TCI_THREADED
+    /* cpu_restore_state() generates the code of a TB again over the
+       original while other CPUs may run it, and tci_fuse_ops() is not
+       called then.  Keep any superinstruction it installed; for a new
+       TB, tci_fuse_ops() sets the handler of every op afterwards.  */
+    if (tci_op_handler_is_fused(op, *(void **)s->code_ptr)) {
+        s->code_ptr += sizeof(tcg_target_ulong);
+    } else {
+        tcg_out_i(s, (tcg_target_ulong)tci_op_handler(op));
+    }
+#endif
 }
 
 /* Write register. */
@@ -156,12 +156,25 @@ typedef enum {
 
 void tci_disas(uint8_t opc);
 
+/* With GCC, the interpreter runs threaded code, and every op of the
+   bytecode carries the address of its handler in tcg_qemu_tb_exec(). */
+#if defined(__GNUC__)
+# define TCI_THREADED
+const void *tci_op_handler(uint8_t opc);
+bool tci_op_handler_is_fused(uint8_t opc, const void *handler);
+void tci_fuse_ops(uint8_t *start, uint8_t *end);
+#endif
+
 tcg_target_ulong tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
 #define tcg_qemu_tb_exec tcg_qemu_tb_exec
 
+/* Called by the code generator once a TB is complete. */
 static inline void flush_icache_range(tcg_target_ulong start,
                                       tcg_target_ulong stop)
 {
+#ifdef TCI_THREADED
+    tci_fuse_ops((uint8_t *)start, (uint8_t *)stop);
+#endif
 }
 
 #endif /* TCG_TARGET_H */
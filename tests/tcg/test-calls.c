@@ -0,0 +1,66 @@
+/*
+ * Call intensive speed test
+ *
+ * Spends its time in indirect calls through a function table and the
+ * corresponding returns, which end translation blocks with an indirect
+ * branch.  Compare "time ./test-calls" with "time qemu-i386 ./test-calls".
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NB_FUNCS 8
+
+typedef unsigned int (*func_t)(unsigned int);
+
+static unsigned int f0(unsigned int x) { return x + 1; }
+static unsigned int f1(unsigned int x) { return x ^ 0x5555; }
+static unsigned int f2(unsigned int x) { return x * 3; }
+static unsigned int f3(unsigned int x) { return x >> 1; }
+static unsigned int f4(unsigned int x) { return x - 7; }
+static unsigned int f5(unsigned int x) { return x | 0x10; }
+static unsigned int f6(unsigned int x) { return x << 2; }
+static unsigned int f7(unsigned int x) { return ~x; }
+
+static func_t funcs[NB_FUNCS] = { f0, f1, f2, f3, f4, f5, f6, f7 };
+
+/* keep the compiler from turning the recursion into a loop */
+static unsigned int (*volatile recurse_ptr)(unsigned int, unsigned int);
+
+static unsigned int recurse(unsigned int depth, unsigned int x)
+{
+    if (depth == 0) {
+        return x;
+    }
+    return recurse_ptr(depth - 1, funcs[depth % NB_FUNCS](x)) + 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long i, n = 10000000;
+    unsigned int x = 1;
+    clock_t start;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+    recurse_ptr = recurse;
+
+    start = clock();
+    for (i = 0; i < n; i++) {
+        x = funcs[(i ^ x) % NB_FUNCS](x);
+    }
+    printf("indirect calls: %lu in %.2fs (x=%08x)\n",
+           n, (double)(clock() - start) / CLOCKS_PER_SEC, x);
+
+    start = clock();
+    for (i = 0; i < n / 32; i++) {
+        x = recurse(32, x);
+    }
+    printf("nested calls:   %lu in %.2fs (x=%08x)\n",
+           (n / 32) * 32, (double)(clock() - start) / CLOCKS_PER_SEC, x);
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Hot trace speed test
+ *
+ * A hot loop whose body is split into many small blocks by forward
+ * branches that are rarely taken.  Compare
+ * "time qemu-i386 ./test-traces" with
+ * "time qemu-i386 -tcg-traces 1000 ./test-traces".
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static unsigned int __attribute__((noinline)) work(unsigned int x,
+                                                   unsigned long i)
+{
+    if (__builtin_expect((i & 0xffff) == 0, 0)) {
+        x ^= 0x1234;
+    }
+    x = x * 33 + 7;
+    if (__builtin_expect(x == 0, 0)) {
+        x = 1;
+    }
+    x ^= x >> 5;
+    if (__builtin_expect((x & 0xfff) == 0xfff, 0)) {
+        x += 3;
+    }
+    x += i;
+    if (__builtin_expect(i == 12345, 0)) {
+        x = ~x;
+    }
+    return x;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long i, n = 20000000;
+    unsigned int x = 1;
+    clock_t start;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+
+    start = clock();
+    for (i = 0; i < n; i++) {
+        x = work(x, i);
+    }
+    printf("iterations: %lu in %.2fs (x=%08x)\n",
+           n, (double)(clock() - start) / CLOCKS_PER_SEC, x);
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * AioContext tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu-aio.h"
+#include "qemu-thread.h"
+#include "main-loop.h"
+#include "qemu-coroutine.h"
+
+static AioContext *ctx;
+
+typedef struct {
+    QEMUBH *bh;
+    int n;
+    bool done;
+} BHTestData;
+
+static void bh_test_cb(void *opaque)
+{
+    BHTestData *data = opaque;
+
+    data->n++;
+}
+
+static int busy_until_done(void *opaque)
+{
+    BHTestData *data = opaque;
+
+    return !data->done;
+}
+
+static void done_cb(void *opaque)
+{
+    BHTestData *data = opaque;
+
+    data->n++;
+    data->done = true;
+}
+
+static void test_bh_schedule(void)
+{
+    BHTestData data = { .n = 0 };
+
+    data.bh = aio_bh_new(ctx, bh_test_cb, &data);
+    qemu_bh_schedule(data.bh);
+    g_assert_cmpint(data.n, ==, 0);
+
+    /* Not run by the main loop's context */
+    qemu_aio_wait();
+    g_assert_cmpint(data.n, ==, 0);
+
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 1);
+
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.n, ==, 1);
+    qemu_bh_delete(data.bh);
+}
+
+static void test_fd_handler(void)
+{
+    BHTestData data = { .n = 0 };
+    int fds[2];
+    char c = 0;
+
+    g_assert(qemu_pipe(fds) == 0);
+    aio_set_fd_handler(ctx, fds[0], done_cb, NULL, busy_until_done, &data);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(data.n, ==, 0);
+
+    g_assert(write(fds[1], &c, 1) == 1);
+    while (!data.done) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data.n, >=, 1);
+
+    aio_set_fd_handler(ctx, fds[0], NULL, NULL, NULL, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    g_assert(!aio_poll(ctx, false));
+}
+
+static void test_timer(void)
+{
+    BHTestData data = { .n = 0 };
+    QEMUTimer *timer;
+
+    timer = aio_timer_new(ctx, rt_clock, SCALE_NS, done_cb, &data);
+    qemu_mod_timer_ns(timer, qemu_get_clock_ns(rt_clock) + 1000000);
+
+    /* An armed timer keeps the context busy */
+    while (!data.done) {
+        g_assert(aio_poll(ctx, true));
+    }
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert(!qemu_timer_pending(timer));
+    g_assert(!aio_poll(ctx, false));
+
+    qemu_free_timer(timer);
+}
+
+typedef struct {
+    QEMUTimer *timer;
+    int64_t expire;
+    int64_t *last;
+    int *fired;
+} OrderTestTimer;
+
+static void order_cb(void *opaque)
+{
+    OrderTestTimer *t = opaque;
+
+    g_assert_cmpint(t->expire, >=, *t->last);
+    *t->last = t->expire;
+    (*t->fired)++;
+}
+
+/* Expired timers fire in deadline order, also after being moved around */
+static void test_timer_order(void)
+{
+    OrderTestTimer timers[200];
+    int64_t base = qemu_get_clock_ns(rt_clock) - 1000000000;
+    int64_t last = INT64_MIN;
+    int i, fired = 0;
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++) {
+        timers[i].timer = aio_timer_new(ctx, rt_clock, SCALE_NS,
+                                        order_cb, &timers[i]);
+        timers[i].expire = base + (i * 7919) % 1000;
+        timers[i].last = &last;
+        timers[i].fired = &fired;
+        qemu_mod_timer_ns(timers[i].timer, timers[i].expire);
+    }
+    for (i = 0; i < ARRAY_SIZE(timers); i += 3) {
+        timers[i].expire = base + (i * 104729) % 1000;
+        qemu_mod_timer_ns(timers[i].timer, timers[i].expire);
+    }
+    for (i = 1; i < ARRAY_SIZE(timers); i += 5) {
+        qemu_del_timer(timers[i].timer);
+        g_assert(!qemu_timer_pending(timers[i].timer));
+    }
+
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(fired, ==, ARRAY_SIZE(timers) - ARRAY_SIZE(timers) / 5);
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++) {
+        g_assert(!qemu_timer_pending(timers[i].timer));
+        qemu_free_timer(timers[i].timer);
+    }
+}
+
+static void *schedule_thread(void *opaque)
+{
+    BHTestData *data = opaque;
+
+    g_usleep(10000);
+    qemu_bh_schedule(data->bh);
+    return NULL;
+}
+
+/* A bottom half scheduled by another thread wakes up a blocked aio_poll */
+static void test_bh_cross_thread(void)
+{
+    BHTestData data = { .n = 0 };
+    QemuThread thread;
+    int fds[2];
+
+    /* An idle descriptor whose flush handler makes aio_poll block */
+    g_assert(qemu_pipe(fds) == 0);
+    aio_set_fd_handler(ctx, fds[0], done_cb, NULL, busy_until_done, &data);
+
+    data.bh = aio_bh_new(ctx, done_cb, &data);
+    qemu_thread_create(&thread, schedule_thread, &data, QEMU_THREAD_JOINABLE);
+    while (!data.done) {
+        aio_poll(ctx, true);
+    }
+    qemu_thread_join(&thread);
+    g_assert_cmpint(data.n, ==, 1);
+
+    qemu_bh_delete(data.bh);
+    aio_set_fd_handler(ctx, fds[0], NULL, NULL, NULL, NULL);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void *poll_thread(void *opaque)
+{
+    BHTestData *data = opaque;
+
+    while (!data->done) {
+        aio_context_acquire(ctx);
+        aio_poll(ctx, true);
+        aio_context_release(ctx);
+    }
+    return NULL;
+}
+
+/* aio_context_acquire takes the context from a thread blocked in aio_poll */
+static void test_context_acquire(void)
+{
+    BHTestData data = { .n = 0 };
+    QemuThread thread;
+    int fds[2];
+
+    g_assert(qemu_pipe(fds) == 0);
+    aio_set_fd_handler(ctx, fds[0], done_cb, NULL, busy_until_done, &data);
+
+    data.bh = aio_bh_new(ctx, done_cb, &data);
+    qemu_thread_create(&thread, poll_thread, &data, QEMU_THREAD_JOINABLE);
+    g_usleep(10000);
+
+    aio_context_acquire(ctx);
+    aio_context_acquire(ctx);
+    aio_context_release(ctx);
+    qemu_bh_schedule(data.bh);
+    g_usleep(10000);
+    /* The poll thread cannot run the bottom half until we release */
+    g_assert_cmpint(data.n, ==, 0);
+    aio_context_release(ctx);
+
+    qemu_thread_join(&thread);
+    g_assert_cmpint(data.n, ==, 1);
+
+    qemu_bh_delete(data.bh);
+    aio_set_fd_handler(ctx, fds[0], NULL, NULL, NULL, NULL);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+typedef struct {
+    CoQueue queue;
+    int n;
+} CoQueueTestData;
+
+static void coroutine_fn co_queue_waiter(void *opaque)
+{
+    CoQueueTestData *data = opaque;
+
+    qemu_co_queue_wait(&data->queue);
+    data->n++;
+}
+
+static void co_queue_next_cb(void *opaque)
+{
+    CoQueueTestData *data = opaque;
+
+    g_assert(qemu_co_queue_next(&data->queue));
+}
+
+/* A coroutine woken up while a context runs is entered by that context,
+ * and the context can be freed afterwards */
+static void test_co_queue_wakeup(void)
+{
+    CoQueueTestData data = { .n = 0 };
+    AioContext *tmp_ctx = aio_context_new();
+    QEMUBH *bh;
+
+    qemu_co_queue_init(&data.queue);
+    qemu_coroutine_enter(qemu_coroutine_create(co_queue_waiter), &data);
+    g_assert_cmpint(data.n, ==, 0);
+
+    bh = aio_bh_new(tmp_ctx, co_queue_next_cb, &data);
+    qemu_bh_schedule(bh);
+    while (aio_poll(tmp_ctx, false)) {
+        /* Run the wakeup bottom half too */
+    }
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert(qemu_co_queue_empty(&data.queue));
+
+    qemu_bh_delete(bh);
+    aio_context_free(tmp_ctx);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qemu_init_main_loop();
+    ctx = aio_context_new();
+    g_assert(ctx);
+
+    g_test_add_func("/aio/bh/schedule", test_bh_schedule);
+    g_test_add_func("/aio/bh/cross-thread", test_bh_cross_thread);
+    g_test_add_func("/aio/context/acquire", test_context_acquire);
+    g_test_add_func("/aio/fd-handler", test_fd_handler);
+    g_test_add_func("/aio/timer", test_timer);
+    g_test_add_func("/aio/timer/order", test_timer_order);
+    g_test_add_func("/aio/co-queue/wakeup", test_co_queue_wakeup);
+    return g_test_run();
+}
@@ -12,7 +12,9 @@
  */
 
 #include <glib.h>
+#include "qemu-common.h"
 #include "qemu-coroutine.h"
+#include "qemu-thread.h"
 
 /*
  * Check that qemu_in_coroutine() works
@@ -150,6 +152,127 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check that coroutines work with guard pages and without a pool
+ */
+
+typedef struct {
+    bool done;
+    uintptr_t stack_addr;
+} StackGuardData;
+
+static void coroutine_fn record_stack(void *opaque)
+{
+    StackGuardData *data = opaque;
+    int i;
+
+    data->stack_addr = (uintptr_t)&i;
+    for (i = 0; i < 5; i++) {
+        qemu_coroutine_yield();
+    }
+    data->done = true;
+}
+
+#if defined(CONFIG_UCONTEXT_COROUTINE) && defined(__linux__)
+/* Return true if the mapping below the one holding @addr is inaccessible */
+static bool stack_has_guard_page(uintptr_t addr)
+{
+    FILE *f = fopen("/proc/self/maps", "r");
+    char line[512];
+    unsigned long start, end, prev_end = 0;
+    char perms[5], prev_perms[5] = "";
+    bool guarded = false;
+
+    g_assert(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3) {
+            continue;
+        }
+        if (addr >= start && addr < end) {
+            guarded = prev_end == start && !strcmp(prev_perms, "---p");
+            break;
+        }
+        prev_end = end;
+        memcpy(prev_perms, perms, sizeof(prev_perms));
+    }
+    fclose(f);
+    return guarded;
+}
+#endif
+
+static void test_stack_guard(void)
+{
+    Coroutine *coroutine;
+    StackGuardData data = { .done = false };
+
+    /* Pooled coroutines from earlier tests are freed, not reused */
+    qemu_coroutine_set_pool_size(0);
+    qemu_coroutine_set_stack_guard(true);
+
+    coroutine = qemu_coroutine_create(record_stack);
+    qemu_coroutine_enter(coroutine, &data);
+#if defined(CONFIG_UCONTEXT_COROUTINE) && defined(__linux__)
+    g_assert(stack_has_guard_page(data.stack_addr));
+#endif
+    while (!data.done) {
+        qemu_coroutine_enter(coroutine, &data);
+    }
+
+    qemu_coroutine_set_stack_guard(false);
+    qemu_coroutine_set_pool_size(64);
+}
+
+/*
+ * Check that coroutines created by one thread can terminate in another,
+ * and be reused by a third one
+ */
+
+#define THREAD_COROUTINES 200
+
+typedef struct {
+    Coroutine *co[THREAD_COROUTINES];
+    bool done[THREAD_COROUTINES];
+} ThreadData;
+
+static void coroutine_fn yield_once(void *opaque)
+{
+    bool *done = opaque;
+
+    qemu_coroutine_yield();
+    *done = true;
+}
+
+static void *create_thread(void *opaque)
+{
+    ThreadData *data = opaque;
+    int i;
+
+    for (i = 0; i < THREAD_COROUTINES; i++) {
+        data->done[i] = false;
+        data->co[i] = qemu_coroutine_create(yield_once);
+        qemu_coroutine_enter(data->co[i], &data->done[i]);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    ThreadData data;
+    QemuThread thread;
+    int i, j;
+
+    for (j = 0; j < 3; j++) {
+        qemu_thread_create(&thread, create_thread, &data, QEMU_THREAD_JOINABLE);
+        qemu_thread_join(&thread);
+
+        for (i = 0; i < THREAD_COROUTINES; i++) {
+            g_assert(!data.done[i]);
+            qemu_coroutine_enter(data.co[i], NULL);
+            g_assert(data.done[i]);
+        }
+    }
+}
+
 /*
  * Lifecycle benchmark
  */
@@ -177,6 +300,77 @@ static void perf_lifecycle(void)
     g_test_message("Lifecycle %u iterations: %f s\n", max, duration);
 }
 
+/*
+ * Yield benchmark: switch back and forth between a coroutine and its caller
+ */
+
+static void coroutine_fn yield_loop(void *opaque)
+{
+    unsigned int *counter = opaque;
+
+    while ((*counter) > 0) {
+        (*counter)--;
+        qemu_coroutine_yield();
+    }
+}
+
+static void perf_yield(void)
+{
+    Coroutine *coroutine;
+    unsigned int i, maxcycles;
+    double duration;
+
+    maxcycles = 100000000;
+    i = maxcycles;
+    coroutine = qemu_coroutine_create(yield_loop);
+
+    g_test_timer_start();
+    while (i > 0) {
+        qemu_coroutine_enter(coroutine, &i);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Yield %u iterations: %f s\n", maxcycles, duration);
+}
+
+/*
+ * Burst benchmark: many coroutines are in flight at once, then terminate,
+ * with the default pool size and with a pool that holds them all
+ */
+
+static void perf_burst_pool(unsigned int pool_size)
+{
+    static Coroutine *co[1000];
+    bool done;
+    unsigned int i, j, max;
+    double duration;
+
+    max = 1000;
+    qemu_coroutine_set_pool_size(pool_size);
+
+    g_test_timer_start();
+    for (j = 0; j < max; j++) {
+        for (i = 0; i < ARRAY_SIZE(co); i++) {
+            co[i] = qemu_coroutine_create(yield_once);
+            qemu_coroutine_enter(co[i], &done);
+        }
+        for (i = 0; i < ARRAY_SIZE(co); i++) {
+            qemu_coroutine_enter(co[i], NULL);
+        }
+    }
+    duration = g_test_timer_elapsed();
+
+    qemu_coroutine_set_pool_size(64);
+    g_test_message("Burst %u iterations of %zu coroutines, pool size %u: "
+                   "%f s\n", max, ARRAY_SIZE(co), pool_size, duration);
+}
+
+static void perf_burst(void)
+{
+    perf_burst_pool(64);
+    perf_burst_pool(1000);
+}
+
 static void perf_nesting(void)
 {
     unsigned int i, maxcycles, maxnesting;
@@ -211,9 +405,13 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
     g_test_add_func("/basic/in_coroutine", test_in_coroutine);
+    g_test_add_func("/basic/stack-guard", test_stack_guard);
+    g_test_add_func("/basic/threads", test_threads);
     if (g_test_perf()) {
         g_test_add_func("/perf/lifecycle", perf_lifecycle);
         g_test_add_func("/perf/nesting", perf_nesting);
+        g_test_add_func("/perf/yield", perf_yield);
+        g_test_add_func("/perf/burst", perf_burst);
     }
     return g_test_run();
 }
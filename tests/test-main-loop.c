@@ -0,0 +1,169 @@
+/*
+ * Main loop tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include <sys/resource.h>
+#include "qemu-common.h"
+#include "main-loop.h"
+
+typedef struct {
+    int rfd;
+    int wfd;
+    unsigned int count;
+} TestPipe;
+
+static void pipe_read(void *opaque)
+{
+    TestPipe *p = opaque;
+    char buf[16];
+
+    if (read(p->rfd, buf, sizeof(buf)) > 0) {
+        p->count++;
+    }
+}
+
+static void pipe_kick(TestPipe *p)
+{
+    char c = 0;
+
+    g_assert(write(p->wfd, &c, 1) == 1);
+}
+
+/* Open N pipes, or as many as the fd limit allows; return the number */
+static int pipes_open(TestPipe *pipes, int n)
+{
+    int i, fds[2];
+
+    for (i = 0; i < n; i++) {
+        if (pipe(fds) < 0) {
+            break;
+        }
+        pipes[i].rfd = fds[0];
+        pipes[i].wfd = fds[1];
+        pipes[i].count = 0;
+        qemu_set_fd_handler(fds[0], pipe_read, NULL, &pipes[i]);
+    }
+    return i;
+}
+
+static void pipes_close(TestPipe *pipes, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        qemu_set_fd_handler(pipes[i].rfd, NULL, NULL, NULL);
+        close(pipes[i].rfd);
+        close(pipes[i].wfd);
+    }
+    /* let the main loop free the handlers */
+    main_loop_wait(true);
+}
+
+static void raise_fd_limit(void)
+{
+    struct rlimit rlim;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < rlim.rlim_max) {
+        rlim.rlim_cur = rlim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rlim);
+    }
+}
+
+/*
+ * Check that handlers are dispatched for descriptors above FD_SETSIZE,
+ * and only for the descriptors that are ready.
+ */
+static void test_many_fds(void)
+{
+    int n = FD_SETSIZE / 2 + 64;
+    TestPipe *pipes = g_new0(TestPipe, n);
+    int i, opened;
+
+    opened = pipes_open(pipes, n);
+    if (opened < n) {
+        pipes_close(pipes, opened);
+        g_free(pipes);
+        g_test_message("cannot open %d pipes, skipping\n", n);
+        return;
+    }
+    g_assert(pipes[n - 1].rfd >= FD_SETSIZE);
+
+    pipe_kick(&pipes[0]);
+    pipe_kick(&pipes[n - 1]);
+    for (i = 0; i < 10 && (!pipes[0].count || !pipes[n - 1].count); i++) {
+        main_loop_wait(false);
+    }
+    g_assert_cmpint(pipes[0].count, ==, 1);
+    g_assert_cmpint(pipes[n - 1].count, ==, 1);
+    for (i = 1; i < n - 1; i++) {
+        g_assert_cmpint(pipes[i].count, ==, 0);
+    }
+
+    pipes_close(pipes, n);
+    g_free(pipes);
+}
+
+/*
+ * Wakeup latency benchmark: one active descriptor, with a growing number
+ * of idle descriptors registered next to it.
+ */
+static void perf_wakeup_idle(int idle)
+{
+    TestPipe *pipes = g_new0(TestPipe, idle + 1);
+    TestPipe *p = &pipes[idle];
+    unsigned int i, max;
+    double duration;
+
+    max = 100000;
+    if (pipes_open(pipes, idle + 1) < idle + 1) {
+        g_test_message("cannot open %d pipes, skipping\n", idle + 1);
+        g_free(pipes);
+        return;
+    }
+    main_loop_wait(true);
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        pipe_kick(p);
+        while (p->count == i) {
+            main_loop_wait(false);
+        }
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Wakeup %u iterations with %d idle fds: %f s, "
+                   "%f us per wakeup\n", max, idle, duration,
+                   duration * 1e6 / max);
+
+    pipes_close(pipes, idle + 1);
+    g_free(pipes);
+}
+
+static void perf_wakeup(void)
+{
+    perf_wakeup_idle(0);
+}
+
+static void perf_wakeup_1k(void)
+{
+    perf_wakeup_idle(1000);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    raise_fd_limit();
+    qemu_init_main_loop();
+
+    g_test_add_func("/main-loop/many-fds", test_many_fds);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/wakeup", perf_wakeup);
+        g_test_add_func("/perf/wakeup-1k", perf_wakeup_1k);
+    }
+    return g_test_run();
+}
@@ -27,7 +27,7 @@
 #define NO_CPU_IO_DEFS
 #include "cpu.h"
 #include "disas.h"
-#include "tcg.h"
+#include "tcg-op.h"
 #include "qemu-timer.h"
 
 /* code generation context */
@@ -45,6 +45,39 @@ void cpu_gen_init(void)
     tcg_context_init(&tcg_ctx); 
 }
 
+/* Count executions of the TB for "info tbs" (-tcg-profile) and, on
+   targets that support traces, for tcg_trace_threshold.  When the trace
+   threshold is reached the TB exits before doing anything, and cpu_exec()
+   retranslates it with tb_gen_trace().  The ops are emitted before the
+   target's own, identically for cpu_gen_code() and cpu_restore_state(). */
+static void gen_tb_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr;
+    TCGv_i32 count;
+    bool trace = false;
+    int l1;
+
+#ifdef TARGET_HAS_TRACES
+    trace = tcg_trace_threshold && !tb->cflags;
+#endif
+    if (!trace && !tcg_tb_profile) {
+        return;
+    }
+    ptr = tcg_const_ptr(&tb->exec_count);
+    count = tcg_temp_new_i32();
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    if (trace) {
+        l1 = gen_new_label();
+        tcg_gen_brcondi_i32(TCG_COND_NE, count, tcg_trace_threshold, l1);
+        tcg_gen_exit_tb((tcg_target_long)tb + 3);
+        gen_set_label(l1);
+    }
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
 /* return non zero if the very first instruction is invalid so that
    the virtual CPU can trigger an exception.
 
@@ -67,6 +100,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #endif
     tcg_func_start(s);
 
+    gen_tb_count(tb);
     gen_intermediate_code(env, tb);
 
     /* generate machine code */
@@ -106,10 +140,8 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     return 0;
 }
 
-/* The cpu state corresponding to 'searched_pc' is restored.
- */
-int cpu_restore_state(TranslationBlock *tb,
-                      CPUArchState *env, uintptr_t searched_pc)
+static int cpu_restore_state_locked(TranslationBlock *tb,
+                                    CPUArchState *env, uintptr_t searched_pc)
 {
     TCGContext *s = &tcg_ctx;
     int j;
@@ -123,6 +155,7 @@ int cpu_restore_state(TranslationBlock *tb,
 #endif
     tcg_func_start(s);
 
+    gen_tb_count(tb);
     gen_intermediate_code_pc(env, tb);
 
     if (use_icount) {
@@ -161,3 +194,17 @@ int cpu_restore_state(TranslationBlock *tb,
 #endif
     return 0;
 }
+
+/* The cpu state corresponding to 'searched_pc' is restored.
+ */
+int cpu_restore_state(TranslationBlock *tb,
+                      CPUArchState *env, uintptr_t searched_pc)
+{
+    int ret;
+
+    /* retranslation uses the shared TCG context */
+    tb_lock_acquire();
+    ret = cpu_restore_state_locked(tb, env, searched_pc);
+    tb_lock_release();
+    return ret;
+}
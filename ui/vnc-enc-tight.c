@@ -336,6 +336,16 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
     return (errors < tight_conf[compression].gradient_threshold);
 }
 
+/* Like tight_detect_smooth_image(), but trust the tile cache if it says so */
+static int tight_rect_is_smooth(VncState *vs, int w, int h)
+{
+    if (vs->tight.photo_hint) {
+        return 1;
+    }
+    vs->tight.smooth = tight_detect_smooth_image(vs, w, h);
+    return vs->tight.smooth;
+}
+
 /*
  * Code to determine how many different colors used in rectangle.
  */
@@ -677,13 +687,12 @@ DEFINE_GRADIENT_FILTER_FUNCTION(32)
     check_solid_tile##bpp(VncState *vs, int x, int y, int w, int h,     \
                           uint32_t* color, bool samecolor)              \
     {                                                                   \
-        VncDisplay *vd = vs->vd;                                        \
         uint##bpp##_t *fbptr;                                           \
         uint##bpp##_t c;                                                \
         int dx, dy;                                                     \
                                                                         \
         fbptr = (uint##bpp##_t *)                                       \
-            (vd->server->data + y * ds_get_linesize(vs->ds) +           \
+            (vs->snapshot->data + y * ds_get_linesize(vs->ds) +           \
              x * ds_get_bytes_per_pixel(vs->ds));                       \
                                                                         \
         c = *fbptr;                                                     \
@@ -712,9 +721,8 @@ DEFINE_CHECK_SOLID_FUNCTION(8)
 static bool check_solid_tile(VncState *vs, int x, int y, int w, int h,
                              uint32_t* color, bool samecolor)
 {
-    VncDisplay *vd = vs->vd;
 
-    switch(vd->server->pf.bytes_per_pixel) {
+    switch(vs->snapshot->pf.bytes_per_pixel) {
     case 4:
         return check_solid_tile32(vs, x, y, w, h, color, samecolor);
     case 2:
@@ -1152,11 +1160,10 @@ static int send_palette_rect(VncState *vs, int x, int y,
 static void rgb_prepare_row24(VncState *vs, uint8_t *dst, int x, int y,
                               int count)
 {
-    VncDisplay *vd = vs->vd;
     uint32_t *fbptr;
     uint32_t pix;
 
-    fbptr = (uint32_t *)(vd->server->data + y * ds_get_linesize(vs->ds) +
+    fbptr = (uint32_t *)(vs->snapshot->data + y * ds_get_linesize(vs->ds) +
                          x * ds_get_bytes_per_pixel(vs->ds));
 
     while (count--) {
@@ -1173,13 +1180,12 @@ static void rgb_prepare_row24(VncState *vs, uint8_t *dst, int x, int y,
     rgb_prepare_row##bpp(VncState *vs, uint8_t *dst,                    \
                          int x, int y, int count)                       \
     {                                                                   \
-        VncDisplay *vd = vs->vd;                                        \
         uint##bpp##_t *fbptr;                                           \
         uint##bpp##_t pix;                                              \
         int r, g, b;                                                    \
                                                                         \
         fbptr = (uint##bpp##_t *)                                       \
-            (vd->server->data + y * ds_get_linesize(vs->ds) +           \
+            (vs->snapshot->data + y * ds_get_linesize(vs->ds) +           \
              x * ds_get_bytes_per_pixel(vs->ds));                       \
                                                                         \
         while (count--) {                                               \
@@ -1483,7 +1489,7 @@ static int send_sub_rect_nojpeg(VncState *vs, int x, int y, int w, int h,
     int ret;
 
     if (colors == 0) {
-        if (tight_detect_smooth_image(vs, w, h)) {
+        if (tight_rect_is_smooth(vs, w, h)) {
             ret = send_gradient_rect(vs, x, y, w, h);
         } else {
             ret = send_full_color_rect(vs, x, y, w, h);
@@ -1509,7 +1515,7 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
 
     if (colors == 0) {
         if (force || (tight_jpeg_conf[vs->tight.quality].jpeg_full &&
-                      tight_detect_smooth_image(vs, w, h))) {
+                      tight_rect_is_smooth(vs, w, h))) {
             int quality = tight_conf[vs->tight.quality].jpeg_quality;
 
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
@@ -1523,7 +1529,7 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
     } else if (colors <= 256) {
         if (force || (colors > 96 &&
                       tight_jpeg_conf[vs->tight.quality].jpeg_idx &&
-                      tight_detect_smooth_image(vs, w, h))) {
+                      tight_rect_is_smooth(vs, w, h))) {
             int quality = tight_conf[vs->tight.quality].jpeg_quality;
 
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
@@ -1537,6 +1543,53 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
 }
 #endif
 
+/*
+ * Rectangles are classified again and again as the guest redraws them.
+ * Remember, per VNC_STAT_RECT tile, that a rectangle covering it turned out
+ * to be a smooth, many-colored image and skip the palette scan and the
+ * smoothness detection for the next few updates of the tile.
+ */
+#define TIGHT_PHOTO_REUSE 8
+
+static bool tight_rect_is_photo(VncState *vs, int x, int y, int w, int h)
+{
+    int i, j;
+
+    if (!vs->vd->lossy || vs->clientds.pf.bytes_per_pixel == 1 ||
+        ds_get_bytes_per_pixel(vs->ds) == 1) {
+        return false;
+    }
+    for (j = y / VNC_STAT_RECT; j <= (y + h - 1) / VNC_STAT_RECT; j++) {
+        for (i = x / VNC_STAT_RECT; i <= (x + w - 1) / VNC_STAT_RECT; i++) {
+            if (!vs->tight.photo[j][i]) {
+                return false;
+            }
+        }
+    }
+    for (j = y / VNC_STAT_RECT; j <= (y + h - 1) / VNC_STAT_RECT; j++) {
+        for (i = x / VNC_STAT_RECT; i <= (x + w - 1) / VNC_STAT_RECT; i++) {
+            vs->tight.photo[j][i]--;
+        }
+    }
+    return true;
+}
+
+static void tight_set_photo(VncState *vs, int x, int y, int w, int h,
+                            bool photo)
+{
+    int i, j;
+
+    /* a small rectangle says little about the rest of the tile */
+    if (photo && w * h < VNC_STAT_RECT * VNC_STAT_RECT / 4) {
+        return;
+    }
+    for (j = y / VNC_STAT_RECT; j <= (y + h - 1) / VNC_STAT_RECT; j++) {
+        for (i = x / VNC_STAT_RECT; i <= (x + w - 1) / VNC_STAT_RECT; i++) {
+            vs->tight.photo[j][i] = photo ? TIGHT_PHOTO_REUSE : 0;
+        }
+    }
+}
+
 static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
 {
     VncPalette *palette = NULL;
@@ -1568,7 +1621,13 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
     }
 #endif
 
-    colors = tight_fill_palette(vs, x, y, w * h, &fg, &bg, &palette);
+    vs->tight.smooth = -1;
+    vs->tight.photo_hint = tight_rect_is_photo(vs, x, y, w, h);
+    if (vs->tight.photo_hint) {
+        colors = 0;
+    } else {
+        colors = tight_fill_palette(vs, x, y, w * h, &fg, &bg, &palette);
+    }
 
 #ifdef CONFIG_VNC_JPEG
     if (allow_jpeg && vs->tight.quality != (uint8_t)-1) {
@@ -1581,6 +1640,10 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
     ret = send_sub_rect_nojpeg(vs, x, y, w, h, bg, fg, colors, palette);
 #endif
 
+    if (!vs->tight.photo_hint) {
+        tight_set_photo(vs, x, y, w, h, colors == 0 && vs->tight.smooth == 1);
+    }
+    vs->tight.photo_hint = false;
     palette_destroy(palette);
     return ret;
 }
@@ -29,6 +29,7 @@
 #include "vnc.h"
 #include "vnc-jobs.h"
 #include "qemu_socket.h"
+#include "qemu-timer.h"
 
 /*
  * Locking:
@@ -41,28 +42,43 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  * 		   	 if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is hold
- * to avoid screen corruptions (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not hold because the thread work on
- * its own output buffer.
+ * A VNC worker thread holds the VncDisplay lock only while it copies the
+ * rectangles of its job from the server surface into its own snapshot, and
+ * encodes from the snapshot without the lock.  vnc_refresh() uses trylock()
+ * so it is never blocked, and a slow encoder cannot keep it from updating the
+ * server surface for the other clients.
+ * The output lock is not held because each thread works on its own output
+ * buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Jobs of one client are encoded in order, by one worker at a time, because
+ * the zlib and tight encoders keep per client stream state.  The jobs of
+ * different clients are encoded in parallel.
 */
 
+#define VNC_WORKER_THREADS 4
+
+typedef struct VncJobQueue VncJobQueue;
+
+typedef struct VncWorker {
+    VncJobQueue *queue;
+    QemuThread thread;
+    Buffer buffer;
+    DisplaySurface snapshot;
+} VncWorker;
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
-    Buffer buffer;
+    VncWorker workers[VNC_WORKER_THREADS];
+    int nb_workers; /* threads that have not exited yet */
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
-typedef struct VncJobQueue VncJobQueue;
-
 /*
- * We use a single global queue, but most of the functions are
- * already reetrant, so we can easilly add more than one encoding thread
+ * We use a single global queue, shared by all the encoding threads
  */
 static VncJobQueue *queue;
 
@@ -108,12 +124,23 @@ void vnc_job_push(VncJob *job)
     if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
         g_free(job);
     } else {
+        job->vs->jobs_pending++;
         QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
         qemu_cond_broadcast(&queue->cond);
     }
     vnc_unlock_queue(queue);
 }
 
+static void vnc_job_free(VncJob *job)
+{
+    VncRectEntry *entry, *tmp;
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        g_free(entry);
+    }
+    g_free(job);
+}
+
 static bool vnc_has_job_locked(VncState *vs)
 {
     VncJob *job;
@@ -136,14 +163,27 @@ bool vnc_has_job(VncState *vs)
     return ret;
 }
 
+int vnc_jobs_pending(VncState *vs)
+{
+    int ret;
+
+    vnc_lock_queue(queue);
+    ret = vs->jobs_pending;
+    vnc_unlock_queue(queue);
+    return ret;
+}
+
+/* Drop the jobs that are waiting; the ones being encoded will complete */
 void vnc_jobs_clear(VncState *vs)
 {
     VncJob *job, *tmp;
 
     vnc_lock_queue(queue);
     QTAILQ_FOREACH_SAFE(job, &queue->jobs, next, tmp) {
-        if (job->vs == vs || !vs) {
+        if ((job->vs == vs || !vs) && !job->running) {
+            job->vs->jobs_pending--;
             QTAILQ_REMOVE(&queue->jobs, job, next);
+            vnc_job_free(job);
         }
     }
     vnc_unlock_queue(queue);
@@ -179,7 +219,8 @@ void vnc_jobs_consume_buffer(VncState *vs)
 /*
  * Copy data for local use
  */
-static void vnc_async_encoding_start(VncState *orig, VncState *local)
+static void vnc_async_encoding_start(VncState *orig, VncState *local,
+                                     Buffer *buffer)
 {
     local->vnc_encoding = orig->vnc_encoding;
     local->features = orig->features;
@@ -192,42 +233,101 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
-    local->output =  queue->buffer;
+    local->output = *buffer;
     local->csock = -1; /* Don't do any network work on this thread */
+    memset(&local->stats, 0, sizeof(local->stats));
 
     buffer_reset(&local->output);
 }
 
-static void vnc_async_encoding_end(VncState *orig, VncState *local)
+static void vnc_async_encoding_end(VncState *orig, VncState *local,
+                                   Buffer *buffer)
 {
+    int i;
+
+    for (i = 0; i < VNC_ENC_STAT_MAX; i++) {
+        orig->stats.enc[i].rects += local->stats.enc[i].rects;
+        orig->stats.enc[i].raw_bytes += local->stats.enc[i].raw_bytes;
+        orig->stats.enc[i].bytes += local->stats.enc[i].bytes;
+        orig->stats.enc[i].time += local->stats.enc[i].time;
+    }
     orig->tight = local->tight;
     orig->zlib = local->zlib;
     orig->hextile = local->hextile;
     orig->zrle = local->zrle;
     orig->lossy_rect = local->lossy_rect;
 
-    queue->buffer = local->output;
+    *buffer = local->output;
+}
+
+/*
+ * Copy the rectangles of the job from the server surface.  The snapshot has
+ * the layout of the server surface, so the encoders address it the same way.
+ */
+static void vnc_snapshot_job(VncWorker *worker, VncJob *job)
+{
+    VncDisplay *vd = job->vs->vd;
+    DisplaySurface *snap = &worker->snapshot;
+    uint8_t *data = snap->data;
+    VncRectEntry *entry;
+    int bpp, i;
+
+    vnc_lock_display(vd);
+    if (snap->linesize != vd->server->linesize ||
+        snap->height != vd->server->height) {
+        g_free(data);
+        data = g_malloc(vd->server->linesize * vd->server->height);
+    }
+    *snap = *vd->server;
+    snap->data = data;
+
+    bpp = snap->pf.bytes_per_pixel;
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        VncRect *rect = &entry->rect;
+        size_t offset = rect->y * snap->linesize + rect->x * bpp;
+
+        for (i = 0; i < rect->h; i++, offset += snap->linesize) {
+            memcpy(snap->data + offset, vd->server->data + offset,
+                   rect->w * bpp);
+        }
+    }
+    vnc_unlock_display(vd);
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+/* First job whose client is not being served by another worker */
+static VncJob *vnc_queue_next_job(VncJobQueue *queue)
 {
     VncJob *job;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (!job->vs->job_running) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static int vnc_worker_thread_loop(VncWorker *worker)
+{
+    VncJobQueue *queue = worker->queue;
+    VncJob *job = NULL;
     VncRectEntry *entry, *tmp;
     VncState vs;
     int n_rectangles;
     int saved_offset;
+    int64_t start;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!queue->exit && !(job = vnc_queue_next_job(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    job->vs->job_running = true;
+    vnc_unlock_queue(queue);
 
     vnc_lock_output(job->vs);
     if (job->vs->csock == -1 || job->vs->abort == true) {
@@ -237,7 +337,10 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     vnc_unlock_output(job->vs);
 
     /* Make a local copy of vs and switch output buffers */
-    vnc_async_encoding_start(job->vs, &vs);
+    vnc_async_encoding_start(job->vs, &vs, &worker->buffer);
+    start = get_clock();
+    vnc_snapshot_job(worker, job);
+    vs.snapshot = &worker->snapshot;
 
     /* Start sending rectangles */
     n_rectangles = 0;
@@ -246,12 +349,11 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->csock == -1) {
-            vnc_unlock_display(job->vs->vd);
+            worker->buffer = vs.output;
             goto disconnected;
         }
 
@@ -261,9 +363,9 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         if (n >= 0) {
             n_rectangles += n;
         }
+        QLIST_REMOVE(entry, next);
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -274,19 +376,26 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         buffer_reserve(&job->vs->jobs_buffer, vs.output.offset);
         buffer_append(&job->vs->jobs_buffer, vs.output.buffer,
                       vs.output.offset);
+        job->vs->stats.updates++;
+        job->vs->stats.encode_time += get_clock() - start;
+        job->vs->stats.encoded_bytes += vs.output.offset;
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(job->vs, &vs, &worker->buffer);
 
 	qemu_bh_schedule(job->vs->bh);
+    } else {
+        worker->buffer = vs.output;
     }
     vnc_unlock_output(job->vs);
 
 disconnected:
     vnc_lock_queue(queue);
     QTAILQ_REMOVE(&queue->jobs, job, next);
+    job->vs->job_running = false;
+    job->vs->jobs_pending--;
     vnc_unlock_queue(queue);
     qemu_cond_broadcast(&queue->cond);
-    g_free(job);
+    vnc_job_free(job);
     return 0;
 }
 
@@ -302,33 +411,52 @@ static VncJobQueue *vnc_queue_init(void)
 
 static void vnc_queue_clear(VncJobQueue *q)
 {
-    qemu_cond_destroy(&queue->cond);
-    qemu_mutex_destroy(&queue->mutex);
-    buffer_free(&queue->buffer);
+    int i;
+
+    qemu_cond_destroy(&q->cond);
+    qemu_mutex_destroy(&q->mutex);
+    for (i = 0; i < VNC_WORKER_THREADS; i++) {
+        buffer_free(&q->workers[i].buffer);
+        g_free(q->workers[i].snapshot.data);
+    }
     g_free(q);
-    queue = NULL; /* Unset global queue */
 }
 
 static void *vnc_worker_thread(void *arg)
 {
-    VncJobQueue *queue = arg;
+    VncWorker *worker = arg;
+    VncJobQueue *queue = worker->queue;
+    bool last;
 
-    qemu_thread_get_self(&queue->thread);
+    qemu_thread_get_self(&worker->thread);
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    while (!vnc_worker_thread_loop(worker)) ;
+
+    /* the last thread to leave frees the queue */
+    vnc_lock_queue(queue);
+    last = --queue->nb_workers == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    int i;
 
     if (vnc_worker_thread_running())
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, vnc_worker_thread, q, QEMU_THREAD_DETACHED);
+    q->nb_workers = VNC_WORKER_THREADS;
+    for (i = 0; i < VNC_WORKER_THREADS; i++) {
+        q->workers[i].queue = q;
+        qemu_thread_create(&q->workers[i].thread, vnc_worker_thread,
+                           &q->workers[i], QEMU_THREAD_DETACHED);
+    }
     queue = q; /* Set global queue */
 }
 
@@ -339,13 +467,16 @@ bool vnc_worker_thread_running(void)
 
 void vnc_stop_worker_thread(void)
 {
+    VncJobQueue *q = queue;
+
     if (!vnc_worker_thread_running())
         return ;
 
-    /* Remove all jobs and wake up the thread */
-    vnc_lock_queue(queue);
-    queue->exit = true;
-    vnc_unlock_queue(queue);
+    /* Remove all jobs and wake up the threads */
     vnc_jobs_clear(NULL);
-    qemu_cond_broadcast(&queue->cond);
+    vnc_lock_queue(q);
+    q->exit = true;
+    vnc_unlock_queue(q);
+    qemu_cond_broadcast(&q->cond);
+    queue = NULL; /* Unset global queue */
 }
@@ -34,9 +34,16 @@
 #include "qmp-commands.h"
 #include "osdep.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define VNC_REFRESH_INTERVAL_BASE 30
 #define VNC_REFRESH_INTERVAL_INC  50
 #define VNC_REFRESH_INTERVAL_MAX  2000
+/* below this many changed 16-pixel chunks per refresh (a blinking cursor,
+   a clock) the refresh rate is left alone instead of being doubled */
+#define VNC_REFRESH_CHUNKS_MIN    32
 static const struct timeval VNC_REFRESH_STATS = { 0, 500000 };
 static const struct timeval VNC_REFRESH_LOSSY = { 2, 0 };
 
@@ -300,13 +307,24 @@ static void vnc_qmp_event(VncState *vs, MonitorEvent event)
     qobject_decref(data);
 }
 
-static VncClientInfo *qmp_query_vnc_client(const VncState *client)
+static const char *const vnc_enc_stat_names[VNC_ENC_STAT_MAX] = {
+    [VNC_ENC_STAT_RAW]       = "raw",
+    [VNC_ENC_STAT_HEXTILE]   = "hextile",
+    [VNC_ENC_STAT_ZLIB]      = "zlib",
+    [VNC_ENC_STAT_TIGHT]     = "tight",
+    [VNC_ENC_STAT_TIGHT_PNG] = "tight-png",
+    [VNC_ENC_STAT_ZRLE]      = "zrle",
+    [VNC_ENC_STAT_ZYWRLE]    = "zywrle",
+};
+
+static VncClientInfo *qmp_query_vnc_client(VncState *client)
 {
     struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
     char host[NI_MAXHOST];
     char serv[NI_MAXSERV];
     VncClientInfo *info;
+    int i;
 
     if (getpeername(client->csock, (struct sockaddr *)&sa, &salen) < 0) {
         return NULL;
@@ -324,6 +342,32 @@ static VncClientInfo *qmp_query_vnc_client(const VncState *client)
     info->service = g_strdup(serv);
     info->family = g_strdup(inet_strfamily(sa.ss_family));
 
+    vnc_lock_output(client);
+    info->updates = client->stats.updates;
+    info->encode_time = client->stats.encode_time;
+    info->encoded_bytes = client->stats.encoded_bytes;
+    info->bytes_sent = client->stats.bytes_sent;
+
+    for (i = VNC_ENC_STAT_MAX - 1; i >= 0; i--) {
+        const VncEncodingStat *stat = &client->stats.enc[i];
+        VncEncodingStatsList *entry;
+
+        if (!stat->rects) {
+            continue;
+        }
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->name = g_strdup(vnc_enc_stat_names[i]);
+        entry->value->rects = stat->rects;
+        entry->value->raw_bytes = stat->raw_bytes;
+        entry->value->bytes = stat->bytes;
+        entry->value->time = stat->time;
+        entry->next = info->encodings;
+        info->encodings = entry;
+        info->has_encodings = true;
+    }
+    vnc_unlock_output(client);
+
 #ifdef CONFIG_VNC_TLS
     if (client->tls.session && client->tls.dname) {
         info->has_x509_dname = true;
@@ -670,11 +714,10 @@ int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int i;
     uint8_t *row;
-    VncDisplay *vd = vs->vd;
 
-    row = vd->server->data + y * ds_get_linesize(vs->ds) + x * ds_get_bytes_per_pixel(vs->ds);
+    row = vs->snapshot->data + y * ds_get_linesize(vs->ds) + x * ds_get_bytes_per_pixel(vs->ds);
     for (i = 0; i < h; i++) {
-        vs->write_pixels(vs, &vd->server->pf, row, w * ds_get_bytes_per_pixel(vs->ds));
+        vs->write_pixels(vs, &vs->snapshot->pf, row, w * ds_get_bytes_per_pixel(vs->ds));
         row += ds_get_linesize(vs->ds);
     }
     return 1;
@@ -683,32 +726,47 @@ int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 int vnc_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int n = 0;
+    int stat;
+    size_t offset = vs->output.offset;
+    int64_t start = get_clock();
 
     switch(vs->vnc_encoding) {
         case VNC_ENCODING_ZLIB:
             n = vnc_zlib_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_ZLIB;
             break;
         case VNC_ENCODING_HEXTILE:
             vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_HEXTILE);
             n = vnc_hextile_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_HEXTILE;
             break;
         case VNC_ENCODING_TIGHT:
             n = vnc_tight_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_TIGHT;
             break;
         case VNC_ENCODING_TIGHT_PNG:
             n = vnc_tight_png_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_TIGHT_PNG;
             break;
         case VNC_ENCODING_ZRLE:
             n = vnc_zrle_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_ZRLE;
             break;
         case VNC_ENCODING_ZYWRLE:
             n = vnc_zywrle_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_ZYWRLE;
             break;
         default:
             vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
             n = vnc_raw_send_framebuffer_update(vs, x, y, w, h);
+            stat = VNC_ENC_STAT_RAW;
             break;
     }
+
+    vs->stats.enc[stat].rects++;
+    vs->stats.enc[stat].raw_bytes += w * h * vs->clientds.pf.bytes_per_pixel;
+    vs->stats.enc[stat].bytes += vs->output.offset - offset;
+    vs->stats.enc[stat].time += get_clock() - start;
     return n;
 }
 
@@ -735,7 +793,9 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
     int i,x,y,pitch,depth,inc,w_lim,s;
     int cmp_bytes;
 
+    vnc_lock_display(vd);
     vnc_refresh_server_surface(vd);
+    vnc_unlock_display(vd);
     QTAILQ_FOREACH_SAFE(vs, &vd->clients, next, vn) {
         if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
             vs->force_update = 1;
@@ -744,7 +804,9 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
         }
     }
 
-    /* do bitblit op on the local surface too */
+    /* do bitblit op on the local surface too, the workers may be copying
+     * from it for the clients without copyrect */
+    vnc_lock_display(vd);
     pitch = ds_get_linesize(vd->ds);
     depth = ds_get_bytes_per_pixel(vd->ds);
     src_row = vd->server->data + pitch * src_y + depth * src_x;
@@ -790,6 +852,7 @@ static void vnc_dpy_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int
         dst_row += pitch - w * depth;
         y += inc;
     }
+    vnc_unlock_display(vd);
 
     QTAILQ_FOREACH(vs, &vd->clients, next) {
         if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
@@ -883,6 +946,10 @@ static int vnc_update_client(VncState *vs, int has_dirty)
             /* kernel send buffers are full -> drop frames to throttle */
             return 0;
 
+        if (vnc_jobs_pending(vs) >= VNC_MAX_PENDING_JOBS && !vs->force_update)
+            /* the encoders are behind -> leave the dirty bits for later */
+            return 0;
+
         if (!has_dirty && !vs->audio_cap && !vs->force_update)
             return 0;
 
@@ -1130,7 +1197,11 @@ long vnc_client_write_buf(VncState *vs, const uint8_t *data, size_t datalen)
 #endif /* CONFIG_VNC_TLS */
         ret = send(vs->csock, (const void *)data, datalen, 0);
     VNC_DEBUG("Wrote wire %p %zd -> %ld\n", data, datalen, ret);
-    return vnc_client_io_error(vs, ret, socket_error());
+    ret = vnc_client_io_error(vs, ret, socket_error());
+    if (ret > 0) {
+        vs->stats.bytes_sent += ret;
+    }
+    return ret;
 }
 
 
@@ -2524,12 +2595,56 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/*
+ * Return the offset of the first 16-byte block that differs between A and
+ * B, or LEN if they are equal.  LEN is a multiple of 16; the surfaces have
+ * no particular alignment.
+ */
+static int vnc_find_diff(const uint8_t *a, const uint8_t *b, int len)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 64 <= len; i += 64) {
+        __m128i d0 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i)),
+                                    _mm_loadu_si128((__m128i *)(b + i)));
+        __m128i d1 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i + 16)),
+                                    _mm_loadu_si128((__m128i *)(b + i + 16)));
+        __m128i d2 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i + 32)),
+                                    _mm_loadu_si128((__m128i *)(b + i + 32)));
+        __m128i d3 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i + 48)),
+                                    _mm_loadu_si128((__m128i *)(b + i + 48)));
+        __m128i all = _mm_and_si128(_mm_and_si128(d0, d1),
+                                    _mm_and_si128(d2, d3));
+
+        if (_mm_movemask_epi8(all) != 0xFFFF) {
+            break;
+        }
+    }
+    for (; i < len; i += 16) {
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i)),
+                                   _mm_loadu_si128((__m128i *)(b + i)));
+        if (_mm_movemask_epi8(d) != 0xFFFF) {
+            break;
+        }
+    }
+#else
+    for (; i < len; i += 16) {
+        if (memcmp(a + i, b + i, 16) != 0) {
+            break;
+        }
+    }
+#endif
+    return MIN(i, len);
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int y;
     uint8_t *guest_row;
     uint8_t *server_row;
     int cmp_bytes;
+    int nb_chunks;
     VncState *vs;
     int has_dirty = 0;
 
@@ -2541,39 +2656,46 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     }
 
     /*
-     * Walk through the guest dirty map.
-     * Check and copy modified bits from guest to server surface.
-     * Update server dirty map.
+     * Walk through the guest dirty map.  It is filled from the display
+     * device's own dirty tracking, so only memory the guest wrote to is
+     * looked at.  Compare each run of dirty chunks in one go, copy the
+     * chunks that really changed from guest to server surface and update
+     * the server dirty map.
      */
     cmp_bytes = 16 * ds_get_bytes_per_pixel(vd->ds);
     if (cmp_bytes > vd->ds->surface->linesize) {
         cmp_bytes = vd->ds->surface->linesize;
     }
+    nb_chunks = vd->guest.ds->width / 16;
     guest_row  = vd->guest.ds->data;
     server_row = vd->server->data;
     for (y = 0; y < vd->guest.ds->height; y++) {
-        if (!bitmap_empty(vd->guest.dirty[y], VNC_DIRTY_BITS)) {
-            int x;
-            uint8_t *guest_ptr;
-            uint8_t *server_ptr;
-
-            guest_ptr  = guest_row;
-            server_ptr = server_row;
-
-            for (x = 0; x + 15 < vd->guest.ds->width;
-                    x += 16, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-                if (!test_and_clear_bit((x / 16), vd->guest.dirty[y]))
-                    continue;
-                if (memcmp(server_ptr, guest_ptr, cmp_bytes) == 0)
-                    continue;
-                memcpy(server_ptr, guest_ptr, cmp_bytes);
+        unsigned long *dirty = vd->guest.dirty[y];
+        int x = find_next_bit(dirty, nb_chunks, 0);
+
+        while (x < nb_chunks) {
+            int end = find_next_zero_bit(dirty, nb_chunks, x);
+            uint8_t *guest_ptr = guest_row + x * cmp_bytes;
+            uint8_t *server_ptr = server_row + x * cmp_bytes;
+            int len = (end - x) * cmp_bytes;
+            int off = 0;
+
+            bitmap_clear(dirty, x, end - x);
+            while ((off += vnc_find_diff(server_ptr + off, guest_ptr + off,
+                                         len - off)) < len) {
+                int chunk = x + off / cmp_bytes;
+
+                off = (chunk - x) * cmp_bytes;
+                memcpy(server_ptr + off, guest_ptr + off, cmp_bytes);
+                off += cmp_bytes;
                 if (!vd->non_adaptive)
-                    vnc_rect_updated(vd, x, y, &tv);
+                    vnc_rect_updated(vd, chunk * 16, y, &tv);
                 QTAILQ_FOREACH(vs, &vd->clients, next) {
-                    set_bit((x / 16), vs->dirty[y]);
+                    set_bit(chunk, vs->dirty[y]);
                 }
                 has_dirty++;
             }
+            x = find_next_bit(dirty, nb_chunks, end);
         }
         guest_row  += ds_get_linesize(vd->ds);
         server_row += ds_get_linesize(vd->ds);
@@ -2581,6 +2703,222 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     return has_dirty;
 }
 
+/*
+ * Scroll detection.  When a large part of the screen changed, hash the rows
+ * of the changed area in the guest and in the server surface and look for
+ * a run of guest rows that is found, shifted vertically, in the server
+ * surface.  The run is then moved on the server surface and sent as
+ * CopyRect to the clients that support it, instead of being re-encoded.
+ */
+#define VNC_SCROLL_MIN_ROWS     32
+#define VNC_SCROLL_BACKOFF_MAX  16
+
+static uint64_t vnc_hash_row(const uint8_t *p, int len)
+{
+    uint64_t h = 0, v;
+    int i;
+
+    for (i = 0; i < len; i += 8) {
+        memcpy(&v, p + i, 8);
+        h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/* Index of the only server row with hash H, or -1 */
+static int vnc_scroll_lookup(const int *table, int mask, const uint64_t *hash,
+                             const uint8_t *dup, uint64_t h)
+{
+    int i;
+
+    for (i = h & mask; table[i] != -1; i = (i + 1) & mask) {
+        if (hash[table[i]] == h) {
+            return dup[table[i]] ? -1 : table[i];
+        }
+    }
+    return -1;
+}
+
+static void vnc_move_server_rows(VncDisplay *vd, int x, int src_y, int dst_y,
+                                 int w, int h)
+{
+    int pitch = ds_get_linesize(vd->ds);
+    int bpp = ds_get_bytes_per_pixel(vd->ds);
+    int c0 = x / 16, c1 = (x + w) / 16;
+    int i, c, y, step;
+    VncState *vs;
+
+    /* walk the rows in the order that does not overwrite unread sources */
+    y = dst_y < src_y ? 0 : h - 1;
+    step = dst_y < src_y ? 1 : -1;
+    for (i = 0; i < h; i++, y += step) {
+        uint8_t *src = vd->server->data + (src_y + y) * pitch + x * bpp;
+        uint8_t *dst = vd->server->data + (dst_y + y) * pitch + x * bpp;
+
+        QTAILQ_FOREACH(vs, &vd->clients, next) {
+            if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
+                /* what was stale at the source is stale at the destination */
+                for (c = c0; c < c1; c++) {
+                    if (test_bit(c, vs->dirty[src_y + y])) {
+                        set_bit(c, vs->dirty[dst_y + y]);
+                    } else {
+                        clear_bit(c, vs->dirty[dst_y + y]);
+                    }
+                }
+            } else {
+                for (c = c0; c < c1; c++) {
+                    if (memcmp(src + (c - c0) * 16 * bpp,
+                               dst + (c - c0) * 16 * bpp, 16 * bpp)) {
+                        set_bit(c, vs->dirty[dst_y + y]);
+                    }
+                }
+            }
+        }
+        memmove(dst, src, w * bpp);
+    }
+}
+
+static void vnc_detect_scroll(VncDisplay *vd)
+{
+    int nb_chunks = vd->guest.ds->width / 16;
+    int pitch = ds_get_linesize(vd->ds);
+    int bpp = ds_get_bytes_per_pixel(vd->ds);
+    int y, y0 = -1, y1 = 0, c0 = nb_chunks, c1 = 0;
+    int x, w, h, len, mask, best_start = 0, best_len = 0, best_d = 0;
+    uint64_t *ghash, *shash;
+    uint8_t *dup;
+    int *table;
+    bool copyrect = false;
+    VncState *vs;
+
+    if (vd->scroll_backoff) {
+        vd->scroll_backoff--;
+        return;
+    }
+
+    QTAILQ_FOREACH(vs, &vd->clients, next) {
+        /* the clients must have seen everything encoded so far */
+        if (vs->csock == -1 || vnc_jobs_pending(vs)) {
+            return;
+        }
+        copyrect |= vnc_has_feature(vs, VNC_FEATURE_COPYRECT);
+    }
+    if (!copyrect) {
+        return;
+    }
+
+    /* bounding box of the guest dirty map */
+    for (y = 0; y < vd->guest.ds->height; y++) {
+        unsigned long *dirty = vd->guest.dirty[y];
+        int first = find_first_bit(dirty, nb_chunks);
+
+        if (first < nb_chunks) {
+            if (y0 < 0) {
+                y0 = y;
+            }
+            y1 = y + 1;
+            c0 = MIN(c0, first);
+            c1 = MAX(c1, (int)find_last_bit(dirty, nb_chunks) + 1);
+        }
+    }
+    if (y0 < 0 || y1 - y0 < VNC_SCROLL_MIN_ROWS) {
+        return;
+    }
+
+    x = c0 * 16;
+    w = (c1 - c0) * 16;
+    h = y1 - y0;
+    len = w * bpp;
+    for (mask = 1; mask < 2 * h; mask <<= 1) {
+        ;
+    }
+    ghash = g_malloc(h * sizeof(uint64_t));
+    shash = g_malloc(h * sizeof(uint64_t));
+    dup = g_malloc0(h);
+    table = g_malloc(mask * sizeof(int));
+    memset(table, -1, mask * sizeof(int));
+    mask--;
+
+    for (y = 0; y < h; y++) {
+        int i;
+
+        ghash[y] = vnc_hash_row(vd->guest.ds->data + (y0 + y) * pitch +
+                                x * bpp, len);
+        shash[y] = vnc_hash_row(vd->server->data + (y0 + y) * pitch +
+                                x * bpp, len);
+        for (i = shash[y] & mask; table[i] != -1; i = (i + 1) & mask) {
+            if (shash[table[i]] == shash[y]) {
+                /* e.g. blank lines: no use to find the offset */
+                dup[table[i]] = 1;
+                break;
+            }
+        }
+        if (table[i] == -1) {
+            table[i] = y;
+        }
+    }
+
+    /* longest run of guest rows found at the same offset in the server */
+    for (y = 0; y < h; ) {
+        int s = vnc_scroll_lookup(table, mask, shash, dup, ghash[y]);
+        int d, start, end;
+
+        if (s < 0 || s == y) {
+            y++;
+            continue;
+        }
+        d = s - y;
+        start = y;
+        while (start > 0 && start - 1 + d >= 0 &&
+               ghash[start - 1] == shash[start - 1 + d]) {
+            start--;
+        }
+        end = y + 1;
+        while (end < h && end + d < h && ghash[end] == shash[end + d]) {
+            end++;
+        }
+        if (end - start > best_len) {
+            best_start = start;
+            best_len = end - start;
+            best_d = d;
+        }
+        y = end;
+    }
+
+    /* the hashes were only a hint: check the rows themselves */
+    for (y = best_start; y < best_start + best_len && best_len; y++) {
+        if (memcmp(vd->guest.ds->data + (y0 + y) * pitch + x * bpp,
+                   vd->server->data + (y0 + y + best_d) * pitch + x * bpp,
+                   len)) {
+            best_len = 0;
+        }
+    }
+
+    g_free(ghash);
+    g_free(shash);
+    g_free(dup);
+    g_free(table);
+
+    if (best_len < VNC_SCROLL_MIN_ROWS) {
+        vd->scroll_fails = MIN(vd->scroll_fails * 2 + 1,
+                               VNC_SCROLL_BACKOFF_MAX);
+        vd->scroll_backoff = vd->scroll_fails;
+        return;
+    }
+    vd->scroll_fails = 0;
+
+    vnc_move_server_rows(vd, x, y0 + best_start + best_d, y0 + best_start,
+                         w, best_len);
+    QTAILQ_FOREACH(vs, &vd->clients, next) {
+        if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
+            vnc_jobs_consume_buffer(vs);
+            vnc_copy(vs, x, y0 + best_start + best_d, x, y0 + best_start,
+                     w, best_len);
+        }
+    }
+}
+
 static void vnc_refresh(void *opaque)
 {
     VncDisplay *vd = opaque;
@@ -2596,6 +2934,7 @@ static void vnc_refresh(void *opaque)
         return;
     }
 
+    vnc_detect_scroll(vd);
     has_dirty = vnc_refresh_server_surface(vd);
     vnc_unlock_display(vd);
 
@@ -2609,10 +2948,12 @@ static void vnc_refresh(void *opaque)
     if (vd->timer == NULL)
         return;
 
-    if (has_dirty && rects) {
+    if (has_dirty >= VNC_REFRESH_CHUNKS_MIN && rects) {
         vd->timer_interval /= 2;
         if (vd->timer_interval < VNC_REFRESH_INTERVAL_BASE)
             vd->timer_interval = VNC_REFRESH_INTERVAL_BASE;
+    } else if (has_dirty && rects) {
+        /* small changes: keep the current rate */
     } else {
         vd->timer_interval += VNC_REFRESH_INTERVAL_INC;
         if (vd->timer_interval > VNC_REFRESH_INTERVAL_MAX)
@@ -90,6 +90,9 @@ typedef void VncSendHextileTile(VncState *vs,
 
 #define VNC_AUTH_CHALLENGE_SIZE 16
 
+/* framebuffer updates a client may have queued or being encoded */
+#define VNC_MAX_PENDING_JOBS 2
+
 typedef struct VncDisplay VncDisplay;
 
 #ifdef CONFIG_VNC_TLS
@@ -145,6 +148,8 @@ struct VncDisplay
     kbd_layout_t *kbd_layout;
     int lock_key_sync;
     QemuMutex mutex;
+    int scroll_fails;   /* scroll detection failed recently... */
+    int scroll_backoff; /* ...so skip it for that many refreshes */
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -185,6 +190,11 @@ typedef struct VncTight {
 #endif
     int levels[4];
     z_stream stream[4];
+    /* for each VNC_STAT_RECT tile, how many more times it can be assumed
+       to hold a photo-like image without looking at its colors again */
+    uint8_t photo[VNC_STAT_ROWS][VNC_STAT_COLS];
+    bool photo_hint;    /* the current rectangle is assumed to be a photo */
+    int smooth;         /* result of the smooth image detection, or -1 */
 } VncTight;
 
 typedef struct VncHextile {
@@ -212,6 +222,25 @@ typedef struct VncZywrle {
     int buf[VNC_ZRLE_TILE_WIDTH * VNC_ZRLE_TILE_HEIGHT];
 } VncZywrle;
 
+/* Per client statistics of the framebuffer encoders */
+enum {
+    VNC_ENC_STAT_RAW,
+    VNC_ENC_STAT_HEXTILE,
+    VNC_ENC_STAT_ZLIB,
+    VNC_ENC_STAT_TIGHT,
+    VNC_ENC_STAT_TIGHT_PNG,
+    VNC_ENC_STAT_ZRLE,
+    VNC_ENC_STAT_ZYWRLE,
+    VNC_ENC_STAT_MAX,
+};
+
+typedef struct VncEncodingStat {
+    uint64_t rects;
+    uint64_t raw_bytes;     /* size of the rectangles in the client format */
+    uint64_t bytes;         /* size of the encoder output */
+    int64_t time;           /* time spent in the encoder, in ns */
+} VncEncodingStat;
+
 struct VncRect
 {
     int x;
@@ -229,6 +258,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -287,9 +317,23 @@ struct VncState
     QEMUPutLEDEntry *led;
 
     bool abort;
+    /* encoders: the worker's copy of the server surface to read from */
+    DisplaySurface *snapshot;
     QemuMutex output_mutex;
     QEMUBH *bh;
     Buffer jobs_buffer;
+    /* protected by the jobs queue lock */
+    int jobs_pending;   /* jobs queued or being encoded */
+    bool job_running;   /* a worker is encoding for this client */
+
+    /* protected by output_mutex, except bytes_sent (main thread only) */
+    struct {
+        uint64_t updates;       /* framebuffer updates encoded */
+        int64_t encode_time;    /* time spent encoding them, in ns */
+        uint64_t encoded_bytes;
+        uint64_t bytes_sent;    /* written to the socket */
+        VncEncodingStat enc[VNC_ENC_STAT_MAX];
+    } stats;
 
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
@@ -166,6 +166,7 @@ int main(int argc, char **argv)
 #include "cpus.h"
 #include "arch_init.h"
 #include "osdep.h"
+#include "iothread.h"
 
 #include "ui/qemu-spice.h"
 
@@ -184,6 +185,7 @@ int display_remote = 0;
 const char* keyboard_layout = NULL;
 ram_addr_t ram_size;
 const char *mem_path = NULL;
+int mem_share = 0; /* map -mem-path backed RAM MAP_SHARED */
 #ifdef MAP_POPULATE
 int mem_prealloc = 0; /* force preallocation of physical target memory */
 #endif
@@ -247,6 +249,8 @@ QTAILQ_HEAD(, FWBootEntry) fw_boot_order = QTAILQ_HEAD_INITIALIZER(fw_boot_order
 
 int nb_numa_nodes;
 uint64_t node_mem[MAX_NODES];
+uint64_t node_host_nodes[MAX_NODES];
+int node_host_policy[MAX_NODES];
 unsigned long *node_cpumask[MAX_NODES];
 
 uint8_t qemu_uuid[16];
@@ -1021,6 +1025,33 @@ static void numa_add(const char *optarg)
 
             bitmap_set(node_cpumask[nodenr], value, endvalue-value+1);
         }
+        if (get_param_value(option, 128, "hostnodes", optarg) != 0) {
+            value = strtoull(option, &endptr, 10);
+            if (*endptr == '-') {
+                endvalue = strtoull(endptr+1, &endptr, 10);
+            } else {
+                endvalue = value;
+            }
+            if (*endptr || endvalue < value || endvalue >= 64) {
+                fprintf(stderr, "qemu: invalid numa hostnodes: %s\n", option);
+                exit(1);
+            }
+            node_host_nodes[nodenr] = (~0ULL >> (63 - endvalue)) &
+                                      (~0ULL << value);
+            node_host_policy[nodenr] = NUMA_POLICY_BIND;
+        }
+        if (get_param_value(option, 128, "policy", optarg) != 0) {
+            if (!strcmp(option, "bind")) {
+                node_host_policy[nodenr] = NUMA_POLICY_BIND;
+            } else if (!strcmp(option, "preferred")) {
+                node_host_policy[nodenr] = NUMA_POLICY_PREFERRED;
+            } else if (!strcmp(option, "interleave")) {
+                node_host_policy[nodenr] = NUMA_POLICY_INTERLEAVE;
+            } else {
+                fprintf(stderr, "qemu: invalid numa policy: %s\n", option);
+                exit(1);
+            }
+        }
         nb_numa_nodes++;
     }
 }
@@ -1937,6 +1968,11 @@ static int device_init_func(QemuOpts *opts, void *opaque)
     return 0;
 }
 
+static int iothread_init_func(QemuOpts *opts, void *opaque)
+{
+    return iothread_create(opts);
+}
+
 static int chardev_init_func(QemuOpts *opts, void *opaque)
 {
     CharDriverState *chr;
@@ -2434,6 +2470,8 @@ int main(int argc, char **argv, char **envp)
     for (i = 0; i < MAX_NODES; i++) {
         node_mem[i] = 0;
         node_cpumask[i] = bitmap_new(MAX_CPUMASK_BITS);
+        node_host_nodes[i] = 0;
+        node_host_policy[i] = NUMA_POLICY_DEFAULT;
     }
 
     nb_numa_nodes = 0;
@@ -2775,6 +2813,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_mempath:
                 mem_path = optarg;
                 break;
+            case QEMU_OPTION_mem_share:
+                mem_share = 1;
+                break;
 #ifdef MAP_POPULATE
             case QEMU_OPTION_mem_prealloc:
                 mem_prealloc = 1;
@@ -3245,6 +3286,31 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tcg_traces:
+                tcg_trace_threshold = strtoul(optarg, NULL, 0);
+                break;
+            case QEMU_OPTION_tcg_profile:
+                tcg_tb_profile = true;
+                break;
+            case QEMU_OPTION_tcg_perfmap:
+                tcg_perfmap_open();
+                break;
+            case QEMU_OPTION_tcg_threads:
+                if (!strcmp(optarg, "multi")) {
+#if defined(_WIN32) || !(defined(__i386__) || defined(__x86_64__))
+                    fprintf(stderr, "-tcg-threads multi is not supported "
+                            "on this host\n");
+                    exit(1);
+#endif
+                    mttcg_enabled = true;
+                } else if (!strcmp(optarg, "single")) {
+                    mttcg_enabled = false;
+                } else {
+                    fprintf(stderr, "Invalid -tcg-threads option: %s\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_icount:
                 icount_option = optarg;
                 break;
@@ -3344,6 +3410,12 @@ int main(int argc, char **argv, char **envp)
                     exit(0);
                 }
                 break;
+            case QEMU_OPTION_iothread:
+                opts = qemu_opts_parse(qemu_find_opts("iothread"), optarg, 0);
+                if (!opts) {
+                    exit(1);
+                }
+                break;
             default:
                 os_parse_cmd_args(popt->index, optarg);
             }
@@ -3503,6 +3575,18 @@ int main(int argc, char **argv, char **envp)
 
     configure_accelerator();
 
+    if (mttcg_enabled && (!tcg_enabled() || icount_option)) {
+        fprintf(stderr, "-tcg-threads multi requires TCG without -icount\n");
+        exit(1);
+    }
+
+    /* A side exit leaves a trace after gen_icount_start() has charged the
+       instructions of the whole TB */
+    if (tcg_trace_threshold && icount_option) {
+        fprintf(stderr, "-tcg-traces cannot be used with -icount\n");
+        exit(1);
+    }
+
     qemu_init_cpu_loop();
     if (qemu_init_main_loop()) {
         fprintf(stderr, "qemu_init_main_loop failed\n");
@@ -3688,6 +3772,12 @@ int main(int argc, char **argv, char **envp)
             exit(1);
     }
 
+    /* after os_daemonize, which does not keep threads */
+    if (qemu_opts_foreach(qemu_find_opts("iothread"), iothread_init_func,
+                          NULL, 1) != 0) {
+        exit(1);
+    }
+
     /* init generic devices */
     if (qemu_opts_foreach(qemu_find_opts("device"), device_init_func, NULL, 1) != 0)
         exit(1);